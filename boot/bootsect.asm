@@ -1,6 +1,8 @@
 ; Identical to lesson 13's boot sector, but the %included files have new paths
 [org 0x7c00]
-KERNEL_OFFSET equ 0x1000 ; The same one we used when linking the kernel
+KERNEL_OFFSET equ 0x10000 ; The same one we used when linking the kernel
+KERNEL_SECTORS equ 512    ; 256KB, loaded one sector at a time so size is not limited by a track
+                          ; (the Makefile reads it and fails the build if kernel.bin is bigger)
 
     mov [BOOT_DRIVE], dl ; Remember that the BIOS sets us the boot drive in 'dl' on boot
     mov bp, 0x9000
@@ -27,8 +29,9 @@ load_kernel:
     call print
     call print_nl
 
-    mov bx, KERNEL_OFFSET ; Read from disk and store in 0x1000
-    mov dh, 32 ; Load more sectors to include .data section (32 sectors = 16KB)
+    mov ax, KERNEL_OFFSET >> 4 ; Read from disk and store in 0x10000 (segment 0x1000)
+    mov es, ax
+    mov cx, KERNEL_SECTORS
     mov dl, [BOOT_DRIVE]
     call disk_load
     ret
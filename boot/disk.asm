@@ -1,28 +1,52 @@
-; load 'dh' sectors from drive 'dl' into ES:BX
+; Geometry of a 1.44MB floppy
+SECTORS_PER_TRACK equ 18
+NUM_HEADS equ 2
+
+; load 'cx' sectors from drive 'dl', starting right after the boot sector,
+; into ES:0. One sector per int 0x13 call: multi-sector reads can't cross
+; a track or a 64KB DMA boundary, and the kernel is larger than both
 disk_load:
     pusha
-    ; reading from disk requires setting specific values in all registers
-    ; so we will overwrite our input parameters from 'dx'. Let's save it
-    ; to the stack for later use.
-    push dx
+    mov [DISK_DRIVE], dl
+    mov ax, 1    ; LBA 0 is our boot sector, 1 is the first 'available' sector
 
-    mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
-    mov al, dh   ; al <- number of sectors to read (0x01 .. 0x80)
-    mov cl, 0x02 ; cl <- sector (0x01 .. 0x11)
-                 ; 0x01 is our boot sector, 0x02 is the first 'available' sector
-    mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
-    ; dl <- drive number. Our caller sets it as a parameter and gets it from BIOS
-    ; (0 = floppy, 1 = floppy2, 0x80 = hdd, 0x81 = hdd2)
-    mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
+disk_load_loop:
+    push ax
+    push cx
+
+    ; convert the LBA in 'ax' to cylinder/head/sector
+    xor dx, dx
+    mov bx, SECTORS_PER_TRACK
+    div bx       ; ax = lba / 18, dx = lba % 18
+    mov cl, dl
+    inc cl       ; cl <- sector (1-based: 0x01 .. 0x12)
+    xor dx, dx
+    mov bx, NUM_HEADS
+    div bx       ; ax = cylinder, dx = head
+    mov ch, al   ; ch <- cylinder (0x0 .. 0x4F)
+    mov dh, dl   ; dh <- head number (0x0 .. 0x1)
+    mov dl, [DISK_DRIVE] ; dl <- drive number (0 = floppy, 0x80 = hdd)
 
     ; [es:bx] <- pointer to buffer where the data will be stored
-    ; caller sets it up for us, and it is actually the standard location for int 13h
+    xor bx, bx
+    mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
+    mov al, 0x01 ; al <- number of sectors to read
     int 0x13      ; BIOS interrupt
     jc disk_error ; if error (stored in the carry bit)
 
-    pop dx
-    cmp al, dh    ; BIOS also sets 'al' to the # of sectors read. Compare it.
+    cmp al, 1    ; BIOS also sets 'al' to the # of sectors read. Compare it.
     jne sectors_error
+
+    ; advance the destination by one sector (512 bytes = 0x20 paragraphs)
+    mov ax, es
+    add ax, 0x20
+    mov es, ax
+
+    pop cx
+    pop ax
+    inc ax
+    loop disk_load_loop
+
     popa
     ret
 
@@ -42,5 +66,6 @@ sectors_error:
 disk_loop:
     jmp $
 
+DISK_DRIVE: db 0
 DISK_ERROR: db "Disk read error", 0
 SECTORS_ERROR: db "Incorrect number of sectors read", 0
@@ -0,0 +1,144 @@
+#include "acpi.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+
+typedef struct {
+    char signature[8];
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_addr;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    acpi_header_t header;
+    u32 lapic_addr;
+    u32 flags;
+} __attribute__((packed)) madt_t;
+
+typedef struct {
+    u8 type;
+    u8 length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct {
+    madt_entry_t entry;
+    u8 acpi_id;
+    u8 apic_id;
+    u32 flags;
+} __attribute__((packed)) madt_lapic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    u8 id;
+    u8 reserved;
+    u32 addr;
+    u32 gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    u8 bus;
+    u8 source;
+    u32 gsi;
+    u16 flags;
+} __attribute__((packed)) madt_override_t;
+
+static acpi_madt_t madt_info;
+static u8 have_madt = 0;
+
+static u8 checksum(u8 *p, u32 len) {
+    u8 sum = 0;
+    for (u32 i = 0; i < len; i++) sum += p[i];
+    return sum;
+}
+
+static acpi_rsdp_t* scan_rsdp(u32 start, u32 end) {
+    for (u32 addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t *rsdp = (acpi_rsdp_t*)addr;
+        if (strncmp(rsdp->signature, ACPI_RSDP_SIGNATURE, 8) == 0 &&
+            checksum((u8*)rsdp, sizeof(acpi_rsdp_t)) == 0) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+static acpi_rsdp_t* find_rsdp() {
+    /* Through asm: GCC takes a constant pointer into the first page for a
+     * NULL dereference */
+    u16 segment;
+    __asm__ __volatile__("movw (%1), %0" : "=r"(segment) : "r"(ACPI_EBDA_SEGMENT_PTR));
+    u32 ebda = (u32)segment << 4;
+    acpi_rsdp_t *rsdp = ebda ? scan_rsdp(ebda, ebda + 1024) : NULL;
+    return rsdp ? rsdp : scan_rsdp(ACPI_BIOS_START, ACPI_BIOS_END);
+}
+
+/* The RSDT's 32 bit table pointers are there in ACPI 2.0+ too, the XSDT
+ * would only add 64 bit ones */
+static acpi_header_t* find_table(acpi_rsdp_t *rsdp, char *signature) {
+    acpi_header_t *rsdt = (acpi_header_t*)rsdp->rsdt_addr;
+    if (strncmp(rsdt->signature, "RSDT", 4) != 0 || checksum((u8*)rsdt, rsdt->length) != 0) return NULL;
+    u32 *tables = (u32*)(rsdt + 1);
+    u32 count = (rsdt->length - sizeof(acpi_header_t)) / sizeof(u32);
+    for (u32 i = 0; i < count; i++) {
+        acpi_header_t *h = (acpi_header_t*)tables[i];
+        if (strncmp(h->signature, signature, 4) == 0 && checksum((u8*)h, h->length) == 0) return h;
+    }
+    return NULL;
+}
+
+static void parse_madt(madt_t *madt) {
+    acpi_madt_t *info = &madt_info;
+    info->lapic_addr = madt->lapic_addr;
+    info->flags = madt->flags;
+    for (u32 irq = 0; irq < ACPI_ISA_IRQS; irq++) info->irq_gsi[irq] = irq;
+
+    u8 *p = (u8*)(madt + 1);
+    u8 *end = (u8*)madt + madt->header.length;
+    while (p + sizeof(madt_entry_t) <= end) {
+        madt_entry_t *e = (madt_entry_t*)p;
+        if (e->length < sizeof(madt_entry_t)) break;
+
+        if (e->type == MADT_LAPIC) {
+            madt_lapic_t *l = (madt_lapic_t*)e;
+            if ((l->flags & MADT_LAPIC_ENABLED) && info->cpu_count < ACPI_MAX_CPUS) {
+                info->cpu_apic_ids[info->cpu_count++] = l->apic_id;
+            }
+        } else if (e->type == MADT_IOAPIC && !info->ioapic_addr) {
+            madt_ioapic_t *io = (madt_ioapic_t*)e;
+            info->ioapic_addr = io->addr;
+            info->ioapic_id = io->id;
+            info->ioapic_gsi_base = io->gsi_base;
+        } else if (e->type == MADT_SOURCE_OVERRIDE) {
+            madt_override_t *o = (madt_override_t*)e;
+            if (o->bus == 0 && o->source < ACPI_ISA_IRQS) {
+                info->irq_gsi[o->source] = o->gsi;
+                info->irq_flags[o->source] = o->flags;
+                info->overrides++;
+            }
+        }
+        p += e->length;
+    }
+    have_madt = 1;
+}
+
+void acpi_init() {
+    acpi_rsdp_t *rsdp = find_rsdp();
+    if (!rsdp) {
+        kprint("ACPI: no RSDP\n");
+        return;
+    }
+    madt_t *madt = (madt_t*)find_table(rsdp, ACPI_MADT_SIGNATURE);
+    if (!madt) {
+        kprint("ACPI: no MADT\n");
+        return;
+    }
+    parse_madt(madt);
+    kprintf("ACPI: %d CPUs, IOAPIC at %x, %d IRQ overrides\n", madt_info.cpu_count,
+            madt_info.ioapic_addr, madt_info.overrides);
+}
+
+acpi_madt_t* get_acpi_madt() {
+    return have_madt ? &madt_info : NULL;
+}
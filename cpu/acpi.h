@@ -0,0 +1,62 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+
+/* Where the RSDP may be: the first KB of the EBDA, or the BIOS area */
+#define ACPI_EBDA_SEGMENT_PTR  0x40E
+#define ACPI_BIOS_START        0xE0000
+#define ACPI_BIOS_END          0x100000
+#define ACPI_RSDP_SIGNATURE    "RSD PTR "
+#define ACPI_MADT_SIGNATURE    "APIC"
+
+/* MADT entry types */
+#define MADT_LAPIC             0
+#define MADT_IOAPIC            1
+#define MADT_SOURCE_OVERRIDE   2
+
+#define MADT_LAPIC_ENABLED     0x1
+#define MADT_FLAGS_PCAT_COMPAT 0x1     /* The board has 8259s too */
+
+/* Interrupt source override flags (MPS INTI) */
+#define MADT_POLARITY_MASK     0x3
+#define MADT_POLARITY_LOW      0x3
+#define MADT_TRIGGER_MASK      0xC
+#define MADT_TRIGGER_LEVEL     0xC
+
+#define ACPI_MAX_CPUS          16
+#define ACPI_ISA_IRQS          16
+
+typedef struct {
+    char signature[4];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+/* What the kernel keeps of the MADT */
+typedef struct {
+    u32 lapic_addr;
+    u32 flags;
+    u32 cpu_count;                     /* Enabled processors */
+    u8 cpu_apic_ids[ACPI_MAX_CPUS];
+    u32 ioapic_addr;                   /* 0: none. Only the first is used */
+    u8 ioapic_id;
+    u32 ioapic_gsi_base;
+    u32 irq_gsi[ACPI_ISA_IRQS];        /* ISA IRQ to global system interrupt */
+    u16 irq_flags[ACPI_ISA_IRQS];      /* 0: ISA defaults, edge and active high */
+    u32 overrides;
+} acpi_madt_t;
+
+/* Find and parse the MADT. Before paging: the tables usually sit at the
+ * top of RAM, outside the identity map */
+void acpi_init();
+/* NULL when there is no ACPI or no MADT */
+acpi_madt_t* get_acpi_madt();
+
+#endif
@@ -0,0 +1,230 @@
+#include "apic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "isr.h"
+#include "paging.h"
+#include "ports.h"
+#include "timer.h"
+#include "../mm/vm.h"
+#include "../drivers/keyboard.h"
+#include "../drivers/screen.h"
+#include "../kernel/bench.h"
+#include "../kernel/smp.h"
+#include "../libc/function.h"
+
+u8 apic_enabled = 0;
+
+static volatile u32 *lapic = NULL;
+static volatile u32 *ioapic = NULL;
+static u32 ioapic_inputs = 0;
+static u32 timer_rate = 0;             /* LAPIC timer ticks per ms */
+static isr_t timer_tick[MAX_CPUS];
+
+static u32 lapic_read(u32 reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(u32 reg, u32 value) {
+    lapic[reg / 4] = value;
+}
+
+static u32 ioapic_read(u32 reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(u32 reg, u32 value) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+/* Uncached at its physical address, NULL if that is not in the MMIO range */
+static volatile u32* map_mmio(u32 phys) {
+    u32 page = phys & PAGE_FRAME_MASK;
+    if (page < VM_MMIO_START) return NULL;
+    if (!get_page_entry(kernel_directory, page) &&
+        !map_page(kernel_directory, page, page, PAGE_WRITABLE | PAGE_NOCACHE | PAGE_WRITETHROUGH)) {
+        return NULL;
+    }
+    return (volatile u32*)phys;
+}
+
+void lapic_init_cpu(u8 boot) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | IRQ_LAPIC_TIMER);
+    /* The 8259 keeps coming in through LINT0 until the IOAPIC takes over */
+    lapic_write(LAPIC_LVT_LINT0, boot ? LAPIC_LVT_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, boot ? LAPIC_LVT_NMI : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+u32 lapic_id() {
+    return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(u32 apic_id, u32 command) {
+    u32 flags = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) __asm__ __volatile__("pause");
+    irq_restore(flags);
+}
+
+u8 apic_available() {
+    return lapic && ioapic;
+}
+
+/* Point the ISA IRQs at IRQ0-IRQ15 on this CPU, honouring the MADT's
+ * source overrides (the PIT usually comes in at GSI 2), or mask them */
+static void route_isa_irqs(u8 on) {
+    acpi_madt_t *madt = get_acpi_madt();
+    for (u32 irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        /* The cascade: nothing is behind it without the 8259 */
+        if (irq == 2) continue;
+        u32 pin = madt->irq_gsi[irq] - madt->ioapic_gsi_base;
+        if (pin >= ioapic_inputs) continue;
+
+        u16 flags = madt->irq_flags[irq];
+        u32 low = (IRQ0 + irq) | (on ? 0 : IOAPIC_MASKED);
+        if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) low |= IOAPIC_ACTIVE_LOW;
+        if ((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) low |= IOAPIC_LEVEL;
+        ioapic_write(IOAPIC_REDIRECTION + 2 * pin + 1, lapic_id() << 24);
+        ioapic_write(IOAPIC_REDIRECTION + 2 * pin, low);
+    }
+}
+
+s32 apic_set_enabled(u8 on) {
+    if (on && !apic_available()) return -1;
+    u32 flags = irq_save();
+    if (on) {
+        port_byte_out(PIC_MASTER_DATA, PIC_MASK_ALL);
+        port_byte_out(PIC_SLAVE_DATA, PIC_MASK_ALL);
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        route_isa_irqs(1);
+    } else if (apic_enabled) {
+        route_isa_irqs(0);
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+        port_byte_out(PIC_MASTER_DATA, PIC_UNMASK_ALL);
+        port_byte_out(PIC_SLAVE_DATA, PIC_UNMASK_ALL);
+    }
+    apic_enabled = on;
+    /* A scancode the old controller latched but never delivered keeps IRQ1
+     * high, and an edge triggered input would never see it again */
+    while (port_byte_in(KEYBOARD_STATUS_PORT) & KEYBOARD_OUTPUT_FULL) port_byte_in(KEYBOARD_DATA_PORT);
+    irq_restore(flags);
+    return 0;
+}
+
+static void lapic_timer_callback(registers_t regs) {
+    isr_t tick = timer_tick[cpu_index()];
+    if (tick) tick(regs);
+}
+
+/* Count the timer down from the top for LAPIC_CALIBRATION_US of TSC time */
+static void calibrate_timer() {
+    time_page_t *tp = get_time_page();
+    if (!tp || !tp->tsc_mhz) return;
+    u32 wait = tp->tsc_mhz * LAPIC_CALIBRATION_US;
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | IRQ_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    u64 start = read_tsc();
+    while ((u32)(read_tsc() - start) < wait);
+    u32 elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    timer_rate = elapsed / (LAPIC_CALIBRATION_US / 1000);
+}
+
+s32 lapic_timer_start(u32 us, u8 mode, isr_t tick) {
+    if (!lapic) return -1;
+    if (!timer_rate) calibrate_timer();
+    if (!timer_rate) return -1;
+    /* us * timer_rate / 1000 without overflowing */
+    u32 count = (us / 1000) * timer_rate + (us % 1000) * timer_rate / 1000;
+    if (!count) count = 1;
+
+    u32 flags = irq_save();
+    timer_tick[cpu_index()] = tick;
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, IRQ_LAPIC_TIMER | (mode == LAPIC_PERIODIC ? LAPIC_TIMER_PERIODIC : 0));
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+    irq_restore(flags);
+    return 0;
+}
+
+void lapic_timer_stop() {
+    if (!lapic) return;
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | IRQ_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
+
+u32 lapic_timer_rate() {
+    return timer_rate;
+}
+
+/* What an EOI costs each controller, and how close a short one-shot comes
+ * to its deadline (TSC MHz * 100 cycles would be exact) */
+static void bench_eoi_pic(u32 arg, u32 iterations) {
+    UNUSED(arg);
+    for (u32 i = 0; i < iterations; i++) port_byte_out(PIC_MASTER_COMMAND, PIC_EOI);
+}
+
+static void bench_eoi_lapic(u32 arg, u32 iterations) {
+    UNUSED(arg);
+    for (u32 i = 0; i < iterations; i++) lapic_eoi();
+}
+
+static volatile u8 oneshot_fired;
+
+static void oneshot_done(registers_t regs) {
+    UNUSED(regs);
+    oneshot_fired = 1;
+}
+
+static void bench_oneshot(u32 us, u32 iterations) {
+    u32 flags = irq_save();
+    for (u32 i = 0; i < iterations; i++) {
+        oneshot_fired = 0;
+        if (lapic_timer_start(us, LAPIC_ONESHOT, oneshot_done) != 0) break;
+        while (!oneshot_fired) cpu_wait();
+    }
+    irq_restore(flags);
+}
+
+static bench_t apic_benches[] = {
+    {"eoi pic", NULL, bench_eoi_pic, NULL, 0, 1000},
+    {"eoi lapic", NULL, bench_eoi_lapic, NULL, 0, 1000},
+    {"lapic oneshot 100us", NULL, bench_oneshot, NULL, 100, 10},
+};
+
+void init_apic() {
+    acpi_madt_t *madt = get_acpi_madt();
+    if (!madt || !(cpu_features() & CPUID_EDX_APIC)) {
+        kprint("APIC: none, IRQs stay on the 8259 PIC\n");
+        return;
+    }
+    if (cpu_features() & CPUID_EDX_MSR) write_msr(MSR_APIC_BASE, read_msr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic = map_mmio(madt->lapic_addr);
+    if (!lapic) {
+        kprint("APIC: local APIC not mappable, IRQs stay on the 8259 PIC\n");
+        return;
+    }
+    lapic_init_cpu(1);
+    register_interrupt_handler(IRQ_LAPIC_TIMER, lapic_timer_callback);
+    for (u32 i = 0; i < sizeof(apic_benches) / sizeof(apic_benches[0]); i++) register_bench(&apic_benches[i]);
+
+    if (madt->ioapic_addr) ioapic = map_mmio(madt->ioapic_addr);
+    if (!ioapic) {
+        kprint("APIC: no IOAPIC, IRQs stay on the 8259 PIC\n");
+        return;
+    }
+    ioapic_inputs = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    apic_set_enabled(1);
+    kprintf_color(GREEN_ON_BLACK, "APIC: IRQs through the IOAPIC (%d inputs) to LAPIC %d\n",
+                  ioapic_inputs, lapic_id());
+}
@@ -0,0 +1,94 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "types.h"
+#include "isr.h"
+
+/* Local APIC registers, offsets from its MMIO base */
+#define LAPIC_ID               0x020
+#define LAPIC_VERSION          0x030
+#define LAPIC_TPR              0x080
+#define LAPIC_EOI              0x0B0
+#define LAPIC_SVR              0x0F0
+#define LAPIC_ICR_LOW          0x300
+#define LAPIC_ICR_HIGH         0x310
+#define LAPIC_LVT_TIMER        0x320
+#define LAPIC_LVT_LINT0        0x350
+#define LAPIC_LVT_LINT1        0x360
+#define LAPIC_LVT_ERROR        0x370
+#define LAPIC_TIMER_INITIAL    0x380
+#define LAPIC_TIMER_CURRENT    0x390
+#define LAPIC_TIMER_DIVIDE     0x3E0
+
+#define LAPIC_SVR_ENABLE       0x100
+#define LAPIC_LVT_MASKED       0x10000
+#define LAPIC_LVT_EXTINT       0x700   /* LINT0 passes the 8259's INTR through */
+#define LAPIC_LVT_NMI          0x400
+#define LAPIC_TIMER_PERIODIC   0x20000
+#define LAPIC_TIMER_DIV_16     0x3
+
+/* Interrupt command register: delivery mode and status */
+#define LAPIC_ICR_FIXED        0x000
+#define LAPIC_ICR_INIT         0x500
+#define LAPIC_ICR_STARTUP      0x600   /* Vector: the real mode page to start at */
+#define LAPIC_ICR_PENDING      0x1000
+#define LAPIC_ICR_ASSERT       0x4000
+
+/* MSR_APIC_BASE bits */
+#define APIC_BASE_ENABLE       0x800
+
+/* IOAPIC: an index register and a data window */
+#define IOAPIC_REGSEL          0x00
+#define IOAPIC_WINDOW          0x10
+#define IOAPIC_VERSION         0x01
+#define IOAPIC_REDIRECTION     0x10    /* Two registers per input */
+
+#define IOAPIC_ACTIVE_LOW      0x2000
+#define IOAPIC_LEVEL           0x8000
+#define IOAPIC_MASKED          0x10000
+
+/* Vectors beyond the 16 ISA lines at IRQ0-IRQ15 */
+#define IRQ_LAPIC_TIMER        48
+#define IRQ_RESCHEDULE         49      /* IPI: wake a halted CPU, there is work */
+#define LAPIC_SPURIOUS_VECTOR  0xFF
+
+/* lapic_timer_start() modes */
+#define LAPIC_ONESHOT          0
+#define LAPIC_PERIODIC         1
+
+/* Ticks the LAPIC timer is calibrated over, against the TSC */
+#define LAPIC_CALIBRATION_US   10000
+
+/* IRQs arrive through the IOAPIC and are acknowledged at the local APIC.
+ * 0: the 8259 delivers them, as at boot */
+extern u8 apic_enabled;
+
+/* Map the local APIC and the IOAPIC the MADT describes and route the ISA
+ * IRQs through them. Without a MADT or an APIC the 8259 stays in charge.
+ * After paging */
+void init_apic();
+/* Whether init_apic() found both controllers */
+u8 apic_available();
+/* Switch IRQ delivery between the IOAPIC and the 8259 at run time. Returns
+ * -1 if there is no APIC to switch to */
+s32 apic_set_enabled(u8 on);
+
+/* The calling CPU's local APIC: enabled, timer masked. An application
+ * processor ignores LINT0/LINT1, the 8259 and NMIs go to the boot CPU */
+void lapic_init_cpu(u8 boot);
+u32 lapic_id();
+void lapic_eoi();
+/* Send 'command' (LAPIC_ICR_* and a vector) to the CPU with 'apic_id' and
+ * wait until its local APIC has taken it */
+void lapic_send_ipi(u32 apic_id, u32 command);
+
+/* Call tick() from the IRQ_LAPIC_TIMER interrupt after 'us' microseconds,
+ * or every 'us' in LAPIC_PERIODIC mode. Each CPU has its own timer and
+ * tick(). It is calibrated against the TSC on first use, so the time page
+ * must be up. Returns -1 without a local APIC */
+s32 lapic_timer_start(u32 us, u8 mode, isr_t tick);
+void lapic_timer_stop();
+/* Timer ticks per millisecond after the divider, 0 before calibration */
+u32 lapic_timer_rate();
+
+#endif
@@ -0,0 +1,34 @@
+#include "cpu.h"
+
+void cpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx) {
+    __asm__ __volatile__("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+u32 cpu_features() {
+    static u32 features;
+    static u8 known = 0;
+    if (!known) {
+        u32 eax, ebx, ecx;
+        cpuid(CPUID_FEATURES, &eax, &ebx, &ecx, &features);
+        known = 1;
+    }
+    return features;
+}
+
+u32 cpu_ext_features() {
+    u32 max, features, ebx, ecx;
+    cpuid(CPUID_EXT_MAX, &max, &ebx, &ecx, &features);
+    if (max < CPUID_EXT_FEATURES) return 0;
+    cpuid(CPUID_EXT_FEATURES, &max, &ebx, &ecx, &features);
+    return features;
+}
+
+u64 read_msr(u32 msr) {
+    u32 low, high;
+    __asm__ __volatile__("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((u64)high << 32) | low;
+}
+
+void write_msr(u32 msr, u64 value) {
+    __asm__ __volatile__("wrmsr" :: "c"(msr), "a"((u32)value), "d"((u32)(value >> 32)));
+}
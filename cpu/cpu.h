@@ -0,0 +1,41 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "types.h"
+
+/* CPUs the kernel brings up (kernel/smp.h), each with its own TSS */
+#define MAX_CPUS           8
+
+/* CPUID leaf 1, EDX feature bits */
+#define CPUID_FEATURES     1
+#define CPUID_EDX_FPU      (1 << 0)
+#define CPUID_EDX_TSC      (1 << 4)
+#define CPUID_EDX_MSR      (1 << 5)
+#define CPUID_EDX_PAE      (1 << 6)
+#define CPUID_EDX_APIC     (1 << 9)
+#define CPUID_EDX_SEP      (1 << 11)   /* SYSENTER/SYSEXIT */
+#define CPUID_EDX_FXSR     (1 << 24)   /* fxsave/fxrstor */
+#define CPUID_EDX_SSE      (1 << 25)
+#define CPUID_EDX_SSE2     (1 << 26)   /* MOVNTI among others */
+
+/* CPUID leaf 0x80000001, EDX (AMD's extended features, on Intel too) */
+#define CPUID_EXT_MAX      0x80000000
+#define CPUID_EXT_FEATURES 0x80000001
+#define CPUID_EXT_EDX_NX   (1 << 20)
+
+/* Model specific registers */
+#define MSR_APIC_BASE      0x1B
+#define MSR_SYSENTER_CS    0x174
+#define MSR_SYSENTER_ESP   0x175
+#define MSR_SYSENTER_EIP   0x176
+
+void cpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx);
+/* EDX of leaf 1, tested against the CPUID_EDX_* bits */
+u32 cpu_features();
+/* EDX of leaf 0x80000001, 0 where the leaf doesn't exist */
+u32 cpu_ext_features();
+
+u64 read_msr(u32 msr);
+void write_msr(u32 msr, u64 value);
+
+#endif
@@ -0,0 +1,206 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "isr.h"
+#include "syscall.h"
+#include "../drivers/screen.h"
+#include "../kernel/bench.h"
+#include "../kernel/smp.h"
+#include "../kernel/task.h"
+#include "../libc/function.h"
+#include "../libc/mem.h"
+
+static u8 enabled = 0;
+static u8 sse = 0;
+/* Right after fninit, what a task starts from */
+static u8 initial_state[FPU_STATE_SIZE] __attribute__((aligned(FPU_STATE_ALIGN)));
+
+static u32 read_cr0() {
+    u32 cr0;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static void write_cr0(u32 cr0) {
+    __asm__ __volatile__("mov %0, %%cr0" :: "r"(cr0) : "memory");
+}
+
+static void clts() {
+    __asm__ __volatile__("clts" ::: "memory");
+}
+
+static void stts() {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fxsave(u8 *state) {
+    __asm__ __volatile__("fxsave (%0)" :: "r"(state) : "memory");
+}
+
+static void fxrstor(u8 *state) {
+    __asm__ __volatile__("fxrstor (%0)" :: "r"(state) : "memory");
+}
+
+void fpu_init_cpu() {
+    u32 cr0 = read_cr0() & ~CR0_EM;
+    if (!enabled) {
+        /* Any FPU instruction traps, and #NM kills whoever ran it */
+        write_cr0(cr0 | CR0_EM);
+        return;
+    }
+    write_cr0((cr0 | CR0_MP | CR0_NE) & ~CR0_TS);
+    u32 cr4;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    if (sse) cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ __volatile__("mov %0, %%cr4" :: "r"(cr4));
+    __asm__ __volatile__("fninit");
+    /* Nobody's state is loaded yet */
+    stts();
+}
+
+u8 fpu_available() {
+    return enabled;
+}
+
+/* Room for a task's state, initialised. 0 if the heap is out */
+static u8 alloc_state(task_t *t) {
+    u8 *block = (u8*)kmalloc(FPU_STATE_SIZE + FPU_STATE_ALIGN, 0, NULL);
+    if (!block) return 0;
+    t->fpu_block = block;
+    t->fpu = (u8*)(((u32)block + FPU_STATE_ALIGN - 1) & ~(FPU_STATE_ALIGN - 1));
+    memory_copy(initial_state, t->fpu, FPU_STATE_SIZE);
+    return 1;
+}
+
+/* #NM: the running task wants the FPU back after a switch */
+static void fpu_trap(registers_t regs) {
+    cpu_t *cpu = this_cpu();
+    task_t *t = cpu->current;
+    if (!enabled || (!t->fpu && !alloc_state(t))) {
+        if ((regs.cs & 3) == 3) user_fault(enabled ? "Out of memory for FPU state" : "FPU instruction", regs.eip);
+        kprintf_color(RED_ON_BLACK, "FPU instruction in the kernel at %x, system halted\n", regs.eip);
+        __asm__ __volatile__("cli; hlt");
+    }
+    clts();
+    /* Its registers may still be here from before, unless another CPU
+     * loaded it since (which took it off this one) */
+    if (cpu->fpu_owner != t) {
+        for (u32 i = 0; i < cpu_count; i++) {
+            if (cpus[i].fpu_owner == t) cpus[i].fpu_owner = NULL;
+        }
+        fxrstor(t->fpu);
+        cpu->fpu_owner = t;
+        cpu->fpu_loads++;
+    }
+    cpu->fpu_used = 1;
+}
+
+void fpu_switch(task_t *prev) {
+    cpu_t *cpu = this_cpu();
+    if (!cpu->fpu_used) return;
+    /* It used the FPU this timeslice: its registers are newer than its
+     * copy. They stay loaded in case it comes back here first */
+    fxsave(prev->fpu);
+    cpu->fpu_saves++;
+    cpu->fpu_used = 0;
+    stts();
+}
+
+void fpu_release(task_t *t) {
+    for (u32 i = 0; i < cpu_count; i++) {
+        if (cpus[i].fpu_owner == t) cpus[i].fpu_owner = NULL;
+    }
+    kfree(t->fpu_block);
+}
+
+u8 kernel_fpu_begin() {
+    if (!sse) return 0;
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    if (cpu->fpu_in_kernel) {
+        irq_restore(flags);
+        return 0;
+    }
+    cpu->fpu_in_kernel = 1;
+    if (cpu->fpu_used) {
+        fxsave(cpu->current->fpu);
+        cpu->fpu_saves++;
+        cpu->fpu_used = 0;
+    }
+    /* The registers are about to be anyone's */
+    cpu->fpu_owner = NULL;
+    clts();
+    irq_restore(flags);
+    return 1;
+}
+
+void kernel_fpu_end() {
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    stts();
+    cpu->fpu_in_kernel = 0;
+    irq_restore(flags);
+}
+
+void fpu_copy(u8 *source, u8 *dest, u32 len) {
+    u32 blocks = len / 64;
+    if (!blocks || !kernel_fpu_begin()) {
+        memory_copy(source, dest, len);
+        return;
+    }
+    for (u32 i = 0; i < blocks; i++, source += 64, dest += 64) {
+        __asm__ __volatile__("movups (%0), %%xmm0\n\t"
+                             "movups 16(%0), %%xmm1\n\t"
+                             "movups 32(%0), %%xmm2\n\t"
+                             "movups 48(%0), %%xmm3\n\t"
+                             "movups %%xmm0, (%1)\n\t"
+                             "movups %%xmm1, 16(%1)\n\t"
+                             "movups %%xmm2, 32(%1)\n\t"
+                             "movups %%xmm3, 48(%1)" :: "r"(source), "r"(dest) : "memory");
+    }
+    kernel_fpu_end();
+    if (len % 64) memory_copy(source, dest, len % 64);
+}
+
+/* One page, with integer and SSE copies */
+static u8 *bench_buffer = NULL;
+
+static void bench_copy_setup(u32 arg) {
+    UNUSED(arg);
+    bench_buffer = (u8*)kmalloc(2 * FRAME_SIZE, 0, NULL);
+}
+
+static void bench_copy(u32 use_sse, u32 iterations) {
+    if (!bench_buffer) return;
+    for (u32 i = 0; i < iterations; i++) {
+        if (use_sse) fpu_copy(bench_buffer, bench_buffer + FRAME_SIZE, FRAME_SIZE);
+        else memory_copy(bench_buffer, bench_buffer + FRAME_SIZE, FRAME_SIZE);
+    }
+}
+
+static void bench_copy_teardown(u32 arg) {
+    UNUSED(arg);
+    kfree(bench_buffer);
+    bench_buffer = NULL;
+}
+
+static bench_t fpu_benches[] = {
+    {"copy page", bench_copy_setup, bench_copy, bench_copy_teardown, 0, 100},
+    {"copy page sse", bench_copy_setup, bench_copy, bench_copy_teardown, 1, 100},
+};
+
+void init_fpu() {
+    u32 features = cpu_features();
+    enabled = (features & CPUID_EDX_FPU) && (features & CPUID_EDX_FXSR);
+    sse = enabled && (features & CPUID_EDX_SSE);
+    register_interrupt_handler(7, fpu_trap);
+    fpu_init_cpu();
+    if (!enabled) {
+        kprint("FPU: no fxsave, FPU instructions trap\n");
+        return;
+    }
+    clts();
+    fxsave(initial_state);
+    stts();
+    for (u32 i = 0; i < sizeof(fpu_benches) / sizeof(fpu_benches[0]); i++) register_bench(&fpu_benches[i]);
+    kprintf_color(GREEN_ON_BLACK, "FPU: x87%s, switched lazily\n", sse ? " and SSE" : "");
+}
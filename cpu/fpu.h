@@ -0,0 +1,46 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+
+#define CR0_MP             0x2         /* wait/fwait trap with TS too */
+#define CR0_EM             0x4         /* No FPU: every FPU instruction traps */
+#define CR0_TS             0x8         /* Set on task switch: the next FPU use traps */
+#define CR0_NE             0x20        /* FPU errors as #MF, not IRQ13 */
+#define CR4_OSFXSR         0x200       /* fxsave/fxrstor cover SSE, SSE enabled */
+#define CR4_OSXMMEXCPT     0x400       /* Unmasked SSE exceptions raise #XM */
+
+/* fxsave image: 512 bytes, 16 byte aligned */
+#define FPU_STATE_SIZE     512
+#define FPU_STATE_ALIGN    16
+
+/* FPU and SSE for everyone, switched lazily: a task switch only sets
+ * CR0.TS, and the first FPU instruction a task runs after that traps to
+ * #NM (ISR 7), which loads its registers. A task that used the FPU during
+ * its timeslice has them saved when it is switched out, one that never
+ * touches it pays nothing and has no state. Without fxsave the FPU stays
+ * off and programs that use it are killed.
+ *
+ * init_fpu() sets up the boot CPU and the #NM handler, fpu_init_cpu()
+ * each application processor */
+void init_fpu();
+void fpu_init_cpu();
+u8 fpu_available();
+
+struct task;
+/* From the scheduler, interrupts off: 'prev' is switched out on this CPU */
+void fpu_switch(struct task *prev);
+/* The task is being freed */
+void fpu_release(struct task *t);
+
+/* FPU/SSE registers for kernel code. Returns 0 if they can't be had (no
+ * SSE, or an interrupted section on this CPU has them) and the caller
+ * uses integer code instead. No task switches until kernel_fpu_end() */
+u8 kernel_fpu_begin();
+void kernel_fpu_end();
+
+/* memory_copy() through the SSE registers, 64 bytes at a time, falling
+ * back to memory_copy() for short copies or without SSE */
+void fpu_copy(u8 *source, u8 *dest, u32 len);
+
+#endif
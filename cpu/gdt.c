@@ -0,0 +1,67 @@
+#include "gdt.h"
+#include "../libc/mem.h"
+
+static gdt_entry_t gdt[GDT_ENTRIES];
+static gdt_register_t gdt_reg;
+static tss_t tss[MAX_CPUS];
+
+static void set_gdt_entry(u32 n, u32 base, u32 limit, u8 access, u8 granularity) {
+    gdt[n].limit_low = low_16(limit);
+    gdt[n].base_low = low_16(base);
+    gdt[n].base_mid = (base >> 16) & BYTE_MASK;
+    gdt[n].access = access;
+    gdt[n].granularity = (granularity & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[n].base_high = (base >> 24) & BYTE_MASK;
+}
+
+/* Reload every segment register so none caches an older descriptor */
+static void load_gdt(u16 tss_selector) {
+    __asm__ __volatile__(
+        "lgdt (%0)\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%gs\n"
+        "mov %%ax, %%ss\n"
+        "mov %3, %%ax\n"
+        "ltr %%ax\n"
+        :: "r"(&gdt_reg), "i"(KERNEL_CS), "i"(KERNEL_DS), "r"(tss_selector)
+        : "eax", "memory");
+}
+
+void init_gdt() {
+    set_gdt_entry(0, 0, 0, 0, 0);
+    set_gdt_entry(KERNEL_CS / 8, 0, 0xFFFFFFFF, GDT_KERNEL_CODE, GDT_FLAT_GRAN);
+    set_gdt_entry(KERNEL_DS / 8, 0, 0xFFFFFFFF, GDT_KERNEL_DATA, GDT_FLAT_GRAN);
+    set_gdt_entry(USER_CS / 8, 0, 0xFFFFFFFF, GDT_USER_CODE, GDT_FLAT_GRAN);
+    set_gdt_entry(USER_DS / 8, 0, 0xFFFFFFFF, GDT_USER_DATA, GDT_FLAT_GRAN);
+
+    /* No I/O permission bitmap: the base points past the end of the TSS */
+    memory_set((u8*)tss, 0, sizeof(tss));
+    for (u32 i = 0; i < MAX_CPUS; i++) {
+        tss[i].ss0 = KERNEL_DS;
+        tss[i].iomap_base = sizeof(tss_t);
+        set_gdt_entry(TSS_SELECTOR_CPU(i) / 8, (u32)&tss[i], sizeof(tss_t) - 1, GDT_TSS, 0);
+    }
+
+    gdt_reg.base = (u32)&gdt;
+    gdt_reg.limit = GDT_ENTRIES * sizeof(gdt_entry_t) - 1;
+    load_gdt(TSS_SELECTOR);
+}
+
+void gdt_init_cpu(u32 cpu) {
+    load_gdt(TSS_SELECTOR_CPU(cpu));
+}
+
+u32 cpu_index() {
+    u16 tr;
+    __asm__ __volatile__("str %0" : "=r"(tr));
+    return (tr - TSS_SELECTOR) / 8;
+}
+
+void set_kernel_stack(u32 esp) {
+    tss[cpu_index()].esp0 = esp;
+}
@@ -0,0 +1,64 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "types.h"
+#include "cpu.h"
+
+/* Segment selectors. The kernel pair keeps the boot GDT's values, and the
+ * order (kernel code, kernel data, user code, user data) is the one
+ * SYSENTER/SYSEXIT derive their selectors from */
+#define KERNEL_CS          0x08
+#define KERNEL_DS          0x10
+#define USER_CS            (0x18 | 3)
+#define USER_DS            (0x20 | 3)
+#define TSS_SELECTOR       0x28        /* The boot CPU's, the others follow */
+#define TSS_SELECTOR_CPU(n) (TSS_SELECTOR + 8 * (n))
+
+#define GDT_ENTRIES        (5 + MAX_CPUS)
+
+/* Access bytes: present, privilege level, code/data or system type */
+#define GDT_KERNEL_CODE    0x9A
+#define GDT_KERNEL_DATA    0x92
+#define GDT_USER_CODE      0xFA
+#define GDT_USER_DATA      0xF2
+#define GDT_TSS            0x89    /* 32-bit available TSS */
+#define GDT_FLAT_GRAN      0xCF    /* 4KB granularity, 32-bit, limit 19:16 all set */
+
+typedef struct {
+    u16 limit_low;
+    u16 base_low;
+    u8 base_mid;
+    u8 access;
+    u8 granularity;
+    u8 base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+typedef struct {
+    u16 limit;
+    u32 base;
+} __attribute__((packed)) gdt_register_t;
+
+/* Only ss0:esp0 matter: the stack the CPU switches to on entry from ring 3 */
+typedef struct {
+    u32 prev_task;
+    u32 esp0, ss0;
+    u32 esp1, ss1;
+    u32 esp2, ss2;
+    u32 cr3, eip, eflags;
+    u32 eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    u32 es, cs, ss, ds, fs, gs;
+    u32 ldt;
+    u16 trap, iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* Replace the boot GDT with one that has user segments and a TSS per CPU,
+ * and load it with the boot CPU's TSS */
+void init_gdt();
+/* The same on an application processor, with TSS number 'cpu' */
+void gdt_init_cpu(u32 cpu);
+/* Which TSS this CPU runs on: its index in kernel/smp.h's cpus[] */
+u32 cpu_index();
+/* This CPU's stack for interrupts and system calls that arrive from ring 3 */
+void set_kernel_stack(u32 esp);
+
+#endif
@@ -11,6 +11,11 @@ void set_idt_gate(s32 n, u32 handler) {
     idt[n].high_offset = high_16(handler);
 }
 
+void set_idt_user_gate(s32 n, u32 handler) {
+    set_idt_gate(n, handler);
+    idt[n].flags = IDT_FLAGS_USER_INT;
+}
+
 void set_idt() {
     idt_reg.base = (u32)(&idt);
     idt_reg.limit = IDT_ENTRIES * sizeof(idt_gate_t) - 1;
@@ -2,9 +2,7 @@
 #define IDT_H
 
 #include "types.h"
-
-/* Segment selectors */
-#define KERNEL_CS 0x08
+#include "gdt.h"
 
 /* IDT gate flags
  * Bit 7: Present (1 = present)
@@ -12,6 +10,7 @@
  * Bit 4: Storage segment (0 = interrupt gate)
  * Bits 3-0: Gate type (1110 = 32-bit interrupt gate) */
 #define IDT_FLAGS_KERNEL_INT 0x8E  /* Present, Ring 0, 32-bit interrupt gate */
+#define IDT_FLAGS_USER_INT   0xEE  /* Same, but ring 3 may raise it with 'int' */
 
 /* How every interrupt gate (handler) is defined */
 typedef struct {
@@ -39,6 +38,7 @@ extern idt_gate_t idt[IDT_ENTRIES];
 extern idt_register_t idt_reg;
 
 void set_idt_gate(s32 n, u32 handler);
+void set_idt_user_gate(s32 n, u32 handler);
 void set_idt();
 
 #endif
@@ -107,6 +107,9 @@ global irq12
 global irq13
 global irq14
 global irq15
+global irq16
+global irq17
+global apic_spurious
 
 ; 0: Divide By Zero Exception
 isr0:
@@ -421,4 +424,22 @@ irq15:
 	cli
 	push byte 15
 	push byte 47
-	jmp irq_common_stub
\ No newline at end of file
+	jmp irq_common_stub
+
+; The local APIC timer
+irq16:
+	cli
+	push byte 16
+	push byte 48
+	jmp irq_common_stub
+
+; Reschedule IPI between CPUs
+irq17:
+	cli
+	push byte 17
+	push byte 49
+	jmp irq_common_stub
+
+; The local APIC's spurious vector: no EOI, nothing to do
+apic_spurious:
+	iret
@@ -5,9 +5,22 @@
 #include "timer.h"
 #include "ports.h"
 #include "paging.h"
+#include "../drivers/ata.h"
+#include "syscall.h"
+#include "acpi.h"
+#include "apic.h"
+#include "../libc/function.h"
+#include "../libc/mem.h"
+#include "../kernel/smp.h"
 
 isr_t interrupt_handlers[MAX_INTERRUPTS];
 
+#ifdef IRQ_STATS
+static irq_stats_t irq_stats[IRQ_LINES];
+#endif
+static u32 spurious_irq7 = 0;
+static u32 spurious_irq15 = 0;
+
 void isr_install() {
     set_idt_gate(0, (u32)isr0);
     set_idt_gate(1, (u32)isr1);
@@ -93,6 +106,9 @@ void isr_install() {
     set_idt_gate(IRQ13, (u32)irq13);
     set_idt_gate(IRQ14, (u32)irq14);
     set_idt_gate(IRQ15, (u32)irq15);
+    set_idt_gate(IRQ_LAPIC_TIMER, (u32)irq16);
+    set_idt_gate(IRQ_RESCHEDULE, (u32)irq17);
+    set_idt_gate(LAPIC_SPURIOUS_VECTOR, (u32)apic_spurious);
 
     set_idt(); // Load with ASM
 }
@@ -137,6 +153,14 @@ char *exception_messages[] = {
 };
 
 void isr_handler(registers_t r) {
+    /* Exceptions the kernel knows how to handle (page faults) return here */
+    if (interrupt_handlers[r.int_no] != NULL) {
+        kernel_lock();
+        interrupt_handlers[r.int_no](r);
+        kernel_unlock();
+        return;
+    }
+    if (r.int_no < 32 && (r.cs & 3) == 3) user_fault(exception_messages[r.int_no], r.eip);
     if (r.int_no < 32) {
         kprintf("received interrupt: %d\n", (s32)r.int_no);
         kprintf("%s\n", exception_messages[r.int_no]);
@@ -149,30 +173,122 @@ void register_interrupt_handler(u8 n, isr_t handler) {
     interrupt_handlers[n] = handler;
 }
 
+u32 irq_save() {
+    u32 flags;
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+void irq_restore(u32 flags) {
+    if (flags & EFLAGS_IF) __asm__ __volatile__("sti" ::: "memory");
+}
+
+/* Whether the PIC behind vector 'n' has it in service */
+static u32 pic_in_service(u32 n) {
+    u16 port = n >= IRQ8 ? PIC_SLAVE_COMMAND : PIC_MASTER_COMMAND;
+    port_byte_out(port, PIC_READ_ISR);
+    return port_byte_in(port) & (1 << ((n - IRQ0) & 7));
+}
+
+#ifdef IRQ_STATS
+static void account(u32 line, u32 cycles, u8 switched) {
+    irq_stats_t *st = &irq_stats[line];
+    st->count++;
+    if (switched) {
+        st->switched++;
+        return;
+    }
+    st->cycles += cycles;
+    if (cycles > st->max_cycles) st->max_cycles = cycles;
+    st->latency[cycles ? 31 - __builtin_clz(cycles) : 0]++;
+}
+#endif
+
 void irq_handler(registers_t r) {
-    /* After every interrupt we need to send an EOI (End Of Interrupt) to the PICs
-     * or they will not send another interrupt again */
-    if (r.int_no >= IRQ8) {
-        /* If the IRQ came from the slave PIC, send EOI to slave */
-        port_byte_out(PIC_SLAVE_COMMAND, PIC_EOI);
+#ifdef IRQ_STATS
+    u64 start = read_tsc();
+    cpu_t *cpu = this_cpu();
+    u32 switches = cpu->switches;
+#endif
+    kernel_lock();
+    if (apic_enabled || r.int_no >= IRQ_LAPIC_TIMER) {
+        /* The local APIC takes a single register write */
+        lapic_eoi();
+    } else {
+        /* A line that drops before the CPU acknowledges it shows up as IRQ7
+         * or IRQ15 with nothing in service. Its own PIC must not get an EOI,
+         * the master still does for the cascade of a spurious IRQ15 */
+        if (r.int_no == IRQ7 && !pic_in_service(IRQ7)) {
+            spurious_irq7++;
+            kernel_unlock();
+            return;
+        }
+        if (r.int_no == IRQ15 && !pic_in_service(IRQ15)) {
+            spurious_irq15++;
+            port_byte_out(PIC_MASTER_COMMAND, PIC_EOI);
+            kernel_unlock();
+            return;
+        }
+
+        /* After every interrupt we need to send an EOI (End Of Interrupt) to the PICs
+         * or they will not send another interrupt again */
+        if (r.int_no >= IRQ8) {
+            /* If the IRQ came from the slave PIC, send EOI to slave */
+            port_byte_out(PIC_SLAVE_COMMAND, PIC_EOI);
+        }
+        /* Always send EOI to master PIC */
+        port_byte_out(PIC_MASTER_COMMAND, PIC_EOI);
     }
-    /* Always send EOI to master PIC */
-    port_byte_out(PIC_MASTER_COMMAND, PIC_EOI);
 
     if (interrupt_handlers[r.int_no] != NULL) {
         isr_t handler = interrupt_handlers[r.int_no];
         handler(r);
     }
+#ifdef IRQ_STATS
+    /* A switch away makes the time other tasks' and maybe another CPU's */
+    account(r.int_no - IRQ0, (u32)(read_tsc() - start), this_cpu() != cpu || cpu->switches != switches);
+#endif
+    kernel_unlock();
+}
+
+irq_stats_t* get_irq_stats(u32 line) {
+#ifdef IRQ_STATS
+    if (line < IRQ_LINES) return &irq_stats[line];
+#endif
+    UNUSED(line);
+    return NULL;
+}
+
+void reset_irq_stats() {
+    u32 flags = irq_save();
+#ifdef IRQ_STATS
+    memory_set((u8*)irq_stats, 0, sizeof(irq_stats));
+#endif
+    spurious_irq7 = 0;
+    spurious_irq15 = 0;
+    irq_restore(flags);
+}
+
+u32 get_spurious_irqs(u32 line) {
+    if (line == 7) return spurious_irq7;
+    if (line == 15) return spurious_irq15;
+    return 0;
 }
 
 void irq_install() {
     /* Enable interruptions */
     asm volatile("sti");
     /* IRQ0: timer */
-    init_timer(50);
+    init_timer(TIMER_HZ);
     /* IRQ1: keyboard */
     init_keyboard();
-    /* IRQ14: page fault */
+    /* Before paging: the ACPI tables usually sit beyond the identity map */
+    acpi_init();
+    /* ISR14: page fault */
     init_paging();
     enable_paging();
+    /* IRQs move to the IOAPIC if there is one */
+    init_apic();
+    /* IRQ14: primary ATA channel */
+    init_ata();
 }
@@ -53,6 +53,11 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+/* The local APIC timer, the reschedule IPI and the APIC spurious vector
+ * (a bare iret) */
+extern void irq16();
+extern void irq17();
+extern void apic_spurious();
 
 /* IRQ vector offsets (remapped from default 8-15 to avoid conflicts with CPU exceptions) */
 #define IRQ0 32
@@ -87,6 +92,8 @@ extern void irq15();
 #define PIC_CASCADE_IRQ    0x04  /* IRQ2 = bit 2 = 0x04 (where slave is connected) */
 #define PIC_SLAVE_ID       0x02  /* Slave PIC cascade identity */
 #define PIC_UNMASK_ALL     0x00  /* Enable all IRQs (no mask) */
+#define PIC_MASK_ALL       0xFF  /* The IOAPIC has taken over */
+#define PIC_READ_ISR       0x0B  /* OCW3: next command port read returns the in-service register */
 
 /* Number of interrupt handlers */
 #define MAX_INTERRUPTS 256
@@ -106,4 +113,38 @@ void irq_install();
 typedef void (*isr_t)(registers_t);
 void register_interrupt_handler(u8 n, isr_t handler);
 
+/* EFLAGS interrupt enable bit */
+#define EFLAGS_IF 0x200
+
+/* Disable interrupts and return the previous EFLAGS, for short critical
+ * sections shared with interrupt handlers */
+u32 irq_save();
+void irq_restore(u32 flags);
+
+/* Per IRQ line statistics, kept by irq_handler() when the kernel is built
+ * with IRQ_STATS (the default, see the Makefile). A handler's time runs
+ * from irq_handler() entry to exit, the EOI included, and covers
+ * everything the handler does, such as redrawing the input line from the
+ * keyboard interrupt. An interrupt whose handler switched tasks (the timer
+ * preempting ring 3) is counted but not timed: its exit comes only once
+ * the task runs again, possibly on another CPU. Lines 16 and 17 are the
+ * LAPIC timer and the reschedule IPI */
+#define IRQ_LINES              18
+#define IRQ_LATENCY_BUCKETS    32  /* Bucket n: 2^n to 2^(n+1) - 1 cycles */
+
+typedef struct {
+    u32 count;
+    u32 switched;                  /* Of those, left untimed */
+    u32 max_cycles;
+    u64 cycles;
+    u32 latency[IRQ_LATENCY_BUCKETS];
+} irq_stats_t;
+
+/* NULL without IRQ_STATS */
+irq_stats_t* get_irq_stats(u32 line);
+void reset_irq_stats();
+/* IRQ7 or IRQ15 raised without the PIC having anything in service. These
+ * are counted with or without IRQ_STATS */
+u32 get_spurious_irqs(u32 line);
+
 #endif
@@ -1,57 +1,181 @@
 #include "paging.h"
+#include "cpu.h"
 #include "../libc/mem.h"
+#include "../drivers/rtc.h"
 #include "../drivers/screen.h"
+#include "../mm/vm.h"
+#include "../mm/zeropool.h"
+#include "../kernel/smp.h"
+#include "syscall.h"
 
 page_directory_t* kernel_directory = 0;
 
-/* Bitmap to track used/free frames */
-static u32 frame_bitmap[BITMAP_SIZE];
-extern u32 free_mem_addr;  /* End of kernel heap from mem.c */
+static u8 pae = 0;
+static u8 nx = 0;
+/* The page table holding every CPU's kmap() windows, shared by all spaces */
+static void *kmap_table = NULL;
 
-/* Cached frame statistics (updated on alloc/free) */
-static u32 used_frames = 0;
-static u32 free_frames = TOTAL_FRAMES;
+/* Entries are 32 or 64 bits wide depending on the format */
+static u32 table_entries() {
+    return pae ? 512 : 1024;
+}
 
-void init_paging() {
-    register_interrupt_handler(14, page_fault_handler);
+static page_entry_t read_entry(void *table, u32 index) {
+    return pae ? ((volatile u64*)table)[index] : ((volatile u32*)table)[index];
+}
+
+/* A 64-bit entry takes two stores: the half with the present bit is
+ * cleared first and written last, so the MMU never walks a mix of two */
+static void write_entry(void *table, u32 index, page_entry_t entry) {
+    if (!pae) {
+        ((volatile u32*)table)[index] = (u32)entry;
+        return;
+    }
+    volatile u32 *half = (volatile u32*)&((u64*)table)[index];
+    half[0] = 0;
+    half[1] = (u32)(entry >> 32);
+    half[0] = (u32)entry;
+}
 
-    u32 phys_dir_addr;
-    u32 phys_table_addr;
+/* Bits the format has: PAGE_NX is reserved without NX, everything above
+ * bit 31 without PAE */
+static page_entry_t entry_mask() {
+    if (!pae) return 0xFFFFFFFF;
+    return nx ? ~0ULL : ~PAGE_NX;
+}
 
-    /* Allocate page-aligned page directory */
-    kernel_directory = (page_directory_t*) kmalloc(sizeof(page_directory_t), 1, &phys_dir_addr);
-    memory_set((u8*)kernel_directory, 0, sizeof(page_directory_t));
+/* The directory with the entry for 'virt', and the entry's index in it.
+ * With PAE all four directories always exist */
+static void* directory_of(page_directory_t *dir, u32 virt, u32 *index) {
+    if (!pae) {
+        *index = virt >> 22;
+        return dir;
+    }
+    *index = (virt >> 21) & 0x1FF;
+    return (void*)(u32)(((u64*)dir)[virt >> 30] & PAGE_ADDR_MASK);
+}
 
-    /* Allocate page-aligned page table */
-    page_table_t* first_table = (page_table_t*) kmalloc(sizeof(page_table_t), 1, &phys_table_addr);
-    memory_set((u8*)first_table, 0, sizeof(page_table_t));
+static u32 table_index(u32 virt) {
+    return (virt >> 12) & (table_entries() - 1);
+}
 
-    /* Identity map first 4MB (0x00000000 - 0x003FFFFF) */
-    for (u32 i = 0; i < 1024; i++) {
-        u32 phys = i * 0x1000;
-        first_table->entries[i] = (phys & 0xFFFFF000) | PAGE_PRESENT | PAGE_WRITABLE;
+/* Bytes one directory entry covers */
+static u32 directory_span() {
+    return pae ? LARGE_PAGE_SIZE : PAGE_TABLE_SPAN;
+}
+
+/* Zeroed, page aligned, from the heap: the frame allocator isn't up yet */
+static void* boot_table() {
+    void *table = (void*)kmalloc(FRAME_SIZE, 1, NULL);
+    memory_set((u8*)table, 0, FRAME_SIZE);
+    return table;
+}
+
+/* Identity map all of physical memory (0x00000000 - MEMORY_END), so the
+ * frames handed out by alloc_frame() are directly addressable */
+static void build_directory() {
+    kernel_directory = (page_directory_t*)boot_table();
+    for (u32 t = 0; t < IDENTITY_TABLES; t++) {
+        u32 *table = (u32*)boot_table();
+        for (u32 i = 0; i < 1024; i++) {
+            u32 phys = t * PAGE_TABLE_SPAN + i * 0x1000;
+            table[i] = (phys & 0xFFFFF000) | PAGE_PRESENT | PAGE_WRITABLE;
+        }
+        /* Link page table into page directory using physical address */
+        ((u32*)kernel_directory)[t] = (u32)table | PAGE_PRESENT | PAGE_WRITABLE;
     }
+}
+
+/* The same with PAE: all four directories up front (the CPU loads the
+ * pointer table with CR3 and won't see later changes to it), and the
+ * identity map in 2MB pages */
+static void build_pae_directory() {
+    kernel_directory = (page_directory_t*)boot_table();
+    for (u32 i = 0; i < PDPT_ENTRIES; i++) {
+        ((u64*)kernel_directory)[i] = (u32)boot_table() | PAGE_PRESENT;
+    }
+    u32 index;
+    u64 *low = (u64*)directory_of(kernel_directory, 0, &index);
+    for (u32 i = 0; i < MEMORY_END / LARGE_PAGE_SIZE; i++) {
+        low[i] = (u64)(i * LARGE_PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE;
+    }
+}
+
+/* RAM past the direct map as QEMU's firmware leaves it in the CMOS (real
+ * hardware would need the BIOS memory map): in 64KB units from 16MB up to
+ * the PCI hole, and from 4GB up. Without PAE only the first is reachable */
+static void init_high_memory() {
+    u32 below = (cmos_read(CMOS_MEM_ABOVE_16M_HIGH) << 8) | cmos_read(CMOS_MEM_ABOVE_16M_LOW);
+    u32 above = (cmos_read(CMOS_MEM_ABOVE_4G_HIGH) << 16) | (cmos_read(CMOS_MEM_ABOVE_4G_MID) << 8) |
+                cmos_read(CMOS_MEM_ABOVE_4G_LOW);
+    phys_t low_end = CMOS_MEM_BASE + (phys_t)below * CMOS_MEM_UNIT;
+    phys_t high_end = FOUR_GB + (phys_t)above * CMOS_MEM_UNIT;
+    if (!pae) above = 0;
+    if (low_end <= MEMORY_END + HIGH_MEMORY_FIRMWARE && !above) return;
+
+    if (!init_high_frames(above ? high_end : low_end)) {
+        kprint_color("High memory: no room for its bitmap\n", RED_ON_BLACK);
+        return;
+    }
+    add_high_frames(MEMORY_END, low_end - HIGH_MEMORY_FIRMWARE);
+    if (above) add_high_frames(FOUR_GB, high_end);
+    kprintf_color(GREEN_ON_BLACK, "High memory: %d MB\n", get_high_frame_count() / (0x100000 / FRAME_SIZE));
+}
+
+void init_paging() {
+    register_interrupt_handler(14, page_fault_handler);
+
+#ifdef PAE
+    pae = (cpu_features() & CPUID_EDX_PAE) != 0;
+    nx = pae && (cpu_ext_features() & CPUID_EXT_EDX_NX);
+#endif
+    if (pae) build_pae_directory();
+    else build_directory();
 
-    /* Link page table into page directory using physical address */
-    kernel_directory->entries[0] = (phys_table_addr & 0xFFFFF000) | PAGE_PRESENT | PAGE_WRITABLE;
+    /* kmap() windows: their page table exists before any address space
+     * is made, so all of them share it */
+    kmap_table = boot_table();
+    u32 index;
+    void *directory = directory_of(kernel_directory, VM_KMAP_START, &index);
+    write_entry(directory, index, (u32)kmap_table | PAGE_PRESENT | PAGE_WRITABLE);
 
-    kprintf_color(GREEN_ON_BLACK, "Paging structures initialized\n");
+    if (pae) kprintf_color(GREEN_ON_BLACK, "Paging structures initialized: PAE%s, 2MB pages\n", nx ? " with NX" : "");
+    else kprintf_color(GREEN_ON_BLACK, "Paging structures initialized\n");
     
     init_frame_allocator();
+    init_high_memory();
 }
 
 void enable_paging() {
     u32 cr0;
+
+    /* The format must be settled before paging is on */
+    if (pae) {
+        u32 cr4;
+        __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ __volatile__("mov %0, %%cr4" :: "r"(cr4 | CR4_PAE));
+    }
+    if (nx) write_msr(MSR_EFER, read_msr(MSR_EFER) | EFER_NXE);
     
-    /* Load page directory address into CR3 */
+    /* Load page directory (or PAE pointer table) address into CR3 */
     __asm__ __volatile__("mov %0, %%cr3" :: "r"(kernel_directory));
     
-    /* Enable paging by setting bit 31 in CR0 */
+    /* Enable paging by setting bit 31 in CR0. WP (bit 16) makes read-only
+     * pages fault in the kernel too, which copy-on-write mappings rely on */
     __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
+    cr0 |= 0x80000000 | CR0_WP;
     __asm__ __volatile__("mov %0, %%cr0" :: "r"(cr0));
     
     kprintf_color(GREEN_ON_BLACK, "Paging enabled!\n");
+    init_vm();
+}
+
+u8 paging_pae() {
+    return pae;
+}
+
+u8 paging_nx() {
+    return nx;
 }
 
 void page_fault_handler(registers_t regs) {
@@ -59,6 +183,13 @@ void page_fault_handler(registers_t regs) {
     
     /* Read CR2 to get the faulting address */
     __asm__ __volatile__("mov %%cr2, %0" : "=r"(faulting_address));
+
+    /* Lazily populated mappings (mmap) are filled in here */
+    if (vm_handle_fault(faulting_address, regs.err_code)) return;
+    if (regs.cs & 3) {
+        kprintf_color(RED_ON_BLACK, "Page fault at %x\n", faulting_address);
+        user_fault("Page Fault", regs.eip);
+    }
     
     /* Decode error code */
     int present = regs.err_code & 0x1;    /* Page not present */
@@ -84,86 +215,141 @@ void page_fault_handler(registers_t regs) {
     __asm__ __volatile__("cli; hlt");
 }
 
-/* Helper: Set bit in bitmap and update stats */
-static void set_frame(u32 frame_addr) {
-    u32 frame = frame_addr / FRAME_SIZE;
-    u32 byte_idx = frame / 8;
-    u32 bit_idx = frame % 8;
-    
-    /* Only update stats if frame was previously free */
-    if (!(frame_bitmap[byte_idx] & (1 << bit_idx))) {
-        used_frames++;
-        free_frames--;
+static void invalidate_page(u32 virt) {
+    __asm__ __volatile__("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+u32 map_page(page_directory_t *dir, u32 virt, phys_t phys, page_entry_t flags) {
+    if (!pae && phys >= FOUR_GB) return 0;
+    u32 index;
+    void *directory = directory_of(dir, virt, &index);
+    page_entry_t pde = read_entry(directory, index);
+    if (pde & PAGE_LARGE) return 0;
+    if (!(pde & PAGE_PRESENT)) {
+        /* Frames are identity mapped, so the new table is addressable as is */
+        u32 table = alloc_frame_zeroed();
+        if (!table) return 0;
+        pde = table | PAGE_PRESENT | PAGE_WRITABLE | (flags & PAGE_USER);
+        write_entry(directory, index, pde);
     }
-    
-    frame_bitmap[byte_idx] |= (1 << bit_idx);
+    void *table = (void*)(u32)(pde & PAGE_ADDR_MASK);
+    page_entry_t old = read_entry(table, table_index(virt));
+    write_entry(table, table_index(virt), ((phys & PAGE_ADDR_MASK) | flags | PAGE_PRESENT) & entry_mask());
+    invalidate_page(virt);
+    /* A replaced kernel entry (copy on write of a kmmap() page) may be in
+     * other CPUs' TLBs, as after unmap_page() */
+    if ((old & PAGE_PRESENT) && dir == kernel_directory) kernel_tlb_invalidate();
+    return 1;
 }
 
-/* Helper: Clear bit in bitmap and update stats */
-static void clear_frame(u32 frame_addr) {
-    u32 frame = frame_addr / FRAME_SIZE;
-    u32 byte_idx = frame / 8;
-    u32 bit_idx = frame % 8;
-    
-    /* Only update stats if frame was previously used */
-    if (frame_bitmap[byte_idx] & (1 << bit_idx)) {
-        used_frames--;
-        free_frames++;
+void unmap_page(page_directory_t *dir, u32 virt) {
+    u32 index;
+    void *directory = directory_of(dir, virt, &index);
+    page_entry_t pde = read_entry(directory, index);
+    if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) return;
+    write_entry((void*)(u32)(pde & PAGE_ADDR_MASK), table_index(virt), 0);
+    invalidate_page(virt);
+    /* Shared by every CPU, user directories only by the one running them */
+    if (dir == kernel_directory) kernel_tlb_invalidate();
+}
+
+page_entry_t get_page_entry(page_directory_t *dir, u32 virt) {
+    u32 index;
+    void *directory = directory_of(dir, virt, &index);
+    page_entry_t pde = read_entry(directory, index);
+    if (!(pde & PAGE_PRESENT)) return 0;
+    if (pde & PAGE_LARGE) {
+        /* The 2MB frame plus the 4KB page's offset in it, with the flags
+         * (bit 12 of a large entry is PAT, not address) */
+        page_entry_t base = pde & PAGE_ADDR_MASK & ~(page_entry_t)(LARGE_PAGE_SIZE - 1);
+        return (base + (virt & (LARGE_PAGE_SIZE - 1) & PAGE_FRAME_MASK)) |
+               (pde & (PAGE_NX | (FRAME_SIZE - 1)) & ~(page_entry_t)PAGE_LARGE);
     }
-    
-    frame_bitmap[byte_idx] &= ~(1 << bit_idx);
+    return read_entry((void*)(u32)(pde & PAGE_ADDR_MASK), table_index(virt));
 }
 
-/* Helper: Test if frame is used */
-static u32 test_frame(u32 frame_addr) {
-    u32 frame = frame_addr / FRAME_SIZE;
-    u32 byte_idx = frame / 8;
-    u32 bit_idx = frame % 8;
-    return frame_bitmap[byte_idx] & (1 << bit_idx);
+/* Does directory entry 'index' of the one for 'base' cover private addresses? */
+static u8 in_range(u32 base, u32 index, u32 start, u32 end) {
+    u32 virt = base + index * directory_span();
+    return virt >= start && virt < end;
 }
 
-void init_frame_allocator() {
-    /* Zero bitmap - all frames start FREE (defensive programming) */
-    memory_set((u8*)frame_bitmap, 0, BITMAP_SIZE);
-    
-    /* Reset counters */
-    used_frames = 0;
-    free_frames = TOTAL_FRAMES;
-    
-    /* Mark frames used by kernel as allocated (0x0 to free_mem_addr) 
-     * This prevents alloc_frame() from giving out kernel memory! */
-    for (u32 addr = 0; addr < free_mem_addr; addr += FRAME_SIZE) {
-        set_frame(addr);
+page_directory_t* create_directory(u32 private_start, u32 private_end) {
+    page_directory_t *dir = (page_directory_t*)alloc_frame_zeroed();
+    if (!dir) return NULL;
+    for (u32 d = 0; d < (pae ? PDPT_ENTRIES : 1); d++) {
+        u32 base = d << 30;
+        u32 index;
+        void *kernel = directory_of(kernel_directory, base, &index);
+        void *directory = dir;
+        if (pae) {
+            /* A directory with nothing private in it is the kernel's own */
+            if ((private_start >> 30) > d || ((private_end - 1) >> 30) < d) {
+                ((u64*)dir)[d] = ((u64*)kernel_directory)[d];
+                continue;
+            }
+            directory = (void*)alloc_frame_zeroed();
+            if (!directory) {
+                destroy_directory(dir, private_start, private_end);
+                return NULL;
+            }
+            ((u64*)dir)[d] = (u32)directory | PAGE_PRESENT;
+        }
+        for (u32 i = 0; i < table_entries(); i++) {
+            if (!in_range(base, i, private_start, private_end)) write_entry(directory, i, read_entry(kernel, i));
+        }
     }
-    
-    kprintf_color(GREEN_ON_BLACK, "Frame allocator initialized: %d frames (%d MB)\n", TOTAL_FRAMES, MEMORY_END / 1024 / 1024);
+    return dir;
 }
 
-u32 alloc_frame() {
-    for (u32 i = 0; i < TOTAL_FRAMES; i++) {
-        u32 addr = i * FRAME_SIZE;
-        if (!test_frame(addr)) {
-            set_frame(addr);
-            return addr;
+void destroy_directory(page_directory_t *dir, u32 private_start, u32 private_end) {
+    for (u32 d = 0; d < (pae ? PDPT_ENTRIES : 1); d++) {
+        u32 base = d << 30;
+        u32 index;
+        void *directory = pae ? (void*)(u32)(((u64*)dir)[d] & PAGE_ADDR_MASK) : (void*)dir;
+        if (!directory || directory == directory_of(kernel_directory, base, &index)) continue;
+        for (u32 i = 0; i < table_entries(); i++) {
+            page_entry_t pde = read_entry(directory, i);
+            if (in_range(base, i, private_start, private_end) && (pde & PAGE_PRESENT) && !(pde & PAGE_LARGE)) {
+                free_frame(pde & PAGE_ADDR_MASK);
+            }
         }
+        if (pae) free_frame((u32)directory);
     }
-    
-    kprintf_color(RED_ON_BLACK, "ERROR: Out of physical memory!\n");
-    return 0;
+    free_frame((u32)dir);
 }
 
-void free_frame(u32 frame_addr) {
-    frame_addr &= 0xFFFFF000;
-    
-    if (frame_addr < MEMORY_END) {
-        clear_frame(frame_addr);
+void sync_kernel_mapping(page_directory_t *dir, u32 virt) {
+    u32 index;
+    void *directory = directory_of(dir, virt, &index);
+    void *kernel = directory_of(kernel_directory, virt, &index);
+    if (directory != kernel && !(read_entry(directory, index) & PAGE_PRESENT)) {
+        write_entry(directory, index, read_entry(kernel, index));
     }
 }
 
-u32 get_free_frame_count() {
-    return free_frames;
+void* kmap(phys_t phys) {
+    if (phys < MEMORY_END) return (void*)(u32)phys;
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    if (cpu->kmap_depth == KMAP_SLOTS) {
+        kprintf_color(RED_ON_BLACK, "kmap: all %d windows of CPU%d in use, system halted\n", KMAP_SLOTS, cpu->id);
+        __asm__ __volatile__("cli; hlt");
+    }
+    u32 virt = VM_KMAP_START + (cpu->id * KMAP_SLOTS + cpu->kmap_depth++) * FRAME_SIZE;
+    write_entry(kmap_table, table_index(virt),
+                ((phys & PAGE_ADDR_MASK) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_NX) & entry_mask());
+    /* Only this CPU uses the window, so only its TLB can hold the last frame */
+    invalidate_page(virt);
+    irq_restore(flags);
+    return (void*)(virt + (u32)(phys & (FRAME_SIZE - 1)));
 }
 
-u32 get_used_frame_count() {
-    return used_frames;
-}
\ No newline at end of file
+void kunmap(void *addr) {
+    if ((u32)addr < VM_KMAP_START) return;
+    u32 flags = irq_save();
+    this_cpu()->kmap_depth--;
+    /* The stale TLB entry goes when the window is next used */
+    write_entry(kmap_table, table_index((u32)addr), 0);
+    irq_restore(flags);
+}
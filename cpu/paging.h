@@ -7,35 +7,114 @@
 #define PAGE_PRESENT   0x1
 #define PAGE_WRITABLE  0x2
 #define PAGE_USER      0x4
+#define PAGE_WRITETHROUGH 0x8
+#define PAGE_NOCACHE   0x10        /* Device registers */
+#define PAGE_ACCESSED  0x20
+#define PAGE_DIRTY     0x40
+#define PAGE_LARGE     0x80        /* Directory entry mapping a 2MB page (PAE) */
+#define PAGE_NX        (1ULL << 63) /* No instruction fetches, with PAE and NX only */
+#define PAGE_FRAME_MASK 0xFFFFF000
+#define PAGE_ADDR_MASK 0x000FFFFFFFFFF000ULL  /* Frame address in an entry, either format */
+
+#define CR0_WP         0x10000
+#define CR4_PAE        0x20
+#define MSR_EFER       0xC0000080
+#define EFER_NXE       0x800       /* PAGE_NX honoured instead of reserved */
+
+/* Page fault error code bits */
+#define PF_PRESENT     0x1
+#define PF_WRITE       0x2
+#define PF_USER        0x4
+#define PF_RESERVED    0x8
+#define PF_FETCH       0x10        /* Instruction fetch, from an NX page */
 
 #define FRAME_SIZE     0x1000       /* 4KB per frame */
 #define FRAMES_PER_BYTE 8           /* 8 frames tracked per byte in bitmap */
 #define MEMORY_END     0x1000000    /* 16MB of RAM (adjustable) */
 #define TOTAL_FRAMES   (MEMORY_END / FRAME_SIZE)
 #define BITMAP_SIZE    (TOTAL_FRAMES / FRAMES_PER_BYTE)
+#define PAGE_TABLE_SPAN 0x400000    /* 4MB mapped by each page table */
+#define IDENTITY_TABLES (MEMORY_END / PAGE_TABLE_SPAN)
+#define LARGE_PAGE_SIZE 0x200000    /* PAE directory entries map 2MB */
+#define PDPT_ENTRIES   4            /* PAE: one directory per GB */
 
-typedef u32 page_entry_t;
+/* RAM past MEMORY_END is high memory: not in the direct map, reached through
+ * page tables and kmap(). Its bitmap comes from the heap, 32KB per GB, so
+ * there is a limit. QEMU's firmware keeps its ACPI tables in the last
+ * HIGH_MEMORY_FIRMWARE bytes below 4GB, which are left alone */
+#define HIGH_MEMORY_END       0x400000000ULL     /* 16GB */
+#define HIGH_MEMORY_FIRMWARE  0x100000
+#define FOUR_GB               0x100000000ULL
 
-typedef struct {
-    page_entry_t entries[1024];
-} page_table_t;
+/* Per CPU windows onto frames outside the direct map, see kmap() */
+#define KMAP_SLOTS     8
 
-typedef struct {
-    page_entry_t entries[1024];
-} page_directory_t;
+typedef u64 phys_t;
+/* Entries are 32 bits wide without PAE and 64 with it; this holds either */
+typedef u64 page_entry_t;
+
+/* The top of a paging hierarchy, what CR3 holds: a page directory of 1024
+ * 32-bit entries, or with PAE a page directory pointer table whose four
+ * entries point to directories of 512 64-bit entries. Every level is in
+ * the direct map */
+typedef struct page_directory page_directory_t;
 
 /* Global paging structures */
 extern page_directory_t* kernel_directory;
 
+/* PAE is used when the CPU has it (and the kernel is built with PAE=1),
+ * NX when it also has that */
 void init_paging();
 void enable_paging();
 void page_fault_handler(registers_t regs);
+u8 paging_pae();
+u8 paging_nx();
+
+/* Map one 4KB page, allocating the page table on first use. PAGE_NX is
+ * dropped where it isn't supported. Returns 0 if no frame was left for the
+ * table, or if 'virt' is in a 2MB page or 'phys' past what the format can
+ * address */
+u32 map_page(page_directory_t *dir, u32 virt, phys_t phys, page_entry_t flags);
+void unmap_page(page_directory_t *dir, u32 virt);
+/* Page table entry for 'virt', 0 if none. Inside a 2MB page, the entry a
+ * 4KB page there would have */
+page_entry_t get_page_entry(page_directory_t *dir, u32 virt);
 
-/* Frame allocator functions */
+/* A new hierarchy sharing the kernel's mappings outside [private_start,
+ * private_end), which starts out empty. Shared parts use the kernel's own
+ * page tables (with PAE its whole directories where they can). NULL if out
+ * of frames */
+page_directory_t* create_directory(u32 private_start, u32 private_end);
+/* Free it with the page tables of the private range */
+void destroy_directory(page_directory_t *dir, u32 private_start, u32 private_end);
+/* Pick up a page table the kernel added for 'virt' since 'dir' was created */
+void sync_kernel_mapping(page_directory_t *dir, u32 virt);
+
+/* Kernel access to any frame. Frames in the direct map are addressable as
+ * they are; others get one of this CPU's KMAP_SLOTS windows until kunmap().
+ * Maps nest last in first out (an interrupt handler may map over a task),
+ * and the task must not give up the CPU in between */
+void* kmap(phys_t phys);
+void kunmap(void *addr);
+
+/* Frame allocator functions. alloc_frame() hands out frames of the direct
+ * map, usable as pointers */
 void init_frame_allocator();
 u32 alloc_frame();
-void free_frame(u32 frame_addr);
+/* Any frame, low or high */
+void free_frame(phys_t frame_addr);
 u32 get_free_frame_count();
 u32 get_used_frame_count();
 
-#endif
\ No newline at end of file
+/* High memory: init_high_frames() sizes the zone up to 'end' (capped at
+ * HIGH_MEMORY_END) with nothing in it, add_high_frames() adds the RAM in
+ * [start, end). Returns 0 if the bitmap didn't fit in the heap */
+u8 init_high_frames(phys_t end);
+void add_high_frames(phys_t start, phys_t end);
+/* A high frame, from the top down so memory below 4GB lasts longest. 0 if
+ * there is none */
+phys_t alloc_frame_high();
+u32 get_high_frame_count();
+u32 get_high_free_frame_count();
+
+#endif
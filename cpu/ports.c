@@ -22,3 +22,30 @@ u16 port_word_in (u16 port) {
 void port_word_out (u16 port, u16 data) {
     __asm__ __volatile__("out %%ax, %%dx" : : "a" (data), "d" (port));
 }
+
+u32 port_long_in (u16 port) {
+    u32 result;
+    __asm__ __volatile__("in %%dx, %%eax" : "=a" (result) : "d" (port));
+    return result;
+}
+
+void port_long_out (u16 port, u32 data) {
+    __asm__ __volatile__("out %%eax, %%dx" : : "a" (data), "d" (port));
+}
+
+/**
+ * Read 'count' words from the port into 'buffer' (rep insw)
+ */
+void port_words_in (u16 port, u16 *buffer, u32 count) {
+    __asm__ __volatile__("cld; rep insw"
+                         : "+D" (buffer), "+c" (count)
+                         : "d" (port)
+                         : "memory");
+}
+
+void port_words_out (u16 port, u16 *buffer, u32 count) {
+    __asm__ __volatile__("cld; rep outsw"
+                         : "+S" (buffer), "+c" (count)
+                         : "d" (port)
+                         : "memory");
+}
@@ -7,5 +7,9 @@ u8 port_byte_in (u16 port);
 void port_byte_out (u16 port, u8 data);
 u16 port_word_in (u16 port);
 void port_word_out (u16 port, u16 data);
+u32 port_long_in (u16 port);
+void port_long_out (u16 port, u32 data);
+void port_words_in (u16 port, u16 *buffer, u32 count);
+void port_words_out (u16 port, u16 *buffer, u32 count);
 
 #endif
@@ -0,0 +1,99 @@
+#include "syscall.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "timer.h"
+#include "idt.h"
+#include "../drivers/screen.h"
+#include "../libc/function.h"
+#include "../mm/vm.h"
+#include "../kernel/task.h"
+#include "../kernel/smp.h"
+
+/* Entry points in usermode.asm */
+extern void syscall_interrupt();
+extern void sysenter_entry();
+
+static syscall_t syscall_table[NUM_SYSCALLS];
+static u8 sysenter = 0;
+
+static s32 sys_null(u32 a, u32 b, u32 c) {
+    UNUSED(a);
+    UNUSED(b);
+    UNUSED(c);
+    return 0;
+}
+
+static s32 sys_exit(u32 status, u32 b, u32 c) {
+    UNUSED(b);
+    UNUSED(c);
+    task_exit(status);
+    return 0;
+}
+
+static s32 sys_write(u32 buffer, u32 len, u32 c) {
+    char chunk[SYSCALL_WRITE_CHUNK + 1];
+    UNUSED(c);
+    if (buffer < VM_USER_START || buffer >= VM_USER_END || len > VM_USER_END - buffer) return SYSCALL_ERROR;
+
+    for (u32 done = 0; done < len; ) {
+        u32 n = MIN(len - done, SYSCALL_WRITE_CHUNK);
+        if (vm_copy(NULL, (u32)chunk, current_task()->space, buffer + done, n) != 0) return SYSCALL_ERROR;
+        chunk[n] = '\0';
+        kprint(chunk);
+        done += n;
+    }
+    return len;
+}
+
+static s32 sys_uptime(u32 a, u32 b, u32 c) {
+    UNUSED(a);
+    UNUSED(b);
+    UNUSED(c);
+    time_page_t *time_page = get_time_page();
+    return time_page ? (s32)time_page_uptime_us(time_page) : SYSCALL_ERROR;
+}
+
+void init_syscalls() {
+    register_syscall(SYS_NULL, sys_null);
+    register_syscall(SYS_EXIT, sys_exit);
+    register_syscall(SYS_WRITE, sys_write);
+    register_syscall(SYS_UPTIME, sys_uptime);
+    set_idt_user_gate(SYSCALL_VECTOR, (u32)syscall_interrupt);
+    sysenter = (cpu_features() & CPUID_EDX_SEP) != 0;
+    syscall_init_cpu();
+}
+
+void syscall_init_cpu() {
+    /* SYSEXIT derives the user selectors from this one (see gdt.h). The
+     * stack MSR follows the kernel stack in user_set_kernel_stack() */
+    if (sysenter) {
+        write_msr(MSR_SYSENTER_CS, KERNEL_CS);
+        write_msr(MSR_SYSENTER_EIP, (u32)sysenter_entry);
+    }
+}
+
+void register_syscall(u32 num, syscall_t handler) {
+    if (num < NUM_SYSCALLS) syscall_table[num] = handler;
+}
+
+u8 sysenter_enabled() {
+    return sysenter;
+}
+
+s32 syscall_dispatch(u32 num, u32 a, u32 b, u32 c) {
+    if (num >= NUM_SYSCALLS || !syscall_table[num]) return SYSCALL_ERROR;
+    kernel_lock();
+    s32 result = syscall_table[num](a, b, c);
+    kernel_unlock();
+    return result;
+}
+
+void user_set_kernel_stack(u32 esp) {
+    set_kernel_stack(esp);
+    if (sysenter) write_msr(MSR_SYSENTER_ESP, esp);
+}
+
+void user_fault(char *what, u32 eip) {
+    kprintf_color(RED_ON_BLACK, "%s in user mode at %x, program killed\n", what, eip);
+    task_exit(USER_KILLED);
+}
@@ -0,0 +1,67 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "types.h"
+
+/* System calls: number in eax, arguments in ebx, esi, edi, result in eax.
+ * ecx and edx are taken by SYSENTER (return stack and address), so the
+ * int 0x80 path uses the same registers to keep one convention */
+#define SYSCALL_VECTOR     0x80
+#define NUM_SYSCALLS       16
+
+#define SYS_NULL           0       /* Does nothing: round trip benchmark */
+#define SYS_EXIT           1       /* exit(status) */
+#define SYS_WRITE          2       /* write(buffer, length) to the console */
+#define SYS_UPTIME         3       /* Microseconds since boot, as the time page gives them */
+#define SYS_SPAWN          4       /* spawn(path, arg): start a program alongside, returns its id */
+#define SYS_PORT_CREATE    5       /* port_create(): a port owned by the caller */
+#define SYS_SEND           6       /* send(port, msg): block until received */
+#define SYS_RECEIVE        7       /* receive(port, msg): returns a reply handle for calls, else 0 */
+#define SYS_CALL           8       /* call(port, msg): send and wait for the reply in 'msg' */
+#define SYS_REPLY          9       /* reply(handle, msg) */
+
+#define SYSCALL_ERROR      -1
+
+#define SYSCALL_WRITE_CHUNK 128
+#define USER_EFLAGS        0x202   /* Interrupts enabled */
+/* Status of a program killed by an exception */
+#define USER_KILLED        ((s32)0x80000000)
+
+/* IPC message descriptor. The sender fills in label, len and data; the
+ * receiver gives data and size (its buffer) and gets label and len back.
+ * Up to IPC_SHORT_MAX bytes are copied straight from the sender's buffer
+ * into the receiver's; whole pages at page aligned addresses on both
+ * sides move by remapping, the sender's copy reads as fresh pages after */
+typedef struct {
+    u32 label;
+    u32 len;
+    u32 size;
+    u32 data;
+} ipc_msg_t;
+
+#define IPC_SHORT_MAX      64
+
+/* IPC errors */
+#define IPC_OK             0
+#define IPC_ERR_PORT       -2      /* No such port, or none left */
+#define IPC_ERR_DEAD       -3      /* Port or server went away */
+#define IPC_ERR_TOO_BIG    -4      /* Message longer than the receiver's buffer */
+#define IPC_ERR_FAULT      -5      /* Bad descriptor or buffer */
+
+typedef s32 (*syscall_t)(u32 a, u32 b, u32 c);
+
+void init_syscalls();
+/* The SYSENTER MSRs of an application processor */
+void syscall_init_cpu();
+void register_syscall(u32 num, syscall_t handler);
+/* SYSENTER is set up when CPUID reports it, int 0x80 always works */
+u8 sysenter_enabled();
+
+/* An exception 'what' at 'eip' in ring 3: report and kill the program */
+void user_fault(char *what, u32 eip);
+
+/* For the entry stubs in usermode.asm */
+s32 syscall_dispatch(u32 num, u32 a, u32 b, u32 c);
+void user_set_kernel_stack(u32 esp);
+
+#endif
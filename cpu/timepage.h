@@ -0,0 +1,45 @@
+#ifndef TIMEPAGE_H
+#define TIMEPAGE_H
+
+#include "types.h"
+
+/* Read-only page the kernel maps at this address in every address space
+ * (VM_TIME_PAGE, just below the kmmap() range) */
+#define TIME_PAGE_ADDR     0x3FFFF000
+
+/* Updated by the timer interrupt. 'seq' is odd while an update is in
+ * progress; readers retry if it was odd or changed under them */
+typedef struct {
+    u32 seq;
+    u32 ticks;
+    u32 hz;
+    u32 tsc_per_tick;            /* Calibrated against the PIT at boot */
+    u32 tsc_mhz;
+    u32 boot_time;               /* Unix time at boot, from the RTC */
+    u64 tsc_at_tick;             /* TSC when 'ticks' last changed */
+} time_page_t;
+
+/* Microseconds since boot: the tick count refined with the TSC. Shared by
+ * the kernel and programs in user/, so no 64-bit division */
+static inline u32 time_page_uptime_us(const volatile time_page_t *tp) {
+    u32 seq, ticks, hz, mhz, low, high;
+    u64 at;
+    do {
+        seq = tp->seq;
+        __asm__ __volatile__("" ::: "memory");
+        ticks = tp->ticks;
+        hz = tp->hz;
+        mhz = tp->tsc_mhz;
+        at = tp->tsc_at_tick;
+        __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+        __asm__ __volatile__("" ::: "memory");
+    } while ((seq & 1) || seq != tp->seq);
+
+    u32 us_per_tick = 1000000 / hz;
+    u32 since_tick = mhz ? (u32)((((u64)high << 32) | low) - at) / mhz : 0;
+    /* A late tick must not let the clock run past where it will land */
+    if (since_tick >= us_per_tick) since_tick = us_per_tick - 1;
+    return ticks * us_per_tick + since_tick;
+}
+
+#endif
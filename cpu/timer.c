@@ -1,19 +1,76 @@
 #include "timer.h"
 #include "isr.h"
 #include "ports.h"
+#include "paging.h"
 #include "../libc/function.h"
+#include "../libc/mem.h"
+#include "../drivers/rtc.h"
+#include "../kernel/task.h"
+#include "../kernel/prof.h"
+#include "../kernel/spinlock.h"
 
-u32 tick = 0;
+/* Written by the timer interrupt only, read anywhere */
+static seqlock_t tick_lock = SEQLOCK_INIT("tick");
+static u64 ticks = 0;
+static u64 tsc_at_tick = 0;
+static time_page_t *time_page = NULL;
+/* Interrupts per tick: more than one while the profiler samples faster */
+static u32 subticks = 1;
+static u32 subtick = 0;
 
 static void timer_callback(registers_t regs) {
-    tick++;
-    UNUSED(regs);
+    if (prof_enabled) prof_sample(regs.eip, regs.cs);
+    if (++subtick < subticks) return;
+    subtick = 0;
+
+    write_seqlock(&tick_lock);
+    ticks++;
+    tsc_at_tick = read_tsc();
+    write_sequnlock(&tick_lock);
+    if (time_page) {
+        time_page->seq++;
+        __asm__ __volatile__("" ::: "memory");
+        time_page->ticks = (u32)ticks;
+        time_page->tsc_at_tick = tsc_at_tick;
+        __asm__ __volatile__("" ::: "memory");
+        time_page->seq++;
+    }
+    /* Only ring 3 code is preempted */
+    task_tick((regs.cs & 3) == 3);
 }
 
-void init_timer(u32 freq) {
-    /* Install the function we just wrote */
-    register_interrupt_handler(IRQ0, timer_callback);
+u32 get_tick() {
+    return (u32)get_tick64();
+}
+
+u64 get_tick64() {
+    u32 seq;
+    u64 t;
+    do {
+        seq = read_seqbegin(&tick_lock);
+        t = ticks;
+    } while (read_seqretry(&tick_lock, seq));
+    return t;
+}
+
+u64 get_tick_tsc(u64 *tsc) {
+    u32 seq;
+    u64 t;
+    do {
+        seq = read_seqbegin(&tick_lock);
+        t = ticks;
+        *tsc = tsc_at_tick;
+    } while (read_seqretry(&tick_lock, seq));
+    return t;
+}
 
+u64 read_tsc() {
+    u32 low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((u64)high << 32) | low;
+}
+
+static void program_pit(u32 freq) {
     /* Get the PIT divisor value: hardware clock at PIT_FREQUENCY Hz */
     u32 divisor = PIT_FREQUENCY / freq;
     u8 low  = low_8(divisor);
@@ -25,3 +82,47 @@ void init_timer(u32 freq) {
     port_byte_out(PIT_DATA_PORT, high);
 }
 
+void init_timer(u32 freq) {
+    /* Install the function we just wrote */
+    register_interrupt_handler(IRQ0, timer_callback);
+    program_pit(freq);
+}
+
+void timer_set_rate(u32 hz) {
+    u32 flags = irq_save();
+    subticks = hz / TIMER_HZ;
+    subtick = 0;
+    program_pit(hz);
+    irq_restore(flags);
+}
+
+
+/* TSC cycles per timer tick, averaged over a few ticks. Needs interrupts on */
+static u32 calibrate_tsc() {
+    u32 start_tick = get_tick();
+    while (get_tick() == start_tick) __asm__ __volatile__("sti; hlt");
+    start_tick = get_tick();
+    u64 start = read_tsc();
+    while (get_tick() - start_tick < TSC_CALIBRATION_TICKS) __asm__ __volatile__("sti; hlt");
+    return (u32)(read_tsc() - start) / TSC_CALIBRATION_TICKS;
+}
+
+void init_time_page() {
+    time_page_t *page = (time_page_t*)alloc_frame();
+    if (!page) return;
+    memory_set((u8*)page, 0, FRAME_SIZE);
+    page->hz = TIMER_HZ;
+    page->tsc_per_tick = calibrate_tsc();
+    page->tsc_mhz = page->tsc_per_tick / (1000000 / TIMER_HZ);
+    u64 tsc;
+    u32 now = (u32)get_tick_tsc(&tsc);
+    page->boot_time = rtc_read_time() - now / TIMER_HZ;
+    page->ticks = now;
+    page->tsc_at_tick = tsc;
+    /* Published last: the interrupt only updates a complete page */
+    time_page = page;
+}
+
+time_page_t* get_time_page() {
+    return time_page;
+}
@@ -2,6 +2,7 @@
 #define TIMER_H
 
 #include "types.h"
+#include "timepage.h"
 
 /* PIT (Programmable Interval Timer) constants */
 #define PIT_FREQUENCY 1193180   /* Base frequency of the PIT in Hz */
@@ -9,6 +10,29 @@
 #define PIT_DATA_PORT 0x40      /* PIT channel 0 data port */
 #define PIT_MODE_SQUARE_WAVE 0x36 /* Channel 0, lobyte/hibyte, rate generator */
 
+/* System tick rate programmed into the PIT at boot */
+#define TIMER_HZ 50
+
+/* Ticks the TSC is measured over when the time page is set up */
+#define TSC_CALIBRATION_TICKS 5
+
 void init_timer(u32 freq);
+/* Ticks since boot. The full count and the TSC at the last tick are read
+ * together under a seqlock */
+u32 get_tick();
+u64 get_tick64();
+u64 get_tick_tsc(u64 *tsc);
+/* Interrupt at 'hz', a multiple of TIMER_HZ, while ticks keep coming at
+ * TIMER_HZ. For the profiler */
+void timer_set_rate(u32 hz);
+
+/* CPU timestamp counter (cycles since reset) */
+u64 read_tsc();
+
+/* Calibrate the TSC, read the RTC and start publishing the time page.
+ * Needs the frame allocator and interrupts */
+void init_time_page();
+/* NULL before init_time_page() */
+time_page_t* get_time_page();
 
 #endif
@@ -0,0 +1,78 @@
+; Application processor start-up. kernel/smp.c copies this code to
+; TRAMPOLINE_ADDR and fills in the parameters at its end; the startup IPI
+; then sends the AP here in real mode, at TRAMPOLINE_ADDR >> 4 : 0.
+; Selectors match cpu/gdt.h, the address kernel/smp.h
+
+TRAMPOLINE_ADDR equ 0x8000
+KERNEL_CS       equ 0x08
+KERNEL_DS       equ 0x10
+CR0_PE          equ 0x1
+CR0_PG_WP       equ 0x80010000
+MSR_EFER        equ 0xC0000080
+
+; Where a label ends up once the code is copied
+%define REL(label) (TRAMPOLINE_ADDR + (label) - trampoline_start)
+
+global trampoline_start
+global trampoline_params
+global trampoline_end
+
+section .text
+
+[bits 16]
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [REL(param_gdtr)]      ; The kernel's GDT, 32 bit base
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword KERNEL_CS:REL(trampoline_32)
+
+[bits 32]
+trampoline_32:
+    mov ax, KERNEL_DS
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov eax, [REL(param_cr4)]       ; PAE, before paging is on
+    mov cr4, eax
+    mov ebx, [REL(param_efer)]      ; EFER bits to set (NXE), 0 for none
+    test ebx, ebx
+    jz .paging
+    mov ecx, MSR_EFER
+    rdmsr
+    or eax, ebx
+    wrmsr
+.paging:
+    mov eax, [REL(param_cr3)]       ; The kernel's page directory (PAE: pointer table)
+    mov cr3, eax
+    mov eax, cr0
+    or eax, CR0_PG_WP
+    mov cr0, eax
+    mov esp, [REL(param_stack)]     ; The top of this CPU's idle task stack
+    push dword [REL(param_cpu)]
+    mov eax, [REL(param_entry)]
+    call eax                        ; ap_main(cpu), never returns
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+; Filled in by smp.c before every startup IPI, see trampoline_params_t
+align 4
+trampoline_params:
+param_gdtr:     dw 0
+                dd 0
+                dw 0                ; Pads the GDT register to 8 bytes
+param_cr3:      dd 0
+param_cr4:      dd 0
+param_efer:     dd 0
+param_stack:    dd 0
+param_entry:    dd 0
+param_cpu:      dd 0
+trampoline_end:
@@ -3,6 +3,8 @@
 
 /* Instead of using 'chars' to allocate non-character bytes,
  * we will use these new types with no semantic meaning */
+typedef unsigned long long u64;
+typedef          long long s64;
 typedef unsigned int   u32;
 typedef          int   s32;
 typedef unsigned short u16;
@@ -11,14 +13,21 @@ typedef unsigned char  u8;
 typedef          char  s8;
 
 /* Additional useful types for OS development */
+#ifdef HOST_BUILD
+/* tests/host: the host's own headers define size_t and NULL */
+#include <stddef.h>
+#else
 typedef u32 size_t;     /* For sizes and lengths - 32-bit is appropriate for 32-bit OS */
+#endif
 
 /* Boolean constants - use with u8 type for boolean values */
 #define true  1
 #define false 0
 
 /* NULL pointer */
+#ifndef NULL
 #define NULL ((void*)0)
+#endif
 
 /* Common bit masks */
 #define BYTE_MASK 0xFF
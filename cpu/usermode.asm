@@ -0,0 +1,104 @@
+; System call entry points, task switching and the first entry to ring 3.
+; Selectors match cpu/gdt.h
+
+[extern syscall_dispatch]
+[extern task_first_run]
+[extern kernel_unlock]
+
+KERNEL_DS   equ 0x10
+USER_DS     equ 0x23
+
+global syscall_interrupt
+global sysenter_entry
+global switch_context
+global user_task_entry
+
+section .text
+
+; int 0x80: number in eax, arguments in ebx, esi, edi, result in eax
+syscall_interrupt:
+    pusha
+    mov ebp, eax        ; number, eax is needed for the segments
+    mov ax, ds
+    push eax
+    mov ax, KERNEL_DS
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    push edi
+    push esi
+    push ebx
+    push ebp
+    call syscall_dispatch
+    add esp, 16
+    mov [esp + 4 + 28], eax ; over the eax saved by pusha
+
+    pop ebx
+    mov ds, bx
+    mov es, bx
+    mov fs, bx
+    mov gs, bx
+    popa
+    iret
+
+; SYSENTER: the same registers plus the caller's stack in ecx and its
+; return address in edx, which SYSEXIT takes back from the same registers.
+; The CPU has already switched to the kernel stack and cleared IF
+sysenter_entry:
+    push ecx
+    push edx
+    push edi
+    push esi
+    push ebx
+    push eax
+    mov ax, KERNEL_DS
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    call syscall_dispatch   ; ebx, esi and edi survive it (callee saved)
+    add esp, 16
+
+    mov dx, USER_DS
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    pop edx
+    pop ecx
+    sti                     ; takes effect after SYSEXIT
+    sysexit
+
+; void switch_context(u32 *old_esp, u32 new_esp): park the current task
+; with its callee saved registers and flags on its stack, resume the other
+; one. A new task's stack is laid out by task_create_user()
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushf
+    mov [eax], esp
+    mov esp, edx
+    popf
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; First return of a new task, with the ring 3 frame on the stack
+user_task_entry:
+    call task_first_run
+    call kernel_unlock              ; Ring 3 runs without the big kernel lock
+    mov ax, USER_DS
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    iret
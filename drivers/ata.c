@@ -0,0 +1,293 @@
+#include "ata.h"
+#include "pci.h"
+#include "screen.h"
+#include "../cpu/ports.h"
+#include "../cpu/isr.h"
+#include "../libc/function.h"
+
+#define ATA_POLL_TIMEOUT 100000
+
+static ata_drive_t drives[ATA_MAX_DRIVES];
+
+/* Bus master I/O base for the primary channel, 0 if DMA is unavailable */
+static u16 bm_base = 0;
+
+/* 256-byte aligned so the table itself never crosses a 64KB boundary */
+static prd_entry_t prdt[ATA_PRD_ENTRIES] __attribute__((aligned(256)));
+
+/* Both drives share the channel, so only one command is in flight.
+ * A drive whose queue dispatches while the channel is busy waits in 'pending_dev' */
+static block_device_t *cur_dev = NULL;
+static block_request_t *cur_req = NULL;
+static block_device_t *pending_dev = NULL;
+static u8 cur_dma = 0;
+static u32 cur_seg = 0;      /* PIO: current scatter segment */
+static u32 cur_seg_off = 0;  /* PIO: sectors already moved in that segment */
+static u32 cur_left = 0;     /* PIO: sectors left to transfer */
+
+/* Each read of the alternate status register takes ~100ns: 4 of them give
+ * the 400ns the drive needs to present a valid status after select/command */
+static void ata_delay() {
+    for (s32 i = 0; i < 4; i++) port_byte_in(ATA_PRIMARY_CTRL);
+}
+
+static u8 ata_wait_not_busy() {
+    for (u32 i = 0; i < ATA_POLL_TIMEOUT; i++) {
+        u8 status = port_byte_in(ATA_PRIMARY_IO + ATA_REG_STATUS);
+        if (!(status & ATA_SR_BSY)) return status;
+    }
+    return ATA_SR_ERR;
+}
+
+static u8 ata_wait_drq() {
+    for (u32 i = 0; i < ATA_POLL_TIMEOUT; i++) {
+        u8 status = port_byte_in(ATA_PRIMARY_IO + ATA_REG_STATUS);
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) return 0;
+        if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) return 1;
+    }
+    return 0;
+}
+
+/* Next sector-sized slice of the current request for PIO transfers */
+static u16* pio_next_sector() {
+    block_segment_t *seg = &cur_req->segs[cur_seg];
+    u8 *buf = seg->buffer + cur_seg_off * SECTOR_SIZE;
+    if (++cur_seg_off == seg->count) {
+        cur_seg++;
+        cur_seg_off = 0;
+    }
+    cur_left--;
+    return (u16*)buf;
+}
+
+/* Describe the request's segments to the bus master. Memory is identity
+ * mapped so virtual addresses are physical. Returns 0 if DMA can't be used */
+static u8 ata_build_prdt(block_request_t *req) {
+    u32 n = 0;
+    for (u32 i = 0; i < req->nsegs; i++) {
+        u32 addr = (u32)req->segs[i].buffer;
+        u32 left = req->segs[i].count * SECTOR_SIZE;
+        if (addr & 1) return 0;  /* Bus master needs word alignment */
+
+        while (left > 0) {
+            if (n == ATA_PRD_ENTRIES) return 0;
+            u32 chunk = MIN(left, DMA_BOUNDARY - (addr & (DMA_BOUNDARY - 1)));
+            prdt[n].phys_addr = addr;
+            prdt[n].byte_count = chunk & WORD_MASK;
+            prdt[n].flags = 0;
+            addr += chunk;
+            left -= chunk;
+            n++;
+        }
+    }
+    prdt[n - 1].flags = PRD_EOT;
+    return 1;
+}
+
+static s32 ata_issue(block_device_t *dev, block_request_t *req) {
+    ata_drive_t *drive = (ata_drive_t*)dev->driver_data;
+    u16 io = ATA_PRIMARY_IO;
+    u8 lba48 = drive->lba48 && (req->lba + req->count > ATA_LBA28_MAX || req->count > ATA_LBA28_SECTORS);
+    u8 dma = drive->dma && ata_build_prdt(req);
+    u8 cmd;
+
+    if (ata_wait_not_busy() & ATA_SR_ERR) return BLOCK_ERROR;
+
+    cur_dev = dev;
+    cur_req = req;
+    cur_dma = dma;
+    cur_seg = 0;
+    cur_seg_off = 0;
+    cur_left = req->count;
+
+    u8 select = ATA_DRIVE_LBA | (drive->slave ? ATA_DRIVE_SLAVE : 0);
+    if (!lba48) select |= (req->lba >> 24) & 0x0F;
+    port_byte_out(io + ATA_REG_DRIVE, select);
+    ata_delay();
+
+    if (lba48) {
+        /* High-order bytes first: the registers are two-deep FIFOs */
+        port_byte_out(io + ATA_REG_SECCOUNT, high_8(req->count));
+        port_byte_out(io + ATA_REG_LBA0, (req->lba >> 24) & BYTE_MASK);
+        port_byte_out(io + ATA_REG_LBA1, 0);
+        port_byte_out(io + ATA_REG_LBA2, 0);
+        cmd = dma ? (req->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT)
+                  : (req->write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT);
+    } else {
+        cmd = dma ? (req->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA)
+                  : (req->write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+    }
+    port_byte_out(io + ATA_REG_SECCOUNT, low_8(req->count));  /* 256 wraps to 0 */
+    port_byte_out(io + ATA_REG_LBA0, req->lba & BYTE_MASK);
+    port_byte_out(io + ATA_REG_LBA1, (req->lba >> 8) & BYTE_MASK);
+    port_byte_out(io + ATA_REG_LBA2, (req->lba >> 16) & BYTE_MASK);
+
+    if (dma) {
+        port_long_out(bm_base + BM_REG_PRDT, (u32)prdt);
+        port_byte_out(bm_base + BM_REG_STATUS, BM_STATUS_IRQ | BM_STATUS_ERROR);
+        port_byte_out(bm_base + BM_REG_COMMAND, req->write ? 0 : BM_CMD_READ);
+        port_byte_out(io + ATA_REG_COMMAND, cmd);
+        port_byte_out(bm_base + BM_REG_COMMAND, (req->write ? 0 : BM_CMD_READ) | BM_CMD_START);
+        return BLOCK_OK;
+    }
+
+    port_byte_out(io + ATA_REG_COMMAND, cmd);
+    if (req->write) {
+        /* PIO writes: the first sector is pushed right away, the rest on each IRQ */
+        if (!ata_wait_drq()) {
+            cur_dev = NULL;
+            cur_req = NULL;
+            return BLOCK_ERROR;
+        }
+        port_words_out(io + ATA_REG_DATA, pio_next_sector(), SECTOR_SIZE / 2);
+    }
+    return BLOCK_OK;
+}
+
+/* block_device_t start hook */
+static s32 ata_start(block_device_t *dev, block_request_t *req) {
+    if (cur_req) {
+        pending_dev = dev;
+        return BLOCK_OK;
+    }
+    return ata_issue(dev, req);
+}
+
+static void ata_finish(s32 status) {
+    block_device_t *dev = cur_dev;
+    cur_dev = NULL;
+    cur_req = NULL;
+
+    /* Let the other drive go first so one busy queue can't starve it */
+    if (pending_dev) {
+        block_device_t *next = pending_dev;
+        pending_dev = NULL;
+        if (ata_issue(next, next->active) != BLOCK_OK) block_complete(next, BLOCK_ERROR);
+    }
+    block_complete(dev, status);
+}
+
+static void ata_callback(registers_t regs) {
+    u8 bm_status = cur_dma ? port_byte_in(bm_base + BM_REG_STATUS) : 0;
+    /* Reading the status register also acknowledges the drive's IRQ */
+    u8 status = port_byte_in(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    UNUSED(regs);
+
+    if (!cur_req) return;
+
+    if (cur_dma) {
+        if (!(bm_status & BM_STATUS_IRQ)) return;
+        port_byte_out(bm_base + BM_REG_COMMAND, 0);
+        port_byte_out(bm_base + BM_REG_STATUS, BM_STATUS_IRQ | BM_STATUS_ERROR);
+        u8 failed = (status & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & BM_STATUS_ERROR);
+        ata_finish(failed ? BLOCK_ERROR : BLOCK_OK);
+        return;
+    }
+
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        ata_finish(BLOCK_ERROR);
+        return;
+    }
+
+    if (cur_req->write) {
+        /* IRQ after each written sector */
+        if (cur_left == 0) ata_finish(BLOCK_OK);
+        else port_words_out(ATA_PRIMARY_IO + ATA_REG_DATA, pio_next_sector(), SECTOR_SIZE / 2);
+    } else {
+        /* IRQ when each sector is ready to be read */
+        if (!(status & ATA_SR_DRQ)) return;
+        port_words_in(ATA_PRIMARY_IO + ATA_REG_DATA, pio_next_sector(), SECTOR_SIZE / 2);
+        if (cur_left == 0) ata_finish(BLOCK_OK);
+    }
+}
+
+/* IDENTIFY strings store two characters per word, high byte first */
+static void ata_copy_model(u16 *ident, char *model) {
+    s32 i;
+    for (i = 0; i < ATA_MODEL_LEN - 1; i += 2) {
+        u16 w = ident[ATA_IDENT_MODEL + i / 2];
+        model[i] = high_8(w);
+        model[i + 1] = low_8(w);
+    }
+    model[ATA_MODEL_LEN - 1] = '\0';
+    for (i = ATA_MODEL_LEN - 2; i >= 0 && model[i] == ' '; i--) model[i] = '\0';
+}
+
+static void ata_identify(ata_drive_t *drive, u8 slave) {
+    u16 io = ATA_PRIMARY_IO;
+    u16 ident[256];
+
+    drive->present = 0;
+    drive->slave = slave;
+
+    port_byte_out(io + ATA_REG_DRIVE, 0xA0 | (slave ? ATA_DRIVE_SLAVE : 0));
+    ata_delay();
+    port_byte_out(io + ATA_REG_SECCOUNT, 0);
+    port_byte_out(io + ATA_REG_LBA0, 0);
+    port_byte_out(io + ATA_REG_LBA1, 0);
+    port_byte_out(io + ATA_REG_LBA2, 0);
+    port_byte_out(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    u8 status = port_byte_in(io + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF) return;  /* No drive / floating bus */
+    if (ata_wait_not_busy() & ATA_SR_ERR) return;
+
+    /* ATAPI and SATA devices abort IDENTIFY and leave a signature here */
+    if (port_byte_in(io + ATA_REG_LBA1) || port_byte_in(io + ATA_REG_LBA2)) return;
+    if (!ata_wait_drq()) return;
+
+    port_words_in(io + ATA_REG_DATA, ident, 256);
+
+    drive->present = 1;
+    drive->lba48 = (ident[ATA_IDENT_COMMANDSETS] & ATA_CMDSET_LBA48) != 0;
+    drive->dma = (ident[ATA_IDENT_CAPABILITIES] & ATA_CAP_DMA) != 0;
+    if (drive->lba48) {
+        /* 48-bit count, clamped to what a u32 LBA can address */
+        if (ident[ATA_IDENT_LBA48 + 2] || ident[ATA_IDENT_LBA48 + 3]) drive->sectors = 0xFFFFFFFF;
+        else drive->sectors = ident[ATA_IDENT_LBA48] | ((u32)ident[ATA_IDENT_LBA48 + 1] << 16);
+    } else {
+        drive->sectors = ident[ATA_IDENT_LBA28] | ((u32)ident[ATA_IDENT_LBA28 + 1] << 16);
+    }
+    ata_copy_model(ident, drive->model);
+}
+
+static void ata_init_busmaster() {
+    pci_device_t pci;
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)) return;
+    /* prog_if bit 7: controller supports bus mastering */
+    if (!(pci.prog_if & 0x80)) return;
+
+    u32 bar4 = pci_read_bar(&pci, 4);
+    if (!(bar4 & 1)) return;  /* Must be an I/O space BAR */
+    bm_base = bar4 & 0xFFFC;
+    pci_enable_bus_master(&pci);
+}
+
+void init_ata() {
+    register_interrupt_handler(IRQ14, ata_callback);
+
+    /* Probe with the device IRQ masked, we poll during IDENTIFY */
+    port_byte_out(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+    ata_identify(&drives[0], 0);
+    ata_identify(&drives[1], 1);
+    port_byte_out(ATA_PRIMARY_CTRL, 0);
+
+    ata_init_busmaster();
+
+    char *names[ATA_MAX_DRIVES] = {"hda", "hdb"};
+    for (u8 i = 0; i < ATA_MAX_DRIVES; i++) {
+        ata_drive_t *drive = &drives[i];
+        if (!drive->present) continue;
+        if (!bm_base) drive->dma = 0;
+
+        drive->blk = register_block_device(names[i], drive->sectors, ata_start, drive);
+        kprintf_color(GREEN_ON_BLACK, "ATA %s: %s, %d MB, %s, %s\n", names[i], drive->model,
+                      drive->sectors / (1024 * 1024 / SECTOR_SIZE),
+                      drive->lba48 ? "LBA48" : "LBA28", drive->dma ? "DMA" : "PIO");
+    }
+}
+
+ata_drive_t* ata_get_drive(u8 index) {
+    if (index >= ATA_MAX_DRIVES || !drives[index].present) return NULL;
+    return &drives[index];
+}
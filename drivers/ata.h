@@ -0,0 +1,97 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "../cpu/types.h"
+#include "block.h"
+
+/* Primary channel legacy ports */
+#define ATA_PRIMARY_IO     0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+
+/* Register offsets from the I/O base */
+#define ATA_REG_DATA       0
+#define ATA_REG_ERROR      1
+#define ATA_REG_FEATURES   1
+#define ATA_REG_SECCOUNT   2
+#define ATA_REG_LBA0       3
+#define ATA_REG_LBA1       4
+#define ATA_REG_LBA2       5
+#define ATA_REG_DRIVE      6
+#define ATA_REG_STATUS     7
+#define ATA_REG_COMMAND    7
+
+/* Status register bits */
+#define ATA_SR_BSY         0x80
+#define ATA_SR_DRDY        0x40
+#define ATA_SR_DF          0x20
+#define ATA_SR_DRQ         0x08
+#define ATA_SR_ERR         0x01
+
+/* Commands */
+#define ATA_CMD_READ_PIO       0x20
+#define ATA_CMD_READ_PIO_EXT   0x24
+#define ATA_CMD_READ_DMA       0xC8
+#define ATA_CMD_READ_DMA_EXT   0x25
+#define ATA_CMD_WRITE_PIO      0x30
+#define ATA_CMD_WRITE_PIO_EXT  0x34
+#define ATA_CMD_WRITE_DMA      0xCA
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_IDENTIFY       0xEC
+
+/* Drive/head register: bits 7 and 5 always set, bit 6 = LBA addressing */
+#define ATA_DRIVE_LBA      0xE0
+#define ATA_DRIVE_SLAVE    0x10
+
+/* Device control register */
+#define ATA_CTRL_NIEN      0x02  /* Set to mask the device IRQ */
+
+/* IDENTIFY data word offsets */
+#define ATA_IDENT_MODEL        27
+#define ATA_IDENT_CAPABILITIES 49
+#define ATA_IDENT_LBA28        60
+#define ATA_IDENT_COMMANDSETS  83
+#define ATA_IDENT_LBA48        100
+#define ATA_CAP_DMA            0x100
+#define ATA_CMDSET_LBA48       0x400
+
+#define ATA_LBA28_MAX      0x0FFFFFFF
+#define ATA_LBA28_SECTORS  256
+
+/* Bus master IDE registers (offset from PCI BAR4) */
+#define BM_REG_COMMAND     0
+#define BM_REG_STATUS      2
+#define BM_REG_PRDT        4
+#define BM_CMD_START       0x01
+#define BM_CMD_READ        0x08  /* Direction: device -> memory */
+#define BM_STATUS_ACTIVE   0x01
+#define BM_STATUS_ERROR    0x02
+#define BM_STATUS_IRQ      0x04
+
+/* Physical Region Descriptor: one DMA chunk, must not cross 64KB */
+#define PRD_EOT            0x8000
+#define ATA_PRD_ENTRIES    32
+#define DMA_BOUNDARY       0x10000
+
+typedef struct {
+    u32 phys_addr;
+    u16 byte_count;  /* 0 means 64KB */
+    u16 flags;
+} __attribute__((packed)) prd_entry_t;
+
+#define ATA_MODEL_LEN      41
+#define ATA_MAX_DRIVES     2
+
+typedef struct {
+    u8 present;
+    u8 slave;
+    u8 lba48;
+    u8 dma;
+    u32 sectors;
+    char model[ATA_MODEL_LEN];
+    block_device_t *blk;
+} ata_drive_t;
+
+void init_ata();
+ata_drive_t* ata_get_drive(u8 index);
+
+#endif
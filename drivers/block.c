@@ -0,0 +1,228 @@
+#include "block.h"
+#include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../cpu/isr.h"
+#include "../kernel/smp.h"
+
+#define BLOCK_BATCH  4      /* Chunks in flight per synchronous call */
+
+static block_device_t block_devices[MAX_BLOCK_DEVICES];
+static u32 num_block_devices = 0;
+
+block_device_t* register_block_device(char *name, u32 sector_count, block_start_t start, void *driver_data) {
+    if (num_block_devices >= MAX_BLOCK_DEVICES) return NULL;
+
+    block_device_t *dev = &block_devices[num_block_devices++];
+    s32 i;
+    for (i = 0; name[i] != '\0' && i < BLOCK_NAME_LEN - 1; i++) dev->name[i] = name[i];
+    dev->name[i] = '\0';
+    dev->sector_count = sector_count;
+    dev->start = start;
+    dev->driver_data = driver_data;
+    return dev;
+}
+
+block_device_t* get_block_device(char *name) {
+    for (u32 i = 0; i < num_block_devices; i++) {
+        if (strcmp(block_devices[i].name, name) == 0) return &block_devices[i];
+    }
+    return NULL;
+}
+
+block_device_t* get_block_device_at(u32 index) {
+    if (index >= num_block_devices) return NULL;
+    return &block_devices[index];
+}
+
+void block_init_request(block_request_t *req, u32 lba, u32 count, u8 *buffer, u8 write) {
+    req->lba = lba;
+    req->count = count;
+    req->write = write;
+    req->done = 0;
+    req->status = BLOCK_OK;
+    req->nsegs = 1;
+    req->segs[0].buffer = buffer;
+    req->segs[0].count = count;
+    req->merged = NULL;
+    req->next = NULL;
+}
+
+void block_add_segment(block_request_t *req, u8 *buffer, u32 count) {
+    block_segment_t *last = &req->segs[req->nsegs - 1];
+    if (last->buffer + last->count * SECTOR_SIZE == buffer) {
+        last->count += count;
+    } else {
+        req->segs[req->nsegs].buffer = buffer;
+        req->segs[req->nsegs].count = count;
+        req->nsegs++;
+    }
+    req->count += count;
+}
+
+/* Append 'src' segments to 'dst', joining chunks that are contiguous in memory */
+static void append_segments(block_request_t *dst, block_request_t *src) {
+    for (u32 i = 0; i < src->nsegs; i++) {
+        block_segment_t *last = &dst->segs[dst->nsegs - 1];
+        if (last->buffer + last->count * SECTOR_SIZE == src->segs[i].buffer) {
+            last->count += src->segs[i].count;
+        } else {
+            dst->segs[dst->nsegs++] = src->segs[i];
+        }
+    }
+}
+
+/* Try to fold 'req' into a queued request it touches. Returns 1 on success */
+static u8 try_merge(block_device_t *dev, block_request_t *req) {
+    for (block_request_t *q = dev->queue; q; q = q->next) {
+        if (q->write != req->write) continue;
+        if (q->count + req->count > BLOCK_MAX_SECTORS) continue;
+        if (q->nsegs + req->nsegs > BLOCK_MAX_SEGMENTS) continue;
+
+        if (q->lba + q->count == req->lba) {
+            /* Back merge: req continues q */
+            append_segments(q, req);
+        } else if (req->lba + req->count == q->lba) {
+            /* Front merge: req precedes q, so its segments go first */
+            block_request_t tmp;
+            tmp.nsegs = q->nsegs;
+            memory_copy((u8*)q->segs, (u8*)tmp.segs, q->nsegs * sizeof(block_segment_t));
+            memory_copy((u8*)req->segs, (u8*)q->segs, req->nsegs * sizeof(block_segment_t));
+            q->nsegs = req->nsegs;
+            append_segments(q, &tmp);
+            q->lba = req->lba;
+        } else {
+            continue;
+        }
+
+        q->count += req->count;
+        req->next = q->merged;
+        q->merged = req;
+        dev->merges++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Start the next request if the device is idle. Interrupts must be off */
+static void block_dispatch(block_device_t *dev) {
+    if (dev->active || dev->plugged || !dev->queue) return;
+
+    /* C-LOOK: first request at or past the head, else wrap to the lowest LBA */
+    block_request_t *prev = NULL;
+    block_request_t *req = dev->queue;
+    while (req && req->lba < dev->head_lba) {
+        prev = req;
+        req = req->next;
+    }
+    if (!req) {
+        prev = NULL;
+        req = dev->queue;
+    }
+
+    if (prev) prev->next = req->next;
+    else dev->queue = req->next;
+    req->next = NULL;
+
+    dev->active = req;
+    dev->head_lba = req->lba + req->count;
+    if (dev->start(dev, req) != BLOCK_OK) {
+        block_complete(dev, BLOCK_ERROR);
+    }
+}
+
+/* The queue is shared with the completion IRQ: interrupts stay off while editing it */
+void block_submit(block_device_t *dev, block_request_t *req) {
+    u32 flags = irq_save();
+
+    if (req->write) dev->writes++;
+    else dev->reads++;
+
+    if (!try_merge(dev, req)) {
+        /* Insert sorted by LBA */
+        block_request_t **link = &dev->queue;
+        while (*link && (*link)->lba <= req->lba) link = &(*link)->next;
+        req->next = *link;
+        *link = req;
+    }
+
+    block_dispatch(dev);
+    irq_restore(flags);
+}
+
+/* Called by the driver (from IRQ context) when the active request finished */
+void block_complete(block_device_t *dev, s32 status) {
+    block_request_t *req = dev->active;
+    dev->active = NULL;
+
+    if (req) {
+        if (status != BLOCK_OK) dev->errors++;
+        block_request_t *m = req->merged;
+        while (m) {
+            block_request_t *next = m->next;
+            m->status = status;
+            m->done = 1;
+            m = next;
+        }
+        req->status = status;
+        req->done = 1;
+    }
+
+    block_dispatch(dev);
+}
+
+void block_wait(block_request_t *req) {
+    u32 flags = irq_save();
+    /* 'sti; hlt' is atomic: sti only takes effect after hlt, so the
+     * completion IRQ can not slip in between the test and the sleep. The
+     * kernel lock goes meanwhile: the IRQ may come in on another CPU. So
+     * may other tasks, callers keep them out with a mutex (kernel/mutex.h) */
+    while (!req->done) cpu_wait();
+    irq_restore(flags);
+}
+
+void block_plug(block_device_t *dev) {
+    dev->plugged = 1;
+}
+
+void block_unplug(block_device_t *dev) {
+    u32 flags = irq_save();
+    dev->plugged = 0;
+    block_dispatch(dev);
+    irq_restore(flags);
+}
+
+static s32 block_rw(block_device_t *dev, u32 lba, u32 count, u8 *buffer, u8 write) {
+    block_request_t reqs[BLOCK_BATCH];
+    s32 status = BLOCK_OK;
+
+    if (!dev || lba + count > dev->sector_count || lba + count < lba) return BLOCK_ERROR;
+
+    while (count > 0) {
+        u32 n = 0;
+        block_plug(dev);
+        while (count > 0 && n < BLOCK_BATCH) {
+            u32 chunk = MIN(count, BLOCK_MAX_SECTORS);
+            block_init_request(&reqs[n], lba, chunk, buffer, write);
+            block_submit(dev, &reqs[n]);
+            lba += chunk;
+            count -= chunk;
+            buffer += chunk * SECTOR_SIZE;
+            n++;
+        }
+        block_unplug(dev);
+
+        for (u32 i = 0; i < n; i++) {
+            block_wait(&reqs[i]);
+            if (reqs[i].status != BLOCK_OK) status = BLOCK_ERROR;
+        }
+    }
+    return status;
+}
+
+s32 block_read(block_device_t *dev, u32 lba, u32 count, u8 *buffer) {
+    return block_rw(dev, lba, count, buffer, 0);
+}
+
+s32 block_write(block_device_t *dev, u32 lba, u32 count, u8 *buffer) {
+    return block_rw(dev, lba, count, buffer, 1);
+}
@@ -0,0 +1,85 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "../cpu/types.h"
+
+#define SECTOR_SIZE         512
+#define MAX_BLOCK_DEVICES   4
+#define BLOCK_NAME_LEN      8
+#define BLOCK_MAX_SEGMENTS  16   /* Scatter list entries per (merged) request */
+#define BLOCK_MAX_SECTORS   128  /* 64KB: one DMA transfer per request */
+
+/* Request status */
+#define BLOCK_OK     0
+#define BLOCK_ERROR  -1
+
+/* One contiguous memory chunk of a request */
+typedef struct {
+    u8 *buffer;
+    u32 count;      /* In sectors */
+} block_segment_t;
+
+/* A read or write of 'count' consecutive sectors starting at 'lba'.
+ * When adjacent requests are merged by the elevator, the absorbed ones
+ * hang off 'merged' and are completed together with their host */
+typedef struct block_request {
+    u32 lba;
+    u32 count;
+    u8 write;
+    volatile u8 done;
+    s32 status;
+    u32 nsegs;
+    block_segment_t segs[BLOCK_MAX_SEGMENTS];
+    struct block_request *merged;
+    struct block_request *next;
+} block_request_t;
+
+struct block_device;
+
+/* Driver hook: start the hardware transfer for 'req'.
+ * The driver calls block_complete() when it is finished (usually from its IRQ) */
+typedef s32 (*block_start_t)(struct block_device *dev, block_request_t *req);
+
+typedef struct block_device {
+    char name[BLOCK_NAME_LEN];
+    u32 sector_count;
+    block_start_t start;
+    void *driver_data;
+
+    block_request_t *queue;     /* Pending requests, sorted by LBA */
+    block_request_t *active;    /* Request owned by the hardware */
+    u32 head_lba;               /* Elevator position (end of last dispatch) */
+    u8 plugged;                 /* While set, requests queue up without dispatch */
+
+    /* Statistics */
+    u32 reads;
+    u32 writes;
+    u32 merges;
+    u32 errors;
+} block_device_t;
+
+block_device_t* register_block_device(char *name, u32 sector_count, block_start_t start, void *driver_data);
+block_device_t* get_block_device(char *name);
+block_device_t* get_block_device_at(u32 index);
+
+void block_init_request(block_request_t *req, u32 lba, u32 count, u8 *buffer, u8 write);
+/* Extend a request by 'count' sectors landing in 'buffer' (scatter I/O).
+ * The caller keeps nsegs within BLOCK_MAX_SEGMENTS */
+void block_add_segment(block_request_t *req, u8 *buffer, u32 count);
+void block_submit(block_device_t *dev, block_request_t *req);
+/* Sleeps with interrupts on and the big kernel lock let go, so other
+ * tasks and interrupt handlers run until the request is done. Task
+ * context only: shell commands run in the shell task, not the keyboard
+ * interrupt, so a key pressed meanwhile can't start another command */
+void block_wait(block_request_t *req);
+void block_complete(block_device_t *dev, s32 status);
+
+/* Batch submissions so the elevator can sort and merge them */
+void block_plug(block_device_t *dev);
+void block_unplug(block_device_t *dev);
+
+/* Synchronous helpers, split into BLOCK_MAX_SECTORS chunks */
+s32 block_read(block_device_t *dev, u32 lba, u32 count, u8 *buffer);
+s32 block_write(block_device_t *dev, u32 lba, u32 count, u8 *buffer);
+
+#endif
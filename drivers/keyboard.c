@@ -5,6 +5,8 @@
 #include "../libc/string.h"
 #include "../libc/function.h"
 #include "../kernel/kernel.h"
+#include "../kernel/command.h"
+#include "../kernel/lineedit.h"
 
 /* Shift key state */
 static u8 shift_pressed = 0;
@@ -12,6 +14,16 @@ static u8 shift_pressed = 0;
 /* Track extended scancode prefix (0xE0) */
 static u8 extended_code = 0;
 
+/* Either Ctrl key is down */
+static u8 ctrl_pressed = 0;
+
+/* The last key pressed was Tab */
+static u8 tab_pressed = 0;
+
+/* The line being typed */
+static line_editor_t editor;
+static u8 editing = 0;
+
 char key_buffer[KEY_BUFFER_SIZE];
 
 /* Name table not used; omitted for clarity */
@@ -34,108 +46,117 @@ const char sc_ascii_upper[] = {
     '?', ' '
 };
 
-/* Safely set current input to new_input by editing in-place */
-static void set_input_to(char *new_input) {
-    s32 cur_len = strlen(key_buffer);
-    s32 new_len = strlen(new_input);
-    s32 i = 0;
-    while (i < cur_len && i < new_len && key_buffer[i] == new_input[i]) i++;
-    /* Remove extra tail from current */
-    for (s32 j = cur_len; j > i; j--) {
-        backspace(key_buffer);
-        kprint_backspace_color(get_input_color());
+/* Whether keys edit the line: not while a command runs, whose output
+ * would mix with the echo. The line starts at the cursor on the first key */
+static u8 accepting() {
+    if (shell_busy()) return 0;
+    if (!editing) {
+        line_begin(&editor, get_input_color());
+        editing = 1;
     }
-    /* Append missing suffix */
-    for (s32 j = i; j < new_len; j++) {
-        char ch = new_input[j];
-        append(key_buffer, ch);
-        char out[2] = {ch, '\0'};
-        kprint_color(out, get_input_color());
+    return 1;
+}
+
+/* Extended keys (0xE0 prefix): arrows, Home, End, Delete, right Ctrl */
+static void extended_key(u8 scancode) {
+    if (scancode == SC_CTRL || scancode == SC_CTRL_RELEASE) {
+        ctrl_pressed = scancode == SC_CTRL;
+        return;
+    }
+    /* Ignore key releases (high bit set) */
+    if ((scancode & 0x80) || !accepting()) return;
+
+    if (scancode == SC_UP_ARROW || scancode == SC_DOWN_ARROW) {
+        char *cmd = get_history(scancode == SC_UP_ARROW ? -1 : 1);
+        if (cmd != NULL) line_set(&editor, cmd);
+        else if (scancode == SC_DOWN_ARROW) line_set(&editor, "");
+    } else if (scancode == SC_LEFT_ARROW) {
+        if (ctrl_pressed) line_word_left(&editor);
+        else line_left(&editor);
+    } else if (scancode == SC_RIGHT_ARROW) {
+        if (ctrl_pressed) line_word_right(&editor);
+        else line_right(&editor);
+    } else if (scancode == SC_HOME) {
+        line_home(&editor);
+    } else if (scancode == SC_END) {
+        line_end(&editor);
+    } else if (scancode == SC_DELETE) {
+        line_delete_forward(&editor);
+    } else {
+        return;
+    }
+    line_redraw(&editor);
+}
+
+/* Tab: extend the command name before the cursor as far as it is
+ * unambiguous, list the candidates on a second Tab */
+static void complete() {
+    char ext[COMMAND_NAME_MAX];
+    line_text(&editor, key_buffer);
+    key_buffer[line_cursor(&editor)] = '\0';
+    u32 matches = tab_complete(key_buffer, ext, sizeof(ext));
+    for (u32 i = 0; ext[i] != '\0'; i++) line_insert(&editor, ext[i]);
+    if (ext[0] == '\0' && matches > 1 && tab_pressed) {
+        tab_list(key_buffer);
+        line_reprint(&editor);
+    } else {
+        line_redraw(&editor);
     }
 }
 
 static void keyboard_callback(registers_t regs) {
     u8 scancode = port_byte_in(KEYBOARD_DATA_PORT);
+    UNUSED(regs);
 
     /* Handle extended scancode prefix */
     if (scancode == SC_EXTENDED_PREFIX) {
         extended_code = 1;
-        UNUSED(regs);
         return;
     }
 
     /* If previous byte was 0xE0, handle extended keys (arrows) */
     if (extended_code) {
         extended_code = 0;
-        /* Ignore key releases (high bit set) */
-        if (scancode & 0x80) {
-            UNUSED(regs);
-            return;
-        }
-        if (scancode == SC_UP_ARROW) {
-            char *prev_cmd = get_history(-1);
-            if (prev_cmd != NULL) set_input_to(prev_cmd);
-            UNUSED(regs);
-            return;
-        }
-        if (scancode == SC_DOWN_ARROW) {
-            char *next_cmd = get_history(1);
-            if (next_cmd != NULL) set_input_to(next_cmd);
-            else set_input_to("");
-            UNUSED(regs);
-            return;
-        }
-        /* Unhandled extended key */
-        UNUSED(regs);
+        extended_key(scancode);
         return;
     }
 
-    /* Handle Shift key press */
+    if (!(scancode & 0x80)) tab_pressed = 0;
+
+    /* Handle Shift and Ctrl */
     if (scancode == SC_LSHIFT || scancode == SC_RSHIFT) {
         shift_pressed = 1;
-        UNUSED(regs);
         return;
     }
-    
-    /* Handle Shift key release */
     if (scancode == SC_LSHIFT_RELEASE || scancode == SC_RSHIFT_RELEASE) {
         shift_pressed = 0;
-        UNUSED(regs);
         return;
     }
-
-    /* Handle tab (command completion) */
-    if (scancode == SC_TAB) {
-        char *completed = tab_complete(key_buffer);
-        if (completed != NULL) {
-            s32 cur_len = strlen(key_buffer);
-            s32 i = 0;
-            while (completed[cur_len + i] != '\0') {
-                char ch = completed[cur_len + i];
-                append(key_buffer, ch);
-                char out[2] = {ch, '\0'};
-                kprint_color(out, get_input_color());
-                i++;
-            }
-        }
-        UNUSED(regs);
+    if (scancode == SC_CTRL || scancode == SC_CTRL_RELEASE) {
+        ctrl_pressed = scancode == SC_CTRL;
         return;
     }
 
-    if (scancode > SC_MAX) {
-        UNUSED(regs);
+    if (!accepting()) return;
+
+    if (scancode == SC_TAB) {
+        complete();
+        tab_pressed = 1;
         return;
     }
-    
+
+    if (scancode > SC_MAX) return;
+
     if (scancode == SC_BACKSPACE) {
-        if (strlen(key_buffer) > 0) {
-            backspace(key_buffer);
-            kprint_backspace_color(get_input_color());
-        }
+        if (line_delete_back(&editor) == 0) line_redraw(&editor);
     } else if (scancode == SC_ENTER) {
+        /* Output starts below the whole line, wherever the cursor was */
+        line_end(&editor);
+        line_redraw(&editor);
         kprint("\n");
+        line_text(&editor, key_buffer);
+        editing = 0;
         user_input(key_buffer);
-        key_buffer[0] = '\0';
     } else {
         char letter;
         if (shift_pressed) {
@@ -143,13 +164,10 @@ static void keyboard_callback(registers_t regs) {
         } else {
             letter = sc_ascii_lower[(s32)scancode];
         }
-        
-        /* Print and append to buffer */
-        char str[2] = {letter, '\0'};
-        append(key_buffer, letter);
-        kprint_color(str, get_input_color());
+
+        /* Insert at the cursor, unless the line is full */
+        if (line_insert(&editor, letter) == 0) line_redraw(&editor);
     }
-    UNUSED(regs);
 }
 
 void init_keyboard() {
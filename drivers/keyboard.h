@@ -5,12 +5,14 @@
 
 /* Keyboard hardware constants */
 #define KEYBOARD_DATA_PORT 0x60      /* PS/2 keyboard data port */
-/* #define KEYBOARD_STATUS_PORT 0x64 */ /* Unused */
+#define KEYBOARD_STATUS_PORT 0x64    /* Bit 0: a byte waits at the data port */
+#define KEYBOARD_OUTPUT_FULL 0x01
 
 /* Keyboard buffer size */
 #define KEY_BUFFER_SIZE 256
 
-/* Global key buffer */
+/* The input line as a string, filled from the line editor
+ * (kernel/lineedit.h) when it is handed to the shell */
 extern char key_buffer[KEY_BUFFER_SIZE];
 
 /* Scancode constants */
@@ -22,8 +24,16 @@ extern char key_buffer[KEY_BUFFER_SIZE];
 #define SC_RSHIFT 0x36
 #define SC_LSHIFT_RELEASE 0xAA
 #define SC_RSHIFT_RELEASE 0xB6
+#define SC_CTRL 0x1D                 /* Left, or right after 0xE0 */
+#define SC_CTRL_RELEASE 0x9D
+/* After 0xE0 */
 #define SC_UP_ARROW 0x48
 #define SC_DOWN_ARROW 0x50
+#define SC_LEFT_ARROW 0x4B
+#define SC_RIGHT_ARROW 0x4D
+#define SC_HOME 0x47
+#define SC_END 0x4F
+#define SC_DELETE 0x53
 #define SC_MAX 57
 
 void init_keyboard();
@@ -0,0 +1,65 @@
+#include "pci.h"
+#include "../cpu/ports.h"
+
+static u32 pci_address(u8 bus, u8 slot, u8 func, u8 offset) {
+    return PCI_ENABLE_BIT | ((u32)bus << 16) | ((u32)slot << 11) |
+           ((u32)func << 8) | (offset & 0xFC);
+}
+
+u32 pci_config_read(u8 bus, u8 slot, u8 func, u8 offset) {
+    port_long_out(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    return port_long_in(PCI_CONFIG_DATA);
+}
+
+void pci_config_write(u8 bus, u8 slot, u8 func, u8 offset, u32 value) {
+    port_long_out(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    port_long_out(PCI_CONFIG_DATA, value);
+}
+
+/* Brute-force scan of every bus/slot/function. Only done once at driver init */
+u8 pci_find_class(u8 class_code, u8 subclass, pci_device_t *out) {
+    for (u32 bus = 0; bus < PCI_MAX_BUS; bus++) {
+        for (u32 slot = 0; slot < PCI_MAX_SLOT; slot++) {
+            for (u32 func = 0; func < PCI_MAX_FUNC; func++) {
+                u32 id = pci_config_read(bus, slot, func, PCI_VENDOR_ID);
+                if ((id & WORD_MASK) == PCI_VENDOR_NONE) {
+                    /* No function 0 means no device in this slot at all */
+                    if (func == 0) break;
+                    continue;
+                }
+
+                u32 class_reg = pci_config_read(bus, slot, func, PCI_CLASS_REVISION);
+                if (((class_reg >> 24) & BYTE_MASK) == class_code &&
+                    ((class_reg >> 16) & BYTE_MASK) == subclass) {
+                    out->bus = bus;
+                    out->slot = slot;
+                    out->func = func;
+                    out->vendor_id = id & WORD_MASK;
+                    out->device_id = (id >> 16) & WORD_MASK;
+                    out->class_code = class_code;
+                    out->subclass = subclass;
+                    out->prog_if = (class_reg >> 8) & BYTE_MASK;
+                    return 1;
+                }
+
+                /* Single-function device: skip functions 1-7 */
+                if (func == 0) {
+                    u32 header = pci_config_read(bus, slot, 0, PCI_HEADER_TYPE);
+                    if (!((header >> 16) & 0x80)) break;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+u32 pci_read_bar(pci_device_t *dev, u8 bar) {
+    return pci_config_read(dev->bus, dev->slot, dev->func, PCI_BAR0 + bar * 4);
+}
+
+void pci_enable_bus_master(pci_device_t *dev) {
+    u32 cmd = pci_config_read(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER;
+    /* Upper half is the status register: writing 1s there would clear bits, keep it 0 */
+    pci_config_write(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd & WORD_MASK);
+}
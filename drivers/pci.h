@@ -0,0 +1,51 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "../cpu/types.h"
+
+/* PCI configuration mechanism #1 ports */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+#define PCI_ENABLE_BIT     0x80000000
+
+/* Configuration space offsets */
+#define PCI_VENDOR_ID      0x00
+#define PCI_COMMAND        0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE    0x0C
+#define PCI_BAR0           0x10
+
+/* Command register bits */
+#define PCI_COMMAND_IO         0x1
+#define PCI_COMMAND_MEMORY     0x2
+#define PCI_COMMAND_BUS_MASTER 0x4
+
+#define PCI_VENDOR_NONE    0xFFFF
+#define PCI_MAX_BUS        256
+#define PCI_MAX_SLOT       32
+#define PCI_MAX_FUNC       8
+
+/* Class codes we care about */
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
+
+typedef struct {
+    u8 bus;
+    u8 slot;
+    u8 func;
+    u16 vendor_id;
+    u16 device_id;
+    u8 class_code;
+    u8 subclass;
+    u8 prog_if;
+} pci_device_t;
+
+u32 pci_config_read(u8 bus, u8 slot, u8 func, u8 offset);
+void pci_config_write(u8 bus, u8 slot, u8 func, u8 offset, u32 value);
+
+/* Find the first device of the given class/subclass. Returns 1 if found */
+u8 pci_find_class(u8 class_code, u8 subclass, pci_device_t *out);
+u32 pci_read_bar(pci_device_t *dev, u8 bar);
+void pci_enable_bus_master(pci_device_t *dev);
+
+#endif
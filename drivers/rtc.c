@@ -0,0 +1,49 @@
+#include "rtc.h"
+#include "../cpu/ports.h"
+
+u8 cmos_read(u8 reg) {
+    port_byte_out(CMOS_ADDRESS_PORT, reg);
+    return port_byte_in(CMOS_DATA_PORT);
+}
+
+static u32 bcd(u8 value) {
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+/* Days from 1970-01-01 to the given date (proleptic Gregorian) */
+static u32 days_since_epoch(u32 year, u32 month, u32 day) {
+    if (month <= 2) year--;
+    u32 era = year / 400;
+    u32 year_of_era = year - era * 400;
+    u32 day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    u32 day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+u32 rtc_read_time() {
+    u8 regs[6], again[6];
+    static const u8 order[6] = {RTC_SECONDS, RTC_MINUTES, RTC_HOURS, RTC_DAY, RTC_MONTH, RTC_YEAR};
+
+    /* Read until two snapshots agree, so an update can't tear the value */
+    u8 stable;
+    do {
+        while (cmos_read(RTC_STATUS_A) & RTC_A_UPDATING);
+        for (u32 i = 0; i < 6; i++) regs[i] = cmos_read(order[i]);
+        while (cmos_read(RTC_STATUS_A) & RTC_A_UPDATING);
+        stable = 1;
+        for (u32 i = 0; i < 6; i++) {
+            again[i] = cmos_read(order[i]);
+            if (again[i] != regs[i]) stable = 0;
+        }
+    } while (!stable);
+
+    u8 status = cmos_read(RTC_STATUS_B);
+    u8 pm = regs[2] & RTC_HOURS_PM;
+    regs[2] &= ~RTC_HOURS_PM;
+    u32 v[6];
+    for (u32 i = 0; i < 6; i++) v[i] = (status & RTC_B_BINARY) ? regs[i] : bcd(regs[i]);
+    if (!(status & RTC_B_24HOUR)) v[2] = (v[2] % 12) + (pm ? 12 : 0);
+
+    u32 days = days_since_epoch(RTC_CENTURY_BASE + v[5], v[4], v[3]);
+    return days * 86400 + v[2] * 3600 + v[1] * 60 + v[0];
+}
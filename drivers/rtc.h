@@ -0,0 +1,41 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include "../cpu/types.h"
+
+/* CMOS real time clock */
+#define CMOS_ADDRESS_PORT  0x70
+#define CMOS_DATA_PORT     0x71
+
+#define RTC_SECONDS        0x00
+#define RTC_MINUTES        0x02
+#define RTC_HOURS          0x04
+#define RTC_DAY            0x07
+#define RTC_MONTH          0x08
+#define RTC_YEAR           0x09
+#define RTC_STATUS_A       0x0A
+#define RTC_STATUS_B       0x0B
+
+#define RTC_A_UPDATING     0x80    /* Registers are being updated, don't read */
+#define RTC_B_24HOUR       0x02
+#define RTC_B_BINARY       0x04    /* Otherwise BCD */
+#define RTC_HOURS_PM       0x80    /* 12 hour mode */
+
+#define RTC_CENTURY_BASE   2000    /* The two digit year is taken as 20xx */
+
+/* Memory size, as QEMU's firmware leaves it: 64KB units from 16MB up to
+ * the PCI hole, and from 4GB up */
+#define CMOS_MEM_ABOVE_16M_LOW   0x34
+#define CMOS_MEM_ABOVE_16M_HIGH  0x35
+#define CMOS_MEM_ABOVE_4G_LOW    0x5B
+#define CMOS_MEM_ABOVE_4G_MID    0x5C
+#define CMOS_MEM_ABOVE_4G_HIGH   0x5D
+#define CMOS_MEM_BASE            0x1000000
+#define CMOS_MEM_UNIT            0x10000
+
+/* Current time as seconds since 1970-01-01 00:00 UTC (the RTC is assumed
+ * to run on UTC, as QEMU's does by default) */
+u32 rtc_read_time();
+u8 cmos_read(u8 reg);
+
+#endif
@@ -5,8 +5,6 @@
 #include "../libc/stdarg.h"
 
 /* Declaration of private functions */
-s32 get_cursor_offset();
-void set_cursor_offset(s32 offset);
 s32 print_char(char c, s32 col, s32 row, char attr);
 s32 get_offset(s32 col, s32 row);
 s32 get_offset_row(s32 offset);
@@ -56,5 +56,8 @@ void kprint_backspace();
 void kprint_backspace_color(char attr);
 void kprintf_color(char attr, char *fmt, ...);
 void kprintf(char *fmt, ...);
+/* Cursor as a byte offset into video memory */
+s32 get_cursor_offset();
+void set_cursor_offset(s32 offset);
 
 #endif
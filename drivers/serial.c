@@ -0,0 +1,35 @@
+#include "serial.h"
+#include "../cpu/ports.h"
+
+static u8 present = 0;
+
+void init_serial() {
+    port_byte_out(COM1_PORT + SERIAL_INT_ENABLE, 0);
+    port_byte_out(COM1_PORT + SERIAL_LINE_CTRL, SERIAL_LCR_DLAB);
+    port_byte_out(COM1_PORT + SERIAL_DATA, SERIAL_BAUD_DIVISOR & 0xFF);
+    port_byte_out(COM1_PORT + SERIAL_INT_ENABLE, SERIAL_BAUD_DIVISOR >> 8);
+    port_byte_out(COM1_PORT + SERIAL_LINE_CTRL, SERIAL_LCR_8N1);
+    port_byte_out(COM1_PORT + SERIAL_FIFO_CTRL, SERIAL_FIFO_ENABLE);
+
+    /* A byte sent in loopback mode has to come back */
+    port_byte_out(COM1_PORT + SERIAL_MODEM_CTRL, SERIAL_MCR_LOOPBACK);
+    port_byte_out(COM1_PORT + SERIAL_DATA, 0xAE);
+    if (port_byte_in(COM1_PORT + SERIAL_DATA) != 0xAE) return;
+
+    port_byte_out(COM1_PORT + SERIAL_MODEM_CTRL, SERIAL_MCR_NORMAL);
+    present = 1;
+}
+
+u8 serial_present() {
+    return present;
+}
+
+void serial_write(char *buf, u32 len) {
+    if (!present) return;
+    for (u32 i = 0; i < len; i++) {
+        for (u32 spin = 0; spin < SERIAL_SPIN_LIMIT; spin++) {
+            if (port_byte_in(COM1_PORT + SERIAL_LINE_STATUS) & SERIAL_LSR_THR_EMPTY) break;
+        }
+        port_byte_out(COM1_PORT + SERIAL_DATA, buf[i]);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "../cpu/types.h"
+
+/* 16550 UART on COM1, transmit only. QEMU writes it to the file named
+ * in the Makefile's -serial option */
+#define COM1_PORT            0x3F8
+#define SERIAL_DATA          0     /* Offsets from the base port */
+#define SERIAL_INT_ENABLE    1
+#define SERIAL_FIFO_CTRL     2
+#define SERIAL_LINE_CTRL     3
+#define SERIAL_MODEM_CTRL    4
+#define SERIAL_LINE_STATUS   5
+
+#define SERIAL_LCR_DLAB      0x80  /* Divisor latch access */
+#define SERIAL_LCR_8N1       0x03
+#define SERIAL_FIFO_ENABLE   0xC7  /* Enable, clear, 14 byte threshold */
+#define SERIAL_MCR_NORMAL    0x0F  /* DTR, RTS, OUT1, OUT2 */
+#define SERIAL_MCR_LOOPBACK  0x1E
+#define SERIAL_LSR_THR_EMPTY 0x20
+#define SERIAL_BAUD_DIVISOR  3     /* 115200 / 3 = 38400 baud */
+#define SERIAL_SPIN_LIMIT    100000
+
+void init_serial();
+/* No UART found: writes are dropped */
+u8 serial_present();
+void serial_write(char *buf, u32 len);
+
+#endif
@@ -0,0 +1,287 @@
+#include "bcache.h"
+#include "../cpu/isr.h"
+#include "../cpu/paging.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+
+#define BUFFERS_PER_FRAME (FRAME_SIZE / BCACHE_BLOCK_SIZE)
+
+static buffer_t *buffers = NULL;
+static u32 num_buffers = 0;
+
+static buffer_t **hash_table = NULL;
+static u32 hash_mask = 0;
+
+/* LRU list: head is the most recently used buffer, tail the eviction candidate */
+static buffer_t *lru_head = NULL;
+static buffer_t *lru_tail = NULL;
+
+static bcache_stats_t stats;
+static u32 last_flush_tick = 0;
+
+static u32 bcache_hash(block_device_t *dev, u32 block) {
+    /* Multiplicative (Knuth) hash: consecutive blocks spread over the table */
+    return (((u32)dev >> 4) ^ (block * 2654435761u)) & hash_mask;
+}
+
+static buffer_t* hash_lookup(block_device_t *dev, u32 block) {
+    buffer_t *b = hash_table[bcache_hash(dev, block)];
+    while (b && (b->dev != dev || b->block != block)) b = b->hash_next;
+    return b;
+}
+
+static void hash_insert(buffer_t *b) {
+    u32 h = bcache_hash(b->dev, b->block);
+    b->hash_next = hash_table[h];
+    hash_table[h] = b;
+}
+
+static void hash_remove(buffer_t *b) {
+    buffer_t **link = &hash_table[bcache_hash(b->dev, b->block)];
+    while (*link && *link != b) link = &(*link)->hash_next;
+    if (*link) *link = b->hash_next;
+    b->hash_next = NULL;
+}
+
+static void lru_unlink(buffer_t *b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+}
+
+/* Move to the most recently used end */
+static void lru_touch(buffer_t *b) {
+    if (lru_head == b) return;
+    lru_unlink(b);
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    lru_head = b;
+    if (!lru_tail) lru_tail = b;
+}
+
+void init_bcache(u32 frames) {
+    u32 free_frames = get_free_frame_count();
+    /* Never take more than half of what is left */
+    if (frames > free_frames / 2) frames = free_frames / 2;
+
+    num_buffers = frames * BUFFERS_PER_FRAME;
+    buffers = (buffer_t*)kmalloc(num_buffers * sizeof(buffer_t), 0, NULL);
+
+    /* Power-of-two bucket count, about one bucket per buffer */
+    u32 buckets = 1;
+    while (buckets < num_buffers) buckets <<= 1;
+    hash_mask = buckets - 1;
+    hash_table = (buffer_t**)kmalloc(buckets * sizeof(buffer_t*), 0, NULL);
+    if (!buffers || !hash_table) {
+        kprintf_color(RED_ON_BLACK, "Buffer cache: out of heap\n");
+        num_buffers = 0;
+        return;
+    }
+    memory_set((u8*)hash_table, 0, buckets * sizeof(buffer_t*));
+    memory_set((u8*)buffers, 0, num_buffers * sizeof(buffer_t));
+
+    u32 n = 0;
+    for (u32 f = 0; f < frames; f++) {
+        u8 *frame = (u8*)alloc_frame();
+        if (!frame) break;
+        for (u32 i = 0; i < BUFFERS_PER_FRAME; i++, n++) {
+            buffer_t *b = &buffers[n];
+            b->data = frame + i * BCACHE_BLOCK_SIZE;
+            /* Append at the tail: unused buffers are evicted first */
+            b->lru_prev = lru_tail;
+            if (lru_tail) lru_tail->lru_next = b;
+            else lru_head = b;
+            lru_tail = b;
+        }
+    }
+    num_buffers = n;
+    stats.buffers = n;
+
+    kprintf_color(GREEN_ON_BLACK, "Buffer cache: %d buffers (%d KB)\n", n, n * BCACHE_BLOCK_SIZE / 1024);
+}
+
+/* Write a batch of referenced buffers, queued together so the elevator
+ * merges neighbouring blocks into single requests */
+static s32 write_batch(buffer_t **batch, u32 n) {
+    block_request_t reqs[BCACHE_FLUSH_BATCH];
+    s32 status = BLOCK_OK;
+
+    for (u32 i = 0; i < n; i++) {
+        block_init_request(&reqs[i], batch[i]->block, 1, batch[i]->data, 1);
+    }
+    for (u32 i = 0; i < n; i++) block_plug(batch[i]->dev);
+    for (u32 i = 0; i < n; i++) block_submit(batch[i]->dev, &reqs[i]);
+    for (u32 i = 0; i < n; i++) block_unplug(batch[i]->dev);
+
+    for (u32 i = 0; i < n; i++) {
+        block_wait(&reqs[i]);
+        u32 flags = irq_save();
+        if (reqs[i].status != BLOCK_OK) {
+            status = BLOCK_ERROR;
+            bcache_mark_dirty(batch[i]);
+        } else {
+            stats.writebacks++;
+        }
+        batch[i]->refcount--;
+        irq_restore(flags);
+    }
+    return status;
+}
+
+/* Collect dirty buffers and write them out. Buffers are taken by index
+ * rather than from the LRU list, which may be reordered while we sleep */
+static s32 flush(block_device_t *dev, u8 expired_only) {
+    buffer_t *batch[BCACHE_FLUSH_BATCH];
+    s32 status = BLOCK_OK;
+    u32 i = 0;
+
+    while (i < num_buffers) {
+        u32 n = 0;
+        u32 flags = irq_save();
+        u32 now = get_tick();
+        for (; i < num_buffers && n < BCACHE_FLUSH_BATCH; i++) {
+            buffer_t *b = &buffers[i];
+            if (!(b->flags & BUF_DIRTY)) continue;
+            if (dev && b->dev != dev) continue;
+            if (expired_only && now - b->dirty_tick < BCACHE_DIRTY_EXPIRE) continue;
+            /* Clean before the write: a store during the I/O re-dirties it */
+            b->flags &= ~BUF_DIRTY;
+            stats.dirty--;
+            b->refcount++;
+            batch[n++] = b;
+        }
+        irq_restore(flags);
+
+        if (n > 0 && write_batch(batch, n) != BLOCK_OK) status = BLOCK_ERROR;
+    }
+    return status;
+}
+
+/* Least recently used buffer nobody holds. Interrupts must be off */
+static buffer_t* find_victim() {
+    for (buffer_t *b = lru_tail; b; b = b->lru_prev) {
+        if (b->refcount == 0) return b;
+    }
+    return NULL;
+}
+
+buffer_t* bcache_get(block_device_t *dev, u32 block) {
+    if (!num_buffers) return NULL;
+
+    u32 flags = irq_save();
+    while (1) {
+        buffer_t *b = hash_lookup(dev, block);
+        if (b) {
+            b->refcount++;
+            lru_touch(b);
+            stats.hits++;
+            irq_restore(flags);
+            return b;
+        }
+
+        b = find_victim();
+        if (!b) {
+            irq_restore(flags);
+            kprintf_color(RED_ON_BLACK, "Buffer cache: all buffers in use\n");
+            return NULL;
+        }
+
+        if (b->flags & BUF_DIRTY) {
+            /* Write it back and look again: the block may have been
+             * cached by someone else while we were sleeping */
+            b->flags &= ~BUF_DIRTY;
+            stats.dirty--;
+            b->refcount++;
+            irq_restore(flags);
+            write_batch(&b, 1);
+            flags = irq_save();
+            continue;
+        }
+
+        if (b->dev) {
+            hash_remove(b);
+            stats.evictions++;
+        }
+        b->dev = dev;
+        b->block = block;
+        b->flags = 0;
+        b->refcount = 1;
+        hash_insert(b);
+        lru_touch(b);
+        stats.misses++;
+        irq_restore(flags);
+        return b;
+    }
+}
+
+buffer_t* bcache_read(block_device_t *dev, u32 block) {
+    buffer_t *b = bcache_get(dev, block);
+    if (!b || (b->flags & BUF_VALID)) return b;
+
+    if (block_read(dev, block, 1, b->data) != BLOCK_OK) {
+        bcache_release(b);
+        return NULL;
+    }
+    b->flags |= BUF_VALID;
+    return b;
+}
+
+void bcache_release(buffer_t *buf) {
+    if (!buf) return;
+    u32 flags = irq_save();
+    if (buf->refcount > 0) buf->refcount--;
+    irq_restore(flags);
+}
+
+void bcache_mark_dirty(buffer_t *buf) {
+    u32 flags = irq_save();
+    buf->flags |= BUF_VALID;
+    if (!(buf->flags & BUF_DIRTY)) {
+        buf->flags |= BUF_DIRTY;
+        buf->dirty_tick = get_tick();
+        stats.dirty++;
+    }
+    irq_restore(flags);
+}
+
+s32 bcache_write(buffer_t *buf) {
+    u32 flags = irq_save();
+    if (buf->flags & BUF_DIRTY) {
+        buf->flags &= ~BUF_DIRTY;
+        stats.dirty--;
+    }
+    buf->flags |= BUF_VALID;
+    buf->refcount++;
+    irq_restore(flags);
+    return write_batch(&buf, 1);
+}
+
+s32 bcache_sync(block_device_t *dev) {
+    return flush(dev, 0);
+}
+
+void bcache_periodic() {
+    if (!num_buffers || get_tick() - last_flush_tick < BCACHE_FLUSH_INTERVAL) return;
+    last_flush_tick = get_tick();
+    if (stats.dirty > 0) flush(NULL, 1);
+}
+
+void bcache_invalidate(block_device_t *dev) {
+    u32 flags = irq_save();
+    for (u32 i = 0; i < num_buffers; i++) {
+        buffer_t *b = &buffers[i];
+        if (b->dev != dev || b->refcount || (b->flags & BUF_DIRTY)) continue;
+        hash_remove(b);
+        b->dev = NULL;
+        b->flags = 0;
+    }
+    irq_restore(flags);
+}
+
+void get_bcache_stats(bcache_stats_t *out) {
+    u32 flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
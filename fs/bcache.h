@@ -0,0 +1,57 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "../cpu/types.h"
+#include "../drivers/block.h"
+#include "../cpu/timer.h"
+
+#define BCACHE_BLOCK_SIZE      SECTOR_SIZE
+#define BCACHE_DEFAULT_FRAMES  256                  /* 1MB budget */
+#define BCACHE_FLUSH_INTERVAL  TIMER_HZ             /* Look for old dirty buffers every second */
+#define BCACHE_DIRTY_EXPIRE    (5 * TIMER_HZ)       /* Write back after 5 seconds */
+#define BCACHE_FLUSH_BATCH     16                   /* Write-backs queued together (merged by the elevator) */
+
+/* Buffer flags */
+#define BUF_VALID  0x1   /* Data matches (or is newer than) the disk */
+#define BUF_DIRTY  0x2   /* Must be written back */
+
+typedef struct buffer {
+    block_device_t *dev;
+    u32 block;
+    u8 *data;
+    u32 flags;
+    u32 refcount;
+    u32 dirty_tick;             /* When it became dirty */
+    struct buffer *hash_next;
+    struct buffer *lru_prev;    /* Towards most recently used */
+    struct buffer *lru_next;    /* Towards least recently used */
+} buffer_t;
+
+typedef struct {
+    u32 buffers;
+    u32 hits;
+    u32 misses;
+    u32 evictions;
+    u32 writebacks;
+    u32 dirty;
+} bcache_stats_t;
+
+void init_bcache(u32 frames);
+
+/* Returned buffers are referenced and must be given back with bcache_release() */
+buffer_t* bcache_get(block_device_t *dev, u32 block);   /* No disk read, for full overwrites */
+buffer_t* bcache_read(block_device_t *dev, u32 block);
+void bcache_release(buffer_t *buf);
+void bcache_mark_dirty(buffer_t *buf);
+s32 bcache_write(buffer_t *buf);
+
+/* Write back dirty buffers of 'dev' (all devices if NULL) */
+s32 bcache_sync(block_device_t *dev);
+/* Called from the idle loop: writes back buffers dirty for BCACHE_DIRTY_EXPIRE */
+void bcache_periodic();
+/* Drop every clean, unreferenced buffer of 'dev' */
+void bcache_invalidate(block_device_t *dev);
+
+void get_bcache_stats(bcache_stats_t *out);
+
+#endif
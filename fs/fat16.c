@@ -0,0 +1,908 @@
+#include "fat16.h"
+#include "bcache.h"
+#include "../cpu/timer.h"
+#include "../cpu/paging.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include "../kernel/mutex.h"
+
+/* MBR layout, for disks that carry a partition table */
+#define MBR_SIGNATURE      0xAA55
+#define MBR_SIGNATURE_OFF  510
+#define MBR_PARTITION_OFF  446
+#define MBR_ENTRY_SIZE     16
+#define MBR_TYPE_OFF       4
+#define MBR_LBA_OFF        8
+#define MBR_PARTITIONS     4
+
+#define FAT_FLUSH_INTERVAL (5 * TIMER_HZ)
+#define FAT_EOC_MARK       0xFFFF
+#define FAT_PAGE_REQUESTS  16
+
+typedef struct {
+    block_device_t *dev;
+    u8 mounted;
+    u32 sectors_per_cluster;
+    u32 fat_lba;
+    u32 fat_sectors;
+    u32 num_fats;
+    u32 root_lba;
+    u32 root_sectors;
+    u32 data_lba;
+    u32 cluster_count;
+
+    /* Whole FAT kept in memory, written back sector by sector */
+    u16 *fat;
+    u8 *fat_dirty;        /* One bit per FAT sector */
+    u32 fat_dirty_count;
+    u32 last_flush_tick;
+    u32 next_free;        /* Allocation hint */
+} fat16_fs_t;
+
+static fat16_fs_t fs;
+
+/* Held by the VFS entry points, fat16_sync() and fat16_periodic(): the
+ * code below them sleeps on the disk with the kernel lock let go, and
+ * keeps 'fs' and the buffers here inconsistent across those sleeps */
+static mutex_t fat_lock = MUTEX_INIT;
+
+/* For partial sectors at the edges of a transfer */
+static u8 bounce[SECTOR_SIZE] __attribute__((aligned(4)));
+
+/* Requests in flight for fat16_read_pages() */
+static block_request_t page_reqs[FAT_PAGE_REQUESTS];
+
+static u32 cluster_lba(u32 cluster) {
+    return fs.data_lba + (cluster - FAT_CLUSTER_FIRST) * fs.sectors_per_cluster;
+}
+
+static u8 cluster_valid(u32 cluster) {
+    return cluster >= FAT_CLUSTER_FIRST && cluster < fs.cluster_count + FAT_CLUSTER_FIRST;
+}
+
+static u16 fat_get(u32 cluster) {
+    return fs.fat[cluster];
+}
+
+static void fat_set(u32 cluster, u16 value) {
+    u32 sector = cluster * sizeof(u16) / SECTOR_SIZE;
+    fs.fat[cluster] = value;
+    if (!(fs.fat_dirty[sector / 8] & (1 << (sector % 8)))) {
+        fs.fat_dirty[sector / 8] |= 1 << (sector % 8);
+        fs.fat_dirty_count++;
+    }
+}
+
+static u8 fat_sector_dirty(u32 sector) {
+    return (fs.fat_dirty[sector / 8] >> (sector % 8)) & 1;
+}
+
+/* Write runs of dirty FAT sectors to every FAT copy */
+static s32 fat_flush() {
+    u32 s = 0;
+    while (s < fs.fat_sectors) {
+        if (!fat_sector_dirty(s)) {
+            s++;
+            continue;
+        }
+        u32 start = s;
+        while (s < fs.fat_sectors && fat_sector_dirty(s)) s++;
+
+        for (u32 copy = 0; copy < fs.num_fats; copy++) {
+            u32 lba = fs.fat_lba + copy * fs.fat_sectors + start;
+            if (block_write(fs.dev, lba, s - start, (u8*)fs.fat + start * SECTOR_SIZE) != BLOCK_OK) {
+                return FAT_ERR_IO;
+            }
+        }
+        for (u32 i = start; i < s; i++) fs.fat_dirty[i / 8] &= ~(1 << (i % 8));
+        fs.fat_dirty_count -= s - start;
+    }
+    fs.last_flush_tick = get_tick();
+    return FAT_OK;
+}
+
+/* Number of clusters following 'cluster' contiguously on disk (at least 1) */
+static u32 run_length(u32 cluster) {
+    u32 run = 1;
+    while (fat_get(cluster + run - 1) == cluster + run) run++;
+    return run;
+}
+
+static void free_chain(u32 cluster) {
+    while (cluster_valid(cluster)) {
+        u32 next = fat_get(cluster);
+        fat_set(cluster, FAT_CLUSTER_FREE);
+        if (cluster < fs.next_free) fs.next_free = cluster;
+        cluster = next;
+    }
+}
+
+/* Allocate 'count' clusters, preferring a single contiguous run so the file
+ * can be moved with one multi-sector request. Returns the first cluster or 0 */
+static u16 alloc_chain(u32 count) {
+    u32 run_start = 0;
+    u32 run_len = 0;
+
+    for (u32 n = 0; n < fs.cluster_count; n++) {
+        u32 c = FAT_CLUSTER_FIRST + (fs.next_free - FAT_CLUSTER_FIRST + n) % fs.cluster_count;
+        if (c == FAT_CLUSTER_FIRST) run_len = 0;  /* Runs don't wrap around */
+        if (fat_get(c) != FAT_CLUSTER_FREE) {
+            run_len = 0;
+            continue;
+        }
+        if (run_len++ == 0) run_start = c;
+        if (run_len == count) {
+            for (u32 i = 0; i < count - 1; i++) fat_set(run_start + i, run_start + i + 1);
+            fat_set(run_start + count - 1, FAT_EOC_MARK);
+            fs.next_free = run_start + count;
+            if (!cluster_valid(fs.next_free)) fs.next_free = FAT_CLUSTER_FIRST;
+            return run_start;
+        }
+    }
+
+    /* Fragmented volume: chain together whatever is free */
+    u32 first = 0;
+    u32 prev = 0;
+    u32 got = 0;
+    for (u32 c = FAT_CLUSTER_FIRST; cluster_valid(c) && got < count; c++) {
+        if (fat_get(c) != FAT_CLUSTER_FREE) continue;
+        fat_set(c, FAT_EOC_MARK);
+        if (prev) fat_set(prev, c);
+        else first = c;
+        prev = c;
+        got++;
+    }
+    if (got < count) {
+        free_chain(first);
+        return 0;
+    }
+    return first;
+}
+
+/* Read 'len' bytes starting 'offset' bytes into sector 'lba'. Whole sectors
+ * go straight to the caller's buffer, only the edges use the bounce buffer */
+static s32 read_span(u32 lba, u32 offset, u8 *buffer, u32 len) {
+    if (offset) {
+        u32 n = MIN(SECTOR_SIZE - offset, len);
+        if (block_read(fs.dev, lba, 1, bounce) != BLOCK_OK) return FAT_ERR_IO;
+        memory_copy(bounce + offset, buffer, n);
+        buffer += n;
+        len -= n;
+        lba++;
+    }
+    u32 whole = len / SECTOR_SIZE;
+    if (whole) {
+        if (block_read(fs.dev, lba, whole, buffer) != BLOCK_OK) return FAT_ERR_IO;
+        buffer += whole * SECTOR_SIZE;
+        len -= whole * SECTOR_SIZE;
+        lba += whole;
+    }
+    if (len) {
+        if (block_read(fs.dev, lba, 1, bounce) != BLOCK_OK) return FAT_ERR_IO;
+        memory_copy(bounce, buffer, len);
+    }
+    return FAT_OK;
+}
+
+/* Write 'len' bytes from the start of sector 'lba', zero padding the last one */
+static s32 write_span(u32 lba, u8 *buffer, u32 len) {
+    u32 whole = len / SECTOR_SIZE;
+    if (whole && block_write(fs.dev, lba, whole, buffer) != BLOCK_OK) return FAT_ERR_IO;
+    len -= whole * SECTOR_SIZE;
+    if (len) {
+        memory_set(bounce, 0, SECTOR_SIZE);
+        memory_copy(buffer + whole * SECTOR_SIZE, bounce, len);
+        if (block_write(fs.dev, lba + whole, 1, bounce) != BLOCK_OK) return FAT_ERR_IO;
+    }
+    return FAT_OK;
+}
+
+/* "readme.txt" -> "README  TXT". Returns 0 if it isn't a valid 8.3 name */
+static u8 to_83(char *name, u8 *out) {
+    memory_set(out, ' ', 11);
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        out[0] = '.';
+        if (name[1]) out[1] = '.';
+        return 1;
+    }
+
+    u32 i = 0;
+    u32 pos = 0;
+    u32 limit = 8;
+    if (name[0] == '\0' || name[0] == '.') return 0;
+    for (; name[i] != '\0'; i++) {
+        char c = name[i];
+        if (c == '.') {
+            if (limit == 11) return 0;  /* Second dot */
+            pos = 8;
+            limit = 11;
+            continue;
+        }
+        if (c == '/' || c == ' ' || pos >= limit) return 0;
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        out[pos++] = c;
+    }
+    return 1;
+}
+
+static void from_83(u8 *raw, char *out) {
+    u32 n = 0;
+    for (u32 i = 0; i < 8 && raw[i] != ' '; i++) out[n++] = raw[i];
+    if (raw[8] != ' ') {
+        out[n++] = '.';
+        for (u32 i = 8; i < 11 && raw[i] != ' '; i++) out[n++] = raw[i];
+    }
+    out[n] = '\0';
+}
+
+static u8 name_equal(u8 *a, u8 *b) {
+    for (u32 i = 0; i < 11; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+static void decode_entry(fat_raw_entry_t *e, u32 lba, u32 index, fat_file_t *out) {
+    from_83(e->name, out->name);
+    out->attr = e->attr;
+    out->cluster = e->cluster;
+    out->size = e->size;
+    out->entry_lba = lba;
+    out->entry_index = index;
+}
+
+/* LBA of sector 'index' of a directory, or 0 past its end */
+static u32 dir_sector_lba(u16 dir_cluster, u32 index) {
+    if (dir_cluster == FAT_ROOT_CLUSTER) {
+        return index < fs.root_sectors ? fs.root_lba + index : 0;
+    }
+    u32 c = dir_cluster;
+    for (u32 skip = index / fs.sectors_per_cluster; skip > 0; skip--) {
+        c = fat_get(c);
+        if (!cluster_valid(c)) return 0;
+    }
+    return cluster_lba(c) + index % fs.sectors_per_cluster;
+}
+
+static u8 entry_visible(fat_raw_entry_t *e) {
+    if (e->name[0] == FAT_ENTRY_DELETED) return 0;
+    if (e->attr == FAT_ATTR_LFN || (e->attr & FAT_ATTR_VOLUME_ID)) return 0;
+    return 1;
+}
+
+s32 fat16_readdir(u16 dir_cluster, u32 index, fat_file_t *out) {
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+
+    u32 n = 0;
+    u32 lba;
+    for (u32 s = 0; (lba = dir_sector_lba(dir_cluster, s)) != 0; s++) {
+        buffer_t *b = bcache_read(fs.dev, lba);
+        if (!b) return FAT_ERR_IO;
+        fat_raw_entry_t *entries = (fat_raw_entry_t*)b->data;
+        for (u32 i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
+            if (entries[i].name[0] == FAT_ENTRY_END) {
+                bcache_release(b);
+                return FAT_ERR_NOT_FOUND;
+            }
+            if (!entry_visible(&entries[i])) continue;
+            if (n++ == index) {
+                decode_entry(&entries[i], lba, i, out);
+                bcache_release(b);
+                return FAT_OK;
+            }
+        }
+        bcache_release(b);
+    }
+    return FAT_ERR_NOT_FOUND;
+}
+
+s32 fat16_lookup_in(u16 dir_cluster, char *name, fat_file_t *out) {
+    u8 raw[11];
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    if (!to_83(name, raw)) return FAT_ERR_INVALID;
+
+    u32 lba;
+    for (u32 s = 0; (lba = dir_sector_lba(dir_cluster, s)) != 0; s++) {
+        buffer_t *b = bcache_read(fs.dev, lba);
+        if (!b) return FAT_ERR_IO;
+        fat_raw_entry_t *entries = (fat_raw_entry_t*)b->data;
+        for (u32 i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
+            if (entries[i].name[0] == FAT_ENTRY_END) {
+                bcache_release(b);
+                return FAT_ERR_NOT_FOUND;
+            }
+            if (entry_visible(&entries[i]) && name_equal(entries[i].name, raw)) {
+                decode_entry(&entries[i], lba, i, out);
+                bcache_release(b);
+                return FAT_OK;
+            }
+        }
+        bcache_release(b);
+    }
+    return FAT_ERR_NOT_FOUND;
+}
+
+static void root_entry(fat_file_t *out) {
+    out->name[0] = '/';
+    out->name[1] = '\0';
+    out->attr = FAT_ATTR_DIRECTORY;
+    out->cluster = FAT_ROOT_CLUSTER;
+    out->size = 0;
+    out->entry_lba = 0;
+    out->entry_index = 0;
+}
+
+s32 fat16_lookup(char *path, fat_file_t *out) {
+    char comp[FAT_NAME_LEN];
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+
+    root_entry(out);
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+
+        u32 n = 0;
+        while (*path && *path != '/') {
+            if (n == FAT_NAME_LEN - 1) return FAT_ERR_INVALID;
+            comp[n++] = *path++;
+        }
+        comp[n] = '\0';
+
+        if (!(out->attr & FAT_ATTR_DIRECTORY)) return FAT_ERR_NOT_DIR;
+        s32 err = fat16_lookup_in(out->cluster, comp, out);
+        if (err != FAT_OK) return err;
+    }
+    return FAT_OK;
+}
+
+/* Split "a/b/c" into the directory cluster of "a/b" and the name "c" */
+static s32 lookup_parent(char *path, u16 *dir_cluster, char **name) {
+    char parent[FAT_MAX_PATH];
+    s32 slash = -1;
+    s32 i;
+    for (i = 0; path[i] != '\0'; i++) {
+        if (i == FAT_MAX_PATH - 1) return FAT_ERR_INVALID;
+        parent[i] = path[i];
+        if (path[i] == '/') slash = i;
+    }
+    parent[slash < 0 ? 0 : slash] = '\0';
+    *name = path + slash + 1;
+
+    fat_file_t dir;
+    s32 err = fat16_lookup(parent, &dir);
+    if (err != FAT_OK) return err;
+    if (!(dir.attr & FAT_ATTR_DIRECTORY)) return FAT_ERR_NOT_DIR;
+    *dir_cluster = dir.cluster;
+    return FAT_OK;
+}
+
+/* Find a free slot in a directory, growing a subdirectory by one cluster if needed */
+static s32 dir_alloc_entry(u16 dir_cluster, u32 *lba_out, u32 *index_out) {
+    u32 lba = 0;
+    u32 last_lba = 0;
+    u32 s;
+    for (s = 0; (lba = dir_sector_lba(dir_cluster, s)) != 0; s++) {
+        buffer_t *b = bcache_read(fs.dev, lba);
+        if (!b) return FAT_ERR_IO;
+        fat_raw_entry_t *entries = (fat_raw_entry_t*)b->data;
+        for (u32 i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
+            u8 first = entries[i].name[0];
+            if (first == FAT_ENTRY_END || first == FAT_ENTRY_DELETED) {
+                *lba_out = lba;
+                *index_out = i;
+                bcache_release(b);
+                return FAT_OK;
+            }
+        }
+        bcache_release(b);
+        last_lba = lba;
+    }
+
+    if (dir_cluster == FAT_ROOT_CLUSTER || !last_lba) return FAT_ERR_NO_SPACE;
+
+    /* Last sector of the chain -> its cluster */
+    u32 tail = FAT_CLUSTER_FIRST + (last_lba - fs.data_lba) / fs.sectors_per_cluster;
+    u16 c = alloc_chain(1);
+    if (!c) return FAT_ERR_NO_SPACE;
+    fat_set(tail, c);
+
+    /* New directory sectors must read back as end-of-directory */
+    for (u32 i = 0; i < fs.sectors_per_cluster; i++) {
+        buffer_t *b = bcache_get(fs.dev, cluster_lba(c) + i);
+        if (!b) return FAT_ERR_IO;
+        memory_set(b->data, 0, SECTOR_SIZE);
+        bcache_mark_dirty(b);
+        bcache_release(b);
+    }
+    *lba_out = cluster_lba(c);
+    *index_out = 0;
+    return FAT_OK;
+}
+
+s32 fat16_read(fat_file_t *file, u32 offset, u8 *buffer, u32 len) {
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    if (file->attr & FAT_ATTR_DIRECTORY) return FAT_ERR_IS_DIR;
+    if (offset >= file->size) return 0;
+    len = MIN(len, file->size - offset);
+
+    u32 cluster_bytes = fat16_cluster_size();
+    u32 cluster = file->cluster;
+    for (u32 skip = offset / cluster_bytes; skip > 0; skip--) {
+        cluster = fat_get(cluster);
+        if (!cluster_valid(cluster)) return FAT_ERR_IO;
+    }
+
+    u32 pos = offset % cluster_bytes;
+    u32 done = 0;
+    while (done < len) {
+        if (!cluster_valid(cluster)) return FAT_ERR_IO;
+        /* One request for the whole contiguous run */
+        u32 run = run_length(cluster);
+        u32 chunk = MIN(run * cluster_bytes - pos, len - done);
+        s32 err = read_span(cluster_lba(cluster) + pos / SECTOR_SIZE, pos % SECTOR_SIZE, buffer + done, chunk);
+        if (err != FAT_OK) return err;
+        done += chunk;
+        cluster = fat_get(cluster + run - 1);
+        pos = 0;
+    }
+    return done;
+}
+
+/* Wait for 'count' queued page reads */
+static s32 finish_page_reads(block_request_t *reqs, u32 count) {
+    s32 err = FAT_OK;
+    block_unplug(fs.dev);
+    for (u32 i = 0; i < count; i++) {
+        block_wait(&reqs[i]);
+        if (reqs[i].status != BLOCK_OK) err = FAT_ERR_IO;
+    }
+    return err;
+}
+
+s32 fat16_read_pages(fat_file_t *file, u32 offset, u8 **pages, u32 count) {
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    if (file->attr & FAT_ATTR_DIRECTORY) return FAT_ERR_IS_DIR;
+    if (offset >= file->size) return FAT_OK;
+
+    /* Whole sectors up to the end of the file: they are all inside its clusters */
+    u32 total = MIN(count * FRAME_SIZE, file->size - offset);
+    total = (total + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    u32 cluster_bytes = fat16_cluster_size();
+    u32 cluster = file->cluster;
+    for (u32 skip = offset / cluster_bytes; skip > 0; skip--) {
+        cluster = fat_get(cluster);
+        if (!cluster_valid(cluster)) return FAT_ERR_IO;
+    }
+
+    u32 pos = offset % cluster_bytes;
+    u32 done = 0;
+    u32 nreqs = 0;
+    s32 err = FAT_OK;
+    block_plug(fs.dev);
+    while (done < total && err == FAT_OK) {
+        if (!cluster_valid(cluster)) {
+            err = FAT_ERR_IO;
+            break;
+        }
+        u32 run = run_length(cluster);
+        u32 span = MIN(run * cluster_bytes - pos, total - done);
+        u32 lba = cluster_lba(cluster) + pos / SECTOR_SIZE;
+
+        /* Each request covers as much of the run as its scatter list allows,
+         * each segment lands in one page */
+        while (span > 0) {
+            if (nreqs == FAT_PAGE_REQUESTS) {
+                err = finish_page_reads(page_reqs, nreqs);
+                nreqs = 0;
+                block_plug(fs.dev);
+                if (err != FAT_OK) break;
+            }
+            block_request_t *req = &page_reqs[nreqs++];
+            u32 n = MIN(FRAME_SIZE - done % FRAME_SIZE, span) / SECTOR_SIZE;
+            block_init_request(req, lba, n, pages[done / FRAME_SIZE] + done % FRAME_SIZE, 0);
+            while (1) {
+                lba += n;
+                done += n * SECTOR_SIZE;
+                span -= n * SECTOR_SIZE;
+                if (span == 0 || req->nsegs == BLOCK_MAX_SEGMENTS || req->count == BLOCK_MAX_SECTORS) break;
+                n = MIN(MIN(FRAME_SIZE, span) / SECTOR_SIZE, BLOCK_MAX_SECTORS - req->count);
+                block_add_segment(req, pages[done / FRAME_SIZE], n);
+            }
+            block_submit(fs.dev, req);
+        }
+        cluster = fat_get(cluster + run - 1);
+        pos = 0;
+    }
+
+    s32 io = finish_page_reads(page_reqs, nreqs);
+    return err != FAT_OK ? err : io;
+}
+
+s32 fat16_create(u16 dir_cluster, char *name, fat_file_t *out) {
+    u8 raw[11];
+    u32 entry_lba;
+    u32 entry_index;
+
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    if (!to_83(name, raw) || raw[0] == '.') return FAT_ERR_INVALID;
+
+    s32 err = fat16_lookup_in(dir_cluster, name, out);
+    if (err == FAT_OK) return FAT_ERR_EXISTS;
+    if (err != FAT_ERR_NOT_FOUND) return err;
+
+    err = dir_alloc_entry(dir_cluster, &entry_lba, &entry_index);
+    if (err != FAT_OK) return err;
+
+    buffer_t *b = bcache_read(fs.dev, entry_lba);
+    if (!b) return FAT_ERR_IO;
+    fat_raw_entry_t *e = &((fat_raw_entry_t*)b->data)[entry_index];
+    memory_set((u8*)e, 0, FAT_ENTRY_SIZE);
+    memory_copy(raw, e->name, 11);
+    e->attr = FAT_ATTR_ARCHIVE;
+    decode_entry(e, entry_lba, entry_index, out);
+    bcache_mark_dirty(b);
+    bcache_release(b);
+    return FAT_OK;
+}
+
+s32 fat16_rewrite(fat_file_t *file, u8 *data, u32 len) {
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    if (file->attr & FAT_ATTR_DIRECTORY) return FAT_ERR_IS_DIR;
+
+    free_chain(file->cluster);
+
+    s32 err = FAT_OK;
+    u32 cluster_bytes = fat16_cluster_size();
+    u32 count = (len + cluster_bytes - 1) / cluster_bytes;
+    u16 first = count ? alloc_chain(count) : 0;
+    if (count && !first) {
+        err = FAT_ERR_NO_SPACE;
+        len = 0;
+    }
+
+    /* Data goes out run by run, bypassing the buffer cache */
+    u32 cluster = first;
+    u32 done = 0;
+    while (err == FAT_OK && done < len) {
+        u32 run = run_length(cluster);
+        u32 chunk = MIN(run * cluster_bytes, len - done);
+        err = write_span(cluster_lba(cluster), data + done, chunk);
+        done += chunk;
+        cluster = fat_get(cluster + run - 1);
+    }
+    if (err != FAT_OK && first) {
+        free_chain(first);
+        first = 0;
+        len = 0;
+    }
+
+    /* On failure the entry is kept, pointing at no data */
+    buffer_t *b = bcache_read(fs.dev, file->entry_lba);
+    if (!b) return FAT_ERR_IO;
+    fat_raw_entry_t *e = &((fat_raw_entry_t*)b->data)[file->entry_index];
+    e->cluster = first;
+    e->size = len;
+    bcache_mark_dirty(b);
+    bcache_release(b);
+
+    file->cluster = first;
+    file->size = len;
+    return err;
+}
+
+s32 fat16_unlink(u16 dir_cluster, char *name) {
+    fat_file_t file;
+    s32 err = fat16_lookup_in(dir_cluster, name, &file);
+    if (err != FAT_OK) return err;
+    if (file.attr & FAT_ATTR_DIRECTORY) return FAT_ERR_IS_DIR;
+
+    buffer_t *b = bcache_read(fs.dev, file.entry_lba);
+    if (!b) return FAT_ERR_IO;
+    ((fat_raw_entry_t*)b->data)[file.entry_index].name[0] = FAT_ENTRY_DELETED;
+    bcache_mark_dirty(b);
+    bcache_release(b);
+
+    free_chain(file.cluster);
+    return FAT_OK;
+}
+
+s32 fat16_write_file(char *path, u8 *data, u32 len) {
+    u16 dir_cluster;
+    char *name;
+    fat_file_t file;
+
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    s32 err = lookup_parent(path, &dir_cluster, &name);
+    if (err != FAT_OK) return err;
+
+    err = fat16_create(dir_cluster, name, &file);
+    if (err != FAT_OK && err != FAT_ERR_EXISTS) return err;
+    return fat16_rewrite(&file, data, len);
+}
+
+s32 fat16_remove(char *path) {
+    u16 dir_cluster;
+    char *name;
+    s32 err = lookup_parent(path, &dir_cluster, &name);
+    if (err != FAT_OK) return err;
+    return fat16_unlink(dir_cluster, name);
+}
+
+s32 fat16_sync() {
+    if (!fs.mounted) return FAT_ERR_NOT_MOUNTED;
+    mutex_lock(&fat_lock);
+    s32 err = fat_flush();
+    if (bcache_sync(fs.dev) != BLOCK_OK) err = FAT_ERR_IO;
+    mutex_unlock(&fat_lock);
+    return err;
+}
+
+void fat16_periodic() {
+    if (!fs.mounted || !fs.fat_dirty_count) return;
+    if (get_tick() - fs.last_flush_tick < FAT_FLUSH_INTERVAL) return;
+    mutex_lock(&fat_lock);
+    fat_flush();
+    mutex_unlock(&fat_lock);
+}
+
+u32 fat16_cluster_size() {
+    return fs.sectors_per_cluster * SECTOR_SIZE;
+}
+
+u8 fat16_is_mounted() {
+    return fs.mounted;
+}
+
+char* fat16_strerror(s32 err) {
+    switch (err) {
+        case FAT_OK: return "ok";
+        case FAT_ERR_IO: return "I/O error";
+        case FAT_ERR_NOT_FOUND: return "not found";
+        case FAT_ERR_NO_SPACE: return "no space left";
+        case FAT_ERR_INVALID: return "invalid name";
+        case FAT_ERR_IS_DIR: return "is a directory";
+        case FAT_ERR_NOT_DIR: return "not a directory";
+        case FAT_ERR_NOT_MOUNTED: return "no FAT16 volume";
+        case FAT_ERR_EXISTS: return "already exists";
+        default: return "error";
+    }
+}
+
+/* Sector of the volume's boot record: 0 for a bare volume, else the
+ * first FAT16 partition of the MBR */
+static s32 find_volume(block_device_t *dev, u32 *part_lba) {
+    *part_lba = 0;
+    if (block_read(dev, 0, 1, bounce) != BLOCK_OK) return FAT_ERR_IO;
+
+    fat_bpb_t *bpb = (fat_bpb_t*)bounce;
+    if (bpb->bytes_per_sector == SECTOR_SIZE && bpb->sectors_per_cluster != 0) return FAT_OK;
+    if (*(u16*)(bounce + MBR_SIGNATURE_OFF) != MBR_SIGNATURE) return FAT_ERR_INVALID;
+
+    for (u32 i = 0; i < MBR_PARTITIONS; i++) {
+        u8 *entry = bounce + MBR_PARTITION_OFF + i * MBR_ENTRY_SIZE;
+        u8 type = entry[MBR_TYPE_OFF];
+        if (type == 0x04 || type == 0x06 || type == 0x0E) {
+            *part_lba = *(u32*)(entry + MBR_LBA_OFF);
+            if (block_read(dev, *part_lba, 1, bounce) != BLOCK_OK) return FAT_ERR_IO;
+            return FAT_OK;
+        }
+    }
+    return FAT_ERR_INVALID;
+}
+
+s32 fat16_mount(block_device_t *dev) {
+    u32 part_lba;
+    if (!dev) return FAT_ERR_INVALID;
+    s32 err = find_volume(dev, &part_lba);
+    if (err != FAT_OK) return err;
+
+    fat_bpb_t *bpb = (fat_bpb_t*)bounce;
+    if (bpb->bytes_per_sector != SECTOR_SIZE || bpb->sectors_per_cluster == 0 ||
+        bpb->fat_size16 == 0 || bpb->num_fats == 0) {
+        return FAT_ERR_INVALID;
+    }
+
+    u32 total = bpb->total_sectors16 ? bpb->total_sectors16 : bpb->total_sectors32;
+    fs.dev = dev;
+    fs.sectors_per_cluster = bpb->sectors_per_cluster;
+    fs.num_fats = bpb->num_fats;
+    fs.fat_sectors = bpb->fat_size16;
+    fs.fat_lba = part_lba + bpb->reserved_sectors;
+    fs.root_sectors = (bpb->root_entries * FAT_ENTRY_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    fs.root_lba = fs.fat_lba + fs.num_fats * fs.fat_sectors;
+    fs.data_lba = fs.root_lba + fs.root_sectors;
+    fs.cluster_count = (total - (fs.data_lba - part_lba)) / fs.sectors_per_cluster;
+
+    if (fs.cluster_count < FAT16_MIN_CLUSTERS || fs.cluster_count > FAT16_MAX_CLUSTERS) {
+        return FAT_ERR_INVALID;
+    }
+    /* The FAT must have an entry for every cluster */
+    if (fs.fat_sectors * SECTOR_SIZE / sizeof(u16) < fs.cluster_count + FAT_CLUSTER_FIRST) {
+        return FAT_ERR_INVALID;
+    }
+
+    u32 dirty_bytes = (fs.fat_sectors + 7) / 8;
+    fs.fat = (u16*)kmalloc(fs.fat_sectors * SECTOR_SIZE, 0, NULL);
+    fs.fat_dirty = (u8*)kmalloc(dirty_bytes, 0, NULL);
+    if (!fs.fat || !fs.fat_dirty) return FAT_ERR_NO_SPACE;
+    memory_set(fs.fat_dirty, 0, dirty_bytes);
+    fs.fat_dirty_count = 0;
+
+    if (block_read(dev, fs.fat_lba, fs.fat_sectors, (u8*)fs.fat) != BLOCK_OK) {
+        kfree(fs.fat);
+        kfree(fs.fat_dirty);
+        return FAT_ERR_IO;
+    }
+
+    fs.next_free = FAT_CLUSTER_FIRST;
+    fs.last_flush_tick = get_tick();
+    fs.mounted = 1;
+
+    kprintf_color(GREEN_ON_BLACK, "FAT16 on %s: %d clusters of %d bytes\n",
+                  dev->name, fs.cluster_count, fat16_cluster_size());
+    return FAT_OK;
+}
+
+/* VFS glue. The inode number is where the directory entry lives, which
+ * makes the root (no entry) inode 0. Each vnode owns a copy of its entry */
+
+static s32 vfs_error(s32 err) {
+    switch (err) {
+        case FAT_OK: return VFS_OK;
+        case FAT_ERR_IO: return VFS_ERR_IO;
+        case FAT_ERR_NOT_FOUND: return VFS_ERR_NOT_FOUND;
+        case FAT_ERR_NO_SPACE: return VFS_ERR_NO_SPACE;
+        case FAT_ERR_IS_DIR: return VFS_ERR_IS_DIR;
+        case FAT_ERR_NOT_DIR: return VFS_ERR_NOT_DIR;
+        case FAT_ERR_EXISTS: return VFS_ERR_EXISTS;
+        default: return VFS_ERR_INVALID;
+    }
+}
+
+static s32 get_vnode(mount_t *mnt, fat_file_t *file, vnode_t **out) {
+    u8 fresh;
+    vnode_t *vn = vfs_iget(mnt, file->entry_lba * FAT_ENTRIES_PER_SECTOR + file->entry_index, &fresh);
+    if (!vn) return VFS_ERR_NO_SPACE;
+    if (fresh) {
+        fat_file_t *copy = (fat_file_t*)kmalloc(sizeof(fat_file_t), 0, NULL);
+        if (!copy) {
+            vfs_iput(vn);
+            return VFS_ERR_NO_SPACE;
+        }
+        memory_copy((u8*)file, (u8*)copy, sizeof(fat_file_t));
+        vn->fs_data = copy;
+        vn->type = (file->attr & FAT_ATTR_DIRECTORY) ? VFS_DIR : VFS_FILE;
+        vn->size = file->size;
+    }
+    *out = vn;
+    return VFS_OK;
+}
+
+static s32 fat_vop_lookup(vnode_t *dir, char *name, vnode_t **out) {
+    fat_file_t file;
+    mutex_lock(&fat_lock);
+    s32 err = fat16_lookup_in(((fat_file_t*)dir->fs_data)->cluster, name, &file);
+    mutex_unlock(&fat_lock);
+    if (err != FAT_OK) return vfs_error(err);
+    return get_vnode(dir->mount, &file, out);
+}
+
+static s32 fat_vop_read(vnode_t *vn, u32 offset, u8 *buffer, u32 len) {
+    mutex_lock(&fat_lock);
+    s32 n = fat16_read((fat_file_t*)vn->fs_data, offset, buffer, len);
+    mutex_unlock(&fat_lock);
+    return n < 0 ? vfs_error(n) : n;
+}
+
+static s32 fat_vop_readpages(vnode_t *vn, u32 index, u8 **pages, u32 count) {
+    mutex_lock(&fat_lock);
+    s32 err = fat16_read_pages((fat_file_t*)vn->fs_data, index * FRAME_SIZE, pages, count);
+    mutex_unlock(&fat_lock);
+    return vfs_error(err);
+}
+
+/* FAT16 files are rewritten whole: build the new contents in memory */
+static s32 resize_and_write(vnode_t *vn, u32 size, u32 offset, u8 *data, u32 len) {
+    fat_file_t *file = (fat_file_t*)vn->fs_data;
+    u8 *buffer = NULL;
+    if (offset == 0 && len == size) {
+        /* New contents are exactly 'data', no staging copy */
+        s32 err = fat16_rewrite(file, data, size);
+        vn->size = file->size;
+        return vfs_error(err);
+    }
+    if (size) {
+        buffer = (u8*)kmalloc(size, 0, NULL);
+        if (!buffer) return VFS_ERR_NO_SPACE;
+        u32 keep = MIN(file->size, size);
+        /* Skip reading what the new data covers completely */
+        if (offset > 0 || len < keep) {
+            s32 n = fat16_read(file, 0, buffer, keep);
+            if (n < 0) {
+                kfree(buffer);
+                return vfs_error(n);
+            }
+        }
+        if (keep < size) memory_set(buffer + keep, 0, size - keep);
+        if (len) memory_copy(data, buffer + offset, len);
+    }
+
+    s32 err = fat16_rewrite(file, buffer, size);
+    vn->size = file->size;
+    kfree(buffer);
+    return vfs_error(err);
+}
+
+static s32 fat_vop_write(vnode_t *vn, u32 offset, u8 *data, u32 len) {
+    fat_file_t *file = (fat_file_t*)vn->fs_data;
+    mutex_lock(&fat_lock);
+    s32 err = resize_and_write(vn, MAX(file->size, offset + len), offset, data, len);
+    mutex_unlock(&fat_lock);
+    return err != VFS_OK ? err : (s32)len;
+}
+
+static s32 fat_vop_truncate(vnode_t *vn, u32 size) {
+    mutex_lock(&fat_lock);
+    s32 err = resize_and_write(vn, size, 0, NULL, 0);
+    mutex_unlock(&fat_lock);
+    return err;
+}
+
+static s32 fat_vop_create(vnode_t *dir, char *name, u8 type, vnode_t **out) {
+    fat_file_t file;
+    if (type == VFS_DIR) return VFS_ERR_NOT_SUPPORTED;
+    mutex_lock(&fat_lock);
+    s32 err = fat16_create(((fat_file_t*)dir->fs_data)->cluster, name, &file);
+    mutex_unlock(&fat_lock);
+    if (err != FAT_OK) return vfs_error(err);
+    return get_vnode(dir->mount, &file, out);
+}
+
+static s32 fat_vop_unlink(vnode_t *dir, char *name) {
+    mutex_lock(&fat_lock);
+    s32 err = fat16_unlink(((fat_file_t*)dir->fs_data)->cluster, name);
+    mutex_unlock(&fat_lock);
+    return vfs_error(err);
+}
+
+/* Same as fat16_readdir(), minus the "." and ".." entries the VFS handles */
+static s32 fat_vop_readdir(vnode_t *dir, u32 index, vfs_dirent_t *out) {
+    fat_file_t entry;
+    mutex_lock(&fat_lock);
+    for (u32 i = 0; ; i++) {
+        s32 err = fat16_readdir(((fat_file_t*)dir->fs_data)->cluster, i, &entry);
+        if (err != FAT_OK) {
+            mutex_unlock(&fat_lock);
+            return vfs_error(err);
+        }
+        if (entry.name[0] != '.' && index-- == 0) break;
+    }
+    mutex_unlock(&fat_lock);
+    strcpy(out->name, entry.name);
+    out->type = (entry.attr & FAT_ATTR_DIRECTORY) ? VFS_DIR : VFS_FILE;
+    out->size = entry.size;
+    return VFS_OK;
+}
+
+static void fat_vop_release(vnode_t *vn) {
+    kfree(vn->fs_data);
+}
+
+static s32 fat_vfs_mount(mount_t *mnt, void *data, vnode_t **root) {
+    fat_file_t file;
+    mutex_lock(&fat_lock);
+    s32 err = fat16_mount((block_device_t*)data);
+    mutex_unlock(&fat_lock);
+    if (err != FAT_OK) return vfs_error(err);
+    root_entry(&file);
+    return get_vnode(mnt, &file, root);
+}
+
+static vnode_ops_t fat_vops = {
+    fat_vop_lookup, fat_vop_read, fat_vop_readpages, fat_vop_write, fat_vop_truncate,
+    fat_vop_create, fat_vop_unlink, fat_vop_readdir, fat_vop_release
+};
+
+filesystem_t fat16_filesystem = {"fat16", VFS_FS_NOCASE, &fat_vops, fat_vfs_mount};
@@ -0,0 +1,130 @@
+#ifndef FAT16_H
+#define FAT16_H
+
+#include "../cpu/types.h"
+#include "../drivers/block.h"
+#include "vfs.h"
+
+/* Directory entry attributes */
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN    0x02
+#define FAT_ATTR_SYSTEM    0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+#define FAT_ATTR_LFN       0x0F  /* Long file name slot, ignored */
+
+/* Special first bytes of a directory entry name */
+#define FAT_ENTRY_END      0x00
+#define FAT_ENTRY_DELETED  0xE5
+
+/* FAT16 cluster values */
+#define FAT_CLUSTER_FREE   0x0000
+#define FAT_CLUSTER_FIRST  2
+#define FAT_CLUSTER_BAD    0xFFF7
+#define FAT_CLUSTER_EOC    0xFFF8  /* >= this ends a chain */
+#define FAT_ROOT_CLUSTER   0       /* How the fixed root directory is referenced */
+
+/* A volume is FAT16 if its cluster count falls in this range */
+#define FAT16_MIN_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65524
+
+#define FAT_NAME_LEN       13      /* "NAME.EXT" + NUL */
+#define FAT_ENTRY_SIZE     32
+#define FAT_ENTRIES_PER_SECTOR (SECTOR_SIZE / FAT_ENTRY_SIZE)
+#define FAT_MAX_PATH       128
+
+/* Error codes */
+#define FAT_OK             0
+#define FAT_ERR_IO         -1
+#define FAT_ERR_NOT_FOUND  -2
+#define FAT_ERR_NO_SPACE   -3
+#define FAT_ERR_INVALID    -4
+#define FAT_ERR_IS_DIR     -5
+#define FAT_ERR_NOT_DIR    -6
+#define FAT_ERR_NOT_MOUNTED -7
+#define FAT_ERR_EXISTS     -8
+
+/* BIOS parameter block, at the start of the volume's first sector */
+typedef struct {
+    u8 jump[3];
+    u8 oem[8];
+    u16 bytes_per_sector;
+    u8 sectors_per_cluster;
+    u16 reserved_sectors;
+    u8 num_fats;
+    u16 root_entries;
+    u16 total_sectors16;
+    u8 media;
+    u16 fat_size16;
+    u16 sectors_per_track;
+    u16 num_heads;
+    u32 hidden_sectors;
+    u32 total_sectors32;
+} __attribute__((packed)) fat_bpb_t;
+
+/* On-disk directory entry */
+typedef struct {
+    u8 name[8];
+    u8 ext[3];
+    u8 attr;
+    u8 reserved;
+    u8 ctime_tenth;
+    u16 ctime;
+    u16 cdate;
+    u16 adate;
+    u16 cluster_high;  /* Always 0 on FAT16 */
+    u16 mtime;
+    u16 mdate;
+    u16 cluster;
+    u32 size;
+} __attribute__((packed)) fat_raw_entry_t;
+
+/* Decoded directory entry, remembers where it lives for updates */
+typedef struct {
+    char name[FAT_NAME_LEN];
+    u8 attr;
+    u16 cluster;
+    u32 size;
+    u32 entry_lba;
+    u32 entry_index;   /* Within that sector */
+} fat_file_t;
+
+/* The calls from here to fat16_remove() take no lock. Other code goes
+ * through the VFS, fat16_sync() and fat16_periodic(), which do */
+s32 fat16_mount(block_device_t *dev);
+u8 fat16_is_mounted();
+
+/* Lookups. Paths are '/' separated 8.3 names, relative to the root */
+s32 fat16_lookup(char *path, fat_file_t *out);
+s32 fat16_lookup_in(u16 dir_cluster, char *name, fat_file_t *out);
+/* Entry number 'index' of a directory (skipping free/LFN/volume slots) */
+s32 fat16_readdir(u16 dir_cluster, u32 index, fat_file_t *out);
+
+/* Returns bytes read or a negative error */
+s32 fat16_read(fat_file_t *file, u32 offset, u8 *buffer, u32 len);
+/* Read 'count' 4KB pages from 'offset' (page aligned) straight into the
+ * given frames, one queued request per contiguous cluster run. Bytes past
+ * the end of the file are left untouched */
+s32 fat16_read_pages(fat_file_t *file, u32 offset, u8 **pages, u32 count);
+/* Create an empty file in a directory */
+s32 fat16_create(u16 dir_cluster, char *name, fat_file_t *out);
+/* Replace the whole contents of a file, updating 'file' */
+s32 fat16_rewrite(fat_file_t *file, u8 *data, u32 len);
+s32 fat16_unlink(u16 dir_cluster, char *name);
+
+/* Path based helpers: create or replace a whole file, delete a file */
+s32 fat16_write_file(char *path, u8 *data, u32 len);
+s32 fat16_remove(char *path);
+
+/* Write the dirty FAT sectors and buffered metadata back */
+s32 fat16_sync();
+void fat16_periodic();
+
+u32 fat16_cluster_size();
+char* fat16_strerror(s32 err);
+
+/* Mount with vfs_mount(path, &fat16_filesystem, block_device) */
+extern filesystem_t fat16_filesystem;
+
+#endif
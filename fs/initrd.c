@@ -0,0 +1,56 @@
+#include "initrd.h"
+#include "ramfs.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+
+static u32 parse_octal(char *s, u32 len) {
+    u32 value = 0;
+    for (u32 i = 0; i < len && s[i] >= '0' && s[i] <= '7'; i++) {
+        value = value * 8 + (s[i] - '0');
+    }
+    return value;
+}
+
+s32 init_initrd() {
+    u8 *pos = initrd_start;
+    s32 files = 0;
+    char path[RAMFS_PATH_LEN];
+
+    while (pos + TAR_BLOCK_SIZE <= initrd_end) {
+        tar_header_t *hdr = (tar_header_t*)pos;
+        if (hdr->name[0] == '\0') break;  /* Two zero blocks end the archive */
+        if (strncmp(hdr->magic, "ustar", 5) != 0) {
+            kprint_color("initrd: not a ustar archive\n", RED_ON_BLACK);
+            return files;
+        }
+
+        u32 size = parse_octal(hdr->size, sizeof(hdr->size));
+        u8 *data = pos + TAR_BLOCK_SIZE;
+
+        /* "./etc/motd" -> "etc/motd", the prefix field carries long paths */
+        char *name = hdr->name;
+        if (name[0] == '.' && name[1] == '/') name += 2;
+        s32 n = 0;
+        if (hdr->prefix[0]) {
+            for (s32 i = 0; i < (s32)sizeof(hdr->prefix) && hdr->prefix[i] && n < RAMFS_PATH_LEN - 2; i++) {
+                path[n++] = hdr->prefix[i];
+            }
+            path[n++] = '/';
+        }
+        for (s32 i = 0; name + i < hdr->name + sizeof(hdr->name) && name[i] && n < RAMFS_PATH_LEN - 1; i++) {
+            path[n++] = name[i];
+        }
+        path[n] = '\0';
+
+        if (hdr->type == TAR_TYPE_DIR) {
+            if (path[0] && ramfs_lookup(path) == NULL) ramfs_create(path, RAMFS_DIR, NULL);
+        } else if (hdr->type == TAR_TYPE_FILE || hdr->type == TAR_TYPE_OLDFILE) {
+            if (ramfs_add_static(path, data, size) == RAMFS_OK) files++;
+        }
+
+        pos = data + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    }
+
+    kprintf_color(GREEN_ON_BLACK, "initrd: %d files (%d KB)\n", files, (u32)(initrd_end - initrd_start) / 1024);
+    return files;
+}
@@ -0,0 +1,39 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "../cpu/types.h"
+
+/* ustar header, one 512-byte block before each member's data */
+#define TAR_BLOCK_SIZE   512
+#define TAR_TYPE_FILE    '0'
+#define TAR_TYPE_OLDFILE '\0'
+#define TAR_TYPE_DIR     '5'
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];      /* Octal ASCII */
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];      /* "ustar" */
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+} __attribute__((packed)) tar_header_t;
+
+/* Archive linked into the kernel image (fs/initrd_image.asm) */
+extern u8 initrd_start[];
+extern u8 initrd_end[];
+
+/* Publish every member of the archive in the ramfs, pointing into the
+ * image rather than copying. Returns the number of files */
+s32 init_initrd();
+
+#endif
@@ -0,0 +1,11 @@
+; The initrd tar archive (built from initrd/ by the Makefile), linked
+; into the kernel image so it is in memory as soon as the kernel is
+[bits 32]
+section .rodata
+global initrd_start
+global initrd_end
+
+align 16
+initrd_start:
+    incbin "initrd.tar"
+initrd_end:
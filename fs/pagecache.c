@@ -0,0 +1,236 @@
+#include "pagecache.h"
+#include "../cpu/paging.h"
+#include "../libc/mem.h"
+#include "../kernel/mutex.h"
+
+static page_t *hash_table[PAGECACHE_HASH_SIZE];
+/* Unpinned pages, most recently released at the head */
+static page_t *lru_head = NULL;
+static page_t *lru_tail = NULL;
+
+/* Held from the lookup in pagecache_get() until the pages it reads are in
+ * the cache, which may sleep on the disk in between. Writes take it too,
+ * so they patch pages read before them rather than race with the read */
+static mutex_t cache_lock = MUTEX_INIT;
+
+static u8 readahead = 1;
+static pagecache_stats_t stats;
+
+static u32 page_bucket(vnode_t *vn, u32 index) {
+    u32 h = ((u32)vn >> 4) ^ (index * 2654435761u);
+    return (h ^ (h >> 16)) & (PAGECACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(page_t *page) {
+    if (page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+    else lru_head = page->lru_next;
+    if (page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+    else lru_tail = page->lru_prev;
+    page->lru_prev = page->lru_next = NULL;
+}
+
+static void lru_push(page_t *page) {
+    page->lru_prev = NULL;
+    page->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = page;
+    else lru_tail = page;
+    lru_head = page;
+}
+
+page_t* pagecache_find(vnode_t *vn, u32 index) {
+    page_t *page = hash_table[page_bucket(vn, index)];
+    while (page && (page->vnode != vn || page->index != index)) page = page->hash_next;
+    return page;
+}
+
+/* Only for unpinned pages */
+static void remove_page(page_t *page) {
+    page_t **link = &hash_table[page_bucket(page->vnode, page->index)];
+    while (*link != page) link = &(*link)->hash_next;
+    *link = page->hash_next;
+
+    if (page->vnode_prev) page->vnode_prev->vnode_next = page->vnode_next;
+    else page->vnode->pages = page->vnode_next;
+    if (page->vnode_next) page->vnode_next->vnode_prev = page->vnode_prev;
+
+    lru_unlink(page);
+    free_frame(page->frame);
+    kfree(page);
+    stats.pages--;
+}
+
+static void insert_page(vnode_t *vn, u32 index, u32 frame) {
+    page_t *page = (page_t*)kmalloc(sizeof(page_t), 0, NULL);
+    if (!page) {
+        free_frame(frame);
+        return;
+    }
+    page->vnode = vn;
+    page->index = index;
+    page->frame = frame;
+    page->mapcount = 0;
+
+    u32 bucket = page_bucket(vn, index);
+    page->hash_next = hash_table[bucket];
+    hash_table[bucket] = page;
+
+    page->vnode_prev = NULL;
+    page->vnode_next = vn->pages;
+    if (vn->pages) vn->pages->vnode_prev = page;
+    vn->pages = page;
+
+    lru_push(page);
+    stats.pages++;
+}
+
+u32 pagecache_shrink(u32 count) {
+    u32 freed = 0;
+    while (freed < count && lru_tail) {
+        remove_page(lru_tail);
+        freed++;
+    }
+    stats.reclaimed += freed;
+    return freed;
+}
+
+/* Read the uncached pages from 'index' on, up to 'count' of them, the end
+ * of file or the first page already cached. Returns how many were read */
+static s32 read_pages(vnode_t *vn, u32 index, u32 count) {
+    u8 *frames[PAGECACHE_RA_MAX];
+    u32 last = (vn->size + FRAME_SIZE - 1) / FRAME_SIZE;
+    if (index >= last) return 0;
+    count = MIN(MIN(count, last - index), PAGECACHE_RA_MAX);
+
+    if (stats.pages + count > PAGECACHE_MAX_PAGES) {
+        pagecache_shrink(stats.pages + count - PAGECACHE_MAX_PAGES);
+    }
+
+    u32 n = 0;
+    for (; n < count && !pagecache_find(vn, index + n); n++) {
+        if (get_free_frame_count() == 0 && pagecache_shrink(count - n) == 0) break;
+        frames[n] = (u8*)alloc_frame();
+        if (!frames[n]) break;
+    }
+    if (n == 0) return pagecache_find(vn, index) ? 0 : VFS_ERR_NO_SPACE;
+
+    s32 err = VFS_OK;
+    if (vn->ops->readpages) {
+        err = vn->ops->readpages(vn, index, frames, n);
+    } else {
+        for (u32 i = 0; i < n && err == VFS_OK; i++) {
+            s32 got = vn->ops->read(vn, (index + i) * FRAME_SIZE, frames[i], FRAME_SIZE);
+            if (got < 0) err = got;
+        }
+    }
+    if (err != VFS_OK) {
+        for (u32 i = 0; i < n; i++) free_frame((u32)frames[i]);
+        return err;
+    }
+
+    for (u32 i = 0; i < n; i++) {
+        /* Whatever lies past the end of file reads as zeros */
+        u32 start = (index + i) * FRAME_SIZE;
+        u32 valid = MIN(FRAME_SIZE, vn->size - start);
+        if (valid < FRAME_SIZE) memory_set(frames[i] + valid, 0, FRAME_SIZE - valid);
+        insert_page(vn, index + i, (u32)frames[i]);
+    }
+    stats.reads++;
+    return n;
+}
+
+static page_t* get_page(vnode_t *vn, u32 index) {
+    page_t *page = pagecache_find(vn, index);
+    u8 sequential = index == 0 || index == vn->ra_last + 1;
+
+    if (page) {
+        stats.hits++;
+        /* A stream running into its last batch: fetch the next one now,
+         * while it still has half a window of cached pages to consume */
+        if (readahead && sequential && vn->ra_window && index + vn->ra_window / 2 >= vn->ra_next) {
+            vn->ra_window = MIN(vn->ra_window * 2, PAGECACHE_RA_MAX);
+            while (vn->ra_next * FRAME_SIZE < vn->size && pagecache_find(vn, vn->ra_next)) vn->ra_next++;
+            s32 n = read_pages(vn, vn->ra_next, vn->ra_window);
+            if (n > 0) {
+                vn->ra_next += n;
+                stats.readahead_pages += n;
+            }
+        }
+    } else {
+        stats.misses++;
+        /* Random access reads one page, a sequential stream ramps up */
+        if (readahead && sequential) {
+            vn->ra_window = vn->ra_window ? MIN(vn->ra_window * 2, PAGECACHE_RA_MAX) : PAGECACHE_RA_MIN;
+        } else {
+            vn->ra_window = 0;
+        }
+        s32 n = read_pages(vn, index, vn->ra_window ? vn->ra_window : 1);
+        if (n <= 0) return NULL;
+        vn->ra_next = index + n;
+        stats.readahead_pages += n - 1;
+        page = pagecache_find(vn, index);
+        if (!page) return NULL;
+    }
+
+    vn->ra_last = index;
+    if (page->mapcount++ == 0) lru_unlink(page);
+    return page;
+}
+
+page_t* pagecache_get(vnode_t *vn, u32 index) {
+    mutex_lock(&cache_lock);
+    page_t *page = get_page(vn, index);
+    mutex_unlock(&cache_lock);
+    return page;
+}
+
+void pagecache_put(page_t *page) {
+    if (--page->mapcount == 0) lru_push(page);
+}
+
+void pagecache_update(vnode_t *vn, u32 offset, u8 *data, u32 len) {
+    mutex_lock(&cache_lock);
+    for (page_t *page = vn->pages; page; page = page->vnode_next) {
+        u32 start = page->index * FRAME_SIZE;
+        if (start >= offset + len || start + FRAME_SIZE <= offset) continue;
+        u32 from = MAX(start, offset);
+        u32 to = MIN(start + FRAME_SIZE, offset + len);
+        memory_copy(data + (from - offset), (u8*)page->frame + (from - start), to - from);
+    }
+    mutex_unlock(&cache_lock);
+}
+
+void pagecache_truncate(vnode_t *vn, u32 size) {
+    mutex_lock(&cache_lock);
+    page_t *page = vn->pages;
+    while (page) {
+        page_t *next = page->vnode_next;
+        u32 start = page->index * FRAME_SIZE;
+        if (start >= size && page->mapcount == 0) {
+            remove_page(page);
+        } else if (start < size && size < start + FRAME_SIZE) {
+            memory_set((u8*)page->frame + (size - start), 0, start + FRAME_SIZE - size);
+        }
+        page = next;
+    }
+    mutex_unlock(&cache_lock);
+}
+
+void pagecache_drop(vnode_t *vn) {
+    page_t *page = vn->pages;
+    while (page) {
+        page_t *next = page->vnode_next;
+        if (page->mapcount == 0) remove_page(page);
+        page = next;
+    }
+    vn->ra_last = 0;
+    vn->ra_next = 0;
+    vn->ra_window = 0;
+}
+
+void pagecache_set_readahead(u8 enabled) {
+    readahead = enabled;
+}
+
+void get_pagecache_stats(pagecache_stats_t *out) {
+    memory_copy((u8*)&stats, (u8*)out, sizeof(pagecache_stats_t));
+}
@@ -0,0 +1,53 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include "../cpu/types.h"
+#include "vfs.h"
+
+#define PAGECACHE_HASH_SIZE  512     /* Buckets, power of two */
+#define PAGECACHE_MAX_PAGES  1024    /* 4MB, unmapped pages beyond this are reclaimed */
+#define PAGECACHE_RA_MIN     4       /* First batch once a stream looks sequential */
+#define PAGECACHE_RA_MAX     32      /* 128KB */
+
+/* One 4KB frame of file data */
+typedef struct page {
+    vnode_t *vnode;
+    u32 index;                   /* Offset in the file / FRAME_SIZE */
+    u32 frame;
+    u32 mapcount;                /* Users of the frame; pins the page */
+    struct page *hash_next;
+    struct page *vnode_prev;     /* Pages of the same vnode */
+    struct page *vnode_next;
+    struct page *lru_prev;       /* Unpinned pages, reclaim order */
+    struct page *lru_next;
+} page_t;
+
+typedef struct {
+    u32 pages;
+    u32 hits;
+    u32 misses;
+    u32 reads;                   /* Batches read from the filesystem */
+    u32 readahead_pages;         /* Pages read before anyone asked for them */
+    u32 reclaimed;
+} pagecache_stats_t;
+
+/* Page 'index' of 'vn' with its mapcount raised, read in (with readahead
+ * for sequential streams) on a miss. NULL past the end of file, on I/O
+ * errors or without memory */
+page_t* pagecache_get(vnode_t *vn, u32 index);
+void pagecache_put(page_t *page);
+/* Cached page or NULL, no I/O and no reference */
+page_t* pagecache_find(vnode_t *vn, u32 index);
+
+/* Keep cached pages coherent with write() and truncation */
+void pagecache_update(vnode_t *vn, u32 offset, u8 *data, u32 len);
+void pagecache_truncate(vnode_t *vn, u32 size);
+/* Free every unpinned page of 'vn' */
+void pagecache_drop(vnode_t *vn);
+/* Free up to 'count' unpinned pages, least recently used first */
+u32 pagecache_shrink(u32 count);
+
+void pagecache_set_readahead(u8 enabled);
+void get_pagecache_stats(pagecache_stats_t *stats);
+
+#endif
@@ -0,0 +1,403 @@
+#include "ramfs.h"
+#include "../cpu/paging.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include "../libc/function.h"
+#include "../mm/zeropool.h"
+
+static ramfs_node_t *hash_table[RAMFS_HASH_SIZE];
+
+/* Every node in creation order, for directory listings */
+static ramfs_node_t *node_head = NULL;
+static ramfs_node_t *node_tail = NULL;
+static u32 node_count = 0;
+
+/* FNV-1a: cheap and spreads similar paths ("f001", "f002"...) well */
+static u32 path_hash(char *path) {
+    u32 h = 2166136261u;
+    while (*path) {
+        h ^= (u8)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Copy 'in' without leading/trailing slashes. Returns 0 if too long */
+static u8 normalize(char *in, char *out) {
+    while (*in == '/') in++;
+    s32 n = 0;
+    while (in[n] != '\0') {
+        if (n == RAMFS_PATH_LEN - 1) return 0;
+        out[n] = in[n];
+        n++;
+    }
+    while (n > 0 && out[n - 1] == '/') n--;
+    out[n] = '\0';
+    return 1;
+}
+
+static ramfs_node_t* lookup_normalized(char *path) {
+    u32 h = path_hash(path);
+    ramfs_node_t *node = hash_table[h & (RAMFS_HASH_SIZE - 1)];
+    while (node && (node->hash != h || strcmp(node->path, path) != 0)) node = node->hash_next;
+    return node;
+}
+
+/* Length of the parent part of a normalized path ("a/b/c" -> 3, "a" -> 0) */
+static s32 parent_len(char *path) {
+    s32 slash = 0;
+    for (s32 i = 0; path[i] != '\0'; i++) {
+        if (path[i] == '/') slash = i;
+    }
+    return slash;
+}
+
+static u8 is_child_of(ramfs_node_t *node, char *dir) {
+    s32 len = parent_len(node->path);
+    if (node->path[0] == '\0') return 0;  /* The root is nobody's child */
+    if (len != strlen(dir)) return 0;
+    return len == 0 || strncmp(node->path, dir, len) == 0;
+}
+
+void init_ramfs() {
+    ramfs_create("", RAMFS_DIR, NULL);
+}
+
+ramfs_node_t* ramfs_lookup(char *path) {
+    char norm[RAMFS_PATH_LEN];
+    if (!normalize(path, norm)) return NULL;
+    return lookup_normalized(norm);
+}
+
+s32 ramfs_create(char *path, u8 type, ramfs_node_t **out) {
+    char norm[RAMFS_PATH_LEN];
+    if (!normalize(path, norm)) return RAMFS_ERR_INVALID;
+    if (lookup_normalized(norm)) return RAMFS_ERR_EXISTS;
+
+    /* Missing parents are created on the way (archives may omit them) */
+    if (norm[0] != '\0') {
+        char parent[RAMFS_PATH_LEN];
+        s32 len = parent_len(norm);
+        memory_copy((u8*)norm, (u8*)parent, len);
+        parent[len] = '\0';
+        ramfs_node_t *dir = lookup_normalized(parent);
+        if (!dir) {
+            s32 err = ramfs_create(parent, RAMFS_DIR, &dir);
+            if (err != RAMFS_OK) return err;
+        }
+        if (dir->type != RAMFS_DIR) return RAMFS_ERR_INVALID;
+    }
+
+    ramfs_node_t *node = (ramfs_node_t*)kmalloc(sizeof(ramfs_node_t), 0, NULL);
+    if (!node) return RAMFS_ERR_NO_SPACE;
+    memory_set((u8*)node, 0, sizeof(ramfs_node_t));
+    strcpy(node->path, norm);
+    node->hash = path_hash(norm);
+    node->type = type;
+
+    u32 bucket = node->hash & (RAMFS_HASH_SIZE - 1);
+    node->hash_next = hash_table[bucket];
+    hash_table[bucket] = node;
+
+    if (node_tail) node_tail->next = node;
+    else node_head = node;
+    node_tail = node;
+    node_count++;
+
+    if (out) *out = node;
+    return RAMFS_OK;
+}
+
+s32 ramfs_add_static(char *path, u8 *data, u32 size) {
+    ramfs_node_t *node;
+    s32 err = ramfs_create(path, RAMFS_FILE, &node);
+    if (err != RAMFS_OK) return err;
+    node->flags = RAMFS_INITRD;
+    node->data = data;
+    node->size = size;
+    return RAMFS_OK;
+}
+
+static void free_frames(ramfs_node_t *node, u32 from_page) {
+    u32 pages = (node->size + FRAME_SIZE - 1) / FRAME_SIZE;
+    for (u32 i = from_page; i < pages; i++) {
+        if (node->frames[i]) free_frame(node->frames[i]);
+        node->frames[i] = 0;
+    }
+}
+
+s32 ramfs_remove(char *path) {
+    char norm[RAMFS_PATH_LEN];
+    if (!normalize(path, norm) || norm[0] == '\0') return RAMFS_ERR_INVALID;
+    ramfs_node_t *node = lookup_normalized(norm);
+    if (!node) return RAMFS_ERR_NOT_FOUND;
+    if (node->type == RAMFS_DIR && ramfs_readdir(norm, 0)) return RAMFS_ERR_INVALID;
+
+    if (node->flags & RAMFS_FRAMES) {
+        free_frames(node, 0);
+        kfree(node->frames);
+    }
+
+    ramfs_node_t **link = &hash_table[node->hash & (RAMFS_HASH_SIZE - 1)];
+    while (*link != node) link = &(*link)->hash_next;
+    *link = node->hash_next;
+
+    ramfs_node_t *prev = NULL;
+    for (ramfs_node_t *n = node_head; n != node; n = n->next) prev = n;
+    if (prev) prev->next = node->next;
+    else node_head = node->next;
+    if (node_tail == node) node_tail = prev;
+    node_count--;
+
+    kfree(node);
+    return RAMFS_OK;
+}
+
+u32 ramfs_map(ramfs_node_t *node, u32 offset, u8 **ptr) {
+    if (node->type != RAMFS_FILE || offset >= node->size) return 0;
+
+    if (node->flags & RAMFS_INITRD) {
+        *ptr = node->data + offset;
+        return node->size - offset;
+    }
+
+    u32 page_off = offset % FRAME_SIZE;
+    *ptr = (u8*)node->frames[offset / FRAME_SIZE] + page_off;
+    return MIN(FRAME_SIZE - page_off, node->size - offset);
+}
+
+s32 ramfs_read(ramfs_node_t *node, u32 offset, u8 *buffer, u32 len) {
+    if (node->type == RAMFS_DIR) return RAMFS_ERR_IS_DIR;
+    u32 done = 0;
+    while (done < len) {
+        u8 *src;
+        u32 n = ramfs_map(node, offset + done, &src);
+        if (n == 0) break;
+        n = MIN(n, len - done);
+        memory_copy(src, buffer + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/* Make sure pages [0, pages) are backed by zeroed frames */
+static s32 ensure_frames(ramfs_node_t *node, u32 pages) {
+    if (pages > node->frames_cap) {
+        u32 cap = node->frames_cap ? node->frames_cap : 4;
+        while (cap < pages) cap *= 2;
+        u32 *frames = (u32*)kmalloc(cap * sizeof(u32), 0, NULL);
+        if (!frames) return RAMFS_ERR_NO_SPACE;
+        memory_set((u8*)frames, 0, cap * sizeof(u32));
+        if (node->frames) {
+            memory_copy((u8*)node->frames, (u8*)frames, node->frames_cap * sizeof(u32));
+            kfree(node->frames);
+        }
+        node->frames = frames;
+        node->frames_cap = cap;
+    }
+
+    for (u32 i = 0; i < pages; i++) {
+        if (node->frames[i]) continue;
+        u32 frame = alloc_frame_zeroed();
+        if (!frame) return RAMFS_ERR_NO_SPACE;
+        node->frames[i] = frame;
+    }
+    return RAMFS_OK;
+}
+
+/* First write to an initrd file: copy it into frames it owns */
+static s32 unshare(ramfs_node_t *node) {
+    u8 *data = node->data;
+    u32 size = node->size;
+    node->flags = RAMFS_FRAMES;
+    node->data = NULL;
+    node->size = 0;
+    s32 err = ensure_frames(node, (size + FRAME_SIZE - 1) / FRAME_SIZE);
+    if (err != RAMFS_OK) return err;
+    node->size = size;
+    return ramfs_write(node, 0, data, size) < 0 ? RAMFS_ERR_NO_SPACE : RAMFS_OK;
+}
+
+s32 ramfs_write(ramfs_node_t *node, u32 offset, u8 *data, u32 len) {
+    if (node->type == RAMFS_DIR) return RAMFS_ERR_IS_DIR;
+    if (node->flags & RAMFS_INITRD) {
+        s32 err = unshare(node);
+        if (err != RAMFS_OK) return err;
+    }
+    node->flags = RAMFS_FRAMES;
+
+    u32 end = offset + len;
+    s32 err = ensure_frames(node, (end + FRAME_SIZE - 1) / FRAME_SIZE);
+    if (err != RAMFS_OK) return err;
+    if (end > node->size) node->size = end;
+
+    u32 done = 0;
+    while (done < len) {
+        u8 *dst;
+        u32 n = MIN(ramfs_map(node, offset + done, &dst), len - done);
+        memory_copy(data + done, dst, n);
+        done += n;
+    }
+    return done;
+}
+
+s32 ramfs_truncate(ramfs_node_t *node, u32 size) {
+    if (node->type == RAMFS_DIR) return RAMFS_ERR_IS_DIR;
+    if (node->flags & RAMFS_INITRD) {
+        if (size <= node->size) {
+            node->size = size;
+            return RAMFS_OK;
+        }
+        s32 err = unshare(node);
+        if (err != RAMFS_OK) return err;
+    }
+    node->flags = RAMFS_FRAMES;
+
+    if (size < node->size) {
+        free_frames(node, (size + FRAME_SIZE - 1) / FRAME_SIZE);
+        /* Growing again later must read zeros past the new end */
+        if (size % FRAME_SIZE) {
+            u8 *last = (u8*)node->frames[size / FRAME_SIZE];
+            memory_set(last + size % FRAME_SIZE, 0, FRAME_SIZE - size % FRAME_SIZE);
+        }
+    } else {
+        s32 err = ensure_frames(node, (size + FRAME_SIZE - 1) / FRAME_SIZE);
+        if (err != RAMFS_OK) return err;
+    }
+    node->size = size;
+    return RAMFS_OK;
+}
+
+ramfs_node_t* ramfs_readdir(char *dir, u32 index) {
+    char norm[RAMFS_PATH_LEN];
+    if (!normalize(dir, norm)) return NULL;
+    for (ramfs_node_t *node = node_head; node; node = node->next) {
+        if (is_child_of(node, norm) && index-- == 0) return node;
+    }
+    return NULL;
+}
+
+char* ramfs_basename(ramfs_node_t *node) {
+    s32 len = parent_len(node->path);
+    return len ? node->path + len + 1 : node->path;
+}
+
+u32 ramfs_file_count() {
+    return node_count;
+}
+
+char* ramfs_strerror(s32 err) {
+    switch (err) {
+        case RAMFS_OK: return "ok";
+        case RAMFS_ERR_NOT_FOUND: return "not found";
+        case RAMFS_ERR_EXISTS: return "already exists";
+        case RAMFS_ERR_NO_SPACE: return "out of memory";
+        case RAMFS_ERR_INVALID: return "invalid path";
+        case RAMFS_ERR_IS_DIR: return "is a directory";
+        default: return "error";
+    }
+}
+
+/* VFS glue. Inode numbers are node addresses */
+
+static s32 vfs_error(s32 err) {
+    switch (err) {
+        case RAMFS_OK: return VFS_OK;
+        case RAMFS_ERR_NOT_FOUND: return VFS_ERR_NOT_FOUND;
+        case RAMFS_ERR_EXISTS: return VFS_ERR_EXISTS;
+        case RAMFS_ERR_NO_SPACE: return VFS_ERR_NO_SPACE;
+        case RAMFS_ERR_IS_DIR: return VFS_ERR_IS_DIR;
+        default: return VFS_ERR_INVALID;
+    }
+}
+
+static s32 get_vnode(mount_t *mnt, ramfs_node_t *node, vnode_t **out) {
+    u8 fresh;
+    vnode_t *vn = vfs_iget(mnt, (u32)node, &fresh);
+    if (!vn) return VFS_ERR_NO_SPACE;
+    if (fresh) {
+        vn->type = node->type == RAMFS_DIR ? VFS_DIR : VFS_FILE;
+        vn->fs_data = node;
+    }
+    vn->size = node->size;
+    *out = vn;
+    return VFS_OK;
+}
+
+/* Full ramfs path of 'name' inside directory 'dir' */
+static u8 child_path(vnode_t *dir, char *name, char *out) {
+    ramfs_node_t *node = (ramfs_node_t*)dir->fs_data;
+    s32 len = strlen(node->path);
+    if (len + strlen(name) + 2 > RAMFS_PATH_LEN) return 0;
+    strcpy(out, node->path);
+    if (len) out[len++] = '/';
+    strcpy(out + len, name);
+    return 1;
+}
+
+static s32 ramfs_vop_lookup(vnode_t *dir, char *name, vnode_t **out) {
+    char path[RAMFS_PATH_LEN];
+    if (!child_path(dir, name, path)) return VFS_ERR_INVALID;
+    ramfs_node_t *node = lookup_normalized(path);
+    if (!node) return VFS_ERR_NOT_FOUND;
+    return get_vnode(dir->mount, node, out);
+}
+
+static s32 ramfs_vop_read(vnode_t *vn, u32 offset, u8 *buffer, u32 len) {
+    s32 n = ramfs_read((ramfs_node_t*)vn->fs_data, offset, buffer, len);
+    return n < 0 ? vfs_error(n) : n;
+}
+
+static s32 ramfs_vop_write(vnode_t *vn, u32 offset, u8 *data, u32 len) {
+    ramfs_node_t *node = (ramfs_node_t*)vn->fs_data;
+    s32 n = ramfs_write(node, offset, data, len);
+    vn->size = node->size;
+    return n < 0 ? vfs_error(n) : n;
+}
+
+static s32 ramfs_vop_truncate(vnode_t *vn, u32 size) {
+    ramfs_node_t *node = (ramfs_node_t*)vn->fs_data;
+    s32 err = ramfs_truncate(node, size);
+    vn->size = node->size;
+    return vfs_error(err);
+}
+
+static s32 ramfs_vop_create(vnode_t *dir, char *name, u8 type, vnode_t **out) {
+    char path[RAMFS_PATH_LEN];
+    ramfs_node_t *node;
+    if (!child_path(dir, name, path)) return VFS_ERR_INVALID;
+    s32 err = ramfs_create(path, type == VFS_DIR ? RAMFS_DIR : RAMFS_FILE, &node);
+    if (err != RAMFS_OK) return vfs_error(err);
+    return get_vnode(dir->mount, node, out);
+}
+
+static s32 ramfs_vop_unlink(vnode_t *dir, char *name) {
+    char path[RAMFS_PATH_LEN];
+    if (!child_path(dir, name, path)) return VFS_ERR_INVALID;
+    return vfs_error(ramfs_remove(path));
+}
+
+static s32 ramfs_vop_readdir(vnode_t *dir, u32 index, vfs_dirent_t *out) {
+    ramfs_node_t *node = ramfs_readdir(((ramfs_node_t*)dir->fs_data)->path, index);
+    if (!node) return VFS_ERR_NOT_FOUND;
+
+    char *name = ramfs_basename(node);
+    s32 n = MIN(strlen(name), VFS_NAME_LEN - 1);
+    memory_copy((u8*)name, (u8*)out->name, n);
+    out->name[n] = '\0';
+    out->type = node->type == RAMFS_DIR ? VFS_DIR : VFS_FILE;
+    out->size = node->size;
+    return VFS_OK;
+}
+
+static s32 ramfs_vfs_mount(mount_t *mnt, void *data, vnode_t **root) {
+    UNUSED(data);
+    return get_vnode(mnt, lookup_normalized(""), root);
+}
+
+static vnode_ops_t ramfs_vops = {
+    ramfs_vop_lookup, ramfs_vop_read, NULL, ramfs_vop_write, ramfs_vop_truncate,
+    ramfs_vop_create, ramfs_vop_unlink, ramfs_vop_readdir, NULL
+};
+
+filesystem_t ramfs_filesystem = {"ramfs", 0, &ramfs_vops, ramfs_vfs_mount};
@@ -0,0 +1,67 @@
+#ifndef RAMFS_H
+#define RAMFS_H
+
+#include "../cpu/types.h"
+#include "vfs.h"
+
+#define RAMFS_PATH_LEN   64
+#define RAMFS_HASH_SIZE  256     /* Buckets in the path index, power of two */
+
+/* Node types */
+#define RAMFS_FILE       1
+#define RAMFS_DIR        2
+
+/* Where a file's bytes live */
+#define RAMFS_INITRD     0x1     /* Read-only, points into the initrd image */
+#define RAMFS_FRAMES     0x2     /* tmpfs: one frame per 4KB page */
+
+/* Error codes */
+#define RAMFS_OK         0
+#define RAMFS_ERR_NOT_FOUND  -1
+#define RAMFS_ERR_EXISTS     -2
+#define RAMFS_ERR_NO_SPACE   -3
+#define RAMFS_ERR_INVALID    -4
+#define RAMFS_ERR_IS_DIR     -5
+
+typedef struct ramfs_node {
+    char path[RAMFS_PATH_LEN];   /* Full path without the leading '/' */
+    u32 hash;
+    u8 type;
+    u8 flags;
+    u32 size;
+    u8 *data;                    /* RAMFS_INITRD */
+    u32 *frames;                 /* RAMFS_FRAMES */
+    u32 frames_cap;
+    struct ramfs_node *hash_next;
+    struct ramfs_node *next;     /* All nodes, for directory listings */
+} ramfs_node_t;
+
+void init_ramfs();
+
+/* O(1) lookup through the hashed path index. Leading '/' is optional */
+ramfs_node_t* ramfs_lookup(char *path);
+s32 ramfs_create(char *path, u8 type, ramfs_node_t **out);
+/* Register a file whose bytes stay in place (initrd), no copy is made */
+s32 ramfs_add_static(char *path, u8 *data, u32 size);
+s32 ramfs_remove(char *path);
+
+/* Zero-copy access: pointer to the byte at 'offset' and how many bytes
+ * are contiguous from there. Returns 0 at end of file */
+u32 ramfs_map(ramfs_node_t *node, u32 offset, u8 **ptr);
+/* Copying helpers built on ramfs_map() */
+s32 ramfs_read(ramfs_node_t *node, u32 offset, u8 *buffer, u32 len);
+s32 ramfs_write(ramfs_node_t *node, u32 offset, u8 *data, u32 len);
+s32 ramfs_truncate(ramfs_node_t *node, u32 size);
+
+/* Child number 'index' of a directory ("" for the root) */
+ramfs_node_t* ramfs_readdir(char *dir, u32 index);
+/* Last path component of a node */
+char* ramfs_basename(ramfs_node_t *node);
+
+u32 ramfs_file_count();
+char* ramfs_strerror(s32 err);
+
+/* Mount with vfs_mount(path, &ramfs_filesystem, NULL) */
+extern filesystem_t ramfs_filesystem;
+
+#endif
@@ -0,0 +1,514 @@
+#include "vfs.h"
+#include "pagecache.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+/* A cached name -> vnode translation within one directory */
+typedef struct dentry {
+    vnode_t *parent;            /* Referenced */
+    vnode_t *vnode;             /* Referenced, NULL for a negative entry */
+    u32 hash;
+    char name[VFS_NAME_LEN];
+    struct dentry *hash_next;   /* Also links the free list */
+    struct dentry *lru_prev;
+    struct dentry *lru_next;
+} dentry_t;
+
+static mount_t mounts[VFS_MAX_MOUNTS];
+static vnode_t *root_vnode = NULL;
+
+static dentry_t dentries[VFS_DCACHE_SIZE];
+static dentry_t *dentry_hash[VFS_DCACHE_HASH];
+static dentry_t *dentry_free = NULL;
+/* Most recently used at the head, recycled from the tail */
+static dentry_t *dentry_lru_head = NULL;
+static dentry_t *dentry_lru_tail = NULL;
+
+static vnode_t *inode_hash[VFS_ICACHE_HASH];
+/* Unreferenced inodes, most recently released at the head */
+static vnode_t *unused_head = NULL;
+static vnode_t *unused_tail = NULL;
+
+static vfs_stats_t stats;
+
+/* FNV-1a over the name, seeded with the parent so equal names in
+ * different directories land in different buckets */
+static u32 name_hash(vnode_t *parent, char *name) {
+    u32 h = (2166136261u ^ (u32)parent) * 16777619u;
+    while (*name) {
+        h ^= (u8)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static u32 inode_bucket(mount_t *mnt, u32 ino) {
+    u32 h = (ino ^ (u32)mnt) * 2654435761u;
+    return (h ^ (h >> 16)) & (VFS_ICACHE_HASH - 1);
+}
+
+static void upcase(char *name) {
+    for (; *name; name++) {
+        if (*name >= 'a' && *name <= 'z') *name -= 'a' - 'A';
+    }
+}
+
+/* --- Inode cache --- */
+
+static void unused_unlink(vnode_t *vn) {
+    if (vn->lru_prev) vn->lru_prev->lru_next = vn->lru_next;
+    else unused_head = vn->lru_next;
+    if (vn->lru_next) vn->lru_next->lru_prev = vn->lru_prev;
+    else unused_tail = vn->lru_prev;
+    vn->lru_prev = vn->lru_next = NULL;
+    stats.inodes_unused--;
+}
+
+static void unused_push(vnode_t *vn) {
+    vn->lru_prev = NULL;
+    vn->lru_next = unused_head;
+    if (unused_head) unused_head->lru_prev = vn;
+    else unused_tail = vn;
+    unused_head = vn;
+    stats.inodes_unused++;
+}
+
+static void inode_unhash(vnode_t *vn) {
+    vnode_t **link = &inode_hash[inode_bucket(vn->mount, vn->ino)];
+    while (*link && *link != vn) link = &(*link)->hash_next;
+    if (*link) *link = vn->hash_next;
+    vn->hash_next = NULL;
+}
+
+static void evict(vnode_t *vn) {
+    vnode_t *parent = vn->parent;
+    inode_unhash(vn);
+    pagecache_drop(vn);
+    if (vn->ops && vn->ops->release) vn->ops->release(vn);
+    kfree(vn);
+    stats.inodes--;
+    stats.inode_evictions++;
+    vfs_iput(parent);
+}
+
+vnode_t* vfs_iget(mount_t *mnt, u32 ino, u8 *fresh) {
+    u32 bucket = inode_bucket(mnt, ino);
+    vnode_t *vn = inode_hash[bucket];
+    while (vn && (vn->mount != mnt || vn->ino != ino)) vn = vn->hash_next;
+    if (vn) {
+        if (vn->refcount++ == 0) unused_unlink(vn);
+        *fresh = 0;
+        return vn;
+    }
+
+    vn = (vnode_t*)kmalloc(sizeof(vnode_t), 0, NULL);
+    if (!vn && vfs_shrink(0)) vn = (vnode_t*)kmalloc(sizeof(vnode_t), 0, NULL);
+    if (!vn) return NULL;
+    memory_set((u8*)vn, 0, sizeof(vnode_t));
+    vn->mount = mnt;
+    vn->ino = ino;
+    vn->ops = mnt->fs->ops;
+    vn->refcount = 1;
+    vn->hash_next = inode_hash[bucket];
+    inode_hash[bucket] = vn;
+    stats.inodes++;
+    *fresh = 1;
+    return vn;
+}
+
+void vfs_igrab(vnode_t *vn) {
+    vn->refcount++;
+}
+
+void vfs_iput(vnode_t *vn) {
+    if (!vn || --vn->refcount > 0) return;
+    if (vn->flags & VFS_VNODE_DEAD) {
+        evict(vn);
+        return;
+    }
+    unused_push(vn);
+    if (stats.inodes_unused > VFS_ICACHE_UNUSED) {
+        vnode_t *victim = unused_tail;
+        unused_unlink(victim);
+        evict(victim);
+    }
+}
+
+/* --- Dentry cache --- */
+
+static void dentry_lru_unlink(dentry_t *d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else dentry_lru_head = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else dentry_lru_tail = d->lru_prev;
+}
+
+static void dentry_lru_push(dentry_t *d) {
+    d->lru_prev = NULL;
+    d->lru_next = dentry_lru_head;
+    if (dentry_lru_head) dentry_lru_head->lru_prev = d;
+    else dentry_lru_tail = d;
+    dentry_lru_head = d;
+}
+
+static dentry_t* d_lookup(vnode_t *parent, char *name, u32 hash) {
+    dentry_t *d = dentry_hash[hash & (VFS_DCACHE_HASH - 1)];
+    while (d && (d->hash != hash || d->parent != parent || strcmp(d->name, name) != 0)) {
+        d = d->hash_next;
+    }
+    if (d && d != dentry_lru_head) {
+        dentry_lru_unlink(d);
+        dentry_lru_push(d);
+    }
+    return d;
+}
+
+static void d_drop(dentry_t *d) {
+    dentry_t **link = &dentry_hash[d->hash & (VFS_DCACHE_HASH - 1)];
+    while (*link != d) link = &(*link)->hash_next;
+    *link = d->hash_next;
+    dentry_lru_unlink(d);
+
+    vnode_t *vn = d->vnode;
+    vnode_t *parent = d->parent;
+    d->hash_next = dentry_free;
+    dentry_free = d;
+    stats.dentries--;
+
+    vfs_iput(vn);
+    vfs_iput(parent);
+}
+
+/* Cache parent/name -> vn (NULL: known not to exist), replacing any entry */
+static void d_set(vnode_t *parent, char *name, u32 hash, vnode_t *vn) {
+    if (vn) vfs_igrab(vn);
+    dentry_t *d = d_lookup(parent, name, hash);
+    if (d) {
+        vfs_iput(d->vnode);
+        d->vnode = vn;
+        return;
+    }
+
+    if (!dentry_free) d_drop(dentry_lru_tail);
+    d = dentry_free;
+    dentry_free = d->hash_next;
+
+    vfs_igrab(parent);
+    d->parent = parent;
+    d->vnode = vn;
+    d->hash = hash;
+    strcpy(d->name, name);
+    u32 bucket = hash & (VFS_DCACHE_HASH - 1);
+    d->hash_next = dentry_hash[bucket];
+    dentry_hash[bucket] = d;
+    dentry_lru_push(d);
+    stats.dentries++;
+}
+
+u32 vfs_shrink(u8 all) {
+    u32 evictions = stats.inode_evictions;
+
+    /* Dentries pin their inodes: drop the older half (or all) first */
+    u32 keep = all ? 0 : stats.dentries / 2;
+    while (stats.dentries > keep) d_drop(dentry_lru_tail);
+
+    while (unused_tail) {
+        vnode_t *victim = unused_tail;
+        unused_unlink(victim);
+        evict(victim);
+    }
+    return stats.inode_evictions - evictions;
+}
+
+/* --- Path walk --- */
+
+/* Copy the next component of 'path' into 'name' and return the rest,
+ * or NULL if the component is too long. An empty name ends the walk */
+static char* next_component(char *path, char *name) {
+    while (*path == '/') path++;
+    u32 n = 0;
+    while (*path && *path != '/') {
+        if (n == VFS_NAME_LEN - 1) return NULL;
+        name[n++] = *path++;
+    }
+    name[n] = '\0';
+    return path;
+}
+
+/* One component from 'dir'. Returns a referenced vnode, stepping onto
+ * the root of anything mounted there */
+static s32 step(vnode_t *dir, char *name, vnode_t **out) {
+    if (dir->type != VFS_DIR) return VFS_ERR_NOT_DIR;
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        if (name[1] == '.') {
+            /* Leave mounted filesystems through the directory they cover */
+            while (dir == dir->mount->root && dir->mount->covered) dir = dir->mount->covered;
+            if (dir->parent) dir = dir->parent;
+        }
+        vfs_igrab(dir);
+        *out = dir;
+        return VFS_OK;
+    }
+
+    if (dir->mount->fs->flags & VFS_FS_NOCASE) upcase(name);
+    u32 hash = name_hash(dir, name);
+    vnode_t *vn;
+    dentry_t *d = d_lookup(dir, name, hash);
+    if (d) {
+        if (!d->vnode) {
+            stats.dcache_negative++;
+            return VFS_ERR_NOT_FOUND;
+        }
+        stats.dcache_hits++;
+        vn = d->vnode;
+        vfs_igrab(vn);
+    } else {
+        if (!dir->ops->lookup) return VFS_ERR_NOT_SUPPORTED;
+        stats.fs_lookups++;
+        s32 err = dir->ops->lookup(dir, name, &vn);
+        if (err == VFS_ERR_NOT_FOUND) d_set(dir, name, hash, NULL);
+        if (err != VFS_OK) return err;
+        if (!vn->parent) {
+            vfs_igrab(dir);
+            vn->parent = dir;
+        }
+        d_set(dir, name, hash, vn);
+    }
+
+    while (vn->mounted) {
+        vnode_t *root = vn->mounted->root;
+        vfs_igrab(root);
+        vfs_iput(vn);
+        vn = root;
+    }
+    *out = vn;
+    return VFS_OK;
+}
+
+s32 vfs_resolve(char *path, vnode_t **out) {
+    char name[VFS_NAME_LEN];
+    if (!root_vnode) return VFS_ERR_NOT_FOUND;
+
+    vnode_t *vn = root_vnode;
+    vfs_igrab(vn);
+    while (1) {
+        path = next_component(path, name);
+        if (!path) {
+            vfs_iput(vn);
+            return VFS_ERR_INVALID;
+        }
+        if (name[0] == '\0') break;
+
+        vnode_t *next;
+        s32 err = step(vn, name, &next);
+        vfs_iput(vn);
+        if (err != VFS_OK) return err;
+        vn = next;
+    }
+    *out = vn;
+    return VFS_OK;
+}
+
+/* Split "a/b/c" into a referenced vnode for "a/b" and the name "c" */
+static s32 resolve_parent(char *path, vnode_t **dir, char *name) {
+    char parent[VFS_MAX_PATH];
+    s32 len = strlen(path);
+    if (len >= VFS_MAX_PATH) return VFS_ERR_INVALID;
+    strcpy(parent, path);
+    while (len > 0 && parent[len - 1] == '/') len--;
+    parent[len] = '\0';
+
+    s32 slash = len - 1;
+    while (slash >= 0 && parent[slash] != '/') slash--;
+    if (len - slash - 1 >= VFS_NAME_LEN) return VFS_ERR_INVALID;
+    strcpy(name, &parent[slash + 1]);
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return VFS_ERR_INVALID;
+    }
+    parent[slash < 0 ? 0 : slash] = '\0';
+
+    s32 err = vfs_resolve(parent, dir);
+    if (err != VFS_OK) return err;
+    if ((*dir)->type != VFS_DIR) {
+        vfs_iput(*dir);
+        return VFS_ERR_NOT_DIR;
+    }
+    if ((*dir)->mount->fs->flags & VFS_FS_NOCASE) upcase(name);
+    return VFS_OK;
+}
+
+s32 vfs_create(char *path, u8 type, vnode_t **out) {
+    char name[VFS_NAME_LEN];
+    vnode_t *dir, *vn;
+    s32 err = resolve_parent(path, &dir, name);
+    if (err != VFS_OK) return err;
+
+    err = step(dir, name, &vn);
+    if (err == VFS_OK) {
+        vfs_iput(vn);
+        err = VFS_ERR_EXISTS;
+    } else if (err == VFS_ERR_NOT_FOUND) {
+        err = dir->ops->create ? dir->ops->create(dir, name, type, &vn) : VFS_ERR_NOT_SUPPORTED;
+    }
+    if (err == VFS_OK) {
+        if (!vn->parent) {
+            vfs_igrab(dir);
+            vn->parent = dir;
+        }
+        d_set(dir, name, name_hash(dir, name), vn);
+        if (out) *out = vn;
+        else vfs_iput(vn);
+    }
+    vfs_iput(dir);
+    return err;
+}
+
+s32 vfs_unlink(char *path) {
+    char name[VFS_NAME_LEN];
+    vnode_t *dir, *vn;
+    s32 err = resolve_parent(path, &dir, name);
+    if (err != VFS_OK) return err;
+
+    err = step(dir, name, &vn);
+    if (err != VFS_OK) {
+        vfs_iput(dir);
+        return err;
+    }
+
+    if (vn == vn->mount->root) err = VFS_ERR_BUSY;
+    else if (!dir->ops->unlink) err = VFS_ERR_NOT_SUPPORTED;
+    else err = dir->ops->unlink(dir, name);
+
+    if (err == VFS_OK) {
+        /* The name now caches as absent; the inode number may be reused */
+        d_set(dir, name, name_hash(dir, name), NULL);
+        inode_unhash(vn);
+        vn->flags |= VFS_VNODE_DEAD;
+    }
+    vfs_iput(vn);
+    vfs_iput(dir);
+    return err;
+}
+
+s32 vfs_readdir(vnode_t *dir, u32 index, vfs_dirent_t *out) {
+    if (dir->type != VFS_DIR) return VFS_ERR_NOT_DIR;
+    if (!dir->ops->readdir) return VFS_ERR_NOT_SUPPORTED;
+    return dir->ops->readdir(dir, index, out);
+}
+
+/* --- Open files --- */
+
+s32 vfs_open(char *path, u8 flags, file_t *file) {
+    vnode_t *vn;
+    s32 err = vfs_resolve(path, &vn);
+    if (err == VFS_ERR_NOT_FOUND && (flags & VFS_O_CREATE)) err = vfs_create(path, VFS_FILE, &vn);
+    if (err != VFS_OK) return err;
+
+    if (vn->type == VFS_DIR) err = VFS_ERR_IS_DIR;
+    else if (flags & VFS_O_TRUNC) {
+        err = vn->ops->truncate ? vn->ops->truncate(vn, 0) : VFS_ERR_NOT_SUPPORTED;
+        if (err == VFS_OK) pagecache_truncate(vn, 0);
+    }
+    if (err != VFS_OK) {
+        vfs_iput(vn);
+        return err;
+    }
+
+    file->vnode = vn;
+    file->offset = 0;
+    file->flags = flags;
+    return VFS_OK;
+}
+
+s32 vfs_read(file_t *file, u8 *buffer, u32 len) {
+    vnode_t *vn = file->vnode;
+    if (vn->flags & VFS_VNODE_DEAD) return VFS_ERR_NOT_FOUND;
+    if (!vn->ops->read) return VFS_ERR_NOT_SUPPORTED;
+    s32 n = vn->ops->read(vn, file->offset, buffer, len);
+    if (n > 0) file->offset += n;
+    return n;
+}
+
+s32 vfs_write(file_t *file, u8 *data, u32 len) {
+    vnode_t *vn = file->vnode;
+    if (vn->flags & VFS_VNODE_DEAD) return VFS_ERR_NOT_FOUND;
+    if (!vn->ops->write) return VFS_ERR_NOT_SUPPORTED;
+    s32 n = vn->ops->write(vn, file->offset, data, len);
+    if (n > 0) {
+        pagecache_update(vn, file->offset, data, n);
+        file->offset += n;
+    }
+    return n;
+}
+
+void vfs_close(file_t *file) {
+    vfs_iput(file->vnode);
+    file->vnode = NULL;
+}
+
+/* --- Mounts --- */
+
+void init_vfs() {
+    for (s32 i = VFS_DCACHE_SIZE - 1; i >= 0; i--) {
+        dentries[i].hash_next = dentry_free;
+        dentry_free = &dentries[i];
+    }
+}
+
+s32 vfs_mount(char *path, filesystem_t *fs, void *data) {
+    mount_t *mnt = NULL;
+    for (u32 i = 0; i < VFS_MAX_MOUNTS && !mnt; i++) {
+        if (!mounts[i].used) mnt = &mounts[i];
+    }
+    if (!mnt) return VFS_ERR_NO_SPACE;
+
+    /* The first mount must be "/", everything else goes on a directory */
+    vnode_t *covered = NULL;
+    if (root_vnode) {
+        s32 err = vfs_resolve(path, &covered);
+        if (err != VFS_OK) return err;
+        if (covered->type != VFS_DIR || covered == covered->mount->root) {
+            err = covered->type != VFS_DIR ? VFS_ERR_NOT_DIR : VFS_ERR_BUSY;
+            vfs_iput(covered);
+            return err;
+        }
+    } else if (strcmp(path, "/") != 0) {
+        return VFS_ERR_NOT_FOUND;
+    }
+
+    mnt->fs = fs;
+    mnt->covered = covered;
+    mnt->used = 1;
+    s32 err = fs->mount(mnt, data, &mnt->root);
+    if (err != VFS_OK) {
+        mnt->used = 0;
+        vfs_iput(covered);
+        return err;
+    }
+
+    /* The mount keeps its references to both vnodes */
+    if (covered) covered->mounted = mnt;
+    else root_vnode = mnt->root;
+    return VFS_OK;
+}
+
+void get_vfs_stats(vfs_stats_t *out) {
+    memory_copy((u8*)&stats, (u8*)out, sizeof(vfs_stats_t));
+}
+
+char* vfs_strerror(s32 err) {
+    switch (err) {
+        case VFS_OK: return "ok";
+        case VFS_ERR_NOT_FOUND: return "not found";
+        case VFS_ERR_EXISTS: return "already exists";
+        case VFS_ERR_NO_SPACE: return "no space";
+        case VFS_ERR_INVALID: return "invalid path";
+        case VFS_ERR_IS_DIR: return "is a directory";
+        case VFS_ERR_NOT_DIR: return "not a directory";
+        case VFS_ERR_IO: return "I/O error";
+        case VFS_ERR_NOT_SUPPORTED: return "not supported";
+        case VFS_ERR_BUSY: return "busy";
+        default: return "error";
+    }
+}
@@ -0,0 +1,145 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include "../cpu/types.h"
+
+#define VFS_NAME_LEN       32      /* One path component, with the NUL */
+#define VFS_MAX_PATH       128
+#define VFS_MAX_MOUNTS     8
+
+#define VFS_DCACHE_SIZE    512     /* Dentries in the pool */
+#define VFS_DCACHE_HASH    256     /* Buckets, power of two */
+#define VFS_ICACHE_HASH    128     /* Buckets, power of two */
+#define VFS_ICACHE_UNUSED  128     /* Unreferenced inodes kept before reclaim */
+
+/* Vnode types */
+#define VFS_FILE           1
+#define VFS_DIR            2
+
+/* Vnode flags */
+#define VFS_VNODE_DEAD     0x1     /* Unlinked, freed on the last release */
+
+/* Filesystem flags */
+#define VFS_FS_NOCASE      0x1     /* Names compare case-insensitively */
+
+/* vfs_open() flags */
+#define VFS_O_CREATE       0x1
+#define VFS_O_TRUNC        0x2
+
+/* Error codes */
+#define VFS_OK                 0
+#define VFS_ERR_NOT_FOUND      -1
+#define VFS_ERR_EXISTS         -2
+#define VFS_ERR_NO_SPACE       -3
+#define VFS_ERR_INVALID        -4
+#define VFS_ERR_IS_DIR         -5
+#define VFS_ERR_NOT_DIR        -6
+#define VFS_ERR_IO             -7
+#define VFS_ERR_NOT_SUPPORTED  -8
+#define VFS_ERR_BUSY           -9
+
+struct vnode;
+struct mount;
+struct page;
+
+typedef struct {
+    char name[VFS_NAME_LEN];
+    u8 type;
+    u32 size;
+} vfs_dirent_t;
+
+/* Filesystem entry points. Lookups and creates hand back a referenced
+ * vnode obtained through vfs_iget(). Any may be NULL if unsupported */
+typedef struct {
+    s32 (*lookup)(struct vnode *dir, char *name, struct vnode **out);
+    s32 (*read)(struct vnode *vn, u32 offset, u8 *buffer, u32 len);
+    /* Fill 'count' 4KB frames from page 'index' on, for the page cache */
+    s32 (*readpages)(struct vnode *vn, u32 index, u8 **pages, u32 count);
+    s32 (*write)(struct vnode *vn, u32 offset, u8 *data, u32 len);
+    s32 (*truncate)(struct vnode *vn, u32 size);
+    s32 (*create)(struct vnode *dir, char *name, u8 type, struct vnode **out);
+    s32 (*unlink)(struct vnode *dir, char *name);
+    s32 (*readdir)(struct vnode *dir, u32 index, vfs_dirent_t *out);
+    /* Inode leaves the cache: free fs_data */
+    void (*release)(struct vnode *vn);
+} vnode_ops_t;
+
+typedef struct vnode {
+    struct mount *mount;
+    u32 ino;                     /* Unique within the mount */
+    u8 type;
+    u8 flags;
+    u32 size;
+    u32 refcount;
+    void *fs_data;
+    vnode_ops_t *ops;
+    struct vnode *parent;        /* Referenced, for ".." */
+    struct mount *mounted;       /* Filesystem mounted on this directory */
+    struct page *pages;          /* Page cache, see pagecache.h */
+    u32 ra_last;                 /* Readahead: last page index accessed */
+    u32 ra_next;                 /* Readahead: first page not read ahead yet */
+    u32 ra_window;               /* Readahead: pages per batch, 0 when random */
+    struct vnode *hash_next;
+    struct vnode *lru_prev;      /* Unused list, while refcount is 0 */
+    struct vnode *lru_next;
+} vnode_t;
+
+typedef struct {
+    char *name;
+    u8 flags;
+    vnode_ops_t *ops;            /* Given to every vnode of the filesystem */
+    /* Set up the root vnode of a new mount. 'data' is filesystem specific */
+    s32 (*mount)(struct mount *mnt, void *data, vnode_t **root);
+} filesystem_t;
+
+typedef struct mount {
+    filesystem_t *fs;
+    vnode_t *root;
+    vnode_t *covered;            /* Directory the mount hides, NULL for "/" */
+    u8 used;
+} mount_t;
+
+typedef struct {
+    vnode_t *vnode;
+    u32 offset;
+    u8 flags;
+} file_t;
+
+typedef struct {
+    u32 dcache_hits;
+    u32 dcache_negative;         /* Hits on a cached "does not exist" */
+    u32 fs_lookups;              /* Misses that went to the filesystem */
+    u32 dentries;
+    u32 inodes;
+    u32 inodes_unused;
+    u32 inode_evictions;
+} vfs_stats_t;
+
+void init_vfs();
+s32 vfs_mount(char *path, filesystem_t *fs, void *data);
+
+/* Inode cache, for filesystems: a referenced vnode for (mnt, ino).
+ * '*fresh' is set when the caller has to fill in type, size and fs_data.
+ * Returns NULL when out of memory */
+vnode_t* vfs_iget(mount_t *mnt, u32 ino, u8 *fresh);
+void vfs_igrab(vnode_t *vn);
+void vfs_iput(vnode_t *vn);
+
+/* Path walk through the dentry cache. Returns a referenced vnode */
+s32 vfs_resolve(char *path, vnode_t **out);
+s32 vfs_create(char *path, u8 type, vnode_t **out);
+s32 vfs_unlink(char *path);
+s32 vfs_readdir(vnode_t *dir, u32 index, vfs_dirent_t *out);
+
+s32 vfs_open(char *path, u8 flags, file_t *file);
+s32 vfs_read(file_t *file, u8 *buffer, u32 len);
+s32 vfs_write(file_t *file, u8 *data, u32 len);
+void vfs_close(file_t *file);
+
+/* Drop cached dentries and unused inodes (memory pressure, benchmarks).
+ * Returns the number of inodes freed */
+u32 vfs_shrink(u8 all);
+void get_vfs_stats(vfs_stats_t *stats);
+char* vfs_strerror(s32 err);
+
+#endif
@@ -0,0 +1,205 @@
+#include "bench.h"
+#include "command.h"
+#include "stream.h"
+#include "../cpu/paging.h"
+#include "../cpu/syscall.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../libc/function.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+static bench_t *benches[BENCH_MAX];
+static u32 num_benches = 0;
+
+s32 register_bench(bench_t *b) {
+    if (num_benches == BENCH_MAX) return -1;
+    benches[num_benches++] = b;
+    return 0;
+}
+
+void bench_run(bench_t *b, bench_result_t *result) {
+    u32 samples[BENCH_SAMPLES];
+    if (b->setup) b->setup(b->arg);
+    for (u32 i = 0; i < BENCH_WARMUP + BENCH_SAMPLES; i++) {
+        u64 start = read_tsc();
+        b->run(b->arg, b->iterations);
+        u32 cycles = (u32)(read_tsc() - start) / b->iterations;
+        if (i >= BENCH_WARMUP) samples[i - BENCH_WARMUP] = cycles;
+    }
+    if (b->teardown) b->teardown(b->arg);
+
+    /* Insertion sort: there are only a handful */
+    for (u32 i = 1; i < BENCH_SAMPLES; i++) {
+        u32 v = samples[i];
+        u32 j = i;
+        for (; j > 0 && samples[j - 1] > v; j--) samples[j] = samples[j - 1];
+        samples[j] = v;
+    }
+    result->min = samples[0];
+    result->median = samples[BENCH_SAMPLES / 2];
+    result->max = samples[BENCH_SAMPLES - 1];
+}
+
+/* kmalloc/kfree: a pair at a time, or a batch freed in reverse order */
+
+static void run_kmalloc_pair(u32 size, u32 iterations) {
+    for (u32 i = 0; i < iterations; i++) kfree((void*)kmalloc(size, 0, NULL));
+}
+
+static void run_kmalloc_batch(u32 size, u32 iterations) {
+    u32 blocks[BENCH_KMALLOC_BATCH];
+    for (u32 done = 0; done < iterations; done += BENCH_KMALLOC_BATCH) {
+        for (u32 i = 0; i < BENCH_KMALLOC_BATCH; i++) blocks[i] = kmalloc(size, 0, NULL);
+        for (u32 i = BENCH_KMALLOC_BATCH; i > 0; i--) kfree((void*)blocks[i - 1]);
+    }
+}
+
+/* alloc_frame/free_frame with a given share of frames taken beforehand */
+
+static u32 *held_frames = NULL;
+static u32 num_held = 0;
+
+static void setup_frames(u32 percent) {
+    u32 used = get_used_frame_count();
+    u32 total = used + get_free_frame_count();
+    u32 target = total / 100 * percent;
+    num_held = 0;
+    if (target <= used) return;
+    held_frames = (u32*)kmalloc((target - used) * sizeof(u32), 0, NULL);
+    if (!held_frames) return;
+    while (num_held < target - used) {
+        u32 frame = alloc_frame();
+        if (!frame) break;
+        held_frames[num_held++] = frame;
+    }
+}
+
+static void teardown_frames(u32 percent) {
+    UNUSED(percent);
+    for (u32 i = 0; i < num_held; i++) free_frame(held_frames[i]);
+    kfree(held_frames);
+    held_frames = NULL;
+    num_held = 0;
+}
+
+static void run_frames(u32 percent, u32 iterations) {
+    UNUSED(percent);
+    for (u32 i = 0; i < iterations; i++) {
+        u32 frame = alloc_frame();
+        if (frame) free_frame(frame);
+    }
+}
+
+/* memory_copy/memory_set over 'size' bytes */
+
+static u8 *copy_src = NULL;
+static u8 *copy_dst = NULL;
+
+static void setup_memory(u32 size) {
+    UNUSED(size);
+    copy_src = (u8*)kmalloc(BENCH_MEMORY_BUFFER, 0, NULL);
+    copy_dst = (u8*)kmalloc(BENCH_MEMORY_BUFFER, 0, NULL);
+    if (copy_src) memory_set(copy_src, 0x5A, BENCH_MEMORY_BUFFER);
+}
+
+static void teardown_memory(u32 size) {
+    UNUSED(size);
+    kfree(copy_src);
+    kfree(copy_dst);
+    copy_src = copy_dst = NULL;
+}
+
+static void run_memory_copy(u32 size, u32 iterations) {
+    if (!copy_src || !copy_dst) return;
+    for (u32 i = 0; i < iterations; i++) memory_copy(copy_src, copy_dst, size);
+}
+
+static void run_memory_set(u32 size, u32 iterations) {
+    if (!copy_dst) return;
+    for (u32 i = 0; i < iterations; i++) memory_set(copy_dst, (u8)i, size);
+}
+
+/* kprintf: a short formatted line, written over the same screen cells */
+
+static s32 kprintf_cursor;
+
+static void setup_kprintf(u32 arg) {
+    UNUSED(arg);
+    kprintf_cursor = get_cursor_offset();
+}
+
+static void run_kprintf(u32 arg, u32 iterations) {
+    UNUSED(arg);
+    for (u32 i = 0; i < iterations; i++) {
+        set_cursor_offset(kprintf_cursor);
+        kprintf("bench %d %x", i, i);
+    }
+}
+
+static void teardown_kprintf(u32 arg) {
+    UNUSED(arg);
+    set_cursor_offset(kprintf_cursor);
+    kprint("                         ");
+    set_cursor_offset(kprintf_cursor);
+}
+
+/* A software interrupt into the system call stub and back */
+static void run_interrupt(u32 arg, u32 iterations) {
+    UNUSED(arg);
+    for (u32 i = 0; i < iterations; i++) {
+        u32 ret;
+        __asm__ __volatile__("int %1" : "=a"(ret) : "i"(SYSCALL_VECTOR), "a"(SYS_NULL), "b"(0), "S"(0), "D"(0) : "memory");
+    }
+}
+
+static bench_t builtin_benches[] = {
+    {"kmalloc+kfree 16B", NULL, run_kmalloc_pair, NULL, 16, 1000},
+    {"kmalloc+kfree 256B", NULL, run_kmalloc_pair, NULL, 256, 1000},
+    {"kmalloc+kfree 4KB", NULL, run_kmalloc_pair, NULL, 4096, 1000},
+    {"kmalloc batch 16B", NULL, run_kmalloc_batch, NULL, 16, 10 * BENCH_KMALLOC_BATCH},
+    {"kmalloc batch 256B", NULL, run_kmalloc_batch, NULL, 256, 10 * BENCH_KMALLOC_BATCH},
+    {"alloc_frame 0% used", setup_frames, run_frames, teardown_frames, 0, 500},
+    {"alloc_frame 50% used", setup_frames, run_frames, teardown_frames, 50, 500},
+    {"alloc_frame 90% used", setup_frames, run_frames, teardown_frames, 90, 500},
+    {"memory_copy 64B", setup_memory, run_memory_copy, teardown_memory, 64, 1000},
+    {"memory_copy 1KB", setup_memory, run_memory_copy, teardown_memory, 1024, 200},
+    {"memory_copy 4KB", setup_memory, run_memory_copy, teardown_memory, 4096, 50},
+    {"memory_copy 64KB", setup_memory, run_memory_copy, teardown_memory, 65536, 4},
+    {"memory_set 64B", setup_memory, run_memory_set, teardown_memory, 64, 1000},
+    {"memory_set 1KB", setup_memory, run_memory_set, teardown_memory, 1024, 200},
+    {"memory_set 4KB", setup_memory, run_memory_set, teardown_memory, 4096, 50},
+    {"memory_set 64KB", setup_memory, run_memory_set, teardown_memory, 65536, 4},
+    {"kprintf", setup_kprintf, run_kprintf, teardown_kprintf, 0, 100},
+    {"int 0x80 round trip", NULL, run_interrupt, NULL, 0, 1000},
+};
+
+/* bench [prefix]: run every benchmark whose name starts with 'prefix'.
+ * The console gets a table, COM1 gets CSV for scripts on the host */
+static void bench_command(char *args) {
+    s32 len = args ? strlen(args) : 0;
+    stream_t *out = stream_out();
+    stream_printf(out, "Cycles per operation, %d samples after %d warm-up:\n", BENCH_SAMPLES, BENCH_WARMUP);
+    stream_printf(&serial_stream, "bench,name,arg,iterations,min,median,max\n");
+
+    for (u32 i = 0; i < num_benches; i++) {
+        bench_t *b = benches[i];
+        if (len && strncmp(b->name, args, len) != 0) continue;
+        bench_result_t r;
+        bench_run(b, &r);
+
+        char pad[BENCH_NAME_WIDTH + 1];
+        s32 n = BENCH_NAME_WIDTH - strlen(b->name);
+        if (n < 1) n = 1;
+        memory_set((u8*)pad, ' ', n);
+        pad[n] = '\0';
+        if (stream_printf(out, "  %s%smin %d  median %d  max %d\n", b->name, pad, r.min, r.median, r.max) < 0) break;
+        stream_printf(&serial_stream, "bench,%s,%d,%d,%d,%d,%d\n", b->name, b->arg, b->iterations,
+                      r.min, r.median, r.max);
+    }
+}
+
+void init_bench() {
+    for (u32 i = 0; i < sizeof(builtin_benches) / sizeof(builtin_benches[0]); i++) register_bench(&builtin_benches[i]);
+    register_command("bench", bench_command, "Kernel microbenchmarks, results also on COM1 [prefix]");
+}
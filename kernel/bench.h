@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../cpu/types.h"
+
+#define BENCH_MAX          64
+#define BENCH_WARMUP       2       /* Samples run and thrown away first */
+#define BENCH_SAMPLES      15      /* Timed samples per benchmark */
+#define BENCH_NAME_WIDTH   24      /* Console column for the numbers */
+
+/* Built-in benchmarks */
+#define BENCH_KMALLOC_BATCH 64     /* Blocks live at once in the batch pattern */
+#define BENCH_MEMORY_BUFFER 65536  /* Largest memory_copy/memory_set */
+
+/* A benchmark times 'iterations' operations per sample with run(); setup()
+ * and teardown() (either may be NULL) bracket all samples, untimed. 'arg'
+ * is passed to all three */
+typedef struct {
+    char *name;
+    void (*setup)(u32 arg);
+    void (*run)(u32 arg, u32 iterations);
+    void (*teardown)(u32 arg);
+    u32 arg;
+    u32 iterations;
+} bench_t;
+
+/* Cycles per operation over the samples */
+typedef struct {
+    u32 min;
+    u32 median;
+    u32 max;
+} bench_result_t;
+
+/* 'b' is kept, not copied. Returns 0, or -1 when the table is full */
+s32 register_bench(bench_t *b);
+void bench_run(bench_t *b, bench_result_t *result);
+
+/* Registers the built-in benchmarks and the bench command */
+void init_bench();
+
+#endif
@@ -0,0 +1,154 @@
+#include "command.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+/* Names are indexed by a trie stored as an array of nodes, each linking
+ * to its first child and next sibling (siblings sorted by character).
+ * Node 0 is the root and stands for the empty prefix */
+typedef struct {
+    char c;
+    u16 child;                     /* 0: none */
+    u16 sibling;                   /* 0: none */
+    u16 command;                   /* Index + 1 of the command ending here, 0: none */
+    u16 count;                     /* Commands in this subtree */
+} trie_node_t;
+
+static command_t *commands = NULL;
+static u32 num_commands = 0;
+static u32 max_commands = 0;
+
+static trie_node_t *nodes = NULL;
+static u32 num_nodes = 0;
+static u32 max_nodes = 0;
+
+/* Double the array at '*table' of '*max' entries of 'size' bytes */
+static u8 grow(void **table, u32 *max, u32 initial, u32 size) {
+    u32 new_max = *max ? *max * 2 : initial;
+    void *bigger = (void*)kmalloc(new_max * size, 0, NULL);
+    if (!bigger) return 0;
+    if (*table) {
+        memory_copy((u8*)*table, (u8*)bigger, *max * size);
+        kfree(*table);
+    }
+    *table = bigger;
+    *max = new_max;
+    return 1;
+}
+
+static u32 new_node(char c) {
+    if (num_nodes == max_nodes && !grow((void**)&nodes, &max_nodes, TRIE_INITIAL_NODES, sizeof(trie_node_t))) {
+        return 0;
+    }
+    trie_node_t *n = &nodes[num_nodes];
+    n->c = c;
+    n->child = 0;
+    n->sibling = 0;
+    n->command = 0;
+    n->count = 0;
+    return num_nodes++;
+}
+
+/* Child of 'parent' for 'c', 0 if there is none */
+static u32 find_child(u32 parent, char c) {
+    for (u32 n = nodes[parent].child; n && nodes[n].c <= c; n = nodes[n].sibling) {
+        if (nodes[n].c == c) return n;
+    }
+    return 0;
+}
+
+/* Node for 'prefix', 0 if no command starts with it (the root only for "") */
+static u32 find_node(char *prefix) {
+    u32 n = 0;
+    for (; *prefix; prefix++) {
+        n = find_child(n, *prefix);
+        if (!n) return 0;
+    }
+    return n;
+}
+
+/* Child of 'parent' for 'c', created in sibling order if needed */
+static u32 add_child(u32 parent, char c) {
+    u16 *link = &nodes[parent].child;
+    while (*link && nodes[*link].c < c) link = &nodes[*link].sibling;
+    if (*link && nodes[*link].c == c) return *link;
+
+    /* new_node() may move the array: find the link again afterwards */
+    u32 index = (u8*)link - (u8*)nodes;
+    u32 n = new_node(c);
+    if (!n) return 0;
+    link = (u16*)((u8*)nodes + index);
+    nodes[n].sibling = *link;
+    *link = n;
+    return n;
+}
+
+s32 register_command(char *name, command_handler_t handler, char *description) {
+    s32 len = strlen(name);
+    if (len == 0 || len >= COMMAND_NAME_MAX || find_command(name)) return -1;
+    if (!nodes) {
+        new_node('\0');           /* The root */
+        if (!nodes) return -1;
+    }
+    if (num_commands == max_commands && !grow((void**)&commands, &max_commands, COMMAND_INITIAL, sizeof(command_t))) {
+        return -1;
+    }
+
+    /* Path first: nothing is counted until every node exists */
+    u32 path[COMMAND_NAME_MAX];
+    u32 n = 0;
+    for (s32 i = 0; i < len; i++) {
+        n = add_child(n, name[i]);
+        if (!n) return -1;
+        path[i] = n;
+    }
+    nodes[0].count++;
+    for (s32 i = 0; i < len; i++) nodes[path[i]].count++;
+
+    commands[num_commands].name = name;
+    commands[num_commands].handler = handler;
+    commands[num_commands].description = description;
+    nodes[n].command = ++num_commands;
+    return 0;
+}
+
+command_t* find_command(char *name) {
+    if (!nodes || !*name) return NULL;
+    u32 n = find_node(name);
+    return n && nodes[n].command ? &commands[nodes[n].command - 1] : NULL;
+}
+
+u32 command_count() {
+    return num_commands;
+}
+
+command_t* get_command(u32 index) {
+    return index < num_commands ? &commands[index] : NULL;
+}
+
+u32 complete_command(char *prefix, char *ext, u32 size) {
+    ext[0] = '\0';
+    if (!nodes) return 0;
+    u32 n = find_node(prefix);
+    if (!n && *prefix) return 0;
+    u32 matches = nodes[n].count;
+
+    /* Follow the path while it doesn't branch or pass a complete name */
+    u32 len = 0;
+    while (len + 1 < size && !nodes[n].command && nodes[n].child && !nodes[nodes[n].child].sibling) {
+        n = nodes[n].child;
+        ext[len++] = nodes[n].c;
+    }
+    ext[len] = '\0';
+    return matches;
+}
+
+static void walk(u32 n, void (*fn)(command_t *command)) {
+    if (nodes[n].command) fn(&commands[nodes[n].command - 1]);
+    for (u32 c = nodes[n].child; c; c = nodes[c].sibling) walk(c, fn);
+}
+
+void list_commands(char *prefix, void (*fn)(command_t *command)) {
+    if (!nodes) return;
+    u32 n = find_node(prefix);
+    if (n || !*prefix) walk(n, fn);
+}
@@ -0,0 +1,38 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "../cpu/types.h"
+
+#define COMMAND_NAME_MAX   32
+/* Initial table sizes, both double as commands are registered */
+#define COMMAND_INITIAL    32
+#define TRIE_INITIAL_NODES 128
+
+typedef void (*command_handler_t)(char *args);
+
+typedef struct {
+    char *name;                    // Command name
+    command_handler_t handler;     // Function to call
+    char *description;
+} command_t;
+
+/* Add a command to the shell. 'name' and 'description' are kept, not
+ * copied. Returns 0, or -1 for an empty, overlong or taken name or when
+ * out of memory */
+s32 register_command(char *name, command_handler_t handler, char *description);
+
+/* Exact lookup through the trie: cost depends on the length of 'name',
+ * not on how many commands there are. NULL if there is no such command */
+command_t* find_command(char *name);
+
+/* Every command, in registration order */
+u32 command_count();
+command_t* get_command(u32 index);
+
+/* Completion: how many commands start with 'prefix'. The characters all
+ * of them share beyond it go to 'ext' (at most 'size' - 1, terminated) */
+u32 complete_command(char *prefix, char *ext, u32 size);
+/* Call 'fn' for every command starting with 'prefix', in name order */
+void list_commands(char *prefix, void (*fn)(command_t *command));
+
+#endif
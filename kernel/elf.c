@@ -0,0 +1,75 @@
+#include "elf.h"
+#include "../fs/pagecache.h"
+
+static s32 check_header(elf_header_t *eh, u32 file_size) {
+    if (*(u32*)eh->ident != ELF_MAGIC || eh->ident[4] != ELF_CLASS_32 ||
+        eh->ident[5] != ELF_DATA_LSB || eh->ident[6] != ELF_VERSION) return ELF_ERR_FORMAT;
+    if (eh->type != ELF_TYPE_EXEC || eh->machine != ELF_MACHINE_386 || eh->version != ELF_VERSION) {
+        return ELF_ERR_FORMAT;
+    }
+    if (eh->phentsize != sizeof(elf_phdr_t) || eh->phnum == 0 || eh->phnum > ELF_MAX_PHDRS) {
+        return ELF_ERR_FORMAT;
+    }
+    /* Program headers have to share the first page with the ELF header */
+    u32 table_size = eh->phnum * sizeof(elf_phdr_t);
+    if (eh->phoff > FRAME_SIZE - table_size || eh->phoff + table_size > file_size) return ELF_ERR_FORMAT;
+    return ELF_OK;
+}
+
+static s32 check_segment(elf_phdr_t *ph, u32 file_size) {
+    if (ph->filesz > ph->memsz) return ELF_ERR_SEGMENT;
+    if (ph->offset > file_size || ph->filesz > file_size - ph->offset) return ELF_ERR_SEGMENT;
+    /* Pages come straight from the page cache, so file and memory layout
+     * must agree below the page size */
+    if ((ph->vaddr - ph->offset) % FRAME_SIZE) return ELF_ERR_SEGMENT;
+    if (ph->vaddr < VM_USER_START || ph->vaddr >= VM_USER_END || ph->memsz > VM_USER_END - ph->vaddr) {
+        return ELF_ERR_SEGMENT;
+    }
+    return ELF_OK;
+}
+
+s32 elf_load(vnode_t *vn, address_space_t *space, u32 *entry) {
+    if (vn->type != VFS_FILE) return VFS_ERR_IS_DIR;
+    if (vn->size < sizeof(elf_header_t)) return ELF_ERR_FORMAT;
+
+    /* The headers are read through the page cache: the first segment
+     * usually starts in the same page and finds it there */
+    page_t *page = pagecache_get(vn, 0);
+    if (!page) return VFS_ERR_IO;
+    elf_header_t *eh = (elf_header_t*)page->frame;
+    s32 err = check_header(eh, vn->size);
+
+    u8 entry_ok = 0;
+    elf_phdr_t *ph = (elf_phdr_t*)(page->frame + eh->phoff);
+    for (u32 i = 0; err == ELF_OK && i < eh->phnum; i++, ph++) {
+        if (ph->type != ELF_PT_LOAD || ph->memsz == 0) continue;
+        err = check_segment(ph, vn->size);
+        if (err != ELF_OK) break;
+
+        /* One region per segment: file data up to filesz, zeros after */
+        u32 start = ph->vaddr & PAGE_FRAME_MASK;
+        u32 skew = ph->vaddr - start;
+        u8 prot = VM_READ | VM_PRIVATE | VM_USER | ((ph->flags & ELF_PF_W) ? VM_WRITE : 0) |
+                  ((ph->flags & ELF_PF_X) ? VM_EXEC : 0);
+        vnode_t *file = ph->filesz ? vn : NULL;
+        if (vm_map_region(space, start, skew + ph->memsz, prot, file, ph->offset - skew, skew + ph->filesz) != 0) {
+            err = ELF_ERR_SEGMENT;
+        }
+        if ((ph->flags & ELF_PF_X) && eh->entry >= ph->vaddr && eh->entry - ph->vaddr < ph->filesz) entry_ok = 1;
+    }
+    if (err == ELF_OK && !entry_ok) err = ELF_ERR_ENTRY;
+    if (err == ELF_OK) *entry = eh->entry;
+
+    pagecache_put(page);
+    return err;
+}
+
+char* elf_strerror(s32 err) {
+    switch (err) {
+        case ELF_ERR_FORMAT: return "not an i386 executable";
+        case ELF_ERR_SEGMENT: return "bad program segment";
+        case ELF_ERR_ENTRY: return "entry point outside the program text";
+        case ELF_ERR_NO_MEMORY: return "out of memory";
+        default: return vfs_strerror(err);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "../cpu/types.h"
+#include "../fs/vfs.h"
+#include "../mm/vm.h"
+
+/* e_ident */
+#define ELF_MAGIC          0x464C457F  /* "\x7FELF" read as a u32 */
+#define ELF_IDENT_SIZE     16
+#define ELF_CLASS_32       1
+#define ELF_DATA_LSB       1
+#define ELF_VERSION        1
+
+#define ELF_TYPE_EXEC      2
+#define ELF_MACHINE_386    3
+
+/* Program header types and flags */
+#define ELF_PT_NULL        0
+#define ELF_PT_LOAD        1
+#define ELF_PF_X           0x1
+#define ELF_PF_W           0x2
+#define ELF_PF_R           0x4
+
+#define ELF_MAX_PHDRS      16
+
+/* Error codes, below the VFS ones so both can come back from exec */
+#define ELF_OK             0
+#define ELF_ERR_FORMAT     -16     /* Not a 32-bit x86 executable */
+#define ELF_ERR_SEGMENT    -17     /* Segment outside the program range, misaligned or overlapping */
+#define ELF_ERR_ENTRY      -18     /* Entry point not in an executable segment */
+#define ELF_ERR_NO_MEMORY  -19
+
+typedef struct {
+    u8 ident[ELF_IDENT_SIZE];
+    u16 type;
+    u16 machine;
+    u32 version;
+    u32 entry;
+    u32 phoff;
+    u32 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+} __attribute__((packed)) elf_header_t;
+
+typedef struct {
+    u32 type;
+    u32 offset;
+    u32 vaddr;
+    u32 paddr;
+    u32 filesz;
+    u32 memsz;
+    u32 flags;
+    u32 align;
+} __attribute__((packed)) elf_phdr_t;
+
+/* Validate the executable 'vn' and register each PT_LOAD segment as a
+ * lazily faulted region of 'space'. Nothing is read beyond the headers:
+ * text and data come in through the page cache on first touch, .bss is
+ * zero filled on demand. Returns ELF_OK, an ELF_ERR_* or a VFS error */
+s32 elf_load(vnode_t *vn, address_space_t *space, u32 *entry);
+char* elf_strerror(s32 err);
+
+#endif
@@ -0,0 +1,82 @@
+#include "exec.h"
+#include "elf.h"
+#include "task.h"
+#include "../cpu/timer.h"
+#include "../cpu/syscall.h"
+#include "../libc/function.h"
+
+/* Load 'path' into a fresh address space and make a task for it, ready to
+ * run 'arg' through its entry point */
+static s32 load(char *path, u32 arg, task_t **task) {
+    vnode_t *vn;
+    s32 err = vfs_resolve(path, &vn);
+    if (err != VFS_OK) return err;
+
+    address_space_t *space = vm_create_space();
+    if (!space) {
+        vfs_iput(vn);
+        return ELF_ERR_NO_MEMORY;
+    }
+    u32 entry;
+    err = elf_load(vn, space, &entry);
+    vfs_iput(vn);                  /* The regions hold their own references */
+
+    u32 stack = EXEC_STACK_TOP - EXEC_STACK_SIZE;
+    if (err == ELF_OK && vm_map_region(space, stack, EXEC_STACK_SIZE,
+                                       VM_READ | VM_WRITE | VM_PRIVATE | VM_USER, NULL, 0, 0) != 0) {
+        err = ELF_ERR_SEGMENT;
+    }
+    /* The entry page: the clock stops at the first instruction rather than
+     * at the fault it would take */
+    if (err == ELF_OK && vm_populate(space, entry, entry + 1) != 0) err = ELF_ERR_NO_MEMORY;
+    if (err == ELF_OK && !(*task = task_create_user(space, entry, EXEC_STACK_TOP, arg))) err = ELF_ERR_NO_MEMORY;
+    if (err != ELF_OK) vm_destroy_space(space);
+    return err;
+}
+
+s32 exec(char *path, exec_result_t *result) {
+    u64 start = read_tsc();
+    task_t *task;
+    s32 err = load(path, 0, &task);
+    if (err != ELF_OK) return err;
+    task->start_tsc = start;
+
+    result->regions = 0;
+    result->mapped_pages = 0;
+    for (vm_region_t *r = task->space->regions; r; r = r->next) {
+        result->regions++;
+        result->mapped_pages += (r->end - r->start) / FRAME_SIZE;
+    }
+
+    vm_stats_t before, after;
+    get_vm_stats(&before);
+    result->status = task_wait(task);
+    get_vm_stats(&after);
+    /* Includes whatever ran alongside */
+    result->faults = after.faults - before.faults;
+    result->load_cycles = (u32)(task->first_run_tsc - task->start_tsc);
+    task_release(task);
+    return ELF_OK;
+}
+
+/* spawn(path, arg): the new program runs detached, nobody collects its
+ * exit status */
+static s32 sys_spawn(u32 path, u32 arg, u32 c) {
+    char name[EXEC_PATH_MAX];
+    UNUSED(c);
+    address_space_t *space = current_task()->space;
+    for (u32 i = 0; ; i++) {
+        if (i == sizeof(name) || vm_copy(NULL, (u32)&name[i], space, path + i, 1) != 0) return VFS_ERR_INVALID;
+        if (!name[i]) break;
+    }
+
+    task_t *task;
+    s32 err = load(name, arg, &task);
+    if (err != ELF_OK) return err;
+    task->detached = 1;
+    return task->id;
+}
+
+void init_exec() {
+    register_syscall(SYS_SPAWN, sys_spawn);
+}
@@ -0,0 +1,29 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "../cpu/types.h"
+#include "../mm/vm.h"
+
+/* Programs get their stack at the top of the program range, faulted in
+ * like everything else */
+#define EXEC_STACK_TOP     VM_USER_END
+#define EXEC_STACK_SIZE    0x10000
+#define EXEC_PATH_MAX      128
+
+typedef struct {
+    s32 status;                  /* Passed to exit(), or USER_KILLED */
+    u32 load_cycles;             /* exec() call to the first instruction */
+    u32 regions;                 /* Segments plus the stack */
+    u32 mapped_pages;            /* Pages those regions span */
+    u32 faults;                  /* Pages faulted in while the program ran */
+} exec_result_t;
+
+/* Load the ELF executable at 'path' into a fresh address space and run it
+ * as a new task until it exits or faults, letting other tasks run
+ * meanwhile. The space is torn down afterwards. Returns ELF_OK, an
+ * ELF_ERR_* or a VFS error */
+s32 exec(char *path, exec_result_t *result);
+/* Registers SYS_SPAWN */
+void init_exec();
+
+#endif
@@ -0,0 +1,81 @@
+#include "heapstat.h"
+#include "command.h"
+#include "ksym.h"
+#include "stream.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+
+/* Tenths of a percent */
+static void show_percent(stream_t *out, char *label, u32 tenths) {
+    stream_printf(out, "%s%d.%d%%\n", label, tenths / 10, tenths % 10);
+}
+
+static void show_fragmentation(stream_t *out) {
+    u32 total, used, free_mem;
+    heap_frag_t f;
+    get_heap_stats(&total, &used, &free_mem);
+    get_heap_fragmentation(&f);
+
+    stream_printf(out, "Heap: %d KB used of %d KB grown, %d KB never used\n", used / 1024, total / 1024, f.tail / 1024);
+    stream_printf(out, "Blocks: %d in use, %d freed holding %d bytes, largest %d\n",
+                  f.used_blocks, f.free_blocks, f.free_bytes, f.largest_free);
+
+    /* External fragmentation: the share of free memory outside the largest
+     * piece a single request could get. The heap is small enough for
+     * bytes * 1000 to fit 32 bits */
+    u32 all_free = f.free_bytes + f.tail;
+    u32 largest = MAX(f.largest_free, f.tail);
+    show_percent(out, "External fragmentation: ", all_free ? 1000 - largest * 1000 / all_free : 0);
+    show_percent(out, "  among freed blocks:    ", f.free_bytes ? 1000 - f.largest_free * 1000 / f.free_bytes : 0);
+
+    if (!f.free_blocks) return;
+    stream_print(out, "Freed block sizes:\n");
+    for (u32 b = 0; b < HEAP_FREE_BUCKETS; b++) {
+        if (!f.histogram[b]) continue;
+        if (b == HEAP_FREE_BUCKETS - 1) stream_printf(out, "  >= %d bytes  %d\n", 1 << b, f.histogram[b]);
+        else stream_printf(out, "  %d-%d bytes  %d\n", 1 << b, (2 << b) - 1, f.histogram[b]);
+    }
+}
+
+static void show_sites(stream_t *out, u32 top) {
+    heap_site_t *sites = (heap_site_t*)kmalloc(HEAP_SITES * sizeof(heap_site_t), 0, NULL);
+    if (!sites) {
+        kprint_color("heapstat: out of memory\n", RED_ON_BLACK);
+        return;
+    }
+    u32 n = get_heap_sites(sites, HEAP_SITES);
+    if (!n) {
+        stream_print(out, "Built without HEAP_TRACK: no allocation sites\n");
+        kfree(sites);
+        return;
+    }
+
+    stream_printf(out, "Top allocation sites by live bytes (%d sites):\n", n);
+    for (u32 shown = 0; shown < top; shown++) {
+        u32 best = 0;
+        for (u32 i = 1; i < n; i++) {
+            if (sites[i].live_bytes > sites[best].live_bytes) best = i;
+        }
+        heap_site_t *s = &sites[best];
+        if (!s->live_bytes) break;
+        u32 offset = 0;
+        ksym_t *sym = ksym_lookup(s->caller, &offset);
+        if (stream_printf(out, "  %d bytes in %d blocks (%d allocations)  %s+%x\n", s->live_bytes, s->live_blocks,
+                          s->allocs, sym ? sym->name : "?", sym ? offset : s->caller) < 0) break;
+        s->live_bytes = 0;
+    }
+    kfree(sites);
+}
+
+/* heapstat [n]: fragmentation, then the top n allocation sites */
+static void heapstat_command(char *args) {
+    stream_t *out = stream_out();
+    u32 top = 0;
+    for (char *p = args; p && *p >= '0' && *p <= '9'; p++) top = top * 10 + (*p - '0');
+    show_fragmentation(out);
+    show_sites(out, top ? top : HEAPSTAT_TOP_DEFAULT);
+}
+
+void init_heapstat() {
+    register_command("heapstat", heapstat_command, "Heap fragmentation and, built with HEAP_TRACK, allocation sites [n]");
+}
@@ -0,0 +1,9 @@
+#ifndef HEAPSTAT_H
+#define HEAPSTAT_H
+
+#define HEAPSTAT_TOP_DEFAULT 10
+
+/* Registers the heapstat command, see get_heap_sites() in libc/mem.h */
+void init_heapstat();
+
+#endif
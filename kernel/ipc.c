@@ -0,0 +1,190 @@
+#include "ipc.h"
+#include "../libc/function.h"
+
+static port_t ports[IPC_MAX_PORTS];
+
+static port_t* find_port(u32 id) {
+    if (id == 0 || id > IPC_MAX_PORTS || ports[id - 1].id != id) return NULL;
+    return &ports[id - 1];
+}
+
+static void queue_push(task_t **queue, task_t *t) {
+    while (*queue) queue = &(*queue)->next;
+    t->next = NULL;
+    *queue = t;
+}
+
+static task_t* queue_pop(task_t **queue) {
+    task_t *t = *queue;
+    if (t) *queue = t->next;
+    return t;
+}
+
+/* Fetch the descriptor at 'msg_user' into t->msg */
+static s32 read_msg(task_t *t, u32 msg_user) {
+    if (vm_copy(NULL, (u32)&t->msg, t->space, msg_user, sizeof(ipc_msg_t)) != 0) return IPC_ERR_FAULT;
+    t->msg_user = msg_user;
+    return IPC_OK;
+}
+
+/* Move the message of 'src' into the buffer of 'dst' and tell 'dst' its
+ * label and length. Short messages take a single copy from one address
+ * space into the other, whole aligned pages are remapped */
+static s32 transfer(task_t *src, task_t *dst) {
+    ipc_msg_t *m = &src->msg;
+    ipc_msg_t *d = &dst->msg;
+    if (m->len > d->size) return IPC_ERR_TOO_BIG;
+
+    s32 err;
+    if (m->len > IPC_SHORT_MAX && m->len % FRAME_SIZE == 0 &&
+        m->data % FRAME_SIZE == 0 && d->data % FRAME_SIZE == 0) {
+        err = vm_move_pages(dst->space, d->data, src->space, m->data, m->len / FRAME_SIZE);
+    } else {
+        err = vm_copy(dst->space, d->data, src->space, m->data, m->len);
+    }
+    if (err != 0) return IPC_ERR_FAULT;
+
+    d->label = m->label;
+    d->len = m->len;
+    if (vm_copy(dst->space, dst->msg_user, NULL, (u32)d, sizeof(ipc_msg_t)) != 0) return IPC_ERR_FAULT;
+    return IPC_OK;
+}
+
+static s32 sys_port_create(u32 a, u32 b, u32 c) {
+    UNUSED(a);
+    UNUSED(b);
+    UNUSED(c);
+    for (u32 i = 0; i < IPC_MAX_PORTS; i++) {
+        if (ports[i].id) continue;
+        ports[i].id = i + 1;
+        ports[i].owner = current_task();
+        ports[i].senders = NULL;
+        ports[i].receivers = NULL;
+        return ports[i].id;
+    }
+    return IPC_ERR_PORT;
+}
+
+/* send() and call(). With a receiver waiting, the message goes across
+ * right away and a call hands the CPU straight to it */
+static s32 send(u32 port_id, u32 msg_user, u8 call) {
+    task_t *self = current_task();
+    port_t *port = find_port(port_id);
+    if (!port) return IPC_ERR_PORT;
+    s32 err = read_msg(self, msg_user);
+    if (err != IPC_OK) return err;
+
+    task_t *rx = queue_pop(&port->receivers);
+    if (!rx) {
+        self->ipc_call = call;
+        self->port = port;
+        queue_push(&port->senders, self);
+        /* The receiver finishes the send, the server the call */
+        task_block(WAIT_IPC_SEND);
+        return self->ipc_result;
+    }
+
+    rx->port = NULL;
+    err = transfer(self, rx);
+    rx->ipc_result = err == IPC_OK ? (call ? (s32)self->id : 0) : err;
+    if (err != IPC_OK || !call) {
+        task_handoff(rx, WAIT_NONE);
+        return err;
+    }
+    self->partner = rx;
+    task_handoff(rx, WAIT_IPC_REPLY);
+    return self->ipc_result;
+}
+
+static s32 sys_send(u32 port_id, u32 msg_user, u32 c) {
+    UNUSED(c);
+    return send(port_id, msg_user, 0);
+}
+
+static s32 sys_call(u32 port_id, u32 msg_user, u32 c) {
+    UNUSED(c);
+    return send(port_id, msg_user, 1);
+}
+
+/* Returns the caller's task id as the reply handle for a call, 0 for a
+ * plain send, or an error */
+static s32 sys_receive(u32 port_id, u32 msg_user, u32 c) {
+    UNUSED(c);
+    task_t *self = current_task();
+    port_t *port = find_port(port_id);
+    if (!port) return IPC_ERR_PORT;
+    s32 err = read_msg(self, msg_user);
+    if (err != IPC_OK) return err;
+
+    task_t *tx = queue_pop(&port->senders);
+    if (!tx) {
+        self->port = port;
+        queue_push(&port->receivers, self);
+        task_block(WAIT_IPC_RECEIVE);
+        return self->ipc_result;
+    }
+
+    tx->port = NULL;
+    err = transfer(tx, self);
+    if (err == IPC_OK && tx->ipc_call) {
+        /* The caller stays blocked, now on our reply */
+        tx->wait = WAIT_IPC_REPLY;
+        tx->partner = self;
+        return tx->id;
+    }
+    tx->ipc_result = err;
+    task_wake(tx, 0);
+    return err;
+}
+
+static s32 sys_reply(u32 handle, u32 msg_user, u32 c) {
+    UNUSED(c);
+    task_t *self = current_task();
+    task_t *caller = find_task(handle);
+    if (!caller || caller->state != TASK_BLOCKED || caller->wait != WAIT_IPC_REPLY || caller->partner != self) {
+        return IPC_ERR_DEAD;
+    }
+    s32 err = read_msg(self, msg_user);
+    if (err == IPC_OK) err = transfer(self, caller);
+
+    /* The caller runs as soon as we block, typically in the next receive() */
+    caller->partner = NULL;
+    caller->ipc_result = err;
+    task_wake(caller, 1);
+    return err;
+}
+
+static void fail_queue(task_t **queue) {
+    task_t *t;
+    while ((t = queue_pop(queue))) {
+        t->port = NULL;
+        t->ipc_result = IPC_ERR_DEAD;
+        task_wake(t, 0);
+    }
+}
+
+void ipc_task_exit(task_t *t) {
+    for (u32 i = 0; i < IPC_MAX_PORTS; i++) {
+        if (!ports[i].id || ports[i].owner != t) continue;
+        fail_queue(&ports[i].senders);
+        fail_queue(&ports[i].receivers);
+        ports[i].id = 0;
+        ports[i].owner = NULL;
+    }
+    /* Calls this task received but never answered */
+    for (task_t *caller = task_list(); caller; caller = caller->all_next) {
+        if (caller->state == TASK_BLOCKED && caller->wait == WAIT_IPC_REPLY && caller->partner == t) {
+            caller->partner = NULL;
+            caller->ipc_result = IPC_ERR_DEAD;
+            task_wake(caller, 0);
+        }
+    }
+}
+
+void init_ipc() {
+    register_syscall(SYS_PORT_CREATE, sys_port_create);
+    register_syscall(SYS_SEND, sys_send);
+    register_syscall(SYS_RECEIVE, sys_receive);
+    register_syscall(SYS_CALL, sys_call);
+    register_syscall(SYS_REPLY, sys_reply);
+}
@@ -0,0 +1,24 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "../cpu/types.h"
+#include "../cpu/syscall.h"
+#include "task.h"
+
+#define IPC_MAX_PORTS      64
+
+/* A rendezvous point: senders and receivers queue here until the other
+ * side shows up. Message formats are up to the programs */
+typedef struct port {
+    u32 id;                            /* 1-based, 0 marks a free slot */
+    task_t *owner;                     /* The port dies with it */
+    task_t *senders;                   /* Blocked in send() or call(), FIFO */
+    task_t *receivers;                 /* Blocked in receive(), FIFO */
+} port_t;
+
+/* Registers the IPC system calls */
+void init_ipc();
+/* Destroy the ports of 't' and fail whoever waits on it */
+void ipc_task_exit(task_t *t);
+
+#endif
@@ -0,0 +1,80 @@
+#include "irqstat.h"
+#include "command.h"
+#include "stream.h"
+#include "../cpu/isr.h"
+#include "../cpu/apic.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+
+static char *irq_names[IRQ_LINES] = {
+    "timer", "keyboard", "cascade", "COM2", "COM1", "LPT2", "floppy", "LPT1",
+    "RTC", "free", "free", "free", "mouse", "FPU", "ATA primary", "ATA secondary",
+    "LAPIC timer", "reschedule IPI"
+};
+
+/* total / n in 32 bit arithmetic */
+static u32 average(u64 total, u32 n) {
+    while (total >> 32) {
+        total >>= 1;
+        n >>= 1;
+    }
+    return n ? (u32)total / n : 0;
+}
+
+static void show_histogram(stream_t *out, irq_stats_t *st) {
+    u32 peak = 0;
+    for (u32 b = 0; b < IRQ_LATENCY_BUCKETS; b++) {
+        if (st->latency[b] > peak) peak = st->latency[b];
+    }
+    for (u32 b = 0; b < IRQ_LATENCY_BUCKETS; b++) {
+        if (!st->latency[b]) continue;
+        char bar[33];
+        u32 len = st->latency[b] / ((peak + 31) / 32);
+        if (len == 0) len = 1;
+        for (u32 i = 0; i < len; i++) bar[i] = '#';
+        bar[len] = '\0';
+        stream_printf(out, "      < 2^%d cycles  %d  %s\n", b + 1, st->latency[b], bar);
+    }
+}
+
+/* irqstat [-h | reset | pic | apic]: interrupts per line, handler time,
+ * -h with the log2 histograms. pic and apic switch the controller that
+ * delivers IRQs, and reset the counters to compare the two */
+static void irqstat_command(char *args) {
+    stream_t *out = stream_out();
+    if (args && strcmp(args, "reset") == 0) {
+        reset_irq_stats();
+        return;
+    }
+    if (args && (strcmp(args, "pic") == 0 || strcmp(args, "apic") == 0)) {
+        if (apic_set_enabled(args[0] == 'a') != 0) {
+            kprint_color("No IOAPIC, IRQs stay on the 8259 PIC\n", RED_ON_BLACK);
+            return;
+        }
+        reset_irq_stats();
+        return;
+    }
+    u8 histograms = args && strcmp(args, "-h") == 0;
+
+    stream_printf(out, "IRQs through the %s\n", apic_enabled ? "IOAPIC" : "8259 PIC");
+    if (!get_irq_stats(0)) stream_print(out, "Built without IRQ_STATS: only spurious interrupts are counted\n");
+    for (u32 line = 0; line < IRQ_LINES; line++) {
+        irq_stats_t *st = get_irq_stats(line);
+        u32 spurious = get_spurious_irqs(line);
+        if ((!st || !st->count) && !spurious) continue;
+
+        stream_printf(out, "IRQ%d %s: ", line, irq_names[line]);
+        if (st) {
+            stream_printf(out, "%d, handler avg %d max %d cycles", st->count,
+                          average(st->cycles, st->count - st->switched), st->max_cycles);
+            if (st->switched) stream_printf(out, " (%d switched tasks, not timed)", st->switched);
+        }
+        if (spurious) stream_printf(out, "%s%d spurious", st ? ", " : "", spurious);
+        if (stream_print(out, "\n") < 0) return;
+        if (st && histograms) show_histogram(out, st);
+    }
+}
+
+void init_irqstat() {
+    register_command("irqstat", irqstat_command, "Interrupts per IRQ line and handler cycles [-h | reset | pic | apic]");
+}
@@ -0,0 +1,7 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+/* Registers the irqstat command, see get_irq_stats() in cpu/isr.h */
+void init_irqstat();
+
+#endif
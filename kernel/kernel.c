@@ -1,9 +1,32 @@
 #include "../cpu/isr.h"
+#include "../cpu/fpu.h"
+#include "../cpu/gdt.h"
+#include "../cpu/syscall.h"
+#include "../cpu/timer.h"
 #include "../drivers/screen.h"
 #include "../drivers/keyboard.h"
 #include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../libc/function.h"
+#include "../fs/bcache.h"
+#include "../fs/fat16.h"
+#include "../fs/ramfs.h"
+#include "../fs/initrd.h"
+#include "../fs/vfs.h"
+#include "../mm/zeropool.h"
+#include "../drivers/block.h"
 #include "kernel.h"
 #include "shell.h"
+#include "task.h"
+#include "ipc.h"
+#include "exec.h"
+#include "bench.h"
+#include "prof.h"
+#include "irqstat.h"
+#include "heapstat.h"
+#include "lockstat.h"
+#include "smp.h"
+#include "../drivers/serial.h"
 
 /* Command history */
 static char history[HISTORY_SIZE][256];
@@ -14,18 +37,89 @@ static int current_history_pos = 0;
 /* Input color (for what the user types) */
 static char input_color = WHITE_ON_BLACK;
 
+/* The line Enter handed over, until the shell task takes its copy */
+static char pending_line[KEY_BUFFER_SIZE];
+static u8 line_pending = 0;
+static u8 busy = 0;
+static task_t *shell_task = NULL;
+
+/* Runs the commands, in a task of its own rather than the keyboard
+ * interrupt: they may sleep (exec, pipelines, disk I/O) with interrupts
+ * on, and the next Enter must not start another one on top */
+static void shell_main(void *arg) {
+    char line[KEY_BUFFER_SIZE];
+    UNUSED(arg);
+    while (1) {
+        u32 flags = irq_save();
+        while (!line_pending) task_block(WAIT_INPUT);
+        memory_copy((u8*)pending_line, (u8*)line, KEY_BUFFER_SIZE);
+        line_pending = 0;
+        irq_restore(flags);
+
+        add_to_history(line);
+        current_history_pos = history_count;
+        command_parser(line);
+        kprint_color(PROMPT_TEXT, WHITE_ON_BLACK);
+        busy = 0;
+    }
+}
+
 void main() {
+    init_serial();
+    init_gdt();
     isr_install();
+    init_fpu();
+    init_syscalls();
+    init_tasks();
+    init_ipc();
+    init_exec();
+    init_shell();
+    init_bench();
+    init_prof();
+    init_irqstat();
+    init_heapstat();
+    init_lockstat();
     irq_install();
+    init_time_page();
+    init_smp();
+    init_zeropool();
+    init_vfs();
+    init_ramfs();
+    init_initrd();
+    init_bcache(BCACHE_DEFAULT_FRAMES);
+
+    /* ramfs is the root, the disk (if any) appears under DISK_MOUNT */
+    vfs_mount("/", &ramfs_filesystem, NULL);
+    vfs_create(DISK_MOUNT, VFS_DIR, NULL);
+    vfs_mount(DISK_MOUNT, &fat16_filesystem, get_block_device("hda"));
+
+    /* Kept on the boot CPU: irqstat apic routes the IRQs to the CPU that
+     * runs it */
+    shell_task = task_create_kernel(shell_main, NULL);
+    if (shell_task) shell_task->pinned = 1;
 
     clear_screen();
     kprint_color(PROMPT_TEXT, WHITE_ON_BLACK);
+
+    /* Idle loop: let programs run, sleep until the next interrupt (without
+     * the kernel lock, so other CPUs go on) once none is left, then run
+     * deferred work */
+    while (1) {
+        task_yield();
+        u32 flags = irq_save();
+        if (!this_cpu()->run_head) cpu_wait();
+        irq_restore(flags);
+        fat16_periodic();
+        bcache_periodic();
+    }
 }
 
 void add_to_history(char *cmd) {
-    if (strlen(cmd) == 0) return;
-    
-    strcpy(history[history_index], cmd);
+    if (cmd[0] == '\0') return;
+
+    kstrbuf_t line;
+    kstrbuf_init(&line, history[history_index], sizeof(history[0]));
+    kstrbuf_set(&line, cmd);
     history_index = (history_index + 1) % HISTORY_SIZE;
     if (history_count < HISTORY_SIZE) history_count++;
     current_history_pos = history_count;
@@ -47,31 +141,37 @@ char* get_history(int offset) {
     return history[actual_index];
 }
 
-void replace_input_line(char *new_input) {
-    /* Clear current line by backspacing */
-    int len = strlen(key_buffer);
-    for (int i = 0; i < len; i++) {
-        kprint_backspace();
+/* The command name being typed: after the last '|', NULL once past it */
+static char* completion_prefix(char *input) {
+    char *start = input;
+    for (char *p = input; *p; p++) {
+        if (*p == '|') start = p + 1;
     }
-    
-    /* Copy and print new input */
-    strcpy(key_buffer, new_input);
-    kprint(key_buffer);
+    while (*start == ' ') start++;
+    for (char *p = start; *p; p++) {
+        if (*p == ' ') return NULL;
+    }
+    return start;
 }
 
-char* tab_complete(char *partial) {
-    extern command_t commands[];
-    int len = strlen(partial);
-    
-    if (len == 0) return NULL;
-    
-    /* Find matching command */
-    for (int i = 0; i < NUM_COMMANDS; i++) {
-        if (strncmp(partial, commands[i].name, len) == 0) {
-            return commands[i].name;
-        }
-    }
-    return NULL;
+u32 tab_complete(char *input, char *ext, u32 size) {
+    char *prefix = completion_prefix(input);
+    ext[0] = '\0';
+    return prefix ? complete_command(prefix, ext, size) : 0;
+}
+
+static void print_candidate(command_t *command) {
+    kprint_color(command->name, get_input_color());
+    kprint_color("  ", get_input_color());
+}
+
+void tab_list(char *input) {
+    char *prefix = completion_prefix(input);
+    if (prefix == NULL) return;
+    kprint("\n");
+    list_commands(prefix, print_candidate);
+    kprint("\n");
+    kprint_color(PROMPT_TEXT, WHITE_ON_BLACK);
 }
 
 char get_input_color() {
@@ -83,8 +183,13 @@ void set_input_color(char color) {
 }
 
 void user_input(char *input) {
-    add_to_history(input);
-    current_history_pos = history_count;
-    command_parser(input);
-    kprint_color(PROMPT_TEXT, WHITE_ON_BLACK);
+    if (busy || !shell_task) return;
+    strcpy(pending_line, input);
+    line_pending = 1;
+    busy = 1;
+    task_wake(shell_task, 1);
+}
+
+u8 shell_busy() {
+    return busy;
 }
\ No newline at end of file
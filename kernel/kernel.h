@@ -1,13 +1,23 @@
 #ifndef KERNEL_H
 #define KERNEL_H
 
+#include "../cpu/types.h"
+
 #define HISTORY_SIZE 10
 #define PROMPT_TEXT "MyOs> "
 
+/* A finished input line, from the keyboard interrupt: the shell task runs
+ * it. Ignored while the shell is busy with the one before */
 void user_input(char *input);
+/* From Enter until the prompt is back */
+u8 shell_busy();
 void add_to_history(char *cmd);
 char* get_history(int offset);
-char* tab_complete(char *partial);
+/* Tab completion of the command name being typed. tab_complete() puts
+ * what all candidates share beyond it in 'ext' and returns how many there
+ * are; tab_list() prints them and a fresh prompt for the input line */
+u32 tab_complete(char *input, char *ext, u32 size);
+void tab_list(char *input);
 char get_input_color();
 void set_input_color(char color);
 
@@ -0,0 +1,15 @@
+#include "ksym.h"
+
+ksym_t* ksym_lookup(u32 addr, u32 *offset) {
+    if (!kernel_symbol_count || addr < kernel_symbols[0].addr || addr >= (u32)etext) return NULL;
+
+    /* Last symbol at or below 'addr' */
+    u32 lo = 0, hi = kernel_symbol_count;
+    while (hi - lo > 1) {
+        u32 mid = (lo + hi) / 2;
+        if (kernel_symbols[mid].addr <= addr) lo = mid;
+        else hi = mid;
+    }
+    if (offset) *offset = addr - kernel_symbols[lo].addr;
+    return &kernel_symbols[lo];
+}
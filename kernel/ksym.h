@@ -0,0 +1,22 @@
+#ifndef KSYM_H
+#define KSYM_H
+
+#include "../cpu/types.h"
+
+/* The kernel's functions, sorted by address. The Makefile generates them
+ * from a first link of kernel.elf (ksyms.asm) */
+typedef struct {
+    u32 addr;
+    char *name;
+} ksym_t;
+
+extern ksym_t kernel_symbols[];
+extern u32 kernel_symbol_count;
+/* End of the kernel code, from the linker */
+extern char etext[];
+
+/* The function 'addr' is in, and how far into it, or NULL outside the
+ * kernel code */
+ksym_t* ksym_lookup(u32 addr, u32 *offset);
+
+#endif
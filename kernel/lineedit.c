@@ -0,0 +1,119 @@
+#include "lineedit.h"
+#include "../drivers/screen.h"
+
+#define CAPACITY (LINE_MAX - 1)
+
+static u32 gap(line_editor_t *ed) {
+    return ed->gap_end - ed->gap_start;
+}
+
+static char char_at(line_editor_t *ed, u32 i) {
+    return i < ed->gap_start ? ed->buf[i] : ed->buf[i + gap(ed)];
+}
+
+void line_begin(line_editor_t *ed, char attr) {
+    ed->gap_start = 0;
+    ed->gap_end = CAPACITY;
+    ed->shown_len = 0;
+    ed->attr = attr;
+    ed->origin = get_cursor_offset();
+}
+
+void line_reprint(line_editor_t *ed) {
+    ed->shown_len = 0;
+    ed->origin = get_cursor_offset();
+    line_redraw(ed);
+}
+
+u32 line_length(line_editor_t *ed) {
+    return CAPACITY - gap(ed);
+}
+
+u32 line_cursor(line_editor_t *ed) {
+    return ed->gap_start;
+}
+
+void line_text(line_editor_t *ed, char *out) {
+    u32 len = line_length(ed);
+    for (u32 i = 0; i < len; i++) out[i] = char_at(ed, i);
+    out[len] = '\0';
+}
+
+s32 line_insert(line_editor_t *ed, char c) {
+    if (!gap(ed)) return -1;
+    ed->buf[ed->gap_start++] = c;
+    return 0;
+}
+
+s32 line_delete_back(line_editor_t *ed) {
+    if (!ed->gap_start) return -1;
+    ed->gap_start--;
+    return 0;
+}
+
+s32 line_delete_forward(line_editor_t *ed) {
+    if (ed->gap_end == CAPACITY) return -1;
+    ed->gap_end++;
+    return 0;
+}
+
+void line_set(line_editor_t *ed, char *text) {
+    ed->gap_start = 0;
+    ed->gap_end = CAPACITY;
+    while (*text && line_insert(ed, *text) == 0) text++;
+}
+
+void line_left(line_editor_t *ed) {
+    if (ed->gap_start) ed->buf[--ed->gap_end] = ed->buf[--ed->gap_start];
+}
+
+void line_right(line_editor_t *ed) {
+    if (ed->gap_end < CAPACITY) ed->buf[ed->gap_start++] = ed->buf[ed->gap_end++];
+}
+
+void line_home(line_editor_t *ed) {
+    while (ed->gap_start) line_left(ed);
+}
+
+void line_end(line_editor_t *ed) {
+    while (ed->gap_end < CAPACITY) line_right(ed);
+}
+
+void line_word_left(line_editor_t *ed) {
+    while (ed->gap_start && ed->buf[ed->gap_start - 1] == ' ') line_left(ed);
+    while (ed->gap_start && ed->buf[ed->gap_start - 1] != ' ') line_left(ed);
+}
+
+void line_word_right(line_editor_t *ed) {
+    while (ed->gap_end < CAPACITY && ed->buf[ed->gap_end] == ' ') line_right(ed);
+    while (ed->gap_end < CAPACITY && ed->buf[ed->gap_end] != ' ') line_right(ed);
+}
+
+void line_redraw(line_editor_t *ed) {
+    u32 len = line_length(ed);
+
+    /* The span that changed: from the first difference to the last. With
+     * the length unchanged a common tail needn't be written either, and a
+     * shorter line blanks what the longer one left behind */
+    u32 start = 0;
+    while (start < len && start < ed->shown_len && char_at(ed, start) == ed->shown[start]) start++;
+    u32 end = MAX(len, ed->shown_len);
+    if (len == ed->shown_len) {
+        while (end > start && char_at(ed, end - 1) == ed->shown[end - 1]) end--;
+    }
+
+    if (start < end) {
+        char span[LINE_MAX];
+        for (u32 i = start; i < end; i++) span[i - start] = i < len ? char_at(ed, i) : ' ';
+        span[end - start] = '\0';
+        set_cursor_offset(ed->origin + start * BYTES_PER_CHAR);
+        kprint_color(span, ed->attr);
+        /* Writing past the bottom scrolled the line up */
+        s32 expected = ed->origin + end * BYTES_PER_CHAR;
+        ed->origin -= expected - get_cursor_offset();
+
+        for (u32 i = start; i < len; i++) ed->shown[i] = char_at(ed, i);
+        ed->shown_len = len;
+    }
+    set_cursor_offset(ed->origin + ed->gap_start * BYTES_PER_CHAR);
+}
@@ -0,0 +1,56 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include "../cpu/types.h"
+#include "../drivers/keyboard.h"
+
+/* Longest line plus its NUL */
+#define LINE_MAX KEY_BUFFER_SIZE
+
+/* The line being typed at the console, as a gap buffer: the characters
+ * before the cursor sit at the start of 'buf', those after it at the end,
+ * so inserting and deleting at the cursor are O(1) wherever it is.
+ * Edits only change the buffer; line_redraw() then writes the span of the
+ * screen that differs from what it last showed */
+typedef struct {
+    char buf[LINE_MAX - 1];
+    u32 gap_start;                 /* The cursor: characters before the gap */
+    u32 gap_end;                   /* First character after the gap */
+    char shown[LINE_MAX];          /* What the screen holds */
+    u32 shown_len;
+    s32 origin;                    /* Screen offset of the first character */
+    char attr;
+} line_editor_t;
+
+/* Empty line starting at the screen cursor, drawn in 'attr' */
+void line_begin(line_editor_t *ed, char attr);
+/* The screen no longer shows the line (it printed something else), draw
+ * it afresh at the screen cursor */
+void line_reprint(line_editor_t *ed);
+
+u32 line_length(line_editor_t *ed);
+u32 line_cursor(line_editor_t *ed);
+/* The whole line into 'out' (LINE_MAX bytes), NUL terminated */
+void line_text(line_editor_t *ed, char *out);
+
+/* 0, or -1 when the line is full */
+s32 line_insert(line_editor_t *ed, char c);
+/* Backspace and Delete. 0, or -1 with nothing to delete */
+s32 line_delete_back(line_editor_t *ed);
+s32 line_delete_forward(line_editor_t *ed);
+/* Replace the whole line (as much as fits), cursor at the end */
+void line_set(line_editor_t *ed, char *text);
+
+void line_left(line_editor_t *ed);
+void line_right(line_editor_t *ed);
+void line_home(line_editor_t *ed);
+void line_end(line_editor_t *ed);
+/* To the start of this or the previous word, to the end of this or the
+ * next one. Words are separated by spaces */
+void line_word_left(line_editor_t *ed);
+void line_word_right(line_editor_t *ed);
+
+/* Bring the screen up to date and put the screen cursor on the line's */
+void line_redraw(line_editor_t *ed);
+
+#endif
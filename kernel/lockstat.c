@@ -0,0 +1,28 @@
+#include "lockstat.h"
+#include "command.h"
+#include "spinlock.h"
+#include "stream.h"
+#include "../libc/string.h"
+
+/* lockstat [reset]: every lock taken since boot (or the last reset), how
+ * often it was found held and the longest anyone held it */
+static void lockstat_command(char *args) {
+    stream_t *out = stream_out();
+    if (args && strcmp(args, "reset") == 0) {
+        reset_lock_stats();
+        return;
+    }
+    lock_stats_t *st = lock_stats_list();
+    if (!st) {
+        stream_print(out, "Built without LOCK_STATS: no lock counters\n");
+        return;
+    }
+    for (; st; st = st->next) {
+        if (stream_printf(out, "%s: %d taken, %d contended, %d read retries, held up to %d cycles\n", st->name,
+                          st->acquisitions, st->contended, st->retries, st->max_hold) < 0) return;
+    }
+}
+
+void init_lockstat() {
+    register_command("lockstat", lockstat_command, "Lock acquisitions, contention and hold times [reset]");
+}
@@ -0,0 +1,7 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+/* Registers the lockstat command, see lock_stats_list() in spinlock.h */
+void init_lockstat();
+
+#endif
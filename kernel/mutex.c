@@ -0,0 +1,30 @@
+#include "mutex.h"
+#include "task.h"
+#include "../cpu/isr.h"
+
+void mutex_lock(mutex_t *m) {
+    u32 flags = irq_save();
+    task_t *self = current_task();
+    if (!m->owner) {
+        m->owner = self;
+    } else {
+        task_t **link = &m->waiters;
+        while (*link) link = &(*link)->next;
+        self->next = NULL;
+        *link = self;
+        /* mutex_unlock() makes us the owner before it wakes us */
+        while (m->owner != self) task_block(WAIT_MUTEX);
+    }
+    irq_restore(flags);
+}
+
+void mutex_unlock(mutex_t *m) {
+    u32 flags = irq_save();
+    task_t *next = m->waiters;
+    m->owner = next;
+    if (next) {
+        m->waiters = next->next;
+        task_wake(next, 0);
+    }
+    irq_restore(flags);
+}
@@ -0,0 +1,23 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "../cpu/types.h"
+
+struct task;
+
+/* A lock whose waiters block instead of spinning, for code that keeps it
+ * across block I/O: block_wait() lets the big kernel lock go, so another
+ * CPU may come in meanwhile. The big kernel lock protects the fields.
+ * Task context only, and it does not nest */
+typedef struct {
+    struct task *owner;
+    struct task *waiters;              /* First come first served, through task->next */
+} mutex_t;
+
+#define MUTEX_INIT {NULL, NULL}
+
+void mutex_lock(mutex_t *m);
+/* Hands the lock straight to the first waiter */
+void mutex_unlock(mutex_t *m);
+
+#endif
@@ -0,0 +1,101 @@
+#include "pipe.h"
+#include "../cpu/isr.h"
+#include "../cpu/paging.h"
+#include "../libc/mem.h"
+
+static s32 read_end_read(stream_t *s, u8 *buf, u32 len) {
+    return pipe_read((pipe_t*)s->priv, buf, len);
+}
+
+static s32 write_end_write(stream_t *s, u8 *buf, u32 len) {
+    return pipe_write((pipe_t*)s->priv, buf, len);
+}
+
+pipe_t* pipe_create() {
+    pipe_t *p = (pipe_t*)kmalloc(sizeof(pipe_t), 0, NULL);
+    if (!p) return NULL;
+    memory_set((u8*)p, 0, sizeof(pipe_t));
+    p->buf = (u8*)alloc_frame();
+    if (!p->buf) {
+        kfree(p);
+        return NULL;
+    }
+    p->reader_open = 1;
+    p->writer_open = 1;
+    p->read_end.read = read_end_read;
+    p->read_end.priv = p;
+    p->write_end.write = write_end_write;
+    p->write_end.priv = p;
+    return p;
+}
+
+static void release(pipe_t *p) {
+    if (p->reader_open || p->writer_open) return;
+    free_frame((u32)p->buf);
+    kfree(p);
+}
+
+static void wake(task_t **waiting) {
+    if (*waiting) {
+        task_wake(*waiting, 0);
+        *waiting = NULL;
+    }
+}
+
+void pipe_close_read(pipe_t *p) {
+    u32 flags = irq_save();
+    p->reader_open = 0;
+    wake(&p->writer_wait);
+    release(p);
+    irq_restore(flags);
+}
+
+void pipe_close_write(pipe_t *p) {
+    u32 flags = irq_save();
+    p->writer_open = 0;
+    wake(&p->reader_wait);
+    release(p);
+    irq_restore(flags);
+}
+
+s32 pipe_read(pipe_t *p, u8 *buf, u32 len) {
+    u32 flags = irq_save();
+    while (p->head == p->tail && p->writer_open) {
+        p->reader_wait = current_task();
+        task_block(WAIT_PIPE);
+    }
+
+    u32 n = MIN(len, p->head - p->tail);
+    u32 pos = p->tail % PIPE_SIZE;
+    u32 first = MIN(n, PIPE_SIZE - pos);
+    memory_copy(p->buf + pos, buf, first);
+    memory_copy(p->buf, buf + first, n - first);
+    p->tail += n;
+    if (n) wake(&p->writer_wait);
+    irq_restore(flags);
+    return n;
+}
+
+s32 pipe_write(pipe_t *p, u8 *buf, u32 len) {
+    u32 flags = irq_save();
+    u32 done = 0;
+    while (done < len) {
+        if (!p->reader_open) break;
+        u32 space = PIPE_SIZE - (p->head - p->tail);
+        if (!space) {
+            p->writer_wait = current_task();
+            task_block(WAIT_PIPE);
+            continue;
+        }
+        u32 n = MIN(len - done, space);
+        u32 pos = p->head % PIPE_SIZE;
+        u32 first = MIN(n, PIPE_SIZE - pos);
+        memory_copy(buf + done, p->buf + pos, first);
+        memory_copy(buf + done + first, p->buf, n - first);
+        p->head += n;
+        done += n;
+        wake(&p->reader_wait);
+    }
+    irq_restore(flags);
+    return done == len ? (s32)len : STREAM_ERR_CLOSED;
+}
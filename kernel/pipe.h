@@ -0,0 +1,37 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "../cpu/types.h"
+#include "stream.h"
+#include "task.h"
+
+#define PIPE_SIZE          FRAME_SIZE  /* Ring buffer, one frame */
+
+/* A one-way byte channel between two tasks. Writers block while the ring
+ * is full, readers while it is empty; closing the write end gives the
+ * reader end of input, closing the read end fails further writes */
+typedef struct {
+    u8 *buf;
+    u32 head;                          /* Bytes written, free running */
+    u32 tail;                          /* Bytes read, free running */
+    u8 reader_open;
+    u8 writer_open;
+    task_t *reader_wait;               /* Blocked on an empty ring */
+    task_t *writer_wait;               /* Blocked on a full ring */
+    stream_t read_end;
+    stream_t write_end;
+} pipe_t;
+
+/* NULL when out of memory. The pipe goes away once both ends are closed */
+pipe_t* pipe_create();
+void pipe_close_read(pipe_t *p);
+void pipe_close_write(pipe_t *p);
+
+/* Up to 'len' bytes, blocking until there is at least one. 0 once the
+ * ring is empty and the write end closed */
+s32 pipe_read(pipe_t *p, u8 *buf, u32 len);
+/* All of 'len' bytes, blocking as needed. STREAM_ERR_CLOSED if the read
+ * end is closed before that */
+s32 pipe_write(pipe_t *p, u8 *buf, u32 len);
+
+#endif
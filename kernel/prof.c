@@ -0,0 +1,179 @@
+#include "prof.h"
+#include "ksym.h"
+#include "command.h"
+#include "stream.h"
+#include "../cpu/isr.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+/* Samples per interrupted address, open addressing with linear probing.
+ * Allocated on the first start */
+typedef struct {
+    u32 eip;
+    u32 count;
+} prof_entry_t;
+
+u8 prof_enabled = 0;
+static prof_entry_t *table = NULL;
+static u32 total = 0;
+static u32 user = 0;
+static u32 dropped = 0;
+
+void prof_sample(u32 eip, u32 cs) {
+    total++;
+    if ((cs & 3) == 3) {
+        user++;
+        return;
+    }
+    u32 h = (eip * 2654435761u) >> (32 - PROF_TABLE_BITS);
+    for (u32 i = 0; i < PROF_MAX_PROBES; i++) {
+        prof_entry_t *e = &table[(h + i) & (PROF_TABLE_SIZE - 1)];
+        if (e->eip == eip && e->count) {
+            e->count++;
+            return;
+        }
+        if (!e->count) {
+            e->eip = eip;
+            e->count = 1;
+            return;
+        }
+    }
+    dropped++;
+}
+
+void prof_reset() {
+    u32 flags = irq_save();
+    if (table) memory_set((u8*)table, 0, PROF_TABLE_SIZE * sizeof(prof_entry_t));
+    total = 0;
+    user = 0;
+    dropped = 0;
+    irq_restore(flags);
+}
+
+s32 prof_start(u32 hz) {
+    if (hz < TIMER_HZ || hz > PROF_MAX_HZ || hz % TIMER_HZ) return -1;
+    if (!table) {
+        table = (prof_entry_t*)kmalloc(PROF_TABLE_SIZE * sizeof(prof_entry_t), 0, NULL);
+        if (!table) return -1;
+        prof_reset();
+    }
+    u32 flags = irq_save();
+    timer_set_rate(hz);
+    prof_enabled = 1;
+    irq_restore(flags);
+    return 0;
+}
+
+void prof_stop() {
+    u32 flags = irq_save();
+    prof_enabled = 0;
+    timer_set_rate(TIMER_HZ);
+    irq_restore(flags);
+}
+
+/* Samples per function, a slot per symbol plus one for addresses outside
+ * the kernel code. NULL when out of memory */
+static u32* per_function() {
+    u32 *counts = (u32*)kmalloc((kernel_symbol_count + 1) * sizeof(u32), 0, NULL);
+    if (!counts) return NULL;
+    memory_set((u8*)counts, 0, (kernel_symbol_count + 1) * sizeof(u32));
+    for (u32 i = 0; i < PROF_TABLE_SIZE; i++) {
+        if (!table[i].count) continue;
+        ksym_t *sym = ksym_lookup(table[i].eip, NULL);
+        counts[sym ? (u32)(sym - kernel_symbols) : kernel_symbol_count] += table[i].count;
+    }
+    return counts;
+}
+
+/* Percent with one decimal, as "12.3" */
+static void percent(char *buf, u32 part, u32 whole) {
+    /* Keeps part * 1000 in 32 bits */
+    while (part > 4000000) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    u32 tenths = whole ? part * 1000 / whole : 0;
+    int_to_ascii(tenths / 10, buf);
+    append(buf, '.');
+    append(buf, '0' + tenths % 10);
+}
+
+static void prof_top(stream_t *out, u32 n) {
+    stream_printf(out, "%d samples%s: %d in user mode, %d dropped\n", total, prof_enabled ? " so far" : "", user, dropped);
+    if (!table || total == user) return;
+    u32 *counts = per_function();
+    if (!counts) {
+        kprint_color("prof: out of memory\n", RED_ON_BLACK);
+        return;
+    }
+
+    /* Selection of the n largest, each taken out once printed */
+    char pct[16];
+    for (u32 shown = 0; shown < n; shown++) {
+        u32 best = 0;
+        for (u32 i = 1; i <= kernel_symbol_count; i++) {
+            if (counts[i] > counts[best]) best = i;
+        }
+        if (!counts[best]) break;
+        percent(pct, counts[best], total);
+        char *name = best < kernel_symbol_count ? kernel_symbols[best].name : "[outside the kernel code]";
+        if (stream_printf(out, "  %d  %s%%  %s\n", counts[best], pct, name) < 0) break;
+        counts[best] = 0;
+    }
+    kfree(counts);
+}
+
+/* prof dump: every sampled address to COM1 as CSV, to be folded into a
+ * flame graph on the host */
+static void prof_dump(stream_t *out) {
+    u32 lines = 0;
+    stream_printf(&serial_stream, "prof,eip,function,offset,samples\n");
+    stream_printf(&serial_stream, "prof,0,[user],0,%d\n", user);
+    for (u32 i = 0; table && i < PROF_TABLE_SIZE; i++) {
+        if (!table[i].count) continue;
+        u32 offset = 0;
+        ksym_t *sym = ksym_lookup(table[i].eip, &offset);
+        stream_printf(&serial_stream, "prof,%x,%s,%d,%d\n", table[i].eip, sym ? sym->name : "?", offset, table[i].count);
+        lines++;
+    }
+    stream_printf(out, "%d addresses written to COM1\n", lines + 1);
+}
+
+/* prof [start [hz] | stop | reset | dump | top [n]] */
+static void prof_command(char *args) {
+    stream_t *out = stream_out();
+    char *arg = args;
+    while (arg && *arg && *arg != ' ') arg++;
+    u32 num = 0;
+    if (arg && *arg) {
+        *arg++ = '\0';
+        while (*arg == ' ') arg++;
+        for (; *arg >= '0' && *arg <= '9'; arg++) num = num * 10 + (*arg - '0');
+    }
+
+    if (!args || !*args || strcmp(args, "top") == 0) {
+        prof_top(out, num ? num : PROF_TOP_DEFAULT);
+    } else if (strcmp(args, "start") == 0) {
+        if (prof_start(num ? num : PROF_DEFAULT_HZ) != 0) {
+            kprintf_color(RED_ON_BLACK, "prof: can't sample at %d Hz (multiples of %d up to %d)\n",
+                          num ? num : PROF_DEFAULT_HZ, TIMER_HZ, PROF_MAX_HZ);
+            return;
+        }
+        stream_printf(out, "Sampling at %d Hz\n", num ? num : PROF_DEFAULT_HZ);
+    } else if (strcmp(args, "stop") == 0) {
+        prof_stop();
+        prof_top(out, PROF_TOP_DEFAULT);
+    } else if (strcmp(args, "reset") == 0) {
+        prof_reset();
+    } else if (strcmp(args, "dump") == 0) {
+        prof_dump(out);
+    } else {
+        kprint_color("Usage: prof [start [hz] | stop | reset | dump | top [n]]\n", RED_ON_BLACK);
+    }
+}
+
+void init_prof() {
+    register_command("prof", prof_command, "Sampling profiler: prof start [hz] | stop | reset | dump | top [n]");
+}
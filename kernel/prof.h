@@ -0,0 +1,31 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include "../cpu/types.h"
+
+#define PROF_DEFAULT_HZ    1000        /* PIT rate while profiling */
+#define PROF_MAX_HZ        10000
+#define PROF_TABLE_BITS    12          /* 4096 distinct addresses */
+#define PROF_TABLE_SIZE    (1 << PROF_TABLE_BITS)
+#define PROF_MAX_PROBES    16          /* Then the sample is dropped */
+#define PROF_TOP_DEFAULT   15
+
+/* Set while sampling, tested by the timer interrupt */
+extern u8 prof_enabled;
+
+/* From the timer interrupt: count one sample at the interrupted eip.
+ * Ring 3 code is only counted as a whole */
+void prof_sample(u32 eip, u32 cs);
+
+/* Speed the PIT up to 'hz' (a multiple of TIMER_HZ) and sample on every
+ * interrupt. Samples add up across runs until prof_reset(). Returns 0,
+ * or -1 for a bad rate or no memory */
+s32 prof_start(u32 hz);
+/* Back to TIMER_HZ, keeping the samples */
+void prof_stop();
+void prof_reset();
+
+/* Registers the prof command */
+void init_prof();
+
+#endif
@@ -5,15 +5,33 @@
 #include "kernel.h"
 #include "../libc/function.h"
 #include "../cpu/paging.h"
+#include "../cpu/timer.h"
+#include "../drivers/block.h"
+#include "../fs/bcache.h"
+#include "../fs/fat16.h"
+#include "../fs/ramfs.h"
+#include "../fs/vfs.h"
+#include "../fs/pagecache.h"
+#include "../mm/vm.h"
+#include "elf.h"
+#include "exec.h"
+#include "../cpu/syscall.h"
+#include "stream.h"
+#include "pipe.h"
+#include "task.h"
 
-extern command_t commands[];
+/* Command output goes to the task's output stream: the console, or a pipe
+ * when the command is part of a pipeline. Errors go to the console */
+#define out(str)     stream_print(stream_out(), str)
+#define outf(...)    stream_printf(stream_out(), __VA_ARGS__)
 
 void help(char *args) {
-    for (int i = 0; i < NUM_COMMANDS; i++) {
-        kprint_color(commands[i].name, get_input_color());
-        kprint_color(" - ", get_input_color());
-        kprint_color(commands[i].description, get_input_color());
-        kprint_color("\n", get_input_color());
+    for (u32 i = 0; i < command_count(); i++) {
+        command_t *command = get_command(i);
+        out(command->name);
+        out(" - ");
+        out(command->description);
+        out("\n");
     }
     UNUSED(args);
 }
@@ -24,22 +42,23 @@ void clear(char *args) {
 
 void echo(char *args) {
     if (args != NULL) {
-        kprint_color(args, get_input_color());
+        out(args);
     }
-    kprint_color("\n", get_input_color());
+    out("\n");
     UNUSED(args);
 }
 
 void shell_exit(char *args) {
-    kprint_color("Halting CPU...\n", get_input_color());
-    __asm__ __volatile__("hlt");
+    out("Halting CPU...\n");
+    /* Commands run with interrupts on, the next one would end a bare hlt */
+    __asm__ __volatile__("cli; hlt");
     UNUSED(args);
 }
 
 void prompt(char *args) {
     if (args == NULL) {
-        kprint_color("Usage: prompt <color>\n", get_input_color());
-        kprint_color("Colors: green, blue, red, cyan, yellow, magenta, white\n", get_input_color());
+        out("Usage: prompt <color>\n");
+        out("Colors: green, blue, red, cyan, yellow, magenta, white\n");
         return;
     }
     
@@ -52,15 +71,63 @@ void prompt(char *args) {
     else if (strcmp(args, "magenta") == 0) color = MAGENTA_ON_BLACK;
     else if (strcmp(args, "white") == 0) color = WHITE_ON_BLACK;
     else {
-        kprint_color("Unknown color. Available: green, blue, red, cyan, yellow, magenta, white\n", get_input_color());
+        out("Unknown color. Available: green, blue, red, cyan, yellow, magenta, white\n");
         return;
     }
     
     set_input_color(color);
 }
 
+/* mem test: take up to MEMTEST_FRAMES high frames, write each one's address
+ * all over it through kmap(), then check and free them. make run MEM=6G
+ * gets frames above 4GB */
+static void mem_test() {
+    if (!get_high_free_frame_count()) {
+        out("No high memory to test (make run MEM=6G)\n");
+        return;
+    }
+    phys_t *frames = (phys_t*)kmalloc(MEMTEST_FRAMES * sizeof(phys_t), 0, NULL);
+    if (!frames) {
+        kprint_color("mem test: out of memory\n", RED_ON_BLACK);
+        return;
+    }
+    u32 n = 0;
+    u32 above = 0;
+    while (n < MEMTEST_FRAMES && (frames[n] = alloc_frame_high())) {
+        u32 *p = (u32*)kmap(frames[n]);
+        for (u32 i = 0; i < FRAME_SIZE / 4; i += 2) {
+            p[i] = (u32)frames[n];
+            p[i + 1] = (u32)(frames[n] >> 32);
+        }
+        kunmap(p);
+        if (frames[n] >= FOUR_GB) above++;
+        n++;
+    }
+    u32 bad = 0;
+    for (u32 k = 0; k < n; k++) {
+        u32 *p = (u32*)kmap(frames[k]);
+        for (u32 i = 0; i < FRAME_SIZE / 4; i += 2) {
+            if (p[i] != (u32)frames[k] || p[i + 1] != (u32)(frames[k] >> 32)) {
+                bad++;
+                break;
+            }
+        }
+        kunmap(p);
+        free_frame(frames[k]);
+    }
+    /* Handed out from the top down */
+    outf("%d high frames from %d MB down to %d MB, %d above 4GB: ", n,
+         (u32)(frames[0] >> 20), n ? (u32)(frames[n - 1] >> 20) : 0, above);
+    if (bad) kprintf_color(RED_ON_BLACK, "%d frames read back wrong\n", bad);
+    else outf("all read back\n");
+    kfree(frames);
+}
+
 void mem(char *args) {
-    UNUSED(args);
+    if (args && strcmp(args, "test") == 0) {
+        mem_test();
+        return;
+    }
     
     char num_str[16];
     
@@ -69,64 +136,977 @@ void mem(char *args) {
     u32 free_frames = get_free_frame_count();
     u32 total_frames = used_frames + free_frames;
     
-    kprintf_color(get_input_color(), "Physical Memory (Frames):\n");
-    kprintf_color(get_input_color(), "  Total: %d frames (%d KB)\n", total_frames, total_frames * 4);
+    outf("Physical Memory (Frames):\n");
+    outf("  Total: %d frames (%d KB)\n", total_frames, total_frames * 4);
     
-    kprintf_color(get_input_color(), "  Used:  %d frames (%d KB)\n", used_frames, used_frames * 4);
+    outf("  Used:  %d frames (%d KB)\n", used_frames, used_frames * 4);
     
-    kprintf_color(get_input_color(), "  Free:  %d frames (%d KB)\n", free_frames, free_frames * 4);
+    outf("  Free:  %d frames (%d KB)\n", free_frames, free_frames * 4);
+
+    /* Past the direct map, for program pages */
+    u32 high_frames = get_high_frame_count();
+    if (high_frames) {
+        u32 high_free = get_high_free_frame_count();
+        outf("\nHigh Memory (%s):\n", paging_pae() ? "PAE" : "no PAE, below 4GB only");
+        outf("  Total: %d frames (%d MB)\n", high_frames, high_frames / 256);
+        outf("  Free:  %d frames (%d MB)\n", high_free, high_free / 256);
+    }
     
     /* Kernel heap */
     u32 heap_total, heap_used, heap_free;
     get_heap_stats(&heap_total, &heap_used, &heap_free);
     
-    kprintf_color(get_input_color(), "\nKernel Heap:\n");
-    kprintf_color(get_input_color(), "  Total: %d bytes (%d KB)\n", heap_total, heap_total / 1024);
+    outf("\nKernel Heap:\n");
+    outf("  Total: %d bytes (%d KB)\n", heap_total, heap_total / 1024);
     
-    kprintf_color(get_input_color(), "  Used:  %d bytes (%d KB)\n", heap_used, heap_used / 1024);
+    outf("  Used:  %d bytes (%d KB)\n", heap_used, heap_used / 1024);
     
-    kprintf_color(get_input_color(), "  Free:  %d bytes (%d KB)\n", heap_free, heap_free / 1024);
+    outf("  Free:  %d bytes (%d KB)\n", heap_free, heap_free / 1024);
+}
+
+/* Print bytes/ticks as MB/s with one decimal */
+static void print_rate(char *label, u32 bytes, u32 ticks) {
+    if (ticks == 0) ticks = 1;
+    u32 kb_per_sec = (bytes / 1024) * TIMER_HZ / ticks;
+    outf("  %s: %d.%d MB/s (%d KB in %d ms)\n", label,
+         kb_per_sec / 1024, (kb_per_sec % 1024) * 10 / 1024,
+         bytes / 1024, ticks * 1000 / TIMER_HZ);
+}
+
+static u32 disktest_seed = 12345;
+
+static u32 disktest_rand() {
+    disktest_seed = disktest_seed * 1103515245 + 12345;
+    return disktest_seed >> 8;
+}
+
+void disktest(char *args) {
+    block_device_t *dev = get_block_device(args != NULL ? args : "hda");
+    if (dev == NULL) {
+        out("No such disk. Start QEMU with a disk image (make run).\n");
+        return;
+    }
+
+    u8 *buffer = (u8*)kmalloc(DISKTEST_BUF_SIZE, 0, NULL);
+    if (!buffer) {
+        kprint_color("disktest: out of memory\n", RED_ON_BLACK);
+        return;
+    }
+    u32 merges_before = dev->merges;
+    outf("Disk %s: %d sectors (%d MB)\n", dev->name,
+         dev->sector_count, dev->sector_count / (1024 * 1024 / SECTOR_SIZE));
+
+    /* Sequential: large reads from the start of the disk, wrapping around */
+    u32 lba = 0;
+    u32 bytes = 0;
+    u32 start = get_tick();
+    while (get_tick() - start < DISKTEST_TICKS) {
+        if (lba >= dev->sector_count) lba = 0;
+        /* A disk smaller than one read gets it whole */
+        u32 count = MIN(BLOCK_MAX_SECTORS, dev->sector_count - lba);
+        if (block_read(dev, lba, count, buffer) != BLOCK_OK) {
+            kprint_color("Read error\n", RED_ON_BLACK);
+            kfree(buffer);
+            return;
+        }
+        lba += count;
+        bytes += count * SECTOR_SIZE;
+    }
+    print_rate("Sequential read", bytes, get_tick() - start);
+
+    /* Random: batches of 4KB reads queued together so the elevator can sort them */
+    block_request_t reqs[DISKTEST_QUEUE_DEPTH];
+    u32 slots = dev->sector_count / DISKTEST_RAND_SECTORS;
+    if (slots == 0) {
+        kfree(buffer);
+        return;
+    }
+    u32 ios = 0;
+    bytes = 0;
+    start = get_tick();
+    while (get_tick() - start < DISKTEST_TICKS) {
+        block_plug(dev);
+        for (u32 i = 0; i < DISKTEST_QUEUE_DEPTH; i++) {
+            u32 slot = disktest_rand() % slots;
+            block_init_request(&reqs[i], slot * DISKTEST_RAND_SECTORS, DISKTEST_RAND_SECTORS,
+                               buffer + i * DISKTEST_RAND_SECTORS * SECTOR_SIZE, 0);
+            block_submit(dev, &reqs[i]);
+        }
+        block_unplug(dev);
+        for (u32 i = 0; i < DISKTEST_QUEUE_DEPTH; i++) block_wait(&reqs[i]);
+        ios += DISKTEST_QUEUE_DEPTH;
+        bytes += DISKTEST_QUEUE_DEPTH * DISKTEST_RAND_SECTORS * SECTOR_SIZE;
+    }
+    u32 ticks = get_tick() - start;
+    print_rate("Random 4KB read", bytes, ticks);
+    outf("  %d IOPS, %d requests merged\n",
+         ios * TIMER_HZ / (ticks ? ticks : 1), dev->merges - merges_before);
+
+    kfree(buffer);
+}
+
+/* part * 100 / whole without overflowing u32 */
+static u32 percent(u32 part, u32 whole) {
+    if (whole == 0) return 0;
+    if (part < 0x1000000) return part * 100 / whole;
+    return part / (whole / 100);
+}
+
+static void print_bcache_stats(bcache_stats_t *st) {
+    outf("  Hits: %d  Misses: %d  Hit rate: %d%%\n",
+         st->hits, st->misses, percent(st->hits, st->hits + st->misses));
+    outf("  Evictions: %d  Write-backs: %d  Dirty: %d\n",
+         st->evictions, st->writebacks, st->dirty);
+}
+
+/* Re-read a working set half the size of the cache: after the first
+ * (cold) pass every lookup should be a hit */
+static void cachestat_bench() {
+    block_device_t *dev = get_block_device("hda");
+    bcache_stats_t before, after;
+    get_bcache_stats(&before);
+
+    if (dev == NULL || before.buffers == 0) {
+        out("Need a disk and a buffer cache\n");
+        return;
+    }
+
+    u32 working_set = MIN(before.buffers / 2, dev->sector_count);
+    for (u32 b = 0; b < working_set; b++) bcache_release(bcache_read(dev, b));
+
+    get_bcache_stats(&before);
+    u32 start = get_tick();
+    for (u32 pass = 0; pass < CACHEBENCH_PASSES; pass++) {
+        for (u32 b = 0; b < working_set; b++) bcache_release(bcache_read(dev, b));
+    }
+    u32 ticks = get_tick() - start;
+    get_bcache_stats(&after);
+
+    u32 hits = after.hits - before.hits;
+    u32 misses = after.misses - before.misses;
+    outf("Working set %d blocks x %d passes: %d ms\n",
+         working_set, CACHEBENCH_PASSES, ticks * 1000 / TIMER_HZ);
+    outf("  Hits: %d  Misses: %d  Hit rate: %d%%\n",
+         hits, misses, percent(hits, hits + misses));
+}
+
+void cachestat(char *args) {
+    if (args != NULL && strcmp(args, "bench") == 0) {
+        cachestat_bench();
+        return;
+    }
+
+    bcache_stats_t st;
+    get_bcache_stats(&st);
+    outf("Buffer cache: %d buffers of %d bytes (%d KB)\n",
+         st.buffers, BCACHE_BLOCK_SIZE, st.buffers * BCACHE_BLOCK_SIZE / 1024);
+    print_bcache_stats(&st);
+}
+
+void sync(char *args) {
+    UNUSED(args);
+    s32 err = fat16_is_mounted() ? fat16_sync() : FAT_OK;
+    if (err != FAT_OK || bcache_sync(NULL) != BLOCK_OK) {
+        kprint_color("sync: write error\n", RED_ON_BLACK);
+    }
+}
+
+static void fs_error(char *cmd, s32 err) {
+    kprintf_color(RED_ON_BLACK, "%s: %s\n", cmd, vfs_strerror(err));
+}
+
+void ls(char *args) {
+    vnode_t *dir;
+    vfs_dirent_t entry;
+    s32 err = vfs_resolve(args != NULL ? args : "/", &dir);
+    if (err != VFS_OK) {
+        fs_error("ls", err);
+        return;
+    }
+    if (dir->type != VFS_DIR) {
+        outf("%s  %d\n", args, dir->size);
+        vfs_iput(dir);
+        return;
+    }
+
+    for (u32 i = 0; vfs_readdir(dir, i, &entry) == VFS_OK; i++) {
+        if (entry.type == VFS_DIR) {
+            outf("%s/\n", entry.name);
+        } else {
+            outf("%s  %d\n", entry.name, entry.size);
+        }
+    }
+    vfs_iput(dir);
+}
+
+void cat(char *args) {
+    file_t file;
+    char chunk[CAT_CHUNK];
+
+    if (args == NULL) {
+        out("Usage: cat <path>\n");
+        return;
+    }
+    s32 err = vfs_open(args, 0, &file);
+    if (err != VFS_OK) {
+        fs_error("cat", err);
+        return;
+    }
+
+    s32 n;
+    while ((n = vfs_read(&file, (u8*)chunk, CAT_CHUNK)) > 0) {
+        /* Stop once nobody reads our output any more */
+        if (stream_write(stream_out(), (u8*)chunk, n) < 0) break;
+    }
+    if (n < 0) fs_error("cat", n);
+    else if (stream_out() == &console_stream) out("\n");     /* Back to a fresh line for the prompt */
+    vfs_close(&file);
+}
+
+/* Create or replace a whole file */
+static s32 write_file(char *path, u8 *data, u32 len) {
+    file_t file;
+    s32 err = vfs_open(path, VFS_O_CREATE | VFS_O_TRUNC, &file);
+    if (err != VFS_OK) return err;
+    s32 n = len ? vfs_write(&file, data, len) : 0;
+    vfs_close(&file);
+    return n < 0 ? n : VFS_OK;
+}
+
+void write(char *args) {
+    if (args == NULL) {
+        out("Usage: write <path> <text>\n");
+        return;
+    }
+
+    /* Split "<path> <text>" */
+    char *text = "";
+    for (s32 i = 0; args[i] != '\0'; i++) {
+        if (args[i] == ' ') {
+            args[i] = '\0';
+            text = &args[i + 1];
+            break;
+        }
+    }
+
+    s32 err = write_file(args, (u8*)text, strlen(text));
+    if (err != VFS_OK) fs_error("write", err);
+}
+
+void rm(char *args) {
+    if (args == NULL) {
+        out("Usage: rm <path>\n");
+        return;
+    }
+    s32 err = vfs_unlink(args);
+    if (err != VFS_OK) fs_error("rm", err);
+}
+
+void mkdir(char *args) {
+    if (args == NULL) {
+        out("Usage: mkdir <path>\n");
+        return;
+    }
+    s32 err = vfs_create(args, VFS_DIR, NULL);
+    if (err != VFS_OK) fs_error("mkdir", err);
+}
+
+/* DISK_MOUNT "/F" + 3 digits + ".TXT" */
+static void fatbench_name(u32 i, char *name) {
+    strcpy(name, DISK_MOUNT "/F000.TXT");
+    s32 d = strlen(DISK_MOUNT) + 2;
+    name[d] = '0' + (i / 100) % 10;
+    name[d + 1] = '0' + (i / 10) % 10;
+    name[d + 2] = '0' + i % 10;
+}
+
+void fatbench(char *args) {
+    UNUSED(args);
+    file_t file;
+    char name[VFS_MAX_PATH];
+
+    if (!fat16_is_mounted()) {
+        fs_error("fatbench", VFS_ERR_NOT_FOUND);
+        return;
+    }
+
+    u8 *buffer = (u8*)kmalloc(FATBENCH_LARGE_SIZE, 0, NULL);
+    if (!buffer) {
+        kprint_color("fatbench: out of memory\n", RED_ON_BLACK);
+        return;
+    }
+    for (u32 i = 0; i < FATBENCH_LARGE_SIZE; i++) buffer[i] = i & BYTE_MASK;
+
+    /* Large file: written once, then read back sequentially for a second */
+    u32 start = get_tick();
+    s32 err = write_file(DISK_MOUNT "/BENCH.DAT", buffer, FATBENCH_LARGE_SIZE);
+    if (err == VFS_OK && fat16_sync() != FAT_OK) err = VFS_ERR_IO;
+    if (err != VFS_OK) {
+        fs_error("fatbench", err);
+        kfree(buffer);
+        return;
+    }
+    print_rate("Large file write", FATBENCH_LARGE_SIZE, get_tick() - start);
+
+    u32 bytes = 0;
+    start = get_tick();
+    while (get_tick() - start < FATBENCH_TICKS) {
+        s32 n = -1;
+        if (vfs_open(DISK_MOUNT "/BENCH.DAT", 0, &file) == VFS_OK) {
+            n = vfs_read(&file, buffer, FATBENCH_LARGE_SIZE);
+            vfs_close(&file);
+        }
+        if (n != FATBENCH_LARGE_SIZE) {
+            kprint_color("fatbench: read error\n", RED_ON_BLACK);
+            break;
+        }
+        bytes += n;
+    }
+    print_rate("Large file read", bytes, get_tick() - start);
+    vfs_unlink(DISK_MOUNT "/BENCH.DAT");
+
+    /* Small files: create, open and read, delete -- all metadata work */
+    u32 ops = 0;
+    start = get_tick();
+    while (get_tick() - start < FATBENCH_TICKS) {
+        for (u32 i = 0; i < FATBENCH_SMALL_FILES; i++) {
+            fatbench_name(i, name);
+            write_file(name, buffer, FATBENCH_SMALL_SIZE);
+        }
+        for (u32 i = 0; i < FATBENCH_SMALL_FILES; i++) {
+            fatbench_name(i, name);
+            if (vfs_open(name, 0, &file) == VFS_OK) {
+                vfs_read(&file, buffer, FATBENCH_SMALL_SIZE);
+                vfs_close(&file);
+            }
+        }
+        for (u32 i = 0; i < FATBENCH_SMALL_FILES; i++) {
+            fatbench_name(i, name);
+            vfs_unlink(name);
+        }
+        ops += 3 * FATBENCH_SMALL_FILES;
+    }
+    u32 ticks = get_tick() - start;
+    outf("  Small files (%d x %d bytes): %d ops/s (create, read, delete)\n",
+         FATBENCH_SMALL_FILES, FATBENCH_SMALL_SIZE, ops * TIMER_HZ / (ticks ? ticks : 1));
+
+    fat16_sync();
+    kfree(buffer);
+}
+
+/* Resolve 'path' VFSBENCH_ITERATIONS times: average cycles and how many
+ * lookups reached the filesystem */
+static void vfsbench_walk(char *label, char *path) {
+    vfs_stats_t before, after;
+    vnode_t *vn;
+    get_vfs_stats(&before);
+    u64 start = read_tsc();
+    for (u32 i = 0; i < VFSBENCH_ITERATIONS; i++) {
+        if (vfs_resolve(path, &vn) == VFS_OK) vfs_iput(vn);
+    }
+    u32 cycles = (u32)(read_tsc() - start);
+    get_vfs_stats(&after);
+    outf("  %s: %d cycles, %d fs lookups, %d dcache hits (%d negative)\n",
+         label, cycles / VFSBENCH_ITERATIONS, after.fs_lookups - before.fs_lookups,
+         after.dcache_hits - before.dcache_hits + after.dcache_negative - before.dcache_negative,
+         after.dcache_negative - before.dcache_negative);
+}
+
+/* Build a VFSBENCH_DEPTH deep tree and look up its leaf (and a missing
+ * name next to it) cold, then warm from the dentry cache */
+void vfsbench(char *args) {
+    UNUSED(args);
+    char path[VFS_MAX_PATH];
+    char missing[VFS_MAX_PATH];
+    vfs_stats_t st;
+    vnode_t *vn;
+
+    kstrbuf_t sb;
+    kstrbuf_init(&sb, path, sizeof(path));
+    kstrbuf_append_str(&sb, VFSBENCH_ROOT);
+    vfs_create(path, VFS_DIR, NULL);
+    for (u32 d = 1; d <= VFSBENCH_DEPTH; d++) {
+        kstrbuf_append_str(&sb, "/d");
+        kstrbuf_append(&sb, '0' + d % 10);
+        s32 err = vfs_create(path, VFS_DIR, NULL);
+        if (err != VFS_OK && err != VFS_ERR_EXISTS) {
+            fs_error("vfsbench", err);
+            return;
+        }
+    }
+    kstrbuf_t msb;
+    kstrbuf_init(&msb, missing, sizeof(missing));
+    kstrbuf_append_str(&msb, path);
+    kstrbuf_append_str(&msb, "/missing");
+    kstrbuf_append_str(&sb, "/file");
+    s32 err = write_file(path, (u8*)"x", 1);
+    if (err != VFS_OK) {
+        fs_error("vfsbench", err);
+        return;
+    }
+
+    outf("%s (%d components):\n", path, VFSBENCH_DEPTH + 2);
+    vfs_shrink(1);
+    get_vfs_stats(&st);
+    u32 lookups = st.fs_lookups;
+    u64 start = read_tsc();
+    if (vfs_resolve(path, &vn) == VFS_OK) vfs_iput(vn);
+    u32 cycles = (u32)(read_tsc() - start);
+    get_vfs_stats(&st);
+    outf("  Cold walk: %d cycles, %d fs lookups\n",
+         cycles, st.fs_lookups - lookups);
+    vfsbench_walk("Warm walk", path);
+    vfsbench_walk("Missing leaf", missing);
+
+    get_vfs_stats(&st);
+    outf("Dentries: %d  Inodes: %d (%d unused)  Evictions: %d\n",
+         st.dentries, st.inodes, st.inodes_unused, st.inode_evictions);
+}
+
+/* Benchmarks fold the data they touch in here so it can't be optimized away */
+static volatile u32 bench_sink;
+
+static u32 sum_words(u32 *data, u32 bytes) {
+    u32 sum = 0;
+    for (u32 i = 0; i < bytes / sizeof(u32); i++) sum += data[i];
+    return sum;
+}
+
+/* One pass of mmapbench over the whole file through a fresh mapping */
+static void mmapbench_pass(vnode_t *vn, u8 cold) {
+    if (cold) pagecache_drop(vn);
+    u32 *data = (u32*)kmmap(vn, 0, vn->size, VM_READ);
+    if (!data) return;
+    bench_sink += sum_words(data, vn->size);
+    kmunmap(data);
+}
+
+static void mmapbench_run(char *label, vnode_t *vn, u8 cold) {
+    pagecache_stats_t pc_before, pc_after;
+    vm_stats_t vm_before, vm_after;
+    get_pagecache_stats(&pc_before);
+    get_vm_stats(&vm_before);
+
+    u32 passes = 0;
+    u32 start = get_tick();
+    while (get_tick() - start < MMAPBENCH_TICKS) {
+        mmapbench_pass(vn, cold);
+        passes++;
+    }
+    print_rate(label, passes * vn->size, get_tick() - start);
+
+    get_pagecache_stats(&pc_after);
+    get_vm_stats(&vm_after);
+    outf("    per pass: %d faults, %d reads, %d pages read ahead\n",
+         (vm_after.faults - vm_before.faults) / passes,
+         (pc_after.reads - pc_before.reads) / passes,
+         (pc_after.readahead_pages - pc_before.readahead_pages) / passes);
+}
+
+/* Scan a large file with read() into a buffer and through kmmap(),
+ * cold (page cache dropped each pass, with and without readahead) and warm */
+void mmapbench(char *args) {
+    char *path = args != NULL ? args : DISK_MOUNT "/" MMAPBENCH_FILE;
+    vnode_t *vn;
+    file_t file;
+
+    s32 err = vfs_resolve(path, &vn);
+    if (err == VFS_OK && vn->size < MMAPBENCH_SIZE && args == NULL) {
+        vfs_iput(vn);
+        err = VFS_ERR_NOT_FOUND;
+    }
+    if (err == VFS_ERR_NOT_FOUND && args == NULL) {
+        u8 *buffer = (u8*)kmalloc(MMAPBENCH_SIZE, 0, NULL);
+        if (!buffer) {
+            kprint_color("mmapbench: out of memory\n", RED_ON_BLACK);
+            return;
+        }
+        for (u32 i = 0; i < MMAPBENCH_SIZE; i++) buffer[i] = i & BYTE_MASK;
+        err = write_file(path, buffer, MMAPBENCH_SIZE);
+        kfree(buffer);
+        if (err == VFS_OK) err = vfs_resolve(path, &vn);
+    }
+    if (err != VFS_OK) {
+        fs_error("mmapbench", err);
+        return;
+    }
+    if (vn->size < FRAME_SIZE) {
+        kprint_color("mmapbench: file too small\n", RED_ON_BLACK);
+        vfs_iput(vn);
+        return;
+    }
+    outf("%s: %d KB\n", path, vn->size / 1024);
+
+    /* read(): copy each chunk into a buffer, then use it */
+    u8 *chunk = (u8*)kmalloc(MMAPBENCH_CHUNK, 0, NULL);
+    u32 bytes = 0;
+    u32 start = get_tick();
+    while (chunk && get_tick() - start < MMAPBENCH_TICKS) {
+        if (vfs_open(path, 0, &file) != VFS_OK) break;
+        s32 n;
+        while ((n = vfs_read(&file, chunk, MMAPBENCH_CHUNK)) > 0) {
+            bench_sink += sum_words((u32*)chunk, n);
+            bytes += n;
+        }
+        vfs_close(&file);
+    }
+    print_rate("read()", bytes, get_tick() - start);
+    kfree(chunk);
+
+    mmapbench_run("mmap cold, readahead", vn, 1);
+    pagecache_set_readahead(0);
+    mmapbench_run("mmap cold, no readahead", vn, 1);
+    pagecache_set_readahead(1);
+    mmapbench_run("mmap warm", vn, 0);
+
+    /* Two mappings of the same file share the cached frames */
+    u8 *a = (u8*)kmmap(vn, 0, FRAME_SIZE, VM_READ);
+    u8 *b = (u8*)kmmap(vn, 0, FRAME_SIZE, VM_READ);
+    if (a && b) {
+        bench_sink += a[0] + b[0];
+        page_entry_t pa = get_page_entry(kernel_directory, (u32)a);
+        page_entry_t pb = get_page_entry(kernel_directory, (u32)b);
+        outf("  Two mappings share one frame: %s\n",
+             (pa & PAGE_PRESENT) && (pa & PAGE_FRAME_MASK) == (pb & PAGE_FRAME_MASK) ? "yes" : "no");
+    }
+    if (a) kmunmap(a);
+    if (b) kmunmap(b);
+    vfs_iput(vn);
+}
+
+/* Run a program image and report how long it took to get going */
+void shell_exec(char *args) {
+    if (args == NULL) {
+        out("Usage: exec <path>\n");
+        return;
+    }
+    exec_result_t result;
+    s32 err = exec(args, &result);
+    if (err != ELF_OK) {
+        kprintf_color(RED_ON_BLACK, "exec: %s\n", elf_strerror(err));
+        return;
+    }
+    if (result.status == USER_KILLED) outf("%s was killed\n", args);
+    else outf("%s exited with status %d\n", args, result.status);
+    outf("  exec to first instruction: %d cycles\n", result.load_cycles);
+    outf("  %d regions spanning %d pages, %d faulted in while running\n",
+         result.regions, result.mapped_pages, result.faults);
+}
+
+/* "bench/f" + 4 digits */
+static void ramfsbench_name(u32 i, char *name) {
+    strcpy(name, "bench/f");
+    name[7] = '0' + (i / 1000) % 10;
+    name[8] = '0' + (i / 100) % 10;
+    name[9] = '0' + (i / 10) % 10;
+    name[10] = '0' + i % 10;
+    name[11] = '\0';
+}
+
+/* Average cycles of a lookup, a zero-copy map and a copying read of a
+ * small file, for growing numbers of files in the ramfs */
+void ramfsbench(char *args) {
+    UNUSED(args);
+    u32 counts[] = RAMFSBENCH_COUNTS;
+    char name[RAMFS_PATH_LEN];
+    u8 payload[RAMFSBENCH_FILE_SIZE];
+    u8 copy[RAMFSBENCH_FILE_SIZE];
+    memory_set(payload, 'x', RAMFSBENCH_FILE_SIZE);
+
+    for (u32 c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        u32 count = counts[c];
+        ramfs_node_t *node;
+        u32 created = 0;
+        for (; created < count; created++) {
+            ramfsbench_name(created, name);
+            if (ramfs_create(name, RAMFS_FILE, &node) != RAMFS_OK ||
+                ramfs_write(node, 0, payload, RAMFSBENCH_FILE_SIZE) < 0) {
+                kprint_color("ramfsbench: out of memory\n", RED_ON_BLACK);
+                break;
+            }
+        }
+
+        u32 lookup_cycles = 0, map_cycles = 0, read_cycles = 0;
+        u32 sum = 0;
+        for (u32 i = 0; created && i < RAMFSBENCH_ITERATIONS; i++) {
+            ramfsbench_name((i * 7919) % created, name);
+            u8 *data;
+
+            u64 t0 = read_tsc();
+            node = ramfs_lookup(name);
+            u64 t1 = read_tsc();
+            u32 n = ramfs_map(node, 0, &data);
+            for (u32 j = 0; j < n; j++) sum += data[j];
+            u64 t2 = read_tsc();
+            ramfs_read(node, 0, copy, RAMFSBENCH_FILE_SIZE);
+            for (u32 j = 0; j < RAMFSBENCH_FILE_SIZE; j++) sum += copy[j];
+            u64 t3 = read_tsc();
+
+            lookup_cycles += (u32)(t1 - t0);
+            map_cycles += (u32)(t2 - t1);
+            read_cycles += (u32)(t3 - t2);
+        }
+        outf("%d files: lookup %d, map %d, read %d cycles\n", created,
+             lookup_cycles / RAMFSBENCH_ITERATIONS, map_cycles / RAMFSBENCH_ITERATIONS,
+             read_cycles / RAMFSBENCH_ITERATIONS);
+        UNUSED(sum);
+
+        for (u32 i = 0; i < created; i++) {
+            ramfsbench_name(i, name);
+            ramfs_remove(name);
+        }
+    }
+    ramfs_remove("bench");
+}
+
+/* Split off the first word of 'args': returns the rest, or NULL */
+static char* split_arg(char *args) {
+    while (*args && *args != ' ') args++;
+    if (!*args) return NULL;
+    *args++ = '\0';
+    while (*args == ' ') args++;
+    return *args ? args : NULL;
+}
+
+/* Input of grep, wc and head: a file when one is named, otherwise the
+ * pipe feeding the command */
+typedef struct {
+    stream_t stream;
+    file_t file;
+} file_stream_t;
+
+static s32 file_stream_read(stream_t *s, u8 *buf, u32 len) {
+    return vfs_read(&((file_stream_t*)s->priv)->file, buf, len);
+}
+
+static stream_t* open_input(char *cmd, char *path, file_stream_t *fs) {
+    if (path == NULL) {
+        if (stream_in() == NULL) kprintf_color(RED_ON_BLACK, "%s: no input, name a file or pipe into it\n", cmd);
+        return stream_in();
+    }
+    s32 err = vfs_open(path, 0, &fs->file);
+    if (err != VFS_OK) {
+        fs_error(cmd, err);
+        return NULL;
+    }
+    fs->stream.write = NULL;
+    fs->stream.read = file_stream_read;
+    fs->stream.priv = fs;
+    return &fs->stream;
+}
+
+static void close_input(stream_t *in, file_stream_t *fs) {
+    if (in == &fs->stream) vfs_close(&fs->file);
+}
+
+typedef struct {
+    stream_t *in;
+    u8 buf[SHELL_READ_CHUNK];
+    u32 pos;
+    u32 len;
+} line_reader_t;
+
+/* Next line without its newline; longer lines than 'max' - 1 come back
+ * in pieces. -1 at the end of input */
+static s32 read_line(line_reader_t *lr, char *line, u32 max) {
+    u32 n = 0;
+    while (n < max - 1) {
+        if (lr->pos == lr->len) {
+            s32 got = stream_read(lr->in, lr->buf, SHELL_READ_CHUNK);
+            if (got <= 0) {
+                if (n == 0) return -1;
+                break;
+            }
+            lr->pos = 0;
+            lr->len = got;
+        }
+        char c = lr->buf[lr->pos++];
+        if (c == '\n') break;
+        line[n++] = c;
+    }
+    line[n] = '\0';
+    return n;
+}
+
+static u8 contains(char *s, char *pattern) {
+    s32 len = strlen(pattern);
+    for (; *s; s++) {
+        if (strncmp(s, pattern, len) == 0) return 1;
+    }
+    return len == 0;
+}
+
+void grep(char *args) {
+    if (args == NULL) {
+        out("Usage: grep <text> [path]\n");
+        return;
+    }
+    char *path = split_arg(args);
+    file_stream_t fs;
+    line_reader_t lr;
+    char line[SHELL_LINE_MAX];
+    lr.in = open_input("grep", path, &fs);
+    if (lr.in == NULL) return;
+    lr.pos = lr.len = 0;
+
+    while (read_line(&lr, line, SHELL_LINE_MAX) >= 0) {
+        if (contains(line, args) && outf("%s\n", line) < 0) break;
+    }
+    close_input(lr.in, &fs);
+}
+
+void wc(char *args) {
+    file_stream_t fs;
+    u8 chunk[SHELL_READ_CHUNK];
+    stream_t *in = open_input("wc", args, &fs);
+    if (in == NULL) return;
+
+    u32 lines = 0, words = 0, bytes = 0;
+    u8 in_word = 0;
+    s32 n;
+    while ((n = stream_read(in, chunk, SHELL_READ_CHUNK)) > 0) {
+        bytes += n;
+        for (s32 i = 0; i < n; i++) {
+            u8 space = chunk[i] == ' ' || chunk[i] == '\n' || chunk[i] == '\t' || chunk[i] == '\r';
+            if (chunk[i] == '\n') lines++;
+            if (!space && !in_word) words++;
+            in_word = !space;
+        }
+    }
+    outf("%d lines, %d words, %d bytes\n", lines, words, bytes);
+    close_input(in, &fs);
+}
+
+void head(char *args) {
+    u32 count = HEAD_DEFAULT_LINES;
+    char *path = args;
+    if (args != NULL && strncmp(args, "-n", 2) == 0) {
+        char *num = split_arg(args);
+        path = num ? split_arg(num) : NULL;
+        count = 0;
+        for (char *p = num; p && *p >= '0' && *p <= '9'; p++) count = count * 10 + (*p - '0');
+    }
+    file_stream_t fs;
+    line_reader_t lr;
+    char line[SHELL_LINE_MAX];
+    lr.in = open_input("head", path, &fs);
+    if (lr.in == NULL) return;
+    lr.pos = lr.len = 0;
+
+    /* Returning closes our end of the pipe, which stops the writer */
+    for (u32 i = 0; i < count && read_line(&lr, line, SHELL_LINE_MAX) >= 0; i++) {
+        if (outf("%s\n", line) < 0) break;
+    }
+    close_input(lr.in, &fs);
+}
+
+typedef struct {
+    pipe_t *pipe;
+    u32 chunk;
+} pipebench_job_t;
+
+static void pipebench_writer(void *arg) {
+    pipebench_job_t *job = (pipebench_job_t*)arg;
+    u8 buf[PIPEBENCH_MAX_CHUNK];
+    memory_set(buf, 'x', job->chunk);
+    for (u32 done = 0; done < PIPEBENCH_BYTES; done += job->chunk) {
+        if (pipe_write(job->pipe, buf, job->chunk) < 0) break;
+    }
+    pipe_close_write(job->pipe);
+}
+
+/* Push PIPEBENCH_BYTES from a kernel task through a pipe into this one,
+ * in chunks of a few sizes */
+void pipebench(char *args) {
+    UNUSED(args);
+    u32 chunks[] = PIPEBENCH_CHUNKS;
+    time_page_t *time_page = get_time_page();
+    u32 mhz = time_page ? time_page->tsc_mhz : 0;
+    u8 *buf = (u8*)kmalloc(PIPEBENCH_MAX_CHUNK, 0, NULL);
+    if (!mhz || !buf) {
+        kprint_color("pipebench: no TSC calibration or out of memory\n", RED_ON_BLACK);
+        kfree(buf);
+        return;
+    }
+    outf("%d KB through a %d byte pipe:\n", PIPEBENCH_BYTES / 1024, PIPE_SIZE);
+
+    for (u32 c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        pipebench_job_t job;
+        job.chunk = chunks[c];
+        job.pipe = pipe_create();
+        task_t *writer = job.pipe ? task_create_kernel(pipebench_writer, &job) : NULL;
+        if (!writer) {
+            kprint_color("pipebench: out of memory\n", RED_ON_BLACK);
+            if (job.pipe) {
+                pipe_close_read(job.pipe);
+                pipe_close_write(job.pipe);
+            }
+            break;
+        }
+
+        u32 bytes = 0;
+        s32 n;
+        u64 start = read_tsc();
+        while ((n = pipe_read(job.pipe, buf, job.chunk)) > 0) bytes += n;
+        u32 cycles = (u32)(read_tsc() - start);
+        pipe_close_read(job.pipe);
+        task_wait(writer);
+        task_release(writer);
+
+        u32 us = cycles / mhz;
+        outf("  %d byte writes: %d MB/s, %d cycles per write\n", job.chunk,
+             bytes / (us ? us : 1), cycles / (bytes / job.chunk ? bytes / job.chunk : 1));
+    }
+    kfree(buf);
 }
 
 void unknown_command() {
-    kprint_color("Unknown command. Type 'help' for available commands.\n", get_input_color());
+    out("Unknown command. Type 'help' for available commands.\n");
 }
 
-/* Command table - defined AFTER the functions so they exist */
-command_t commands[] = {
+/* Built-in commands - defined AFTER the functions so they exist */
+static const command_t builtin_commands[] = {
     {"help", help, "Show this help message"},
     {"clear", clear, "Clear the screen"},
     {"echo", echo, "Print a message"},
-    {"mem", mem, "Show memory statistics"},
+    {"mem", mem, "Show memory statistics [test]"},
     {"prompt", prompt, "Change typing color"},
+    {"disktest", disktest, "Measure disk throughput [device]"},
+    {"cachestat", cachestat, "Buffer cache statistics [bench]"},
+    {"sync", sync, "Write dirty buffers to disk"},
+    {"ls", ls, "List a directory [path]"},
+    {"cat", cat, "Print a file"},
+    {"write", write, "Write text to a file: write <path> <text>"},
+    {"rm", rm, "Delete a file"},
+    {"mkdir", mkdir, "Create a directory"},
+    {"fatbench", fatbench, "FAT16 large file and small file benchmark"},
+    {"ramfsbench", ramfsbench, "ramfs lookup/read latency vs file count"},
+    {"vfsbench", vfsbench, "Deep path lookups, cold vs dentry cache"},
+    {"mmapbench", mmapbench, "mmap vs read() over a large file [path]"},
+    {"exec", shell_exec, "Run an ELF program: exec <path>"},
+    {"grep", grep, "Lines containing a text: grep <text> [path]"},
+    {"wc", wc, "Count lines, words and bytes [path]"},
+    {"head", head, "First lines: head [-n N] [path]"},
+    {"pipebench", pipebench, "Pipe throughput between two tasks"},
     {"exit", shell_exit, "Halt the CPU"}
 };
 
-/* Main command parser */
-void command_parser(char *input) {
-    char *args = NULL;
-
-    /* Parse command and arguments */
-    int i = 0;
-    while (input[i] != '\0') {
-        if (input[i] == ' ') {
-            input[i] = '\0'; 
-            args = &input[i+1];
-            break;
+void init_shell() {
+    for (u32 i = 0; i < sizeof(builtin_commands) / sizeof(builtin_commands[0]); i++) {
+        register_command(builtin_commands[i].name, builtin_commands[i].handler, builtin_commands[i].description);
+    }
+}
+
+/* One command of a pipeline, running in its own task */
+typedef struct {
+    char *line;
+    command_t *command;
+    char *args;
+    pipe_t *in;                    /* From the previous command */
+    pipe_t *out;                   /* To the next one */
+    task_t *task;
+} pipeline_stage_t;
+
+/* Split 'line' into command name and arguments, in place */
+static char* parse_args(char *line) {
+    for (int i = 0; line[i] != '\0'; i++) {
+        if (line[i] == ' ') {
+            line[i] = '\0';
+            return &line[i + 1];
         }
-        i++;
     }
+    return NULL;
+}
 
-    /* Look up command in table */
-    for (int i = 0; i < NUM_COMMANDS; i++) {
-        if (strcmp(input, commands[i].name) == 0) {
-            commands[i].handler(args);
+static char* trim(char *s) {
+    while (*s == ' ') s++;
+    s32 len = strlen(s);
+    while (len > 0 && s[len - 1] == ' ') s[--len] = '\0';
+    return s;
+}
+
+static void close_stage(pipeline_stage_t *stage) {
+    if (stage->in) pipe_close_read(stage->in);
+    if (stage->out) pipe_close_write(stage->out);
+}
+
+static void run_stage(void *arg) {
+    pipeline_stage_t *stage = (pipeline_stage_t*)arg;
+    task_t *self = current_task();
+    self->in = stage->in ? &stage->in->read_end : NULL;
+    self->out = stage->out ? &stage->out->write_end : NULL;
+    stage->command->handler(stage->args);
+    close_stage(stage);
+}
+
+/* Every command in its own task, all running at once: a writer blocks
+ * when its pipe is full and the reader gets to run. The shell task waits
+ * for them; no other line starts meanwhile (see user_input()), so only
+ * the stages ever write into the pipes */
+static void run_pipeline(pipeline_stage_t *stages, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        stages[i].in = i ? stages[i - 1].out : NULL;
+        stages[i].out = NULL;
+        stages[i].task = NULL;
+    }
+    for (u32 i = 0; i + 1 < count; i++) {
+        stages[i].out = pipe_create();
+        if (!stages[i].out) {
+            kprint_color("Out of memory for pipes\n", RED_ON_BLACK);
+            for (u32 j = 0; j < i; j++) {
+                pipe_close_read(stages[j].out);
+                pipe_close_write(stages[j].out);
+            }
             return;
         }
+        stages[i + 1].in = stages[i].out;
     }
-    
-    /* Command not found */
-    if (input[0] != '\0') {
-        unknown_command();
+    for (u32 i = 0; i < count; i++) {
+        stages[i].task = task_create_kernel(run_stage, &stages[i]);
+        /* Its neighbours see end of input or a closed pipe */
+        if (!stages[i].task) close_stage(&stages[i]);
     }
-}
\ No newline at end of file
+    for (u32 i = 0; i < count; i++) {
+        if (!stages[i].task) continue;
+        task_wait(stages[i].task);
+        task_release(stages[i].task);
+    }
+}
+
+/* Main command parser: a command, or commands joined by '|' */
+void command_parser(char *input) {
+    pipeline_stage_t stages[SHELL_PIPELINE_MAX];
+    u32 count = 0;
+
+    for (char *line = input; ; ) {
+        char *bar = line;
+        while (*bar && *bar != '|') bar++;
+        if (count == SHELL_PIPELINE_MAX) {
+            kprintf_color(RED_ON_BLACK, "At most %d commands in a pipeline\n", SHELL_PIPELINE_MAX);
+            return;
+        }
+        stages[count++].line = line;
+        if (!*bar) break;
+        *bar = '\0';
+        line = bar + 1;
+    }
+
+    if (count == 1) {
+        char *args = parse_args(input);
+        command_t *command = find_command(input);
+        if (command) command->handler(args);
+        else if (input[0] != '\0') unknown_command();
+        return;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        char *line = trim(stages[i].line);
+        stages[i].args = parse_args(line);
+        stages[i].command = find_command(line);
+        if (!stages[i].command) {
+            unknown_command();
+            return;
+        }
+    }
+    run_pipeline(stages, count);
+}
@@ -1,16 +1,63 @@
 #ifndef SHELL_H
 #define SHELL_H
 
-#define NUM_COMMANDS 6
+#include "command.h"
 
-typedef void (*command_handler_t)(char *args);
+/* Commands joined by '|' run as one task each */
+#define SHELL_PIPELINE_MAX    4
 
-typedef struct {
-    char *name;                    // Command name
-    command_handler_t handler;     // Function to call
-    char *description;
-} command_t;
+/* grep, wc and head read their input in chunks, lines up to this long */
+#define SHELL_READ_CHUNK      512
+#define SHELL_LINE_MAX        256
+#define HEAD_DEFAULT_LINES    10
 
+/* pipebench: bytes pushed for each write size */
+#define PIPEBENCH_BYTES       0x400000  /* 4MB */
+#define PIPEBENCH_CHUNKS      {64, 512, 4096}
+#define PIPEBENCH_MAX_CHUNK   4096
+
+/* disktest parameters */
+#define DISKTEST_TICKS        TIMER_HZ  /* Run each pass for one second */
+#define DISKTEST_BUF_SIZE     0x10000
+#define DISKTEST_RAND_SECTORS 8         /* 4KB random reads */
+#define DISKTEST_QUEUE_DEPTH  8
+
+/* cachestat bench: passes over the warm working set */
+#define CACHEBENCH_PASSES     10
+
+/* cat reads files in chunks of this size */
+#define CAT_CHUNK             512
+
+/* Where the FAT16 volume on hda appears in the namespace */
+#define DISK_MOUNT            "/disk"
+
+/* fatbench parameters */
+#define FATBENCH_TICKS        TIMER_HZ
+#define FATBENCH_LARGE_SIZE   0x100000  /* 1MB */
+#define FATBENCH_SMALL_FILES  64
+#define FATBENCH_SMALL_SIZE   100
+
+/* ramfsbench parameters */
+#define RAMFSBENCH_COUNTS     {16, 128, 512}
+#define RAMFSBENCH_ITERATIONS 1000
+#define RAMFSBENCH_FILE_SIZE  64
+
+/* vfsbench parameters */
+#define VFSBENCH_ROOT         "/tmp"
+#define VFSBENCH_DEPTH        8
+#define VFSBENCH_ITERATIONS   1000
+
+/* mem test: high frames taken, written and checked */
+#define MEMTEST_FRAMES        1024
+
+/* mmapbench parameters */
+#define MMAPBENCH_FILE        "MMAP.DAT"
+#define MMAPBENCH_SIZE        0x100000  /* 1MB */
+#define MMAPBENCH_CHUNK       0x10000   /* read() buffer */
+#define MMAPBENCH_TICKS       TIMER_HZ
+
+/* Registers the built-in commands */
+void init_shell();
 void command_parser(char *input);
 void unknown_command();
 
@@ -21,6 +68,23 @@ void echo(char *args);
 void shell_exit(char *args);
 void prompt(char *args);
 void mem(char *args);
+void disktest(char *args);
+void cachestat(char *args);
+void sync(char *args);
+void ls(char *args);
+void cat(char *args);
+void write(char *args);
+void rm(char *args);
+void mkdir(char *args);
+void fatbench(char *args);
+void ramfsbench(char *args);
+void vfsbench(char *args);
+void mmapbench(char *args);
+void shell_exec(char *args);
+void grep(char *args);
+void wc(char *args);
+void head(char *args);
+void pipebench(char *args);
 
 #endif
 
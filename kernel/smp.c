@@ -0,0 +1,251 @@
+#include "smp.h"
+#include "task.h"
+#include "command.h"
+#include "spinlock.h"
+#include "stream.h"
+#include "../cpu/acpi.h"
+#include "../cpu/apic.h"
+#include "../cpu/fpu.h"
+#include "../cpu/gdt.h"
+#include "../cpu/idt.h"
+#include "../cpu/isr.h"
+#include "../cpu/syscall.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../libc/function.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+/* In trampoline.asm */
+extern u8 trampoline_start[];
+extern u8 trampoline_params[];
+extern u8 trampoline_end[];
+
+/* The data at trampoline_params */
+typedef struct {
+    gdt_register_t gdtr;
+    u16 pad;
+    u32 cr3;
+    u32 cr4;
+    u32 efer;
+    u32 stack;
+    u32 entry;
+    u32 cpu;
+} __attribute__((packed)) trampoline_params_t;
+
+cpu_t cpus[MAX_CPUS] = {{.online = 1, .space = &kernel_space}};
+u32 cpu_count = 1;
+
+static spinlock_t big_lock = SPINLOCK_INIT("kernel");
+static u32 tlb_generation = 0;
+
+cpu_t* this_cpu() {
+    return &cpus[cpu_index()];
+}
+
+void kernel_lock() {
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    if (cpu->lock_depth++ == 0) {
+        spin_lock(&big_lock);
+        if (cpu->tlb_generation != tlb_generation) {
+            cpu->tlb_generation = tlb_generation;
+            __asm__ __volatile__("mov %%cr3, %%eax; mov %%eax, %%cr3" ::: "eax", "memory");
+        }
+    }
+    irq_restore(flags);
+}
+
+void kernel_unlock() {
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    if (--cpu->lock_depth == 0) spin_unlock(&big_lock);
+    irq_restore(flags);
+}
+
+u32 kernel_lock_drop() {
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    u32 depth = cpu->lock_depth;
+    if (depth) {
+        cpu->lock_depth = 0;
+        spin_unlock(&big_lock);
+    }
+    irq_restore(flags);
+    return depth;
+}
+
+void kernel_lock_restore(u32 depth) {
+    if (!depth) return;
+    u32 flags = irq_save();
+    kernel_lock();
+    this_cpu()->lock_depth = depth;
+    irq_restore(flags);
+}
+
+void kernel_tlb_invalidate() {
+    tlb_generation++;
+    /* The caller has flushed its own entry */
+    this_cpu()->tlb_generation = tlb_generation;
+}
+
+void cpu_wait() {
+    /* Before the lock goes, so whoever queues work next sees it asleep */
+    this_cpu()->halted = 1;
+    u32 depth = kernel_lock_drop();
+    __asm__ __volatile__("sti; hlt; cli" ::: "memory");
+    /* An interrupt handler may have switched tasks, so possibly CPUs */
+    this_cpu()->halted = 0;
+    kernel_lock_restore(depth);
+}
+
+void smp_kick(cpu_t *cpu) {
+    cpu_t *self = this_cpu();
+    for (u32 i = 0; !cpu && i < cpu_count; i++) {
+        if (&cpus[i] != self && cpus[i].halted) cpu = &cpus[i];
+    }
+    if (!cpu || cpu == self || !cpu->halted) return;
+    /* Not kicked twice before it gets going */
+    cpu->halted = 0;
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_FIXED | IRQ_RESCHEDULE);
+}
+
+/* Preemption on the application processors, as the PIT does it on the
+ * boot CPU */
+static void ap_tick(registers_t regs) {
+    task_tick((regs.cs & 3) == 3);
+}
+
+void ap_main(u32 id) {
+    cpu_t *cpu = &cpus[id];
+    gdt_init_cpu(id);
+    set_idt();
+    syscall_init_cpu();
+    fpu_init_cpu();
+    lapic_init_cpu(0);
+    cpu->current = cpu->idle;
+    /* The boot CPU still holds the lock while it starts the others */
+    cpu->online = 1;
+    kernel_lock();
+    lapic_timer_start(1000000 / TIMER_HZ, LAPIC_PERIODIC, ap_tick);
+    task_idle_loop();
+}
+
+static void delay_us(u32 us) {
+    u32 cycles = get_time_page()->tsc_mhz * us;
+    u64 start = read_tsc();
+    while ((u32)(read_tsc() - start) < cycles) __asm__ __volatile__("pause");
+}
+
+/* INIT, then two startup IPIs as the MP specification has it (the second
+ * is ignored by a CPU already running) */
+static u8 start_ap(cpu_t *cpu, trampoline_params_t *params) {
+    params->stack = (u32)cpu->idle->stack + TASK_STACK_SIZE;
+    params->cpu = cpu->id;
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    delay_us(SMP_INIT_DELAY_US);
+    for (u32 i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (TRAMPOLINE_ADDR >> 12));
+        delay_us(SMP_SIPI_DELAY_US);
+    }
+    for (u32 waited = 0; !cpu->online && waited < SMP_START_TIMEOUT_US; waited += 100) delay_us(100);
+    return cpu->online;
+}
+
+/* smp bench: every task runs the same loop without the lock. With up to
+ * one task per CPU a round should take as long as a single task */
+static void bench_task(void *arg) {
+    u32 depth = kernel_lock_drop();
+    __asm__ __volatile__("sti");
+    u32 x = 2463534242u;
+    for (u32 i = 0; i < SMP_BENCH_WORK; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    __asm__ __volatile__("cli");
+    kernel_lock_restore(depth);
+    *(u32*)arg = x;
+}
+
+/* Cycles for 'n' tasks to finish, 0 if they could not all be created */
+static u32 bench_round(u32 n) {
+    task_t *tasks[SMP_BENCH_MAX_TASKS];
+    u32 results[SMP_BENCH_MAX_TASKS];
+    u64 start = read_tsc();
+    u32 started = 0;
+    while (started < n && (tasks[started] = task_create_kernel(bench_task, &results[started]))) started++;
+    for (u32 i = 0; i < started; i++) {
+        task_wait(tasks[i]);
+        task_release(tasks[i]);
+    }
+    return started == n ? (u32)(read_tsc() - start) : 0;
+}
+
+static void smp_bench(stream_t *out) {
+    u32 max = MIN(2 * cpu_count, SMP_BENCH_MAX_TASKS);
+    u32 single = 0;
+    stream_printf(out, "%d CPUs, %d iterations per task\n", cpu_count, SMP_BENCH_WORK);
+    for (u32 n = 1; n <= max; n++) {
+        u32 cycles = bench_round(n);
+        if (!cycles) {
+            kprint_color("Out of memory for tasks\n", RED_ON_BLACK);
+            return;
+        }
+        if (n == 1) single = cycles;
+        /* n * single / cycles, in hundredths */
+        u32 speedup = (single / 1000) * n * 100 / (cycles / 1000 ? cycles / 1000 : 1);
+        if (stream_printf(out, "  %d tasks: %d Mcycles, speedup %d.%d%d\n", n, cycles / 1000000,
+                          speedup / 100, speedup / 10 % 10, speedup % 10) < 0) return;
+    }
+}
+
+/* smp [bench]: what each CPU has been doing, or the scaling benchmark */
+static void smp_command(char *args) {
+    stream_t *out = stream_out();
+    if (args && strcmp(args, "bench") == 0) {
+        smp_bench(out);
+        return;
+    }
+    for (u32 i = 0; i < cpu_count; i++) {
+        cpu_t *cpu = &cpus[i];
+        if (stream_printf(out, "CPU%d APIC %d: %d ticks, %d switches, %d steals, %d queued, FPU %d loads %d saves%s\n",
+                          i, cpu->apic_id, cpu->ticks, cpu->switches, cpu->steals, cpu->run_length,
+                          cpu->fpu_loads, cpu->fpu_saves, cpu == this_cpu() ? " (this one)" : "") < 0) return;
+    }
+}
+
+void init_smp() {
+    register_command("smp", smp_command, "Per CPU scheduling counters [bench]");
+    acpi_madt_t *madt = get_acpi_madt();
+    if (!apic_available() || !madt || madt->cpu_count < 2 || !get_time_page()) {
+        kprint("SMP: 1 CPU\n");
+        return;
+    }
+    cpus[0].apic_id = lapic_id();
+
+    memory_copy(trampoline_start, (u8*)TRAMPOLINE_ADDR, trampoline_end - trampoline_start);
+    trampoline_params_t *params = (trampoline_params_t*)(TRAMPOLINE_ADDR + (trampoline_params - trampoline_start));
+    __asm__ __volatile__("sgdt (%0)" :: "r"(&params->gdtr) : "memory");
+    params->cr3 = (u32)kernel_directory;
+    params->cr4 = paging_pae() ? CR4_PAE : 0;
+    params->efer = paging_nx() ? EFER_NXE : 0;
+    params->entry = (u32)ap_main;
+
+    for (u32 i = 0; i < madt->cpu_count && cpu_count < MAX_CPUS; i++) {
+        if (madt->cpu_apic_ids[i] == cpus[0].apic_id) continue;
+        cpu_t *cpu = &cpus[cpu_count];
+        cpu->id = cpu_count;
+        cpu->apic_id = madt->cpu_apic_ids[i];
+        cpu->space = &kernel_space;
+        cpu->idle = task_create_idle(cpu->id);
+        if (!cpu->idle) break;
+        /* One that comes up late must not find its slot taken: stop here */
+        if (!start_ap(cpu, params)) {
+            kprintf_color(RED_ON_BLACK, "SMP: CPU with APIC %d did not start\n", cpu->apic_id);
+            break;
+        }
+        cpu_count++;
+    }
+    kprintf_color(GREEN_ON_BLACK, "SMP: %d CPUs\n", cpu_count);
+}
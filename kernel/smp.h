@@ -0,0 +1,80 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "../cpu/types.h"
+#include "../cpu/cpu.h"
+
+/* Real mode start of the application processors (cpu/trampoline.asm):
+ * below the kernel, in a page alloc_frame() never hands out */
+#define TRAMPOLINE_ADDR        0x8000
+#define SMP_INIT_DELAY_US      10000   /* INIT to the first startup IPI */
+#define SMP_SIPI_DELAY_US      200     /* Between the two startup IPIs */
+#define SMP_START_TIMEOUT_US   100000  /* For an AP to report in */
+
+/* smp bench: iterations of the per task loop, and most tasks in a round */
+#define SMP_BENCH_WORK         20000000
+#define SMP_BENCH_MAX_TASKS    (2 * MAX_CPUS)
+
+struct task;
+struct address_space;
+
+/* One per CPU, indexed by cpu_index() (cpu/gdt.h). Everything in here
+ * changes under the big kernel lock, or on its own CPU with interrupts off */
+typedef struct {
+    u32 id;
+    u32 apic_id;
+    volatile u8 online;
+    volatile u8 halted;                /* In cpu_wait(): an IPI wakes it */
+    struct task *current;
+    struct task *idle;                 /* Runs when nothing else can, never queued */
+    struct task *run_head;
+    struct task *run_tail;
+    u32 run_length;
+    u32 lock_depth;                    /* Big kernel lock nesting, 0: not held */
+    u32 tlb_generation;                /* Last kernel unmap this CPU flushed for */
+    struct address_space *space;       /* In CR3 */
+    u32 ticks;
+    u32 switches;
+    u32 steals;                        /* Tasks taken from other CPUs' queues */
+    struct task *fpu_owner;            /* Whose state the FPU registers hold, see cpu/fpu.h */
+    u8 fpu_used;                       /* CR0.TS clear: fpu_owner runs and has used them */
+    u8 fpu_in_kernel;                  /* Between kernel_fpu_begin() and kernel_fpu_end() */
+    u32 fpu_loads;
+    u32 fpu_saves;
+    u32 kmap_depth;                    /* kmap() windows in use, see cpu/paging.h */
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+/* CPUs online, the boot CPU is cpus[0] */
+extern u32 cpu_count;
+
+cpu_t* this_cpu();
+
+/* Start every other processor the MADT lists with INIT and two startup
+ * IPIs and register the smp command. Needs the APICs and the time page */
+void init_smp();
+/* Where the trampoline lands each application processor */
+void ap_main(u32 id);
+
+/* The big kernel lock. A CPU holds it whenever it runs kernel code: the
+ * interrupt, exception and system call entries take it, returning to
+ * ring 3 or sleeping in cpu_wait() lets it go. It nests, and the nesting
+ * depth is switched along with the task (see task.c) */
+void kernel_lock();
+void kernel_unlock();
+/* Let go of it completely for a stretch that touches nothing shared,
+ * then take it back at the same depth */
+u32 kernel_lock_drop();
+void kernel_lock_restore(u32 depth);
+/* A page the kernel unmapped may still be in other CPUs' TLBs: each flushes
+ * before it next takes the lock */
+void kernel_tlb_invalidate();
+
+/* Sleep until the next interrupt, interrupts off before and after, with
+ * the lock let go meanwhile */
+void cpu_wait();
+/* Wake 'cpu' from cpu_wait(), or any sleeping CPU that could take over
+ * work queued here if 'cpu' is NULL */
+void smp_kick(cpu_t *cpu);
+
+#endif
@@ -0,0 +1,177 @@
+#include "spinlock.h"
+#include "../cpu/isr.h"
+#include "../cpu/timer.h"
+
+#ifdef HOST_BUILD
+#include <sched.h>
+/* tests/host: the test threads can outnumber the host's CPUs, and a ticket
+ * holder that isn't running would stall the others for whole timeslices */
+#define cpu_relax() sched_yield()
+#else
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#endif
+/* Keeps the compiler from moving loads and stores across it; x86 itself
+ * orders them enough for a lock */
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+#ifdef LOCK_STATS
+static lock_stats_t *all_locks = NULL;
+
+/* On the lock's first use, whoever gets there first */
+static void list_lock(lock_stats_t *st) {
+    if (st->listed || __sync_lock_test_and_set(&st->listed, 1)) return;
+    do {
+        st->next = all_locks;
+    } while (!__sync_bool_compare_and_swap(&all_locks, st->next, st));
+}
+
+/* With the lock held exclusively */
+static void stats_acquired(lock_stats_t *st, u8 contended) {
+    list_lock(st);
+    st->acquisitions++;
+    if (contended) st->contended++;
+    st->held_since = read_tsc();
+}
+
+static void stats_released(lock_stats_t *st) {
+    u64 held = read_tsc() - st->held_since;
+    u32 cycles = held >> 32 ? 0xFFFFFFFF : (u32)held;
+    if (cycles > st->max_hold) st->max_hold = cycles;
+}
+
+/* Readers share the lock, so their counts are atomic and their hold time
+ * is not kept */
+static void stats_read_acquired(lock_stats_t *st, u8 contended) {
+    list_lock(st);
+    __sync_fetch_and_add(&st->acquisitions, 1);
+    if (contended) __sync_fetch_and_add(&st->contended, 1);
+}
+#endif
+
+void spin_lock(spinlock_t *lock) {
+    u16 ticket = __sync_fetch_and_add(&lock->next, 1);
+    u8 contended = lock->owner != ticket;
+    while (lock->owner != ticket) cpu_relax();
+    barrier();
+#ifdef LOCK_STATS
+    stats_acquired(&lock->stats, contended);
+#else
+    (void)contended;
+#endif
+}
+
+void spin_unlock(spinlock_t *lock) {
+#ifdef LOCK_STATS
+    stats_released(&lock->stats);
+#endif
+    barrier();
+    /* Only the holder writes 'owner' */
+    lock->owner++;
+}
+
+u32 spin_lock_irqsave(spinlock_t *lock) {
+    u32 flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, u32 flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void read_lock(rwlock_t *lock) {
+    u8 contended = 0;
+    while (1) {
+        u32 value = lock->value;
+        if (!(value & RWLOCK_WRITER) && __sync_bool_compare_and_swap(&lock->value, value, value + 1)) break;
+        contended = 1;
+        cpu_relax();
+    }
+#ifdef LOCK_STATS
+    stats_read_acquired(&lock->stats, contended);
+#else
+    (void)contended;
+#endif
+}
+
+void read_unlock(rwlock_t *lock) {
+    __sync_fetch_and_sub(&lock->value, 1);
+}
+
+void write_lock(rwlock_t *lock) {
+    u8 contended = 0;
+    /* Claim it first, then wait for the readers already inside */
+    while (1) {
+        u32 value = lock->value;
+        if (!(value & RWLOCK_WRITER) && __sync_bool_compare_and_swap(&lock->value, value, value | RWLOCK_WRITER)) break;
+        contended = 1;
+        cpu_relax();
+    }
+    while (lock->value != RWLOCK_WRITER) {
+        contended = 1;
+        cpu_relax();
+    }
+    barrier();
+#ifdef LOCK_STATS
+    stats_acquired(&lock->stats, contended);
+#else
+    (void)contended;
+#endif
+}
+
+void write_unlock(rwlock_t *lock) {
+#ifdef LOCK_STATS
+    stats_released(&lock->stats);
+#endif
+    barrier();
+    /* No reader gets in while the writer bit is set */
+    lock->value = 0;
+}
+
+void write_seqlock(seqlock_t *sl) {
+    spin_lock(&sl->lock);
+    sl->seq++;
+    barrier();
+}
+
+void write_sequnlock(seqlock_t *sl) {
+    barrier();
+    sl->seq++;
+    spin_unlock(&sl->lock);
+}
+
+u32 read_seqbegin(seqlock_t *sl) {
+    u32 seq;
+    while ((seq = sl->seq) & 1) cpu_relax();
+    barrier();
+    return seq;
+}
+
+u8 read_seqretry(seqlock_t *sl, u32 start) {
+    barrier();
+    u8 retry = sl->seq != start;
+#ifdef LOCK_STATS
+    if (retry) __sync_fetch_and_add(&sl->lock.stats.retries, 1);
+#endif
+    return retry;
+}
+
+lock_stats_t* lock_stats_list() {
+#ifdef LOCK_STATS
+    return all_locks;
+#else
+    return NULL;
+#endif
+}
+
+void reset_lock_stats() {
+#ifdef LOCK_STATS
+    for (lock_stats_t *st = all_locks; st; st = st->next) {
+        st->acquisitions = 0;
+        st->contended = 0;
+        st->retries = 0;
+        st->max_hold = 0;
+    }
+#endif
+}
@@ -0,0 +1,91 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../cpu/types.h"
+
+/* Built with LOCK_STATS (make LOCK_STATS=1) every lock counts how often it
+ * was taken and had to be waited for, and the longest it was held. A lock
+ * joins the list lockstat shows the first time it is taken */
+typedef struct lock_stats {
+    char *name;
+    u32 acquisitions;
+    u32 contended;                     /* Found held, had to spin */
+    u32 retries;                       /* Seqlock reads that had to go again */
+    u32 max_hold;                      /* TSC cycles, writers only for rwlocks */
+    u64 held_since;
+    u8 listed;
+    struct lock_stats *next;
+} lock_stats_t;
+
+#ifdef LOCK_STATS
+#define LOCK_STATS_INIT(lock_name) .stats = {.name = lock_name},
+#else
+#define LOCK_STATS_INIT(lock_name)
+#endif
+
+/* Ticket lock: first come, first served. 'next' is the ticket the next
+ * locker draws, 'owner' the one being served */
+typedef struct {
+    volatile u16 owner;
+    volatile u16 next;
+#ifdef LOCK_STATS
+    lock_stats_t stats;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT(name) {LOCK_STATS_INIT(name)}
+
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+/* For data IRQ handlers touch too: interrupts stay off while it is held,
+ * or a handler on the same CPU would spin on it forever */
+u32 spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, u32 flags);
+
+/* Any number of readers or one writer. A waiting writer keeps new readers
+ * out, so it gets in once the readers inside are done. No irqsave forms:
+ * take it with interrupts off where a handler uses it */
+#define RWLOCK_WRITER 0x80000000       /* Low bits: readers inside */
+
+typedef struct {
+    volatile u32 value;
+#ifdef LOCK_STATS
+    lock_stats_t stats;
+#endif
+} rwlock_t;
+
+#define RWLOCK_INIT(name) {LOCK_STATS_INIT(name)}
+
+void read_lock(rwlock_t *lock);
+void read_unlock(rwlock_t *lock);
+void write_lock(rwlock_t *lock);
+void write_unlock(rwlock_t *lock);
+
+/* Read-mostly data: writers take the lock and make 'seq' odd while they
+ * change things, readers take nothing and go again if 'seq' was odd or
+ * moved under them.
+ *
+ *     u32 seq;
+ *     do {
+ *         seq = read_seqbegin(&sl);
+ *         ... copy the data ...
+ *     } while (read_seqretry(&sl, seq));
+ *
+ * A reader must not be able to interrupt a writer on the same CPU */
+typedef struct {
+    spinlock_t lock;
+    volatile u32 seq;
+} seqlock_t;
+
+#define SEQLOCK_INIT(name) {SPINLOCK_INIT(name), 0}
+
+void write_seqlock(seqlock_t *sl);
+void write_sequnlock(seqlock_t *sl);
+u32 read_seqbegin(seqlock_t *sl);
+u8 read_seqretry(seqlock_t *sl, u32 start);
+
+/* Every lock taken since boot, NULL without LOCK_STATS */
+lock_stats_t* lock_stats_list();
+void reset_lock_stats();
+
+#endif
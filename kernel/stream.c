@@ -0,0 +1,131 @@
+#include "stream.h"
+#include "kernel.h"
+#include "task.h"
+#include "../drivers/screen.h"
+#include "../drivers/serial.h"
+#include "../libc/string.h"
+#include "../libc/stdarg.h"
+#include "../libc/function.h"
+
+/* stream_printf() formats into this much before each write */
+#define PRINTF_CHUNK 128
+
+static s32 console_write(stream_t *s, u8 *buf, u32 len) {
+    char chunk[PRINTF_CHUNK + 1];
+    UNUSED(s);
+    for (u32 done = 0; done < len; ) {
+        u32 n = MIN(len - done, PRINTF_CHUNK);
+        for (u32 i = 0; i < n; i++) chunk[i] = buf[done + i];
+        chunk[n] = '\0';
+        kprint_color(chunk, get_input_color());
+        done += n;
+    }
+    return len;
+}
+
+stream_t console_stream = {console_write, NULL, NULL};
+
+static s32 serial_stream_write(stream_t *s, u8 *buf, u32 len) {
+    UNUSED(s);
+    serial_write((char*)buf, len);
+    return len;
+}
+
+stream_t serial_stream = {serial_stream_write, NULL, NULL};
+
+stream_t* stream_out() {
+    stream_t *out = current_task()->out;
+    return out ? out : &console_stream;
+}
+
+stream_t* stream_in() {
+    return current_task()->in;
+}
+
+s32 stream_write(stream_t *s, u8 *buf, u32 len) {
+    return s->write ? s->write(s, buf, len) : STREAM_ERR_UNSUPPORTED;
+}
+
+s32 stream_read(stream_t *s, u8 *buf, u32 len) {
+    return s->read ? s->read(s, buf, len) : STREAM_ERR_UNSUPPORTED;
+}
+
+s32 stream_print(stream_t *s, char *str) {
+    return stream_write(s, (u8*)str, strlen(str));
+}
+
+typedef struct {
+    stream_t *s;
+    char buf[PRINTF_CHUNK];
+    u32 len;
+    s32 err;
+} printf_state_t;
+
+static void flush(printf_state_t *st) {
+    if (st->len && st->err >= 0) {
+        s32 n = stream_write(st->s, (u8*)st->buf, st->len);
+        if (n < 0) st->err = n;
+    }
+    st->len = 0;
+}
+
+static void put(printf_state_t *st, char c) {
+    if (st->len == PRINTF_CHUNK) flush(st);
+    st->buf[st->len++] = c;
+}
+
+static void put_str(printf_state_t *st, char *str) {
+    while (*str) put(st, *str++);
+}
+
+s32 stream_printf(stream_t *s, char *fmt, ...) {
+    printf_state_t st;
+    st.s = s;
+    st.len = 0;
+    st.err = 0;
+    va_list args;
+    va_start(args, fmt);
+
+    for (char *p = fmt; *p; ++p) {
+        if (*p != '%') {
+            put(&st, *p);
+            continue;
+        }
+
+        ++p;
+        if (!*p) break;
+
+        char num[16];
+        switch (*p) {
+            case 's': {
+                char *str = va_arg(args, char*);
+                put_str(&st, str ? str : "(null)");
+                break;
+            }
+            case 'd':
+                num[0] = '\0';
+                int_to_ascii(va_arg(args, s32), num);
+                put_str(&st, num);
+                break;
+            case 'x':
+                num[0] = '\0';
+                hex_to_ascii(va_arg(args, s32), num);
+                put_str(&st, num);
+                break;
+            case 'c':
+                put(&st, (char)va_arg(args, int));
+                break;
+            case '%':
+                put(&st, '%');
+                break;
+            default:
+                put(&st, '%');
+                put(&st, *p);
+                break;
+        }
+    }
+
+    va_end(args);
+    flush(&st);
+    return st.err;
+}
@@ -0,0 +1,35 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "../cpu/types.h"
+
+#define STREAM_ERR_CLOSED      -1  /* Nobody reads the other end any more */
+#define STREAM_ERR_UNSUPPORTED -2  /* Read from a write-only stream or the other way round */
+
+/* Where command output goes and input comes from: the console, a pipe
+ * end or a file. Each task has one of each, see stream_out() */
+typedef struct stream {
+    /* Bytes moved or a negative error; read() returns 0 at the end of
+     * input. Either may be NULL */
+    s32 (*write)(struct stream *s, u8 *buf, u32 len);
+    s32 (*read)(struct stream *s, u8 *buf, u32 len);
+    void *priv;
+} stream_t;
+
+/* The screen, in the shell's input colour. Write only */
+extern stream_t console_stream;
+/* COM1, for output meant for the host rather than a person. Write only */
+extern stream_t serial_stream;
+
+/* Output of the current task: the console unless redirected */
+stream_t* stream_out();
+/* Input of the current task, NULL when it has none */
+stream_t* stream_in();
+
+s32 stream_write(stream_t *s, u8 *buf, u32 len);
+s32 stream_read(stream_t *s, u8 *buf, u32 len);
+s32 stream_print(stream_t *s, char *str);
+/* %s, %d, %x and %c like kprintf. Returns the first error, if any */
+s32 stream_printf(stream_t *s, char *fmt, ...);
+
+#endif
@@ -0,0 +1,350 @@
+#include "task.h"
+#include "ipc.h"
+#include "smp.h"
+#include "../cpu/fpu.h"
+#include "../cpu/gdt.h"
+#include "../cpu/isr.h"
+#include "../cpu/timer.h"
+#include "../libc/mem.h"
+
+/* In usermode.asm */
+extern void switch_context(u32 *old_esp, u32 new_esp);
+extern void user_task_entry();
+
+static task_t boot_task;
+static task_t *all_tasks = &boot_task;
+/* A detached task that exited, freed by whoever runs next (it can't free
+ * the stack it is still on) */
+static task_t *dead = NULL;
+static u32 next_id = 1;
+
+static void idle_entry();
+
+void init_tasks() {
+    boot_task.id = 0;
+    boot_task.state = TASK_RUNNING;
+    boot_task.space = &kernel_space;
+    boot_task.slice = TASK_SLICE_TICKS;
+    /* main()'s loop stays on the boot CPU */
+    boot_task.pinned = 1;
+    cpus[0].current = &boot_task;
+    cpus[0].idle = task_create_idle(0);
+    kernel_lock();
+}
+
+task_t* current_task() {
+    return this_cpu()->current;
+}
+
+task_t* find_task(u32 id) {
+    for (task_t *t = all_tasks; t; t = t->all_next) {
+        if (t->id == id) return t;
+    }
+    return NULL;
+}
+
+task_t* task_list() {
+    return all_tasks;
+}
+
+/* Onto the queue of the CPU it last ran on */
+static void enqueue(task_t *t, u8 first) {
+    cpu_t *cpu = &cpus[t->cpu];
+    t->state = TASK_READY;
+    if (first) {
+        t->next = cpu->run_head;
+        cpu->run_head = t;
+        if (!cpu->run_tail) cpu->run_tail = t;
+    } else {
+        t->next = NULL;
+        if (cpu->run_tail) cpu->run_tail->next = t;
+        else cpu->run_head = t;
+        cpu->run_tail = t;
+    }
+    cpu->run_length++;
+    /* Wake its CPU, or one that can steal it from this busy one */
+    if (cpu != this_cpu()) smp_kick(cpu);
+    else if (!cpu->halted) smp_kick(NULL);
+}
+
+static task_t* pop(cpu_t *cpu) {
+    task_t *t = cpu->run_head;
+    if (!t) return NULL;
+    cpu->run_head = t->next;
+    if (!cpu->run_head) cpu->run_tail = NULL;
+    cpu->run_length--;
+    t->next = NULL;
+    return t;
+}
+
+/* The oldest task that may move from the CPU with most waiting */
+static task_t* steal(cpu_t *self) {
+    cpu_t *busiest = NULL;
+    for (u32 i = 0; i < cpu_count; i++) {
+        cpu_t *cpu = &cpus[i];
+        if (cpu != self && cpu->run_length && (!busiest || cpu->run_length > busiest->run_length)) busiest = cpu;
+    }
+    if (!busiest) return NULL;
+
+    task_t *prev = NULL;
+    for (task_t *t = busiest->run_head; t; prev = t, t = t->next) {
+        if (t->pinned) continue;
+        if (prev) prev->next = t->next;
+        else busiest->run_head = t->next;
+        if (busiest->run_tail == t) busiest->run_tail = prev;
+        busiest->run_length--;
+        t->next = NULL;
+        t->cpu = self->id;
+        self->steals++;
+        return t;
+    }
+    return NULL;
+}
+
+/* Next ready task for this CPU, its idle task if there is none */
+static task_t* dequeue() {
+    cpu_t *cpu = this_cpu();
+    task_t *t = pop(cpu);
+    if (!t) t = steal(cpu);
+    return t ? t : cpu->idle;
+}
+
+static void free_task(task_t *t) {
+    for (task_t **p = &all_tasks; *p; p = &(*p)->all_next) {
+        if (*p == t) {
+            *p = t->all_next;
+            break;
+        }
+    }
+    if (t->space != &kernel_space) vm_destroy_space(t->space);
+    fpu_release(t);
+    kfree(t->stack);
+    kfree(t);
+}
+
+static void reap() {
+    if (dead && dead != current_task()) {
+        free_task(dead);
+        dead = NULL;
+    }
+}
+
+/* Interrupts off, the big kernel lock held. 'slice' is the timeslice
+ * 'next' starts with */
+static void switch_to(task_t *next, u32 slice) {
+    cpu_t *cpu = this_cpu();
+    task_t *prev = cpu->current;
+    next->state = TASK_RUNNING;
+    next->slice = slice;
+    if (next == prev) return;
+
+    cpu->current = next;
+    cpu->switches++;
+    if (next->space != vm_current_space()) vm_switch_space(next->space);
+    /* Task 0 never enters ring 3, so its boot stack needn't be known */
+    if (next->stack) user_set_kernel_stack((u32)next->stack + TASK_STACK_SIZE);
+    /* The lock stays with the CPU, each task keeps its own nesting */
+    prev->lock_depth = cpu->lock_depth;
+    cpu->lock_depth = next->lock_depth;
+    fpu_switch(prev);
+    switch_context(&prev->esp, next->esp);
+    /* Back on our own stack, possibly much later and on another CPU */
+    reap();
+}
+
+/* A task with a stack, not yet runnable */
+static task_t* new_task(address_space_t *space) {
+    task_t *t = (task_t*)kmalloc(sizeof(task_t), 0, NULL);
+    if (!t) return NULL;
+    memory_set((u8*)t, 0, sizeof(task_t));
+    t->stack = (u8*)kmalloc(TASK_STACK_SIZE, 0, NULL);
+    if (!t->stack) {
+        kfree(t);
+        return NULL;
+    }
+    t->space = space;
+    t->cpu = this_cpu()->id;
+    /* It starts inside the kernel, in switch_to() */
+    t->lock_depth = 1;
+    t->start_tsc = read_tsc();
+    return t;
+}
+
+/* Push what switch_context() pops, returning into 'ret' */
+static u32* push_context(u32 *sp, void (*ret)()) {
+    *--sp = (u32)ret;
+    *--sp = 0;                     /* ebp */
+    *--sp = 0;                     /* ebx */
+    *--sp = 0;                     /* esi */
+    *--sp = 0;                     /* edi */
+    *--sp = 0x002;                 /* eflags: interrupts off */
+    return sp;
+}
+
+static void start(task_t *t) {
+    u32 flags = irq_save();
+    t->id = next_id++;
+    t->all_next = all_tasks;
+    all_tasks = t;
+    enqueue(t, 0);
+    irq_restore(flags);
+}
+
+task_t* task_create_user(address_space_t *space, u32 entry, u32 stack, u32 arg) {
+    task_t *t = new_task(space);
+    if (!t) return NULL;
+
+    /* The entry point sees 'arg' as its only argument, under a return
+     * address that leads nowhere */
+    u32 args[2] = {0, arg};
+    stack -= sizeof(args);
+    if (vm_copy(space, stack, NULL, (u32)args, sizeof(args)) != 0) {
+        kfree(t->stack);
+        kfree(t);
+        return NULL;
+    }
+
+    /* user_task_entry irets to the ring 3 frame above the context */
+    u32 *sp = (u32*)(t->stack + TASK_STACK_SIZE);
+    *--sp = USER_DS;
+    *--sp = stack;
+    *--sp = USER_EFLAGS;
+    *--sp = USER_CS;
+    *--sp = entry;
+    t->esp = (u32)push_context(sp, user_task_entry);
+    start(t);
+    return t;
+}
+
+static void kernel_task_entry() {
+    task_first_run();
+    task_t *self = current_task();
+    self->entry(self->arg);
+    task_exit(0);
+}
+
+task_t* task_create_kernel(void (*entry)(void *arg), void *arg) {
+    task_t *t = new_task(&kernel_space);
+    if (!t) return NULL;
+    t->entry = entry;
+    t->arg = arg;
+    u32 *sp = (u32*)(t->stack + TASK_STACK_SIZE);
+    *--sp = 0;                     /* kernel_task_entry's return address, never used */
+    t->esp = (u32)push_context(sp, kernel_task_entry);
+    start(t);
+    return t;
+}
+
+void task_first_run() {
+    /* Whoever ran before may have left a dead task behind */
+    reap();
+    current_task()->first_run_tsc = read_tsc();
+}
+
+s32 task_wait(task_t *t) {
+    u32 flags = irq_save();
+    if (t->state != TASK_ZOMBIE) {
+        t->waiter = current_task();
+        task_block(WAIT_TASK);
+    }
+    irq_restore(flags);
+    return t->status;
+}
+
+void task_release(task_t *t) {
+    u32 flags = irq_save();
+    free_task(t);
+    irq_restore(flags);
+}
+
+void task_exit(s32 status) {
+    irq_save();
+    task_t *self = current_task();
+    self->status = status;
+    self->state = TASK_ZOMBIE;
+    ipc_task_exit(self);
+    if (self->waiter) task_wake(self->waiter, 1);
+    else if (self->detached) dead = self;
+    switch_to(dequeue(), TASK_SLICE_TICKS);
+    /* Never comes back */
+}
+
+void task_yield() {
+    u32 flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    if (cpu->current != cpu->idle) {
+        task_t *next = pop(cpu);
+        if (!next) next = steal(cpu);
+        if (next) {
+            enqueue(cpu->current, 0);
+            switch_to(next, TASK_SLICE_TICKS);
+        }
+    }
+    irq_restore(flags);
+}
+
+void task_block(u8 wait) {
+    u32 flags = irq_save();
+    task_t *self = current_task();
+    self->state = TASK_BLOCKED;
+    self->wait = wait;
+    switch_to(dequeue(), TASK_SLICE_TICKS);
+    self->wait = WAIT_NONE;
+    irq_restore(flags);
+}
+
+void task_wake(task_t *t, u8 first) {
+    u32 flags = irq_save();
+    if (t->state == TASK_BLOCKED) enqueue(t, first);
+    irq_restore(flags);
+}
+
+void task_handoff(task_t *t, u8 wait) {
+    u32 flags = irq_save();
+    task_t *self = current_task();
+    if (wait == WAIT_NONE) {
+        enqueue(self, 0);
+    } else {
+        self->state = TASK_BLOCKED;
+        self->wait = wait;
+    }
+    switch_to(t, self->slice ? self->slice : 1);
+    self->wait = WAIT_NONE;
+    irq_restore(flags);
+}
+
+void task_tick(u8 from_user) {
+    cpu_t *cpu = this_cpu();
+    task_t *self = cpu->current;
+    cpu->ticks++;
+    if (self->slice) self->slice--;
+    if (!self->slice && from_user && cpu->run_head) task_yield();
+}
+
+task_t* task_create_idle(u32 cpu) {
+    task_t *t = new_task(&kernel_space);
+    if (!t) return NULL;
+    t->cpu = cpu;
+    t->pinned = 1;
+    t->state = TASK_RUNNING;
+    /* The boot CPU switches to it, the others start on the stack */
+    u32 *sp = (u32*)(t->stack + TASK_STACK_SIZE);
+    *--sp = 0;
+    t->esp = (u32)push_context(sp, idle_entry);
+    return t;
+}
+
+void task_idle_loop() {
+    while (1) {
+        cpu_t *cpu = this_cpu();
+        task_t *next = pop(cpu);
+        if (!next) next = steal(cpu);
+        if (next) switch_to(next, TASK_SLICE_TICKS);
+        else cpu_wait();
+    }
+}
+
+static void idle_entry() {
+    task_first_run();
+    task_idle_loop();
+}
@@ -0,0 +1,107 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "../cpu/types.h"
+#include "../cpu/syscall.h"
+#include "../mm/vm.h"
+
+#define TASK_STACK_SIZE    0x4000      /* Kernel stack per task, shell commands run on it too */
+#define TASK_SLICE_TICKS   2           /* Timeslice: 40ms at TIMER_HZ 50 */
+
+/* Task states */
+#define TASK_READY         0
+#define TASK_RUNNING       1
+#define TASK_BLOCKED       2
+#define TASK_ZOMBIE        3
+
+/* What a blocked task waits for */
+#define WAIT_NONE          0
+#define WAIT_TASK          1           /* task_wait() */
+#define WAIT_IPC_SEND      2           /* Queued on a port for a receiver */
+#define WAIT_IPC_RECEIVE   3           /* Queued on a port for a sender */
+#define WAIT_IPC_REPLY     4           /* call() waiting for its reply */
+#define WAIT_PIPE          5           /* Pipe full or empty */
+#define WAIT_WORK          6           /* Background task with nothing to do */
+#define WAIT_MUTEX         7           /* mutex_lock(), see mutex.h */
+#define WAIT_INPUT         8           /* The shell, for the next line */
+
+typedef struct task {
+    u32 id;
+    u8 state;
+    u8 wait;
+    u8 detached;                       /* Freed on exit, nobody waits for it */
+    u32 esp;                           /* Saved kernel stack pointer */
+    u8 *stack;                         /* Kernel stack, TASK_STACK_SIZE */
+    address_space_t *space;
+    u32 slice;                         /* Ticks left in this timeslice */
+    u32 cpu;                           /* Whose run queue it goes on */
+    u8 pinned;                         /* Never stolen by another CPU */
+    u32 lock_depth;                    /* Big kernel lock nesting while switched out */
+    u8 *fpu;                           /* fxsave image, NULL until it first uses the FPU */
+    void *fpu_block;                   /* The allocation 'fpu' is aligned within */
+    s32 status;                        /* Exit status */
+    u64 start_tsc;                     /* Set by the creator */
+    u64 first_run_tsc;                 /* Entering ring 3 the first time */
+    struct task *waiter;               /* In task_wait() for this task */
+    struct task *next;                 /* Run queue or port queue */
+    struct task *all_next;             /* Every task */
+    struct stream *in;                 /* NULL: no input */
+    struct stream *out;                /* NULL: the console */
+    void (*entry)(void *arg);          /* Kernel tasks */
+    void *arg;
+
+    /* IPC, see kernel/ipc.c */
+    struct port *port;                 /* Port queued on */
+    struct task *partner;              /* Server a call waits on for the reply */
+    u8 ipc_call;                       /* Queued message expects a reply */
+    ipc_msg_t msg;                     /* Copy of the user descriptor */
+    u32 msg_user;                      /* Where the descriptor lives */
+    s32 ipc_result;
+} task_t;
+
+/* The boot flow (kernel main, then its idle loop) becomes task 0, pinned
+ * to the boot CPU, which takes the big kernel lock */
+void init_tasks();
+/* The running task of the calling CPU */
+task_t* current_task();
+task_t* find_task(u32 id);
+/* Every task, linked through all_next */
+task_t* task_list();
+
+/* A task that enters ring 3 at 'entry' on 'stack' in 'space', with 'arg'
+ * as the argument of the entry point. It owns the space. Starts ready */
+task_t* task_create_user(address_space_t *space, u32 entry, u32 stack, u32 arg);
+/* A task that runs entry(arg) in the kernel and exits when it returns.
+ * Kernel tasks are never preempted, they run until they block */
+task_t* task_create_kernel(void (*entry)(void *arg), void *arg);
+/* Block until 't' exits and return its status. 't' stays around for a
+ * look at its fields until task_release(). Like every call that blocks,
+ * task context only: an interrupt handler would sleep in whatever task it
+ * interrupted */
+s32 task_wait(task_t *t);
+void task_release(task_t *t);
+void task_exit(s32 status);
+
+/* Scheduling: round robin over each CPU's ready tasks. A CPU that runs out
+ * takes the oldest task of the CPU with most waiting. The kernel itself is
+ * not preempted, only code running in ring 3 */
+void task_yield();
+void task_block(u8 wait);
+/* Make a blocked task ready; 'first' puts it at the head of the queue */
+void task_wake(task_t *t, u8 first);
+/* Run 't' now on what is left of our timeslice. The current task blocks
+ * on 'wait', or stays ready behind everyone else for WAIT_NONE */
+void task_handoff(task_t *t, u8 wait);
+/* From the timer interrupt */
+void task_tick(u8 from_user);
+
+/* The task a CPU runs when it has nothing else, never queued. Its stack is
+ * the one an application processor starts on */
+task_t* task_create_idle(u32 cpu);
+/* Body of the idle tasks: run whatever becomes ready, sleep otherwise */
+void task_idle_loop();
+
+/* Called once by every new task before its first return to ring 3 */
+void task_first_run();
+
+#endif
@@ -1,4 +1,5 @@
 #include "mem.h"
+#include "../kernel/spinlock.h"
 
 void memory_copy(u8 *source, u8 *dest, s32 nbytes) {
     s32 i;
@@ -17,16 +18,47 @@ typedef struct heap_block {
     u32 size;
     u32 is_free;
     struct heap_block *next;
+#ifdef HEAP_TRACK
+    heap_site_t *site;             /* Who allocated it */
+#endif
 } heap_block_t;
 
 #define BLOCK_HEADER_SIZE sizeof(heap_block_t)
 
-/* Heap state */
+/* Heap state, under heap_lock: IRQ handlers allocate too */
+static spinlock_t heap_lock = SPINLOCK_INIT("heap");
 u32 free_mem_addr = KMALLOC_START;
 static heap_block_t *free_list = 0;  /* Linked list of free blocks */
 static u32 total_allocated = 0;
 static u32 total_freed = 0;
 
+#ifdef HEAP_TRACK
+/* Allocation sites by return address, open addressing. A site that finds
+ * the table full is charged to the last slot */
+static heap_site_t sites[HEAP_SITES];
+
+static heap_site_t* find_site(u32 caller) {
+    u32 h = (caller * 2654435761u) % HEAP_SITES;
+    for (u32 i = 0; i < HEAP_SITES - 1; i++) {
+        heap_site_t *site = &sites[(h + i) % HEAP_SITES];
+        if (site->caller == caller) return site;
+        if (!site->caller) {
+            site->caller = caller;
+            return site;
+        }
+    }
+    return &sites[HEAP_SITES - 1];
+}
+
+static heap_site_t* charge(u32 caller, u32 size) {
+    heap_site_t *site = find_site(caller);
+    site->allocs++;
+    site->live_blocks++;
+    site->live_bytes += size;
+    return site;
+}
+#endif
+
 /* Find free block that fits size (first-fit) */
 static heap_block_t* find_free_block(u32 size) {
     heap_block_t *current = free_list;
@@ -39,39 +71,59 @@ static heap_block_t* find_free_block(u32 size) {
     return 0;
 }
 
-/* allocate memory on the heap */
-u32 kmalloc(u32 size, u8 align, u32 *phys_addr) {
+/* kmalloc() with the lock held. 'caller' is whom the block is charged to */
+static u32 alloc(u32 size, u8 align, u32 caller) {
+#ifndef HEAP_TRACK
+    (void)caller;
+#endif
     if (align) {
         if (free_mem_addr & PAGE_OFFSET_MASK) {
             free_mem_addr &= PAGE_ALIGN_MASK;
             free_mem_addr += PAGE_SIZE;
         }
+        if (free_mem_addr + size > KMALLOC_END) return 0;
         u32 ret = free_mem_addr;
         free_mem_addr += size;
         total_allocated += size;
-        if (phys_addr) *phys_addr = ret;
+#ifdef HEAP_TRACK
+        charge(caller, size);
+#endif
         return ret;
     }
 
     heap_block_t *block = find_free_block(size);
     if (block) {
         block->is_free = 0;
-        u32 addr = (u32)block + BLOCK_HEADER_SIZE;
-        if (phys_addr) *phys_addr = addr;
-        return addr;
+        total_allocated += block->size;
+#ifdef HEAP_TRACK
+        block->site = charge(caller, block->size);
+#endif
+        return (u32)block + BLOCK_HEADER_SIZE;
     }
 
+    if (free_mem_addr + BLOCK_HEADER_SIZE + size > KMALLOC_END) return 0;
+
     heap_block_t *new_block = (heap_block_t*)free_mem_addr;
     new_block->size = size;
     new_block->is_free = 0;
     new_block->next = free_list;
     free_list = new_block;
+#ifdef HEAP_TRACK
+    new_block->site = charge(caller, size);
+#endif
 
     u32 ret = free_mem_addr + BLOCK_HEADER_SIZE;
     free_mem_addr += BLOCK_HEADER_SIZE + size;
     total_allocated += size;
+    return ret;
+}
 
-    if (phys_addr) *phys_addr = ret;
+/* allocate memory on the heap */
+u32 kmalloc(u32 size, u8 align, u32 *phys_addr) {
+    u32 flags = spin_lock_irqsave(&heap_lock);
+    u32 ret = alloc(size, align, (u32)__builtin_return_address(0));
+    spin_unlock_irqrestore(&heap_lock, flags);
+    if (ret && phys_addr) *phys_addr = ret;
     return ret;
 }
 
@@ -80,16 +132,56 @@ void kfree(void *ptr) {
     if (!ptr) return;
     
     heap_block_t *block = (heap_block_t*)((u32)ptr - BLOCK_HEADER_SIZE);
-    
+    u32 flags = spin_lock_irqsave(&heap_lock);
     if (!block->is_free) {
         block->is_free = 1;
         total_freed += block->size;
+#ifdef HEAP_TRACK
+        block->site->live_blocks--;
+        block->site->live_bytes -= block->size;
+#endif
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 /* get heap statistics */
 void get_heap_stats(u32 *total, u32 *used, u32 *free_mem) {
+    u32 flags = spin_lock_irqsave(&heap_lock);
     *total = free_mem_addr - KMALLOC_START;
     *used = total_allocated - total_freed;
     *free_mem = *total - *used;
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+void get_heap_fragmentation(heap_frag_t *f) {
+    memory_set((u8*)f, 0, sizeof(heap_frag_t));
+    u32 flags = spin_lock_irqsave(&heap_lock);
+    for (heap_block_t *b = free_list; b; b = b->next) {
+        if (!b->is_free) {
+            f->used_blocks++;
+            continue;
+        }
+        f->free_blocks++;
+        f->free_bytes += b->size;
+        if (b->size > f->largest_free) f->largest_free = b->size;
+        u32 bucket = b->size ? 31 - __builtin_clz(b->size) : 0;
+        f->histogram[MIN(bucket, HEAP_FREE_BUCKETS - 1)]++;
+    }
+    f->tail = KMALLOC_END - free_mem_addr;
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+u32 get_heap_sites(heap_site_t *out, u32 max) {
+    u32 n = 0;
+#ifdef HEAP_TRACK
+    u32 flags = spin_lock_irqsave(&heap_lock);
+    for (u32 i = 0; i < HEAP_SITES && n < max; i++) {
+        if (sites[i].caller) out[n++] = sites[i];
+    }
+    spin_unlock_irqrestore(&heap_lock, flags);
+#else
+    (void)out;
+    (void)max;
+#endif
+    return n;
 }
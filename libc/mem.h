@@ -8,8 +8,11 @@
 #define PAGE_ALIGN_MASK 0xFFFFF000 /* Mask to align down to page boundary */
 #define PAGE_OFFSET_MASK 0xFFF     /* Mask to get offset within page */
 
-/* Initial free memory address (64KB - after kernel and stack) */
-#define KMALLOC_START 0x10000
+/* Initial free memory address (1MB - above the kernel image at 0x10000,
+ * its stack at 0x90000 and the VGA/BIOS area) */
+#define KMALLOC_START 0x100000
+/* The heap owns everything up to 4MB, the frame allocator hands out the rest */
+#define KMALLOC_END   0x400000
 
 void memory_copy(u8 *source, u8 *dest, s32 nbytes);
 void memory_set(u8 *dest, u8 val, u32 len);
@@ -19,4 +22,34 @@ u32 kmalloc(u32 size, u8 align, u32 *phys_addr);
 void kfree(void *ptr);
 void get_heap_stats(u32 *total, u32 *used, u32 *free);
 
+/* Freed blocks, walked on request. A freed block is only reused whole by
+ * a request it fits, the tail past the last block serves anything */
+#define HEAP_FREE_BUCKETS 24       /* Bucket n: 2^n to 2^(n+1) - 1 bytes, the last takes the rest */
+
+typedef struct {
+    u32 used_blocks;
+    u32 free_blocks;
+    u32 free_bytes;
+    u32 largest_free;
+    u32 tail;                      /* Never allocated, up to KMALLOC_END */
+    u32 histogram[HEAP_FREE_BUCKETS];
+} heap_frag_t;
+
+void get_heap_fragmentation(heap_frag_t *f);
+
+/* Built with HEAP_TRACK, kmalloc() charges every block to the address it
+ * was called from until it is freed. Page aligned blocks are never freed */
+#define HEAP_SITES 256
+
+typedef struct {
+    u32 caller;
+    u32 allocs;
+    u32 live_blocks;
+    u32 live_bytes;
+} heap_site_t;
+
+/* Copies up to 'max' sites with any allocation to 'sites', returns how
+ * many. Always 0 without HEAP_TRACK */
+u32 get_heap_sites(heap_site_t *sites, u32 max);
+
 #endif
\ No newline at end of file
@@ -1,5 +1,15 @@
 #include "string.h"
 
+/* strlen, strcmp, strncmp and strcpy go a word at a time once aligned: a
+ * word holds a NUL when has_zero() is non-zero. An aligned word never
+ * straddles a page, so reading past the NUL within it is safe */
+typedef u32 __attribute__((__may_alias__)) word_t;
+
+#define ONES  0x01010101
+#define HIGHS 0x80808080
+#define has_zero(w) (((w) - ONES) & ~(w) & HIGHS)
+#define aligned(p) (((u32)(p) & 3) == 0)
+
 void int_to_ascii(s32 n, char str[]) {
     s32 i, sign;
     if ((sign = n) < 0) n = -n;
@@ -15,8 +25,10 @@ void int_to_ascii(s32 n, char str[]) {
 }
 
 void hex_to_ascii(s32 n, char str[]) {
-    append(str, '0');
-    append(str, 'x');
+    /* Appends to 'str', finding its end once */
+    char *p = str + strlen(str);
+    *p++ = '0';
+    *p++ = 'x';
     u8 zeros = false;
 
     s32 tmp;
@@ -25,13 +37,14 @@ void hex_to_ascii(s32 n, char str[]) {
         tmp = (n >> i) & 0xF;
         if (tmp == 0 && !zeros) continue;
         zeros = true;
-        if (tmp > 0xA) append(str, tmp - 0xA + 'a');
-        else append(str, tmp + '0');
+        if (tmp >= 0xA) *p++ = tmp - 0xA + 'a';
+        else *p++ = tmp + '0';
     }
 
     tmp = n & 0xF;
-    if (tmp >= 0xA) append(str, tmp - 0xA + 'a');
-    else append(str, tmp + '0');
+    if (tmp >= 0xA) *p++ = tmp - 0xA + 'a';
+    else *p++ = tmp + '0';
+    *p = '\0';
 }
 
 void reverse(char s[]) {
@@ -43,12 +56,6 @@ void reverse(char s[]) {
     }
 }
 
-s32 strlen(char s[]) {
-    s32 i = 0;
-    while (s[i] != '\0') ++i;
-    return i;
-}
-
 void append(char s[], char n) {
     s32 len = strlen(s);
     s[len] = n;
@@ -60,29 +67,106 @@ void backspace(char s[]) {
     s[len-1] = '\0';
 }
 
+s32 strlen(char s[]) {
+    char *p = s;
+    for (; !aligned(p); p++) {
+        if (!*p) return p - s;
+    }
+    word_t *w = (word_t*)p;
+    while (!has_zero(*w)) w++;
+    for (p = (char*)w; *p; p++);
+    return p - s;
+}
+
 /* Returns <0 if s1<s2, 0 if s1==s2, >0 if s1>s2 */
 s32 strcmp(char s1[], char s2[]) {
-    s32 i;
-    for (i = 0; s1[i] == s2[i]; i++) {
-        if (s1[i] == '\0') return 0;
+    if (((u32)s1 & 3) == ((u32)s2 & 3)) {
+        for (; !aligned(s1); s1++, s2++) {
+            if (*s1 != *s2 || !*s1) return *s1 - *s2;
+        }
+        word_t *w1 = (word_t*)s1, *w2 = (word_t*)s2;
+        while (*w1 == *w2 && !has_zero(*w1)) {
+            w1++;
+            w2++;
+        }
+        s1 = (char*)w1;
+        s2 = (char*)w2;
     }
-    return s1[i] - s2[i];
+    for (; *s1 == *s2; s1++, s2++) {
+        if (*s1 == '\0') return 0;
+    }
+    return *s1 - *s2;
 }
 
 void strcpy(char dest[], char src[]) {
-    s32 i = 0;
-    while (src[i] != '\0') {
-        dest[i] = src[i];
-        i++;
+    if (((u32)dest & 3) == ((u32)src & 3)) {
+        for (; !aligned(src); src++, dest++) {
+            if (!(*dest = *src)) return;
+        }
+        /* Whole words up to the one with the NUL, which goes bytewise so
+         * nothing past it is written */
+        word_t *d = (word_t*)dest, *w = (word_t*)src;
+        while (!has_zero(*w)) *d++ = *w++;
+        dest = (char*)d;
+        src = (char*)w;
     }
-    dest[i] = '\0';
+    while ((*dest++ = *src++));
 }
 
 s32 strncmp(char s1[], char s2[], s32 n) {
-    s32 i;
-    for (i = 0; i < n && s1[i] == s2[i]; i++) {
-        if (s1[i] == '\0') return 0;
+    if (((u32)s1 & 3) == ((u32)s2 & 3)) {
+        for (; n > 0 && !aligned(s1); s1++, s2++, n--) {
+            if (*s1 != *s2 || !*s1) return *s1 - *s2;
+        }
+        word_t *w1 = (word_t*)s1, *w2 = (word_t*)s2;
+        while (n >= 4 && *w1 == *w2 && !has_zero(*w1)) {
+            w1++;
+            w2++;
+            n -= 4;
+        }
+        s1 = (char*)w1;
+        s2 = (char*)w2;
+    }
+    for (; n > 0; s1++, s2++, n--) {
+        if (*s1 != *s2 || !*s1) return *s1 - *s2;
     }
-    if (i == n) return 0;
-    return s1[i] - s2[i];
+    return 0;
+}
+
+void kstrbuf_init(kstrbuf_t *sb, char *buf, u32 cap) {
+    sb->buf = buf;
+    sb->cap = cap;
+    sb->len = 0;
+    buf[0] = '\0';
+}
+
+s32 kstrbuf_append(kstrbuf_t *sb, char c) {
+    if (sb->len + 1 >= sb->cap) return -1;
+    sb->buf[sb->len++] = c;
+    sb->buf[sb->len] = '\0';
+    return 0;
+}
+
+u32 kstrbuf_append_str(kstrbuf_t *sb, char *s) {
+    u32 n = 0;
+    while (s[n] && sb->len + 1 < sb->cap) sb->buf[sb->len++] = s[n++];
+    sb->buf[sb->len] = '\0';
+    return n;
+}
+
+s32 kstrbuf_backspace(kstrbuf_t *sb) {
+    if (!sb->len) return -1;
+    sb->buf[--sb->len] = '\0';
+    return 0;
+}
+
+void kstrbuf_truncate(kstrbuf_t *sb, u32 len) {
+    if (len >= sb->len) return;
+    sb->len = len;
+    sb->buf[len] = '\0';
+}
+
+u32 kstrbuf_set(kstrbuf_t *sb, char *s) {
+    sb->len = 0;
+    return kstrbuf_append_str(sb, s);
 }
@@ -13,4 +13,25 @@ s32 strcmp(char s1[], char s2[]);
 void strcpy(char dest[], char src[]);
 s32 strncmp(char s1[], char s2[], s32 n);
 
+/* A string that tracks its length: appends and backspaces are O(1) and
+ * never write past 'cap' bytes (the NUL included). 'buf' always holds a
+ * terminated string */
+typedef struct {
+    char *buf;
+    u32 len;
+    u32 cap;
+} kstrbuf_t;
+
+void kstrbuf_init(kstrbuf_t *sb, char *buf, u32 cap);
+/* 0, or -1 when full */
+s32 kstrbuf_append(kstrbuf_t *sb, char c);
+/* Appends as much of 's' as fits, returns how many characters that was */
+u32 kstrbuf_append_str(kstrbuf_t *sb, char *s);
+/* 0, or -1 when empty */
+s32 kstrbuf_backspace(kstrbuf_t *sb);
+/* Cut to 'len' characters if longer */
+void kstrbuf_truncate(kstrbuf_t *sb, u32 len);
+/* Replace the contents with as much of 's' as fits */
+u32 kstrbuf_set(kstrbuf_t *sb, char *s);
+
 #endif
@@ -0,0 +1,194 @@
+#include "../cpu/paging.h"
+#include "../libc/mem.h"
+#include "../drivers/screen.h"
+#include "../kernel/spinlock.h"
+
+/* Physical frame allocator. Kept apart from the paging code so the host
+ * test harness (tests/host) can build it */
+
+/* Bitmap to track used/free frames, and the counts below, under frame_lock */
+static spinlock_t frame_lock = SPINLOCK_INIT("frames");
+static u32 frame_bitmap[BITMAP_SIZE];
+
+/* Cached frame statistics (updated on alloc/free) */
+static u32 used_frames = 0;
+static u32 free_frames = TOTAL_FRAMES;
+
+/* High memory, also under frame_lock: one bit per frame from MEMORY_END,
+ * set for used frames and for holes. Every word from high_hint on is full */
+#define HIGH_BASE_FRAME (MEMORY_END / FRAME_SIZE)
+static u32 *high_bitmap = NULL;
+static u32 high_words = 0;
+static u32 high_limit = 0;             /* Frames the bitmap covers */
+static u32 high_hint = 0;
+static u32 high_frames = 0;
+static u32 high_free = 0;
+
+/* Helper: Set bit in bitmap and update stats */
+static void set_frame(u32 frame_addr) {
+    u32 frame = frame_addr / FRAME_SIZE;
+    u32 byte_idx = frame / 8;
+    u32 bit_idx = frame % 8;
+    
+    /* Only update stats if frame was previously free */
+    if (!(frame_bitmap[byte_idx] & (1 << bit_idx))) {
+        used_frames++;
+        free_frames--;
+    }
+    
+    frame_bitmap[byte_idx] |= (1 << bit_idx);
+}
+
+/* Helper: Clear bit in bitmap and update stats */
+static void clear_frame(u32 frame_addr) {
+    u32 frame = frame_addr / FRAME_SIZE;
+    u32 byte_idx = frame / 8;
+    u32 bit_idx = frame % 8;
+    
+    /* Only update stats if frame was previously used */
+    if (frame_bitmap[byte_idx] & (1 << bit_idx)) {
+        used_frames--;
+        free_frames++;
+    }
+    
+    frame_bitmap[byte_idx] &= ~(1 << bit_idx);
+}
+
+/* Helper: Test if frame is used */
+static u32 test_frame(u32 frame_addr) {
+    u32 frame = frame_addr / FRAME_SIZE;
+    u32 byte_idx = frame / 8;
+    u32 bit_idx = frame % 8;
+    return frame_bitmap[byte_idx] & (1 << bit_idx);
+}
+
+void init_frame_allocator() {
+    /* Zero bitmap - all frames start FREE (defensive programming) */
+    memory_set((u8*)frame_bitmap, 0, sizeof(frame_bitmap));
+    
+    /* Reset counters, and forget high memory */
+    used_frames = 0;
+    free_frames = TOTAL_FRAMES;
+    high_bitmap = NULL;
+    high_words = 0;
+    high_limit = 0;
+    high_hint = 0;
+    high_frames = 0;
+    high_free = 0;
+    
+    /* Mark frames used by kernel and heap as allocated (0x0 to KMALLOC_END)
+     * This prevents alloc_frame() from giving out kernel memory, and keeps
+     * frames out of the way of a heap that is still growing */
+    for (u32 addr = 0; addr < KMALLOC_END; addr += FRAME_SIZE) {
+        set_frame(addr);
+    }
+    
+    kprintf_color(GREEN_ON_BLACK, "Frame allocator initialized: %d frames (%d MB)\n", TOTAL_FRAMES, MEMORY_END / 1024 / 1024);
+}
+
+u32 alloc_frame() {
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    for (u32 i = 0; i < TOTAL_FRAMES; i++) {
+        u32 addr = i * FRAME_SIZE;
+        if (!test_frame(addr)) {
+            set_frame(addr);
+            spin_unlock_irqrestore(&frame_lock, flags);
+            return addr;
+        }
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+    
+    kprintf_color(RED_ON_BLACK, "ERROR: Out of physical memory!\n");
+    return 0;
+}
+
+/* High frame 'frame' (counted from MEMORY_END) is free again */
+static void free_high(u32 frame) {
+    u32 word = frame / 32;
+    u32 bit = 1u << (frame % 32);
+    if (!(high_bitmap[word] & bit)) return;
+    high_bitmap[word] &= ~bit;
+    high_free++;
+    if (word >= high_hint) high_hint = word + 1;
+}
+
+void free_frame(phys_t frame_addr) {
+    frame_addr &= ~(phys_t)(FRAME_SIZE - 1);
+    
+    if (frame_addr < MEMORY_END) {
+        u32 flags = spin_lock_irqsave(&frame_lock);
+        clear_frame((u32)frame_addr);
+        spin_unlock_irqrestore(&frame_lock, flags);
+    } else if ((frame_addr >> 12) - HIGH_BASE_FRAME < high_limit) {
+        u32 flags = spin_lock_irqsave(&frame_lock);
+        free_high((u32)(frame_addr >> 12) - HIGH_BASE_FRAME);
+        spin_unlock_irqrestore(&frame_lock, flags);
+    }
+}
+
+u32 get_free_frame_count() {
+    return free_frames;
+}
+
+u32 get_used_frame_count() {
+    return used_frames;
+}
+
+u8 init_high_frames(phys_t end) {
+    if (end > HIGH_MEMORY_END) end = HIGH_MEMORY_END;
+    if (end <= MEMORY_END) return 1;
+    u32 limit = (u32)(end >> 12) - HIGH_BASE_FRAME;
+    u32 words = (limit + 31) / 32;
+    u32 *bitmap = (u32*)kmalloc(words * 4, 0, NULL);
+    if (!bitmap) return 0;
+    /* Holes until add_high_frames() says otherwise */
+    memory_set((u8*)bitmap, 0xFF, words * 4);
+
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    high_bitmap = bitmap;
+    high_words = words;
+    high_limit = limit;
+    high_hint = 0;
+    high_frames = 0;
+    high_free = 0;
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return 1;
+}
+
+void add_high_frames(phys_t start, phys_t end) {
+    if (start < MEMORY_END) start = MEMORY_END;
+    if (end <= start) return;
+    u32 first = (u32)((start + FRAME_SIZE - 1) >> 12) - HIGH_BASE_FRAME;
+    u32 last = MIN((u32)(end >> 12) - HIGH_BASE_FRAME, high_limit);
+
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    for (u32 frame = first; frame < last; frame++) {
+        high_frames++;
+        free_high(frame);
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+phys_t alloc_frame_high() {
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    while (high_hint && high_bitmap[high_hint - 1] == 0xFFFFFFFF) high_hint--;
+    if (!high_hint) {
+        spin_unlock_irqrestore(&frame_lock, flags);
+        return 0;
+    }
+    u32 word = high_hint - 1;
+    /* Highest free bit */
+    u32 bit = 31 - __builtin_clz(~high_bitmap[word]);
+    high_bitmap[word] |= 1u << bit;
+    high_free--;
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return (phys_t)(HIGH_BASE_FRAME + word * 32 + bit) << 12;
+}
+
+u32 get_high_frame_count() {
+    return high_frames;
+}
+
+u32 get_high_free_frame_count() {
+    return high_free;
+}
@@ -0,0 +1,361 @@
+#include "vm.h"
+#include "zeropool.h"
+#include "../cpu/fpu.h"
+#include "../cpu/timer.h"
+#include "../fs/pagecache.h"
+#include "../kernel/smp.h"
+#include "../libc/mem.h"
+
+address_space_t kernel_space;
+static vm_stats_t stats;
+
+void init_vm() {
+    kernel_space.dir = kernel_directory;
+    kernel_space.regions = NULL;
+}
+
+static vm_region_t* find_region(address_space_t *space, u32 addr) {
+    for (vm_region_t *r = space->regions; r && r->start <= addr; r = r->next) {
+        if (addr < r->end) return r;
+    }
+    return NULL;
+}
+
+/* Link a new region in front of '*link' (keeps the list sorted) */
+static vm_region_t* insert_region(vm_region_t **link, u32 start, u32 size, u8 prot,
+                                  vnode_t *vn, u32 offset, u32 file_len) {
+    vm_region_t *r = (vm_region_t*)kmalloc(sizeof(vm_region_t), 0, NULL);
+    if (!r) return NULL;
+    r->start = start;
+    r->end = start + size;
+    r->prot = prot;
+    r->vnode = vn;
+    r->offset = offset;
+    r->file_end = vn ? start + file_len : start;
+    r->next = *link;
+    *link = r;
+    if (vn) vfs_igrab(vn);
+    stats.regions++;
+    return r;
+}
+
+/* The page cache page whose frame backs 'va', NULL for private frames */
+static page_t* shared_page(vm_region_t *r, u32 va, phys_t frame) {
+    if (!r->vnode) return NULL;
+    page_t *page = pagecache_find(r->vnode, (r->offset + va - r->start) / FRAME_SIZE);
+    return page && page->frame == frame ? page : NULL;
+}
+
+/* Unmap page 'va' of 'r' if present */
+static void release_page(address_space_t *space, vm_region_t *r, u32 va) {
+    page_entry_t pte = get_page_entry(space->dir, va);
+    if (!(pte & PAGE_PRESENT)) return;
+    page_t *page = shared_page(r, va, pte & PAGE_ADDR_MASK);
+    unmap_page(space->dir, va);
+    /* Shared page cache frames are only released, private ones freed */
+    if (page) pagecache_put(page);
+    else free_frame(pte & PAGE_ADDR_MASK);
+}
+
+/* Drop every page of 'r' and the region itself */
+static void unmap_region(address_space_t *space, vm_region_t *r) {
+    for (u32 va = r->start; va < r->end; va += FRAME_SIZE) release_page(space, r, va);
+    vfs_iput(r->vnode);
+    kfree(r);
+    stats.regions--;
+}
+
+address_space_t* vm_create_space() {
+    address_space_t *space = (address_space_t*)kmalloc(sizeof(address_space_t), 0, NULL);
+    if (!space) return NULL;
+    /* Share the identity map, whatever kmmap() tables exist already, the
+     * device registers and the kmap() windows: all but the program range */
+    space->dir = create_directory(VM_USER_START, VM_MMAP_START);
+    if (!space->dir) {
+        kfree(space);
+        return NULL;
+    }
+    space->regions = NULL;
+
+    /* Read-only for programs, the timer interrupt writes it through the identity map */
+    time_page_t *time_page = get_time_page();
+    if (time_page && !map_page(space->dir, VM_TIME_PAGE, (u32)time_page, PAGE_USER | PAGE_NX)) {
+        vm_destroy_space(space);
+        return NULL;
+    }
+    return space;
+}
+
+void vm_destroy_space(address_space_t *space) {
+    if (space == vm_current_space()) vm_switch_space(&kernel_space);
+    while (space->regions) {
+        vm_region_t *r = space->regions;
+        space->regions = r->next;
+        unmap_region(space, r);
+    }
+    /* Page tables below the kmmap() range are private to this space (the
+     * time page's frame is not: it has no region and stays) */
+    destroy_directory(space->dir, VM_USER_START, VM_MMAP_START);
+    kfree(space);
+}
+
+void vm_switch_space(address_space_t *space) {
+    this_cpu()->space = space;
+    __asm__ __volatile__("mov %0, %%cr3" :: "r"(space->dir) : "memory");
+}
+
+address_space_t* vm_current_space() {
+    return this_cpu()->space;
+}
+
+s32 vm_map_region(address_space_t *space, u32 start, u32 len, u8 prot,
+                  vnode_t *vn, u32 offset, u32 file_len) {
+    if (start % FRAME_SIZE || offset % FRAME_SIZE || len == 0 || file_len > len) return -1;
+    u32 size = (len + FRAME_SIZE - 1) & PAGE_FRAME_MASK;
+    if (start < VM_USER_START || start + size > VM_USER_END || start + size < start) return -1;
+    if (vn && (prot & VM_WRITE) && !(prot & VM_PRIVATE)) return -1;
+
+    vm_region_t **link = &space->regions;
+    while (*link && (*link)->end <= start) link = &(*link)->next;
+    if (*link && (*link)->start < start + size) return -1;
+    return insert_region(link, start, size, prot, vn, offset, file_len) ? 0 : -1;
+}
+
+/* Page table flags for the pages of 'r' */
+static page_entry_t region_flags(vm_region_t *r) {
+    return ((r->prot & VM_WRITE) ? PAGE_WRITABLE : 0) | ((r->prot & VM_USER) ? PAGE_USER : 0) |
+           ((r->prot & VM_EXEC) ? 0 : PAGE_NX);
+}
+
+/* A frame for a region page, which the kernel itself only reaches through
+ * kmap(): from high memory while there is some, keeping the direct map
+ * for page tables, buffers and the page cache */
+static phys_t alloc_page_frame() {
+    phys_t frame = alloc_frame_high();
+    if (!frame) frame = alloc_frame();
+    if (!frame && pagecache_shrink(1)) frame = alloc_frame();
+    return frame;
+}
+
+/* Copy of 'src' in a new frame, for a private page */
+static phys_t copy_frame(phys_t src) {
+    phys_t frame = alloc_page_frame();
+    if (!frame) return 0;
+    u8 *from = (u8*)kmap(src);
+    u8 *to = (u8*)kmap(frame);
+    fpu_copy(from, to, FRAME_SIZE);
+    kunmap(to);
+    kunmap(from);
+    return frame;
+}
+
+/* A zeroed frame for a region page: a high one zeroed here while there
+ * are any, then pre-zeroed from the pool (which holds direct-map frames) */
+static phys_t zeroed_frame() {
+    if (zeropool_preferred()) return alloc_frame_zeroed();
+    phys_t frame = alloc_frame_high();
+    if (!frame) {
+        u32 pooled = zeropool_take();
+        if (pooled) return pooled;
+        frame = alloc_page_frame();
+    }
+    if (!frame) return 0;
+    u8 *p = (u8*)kmap(frame);
+    memory_set(p, 0, FRAME_SIZE);
+    kunmap(p);
+    return frame;
+}
+
+/* Back page 'va' of region 'r' */
+static u8 resolve(address_space_t *space, vm_region_t *r, u32 va, u32 err_code) {
+    page_entry_t flags = region_flags(r);
+    stats.faults++;
+
+    if (!r->vnode || va >= r->file_end) {
+        /* Anonymous memory or .bss: a fresh zeroed frame */
+        phys_t frame = zeroed_frame();
+        if (!frame) return 0;
+        if (!map_page(space->dir, va, frame, flags)) {
+            free_frame(frame);
+            return 0;
+        }
+        stats.zero_faults++;
+        return 1;
+    }
+
+    u32 index = (r->offset + va - r->start) / FRAME_SIZE;
+    if (err_code & PF_PRESENT) {
+        /* Write to a shared page of a private mapping: take a copy */
+        page_t *page = pagecache_find(r->vnode, index);
+        page_entry_t pte = get_page_entry(space->dir, va);
+        if (!page || (pte & PAGE_ADDR_MASK) != page->frame) return 0;
+        phys_t frame = copy_frame(page->frame);
+        if (!frame) return 0;
+        if (!map_page(space->dir, va, frame, flags)) {
+            free_frame(frame);
+            return 0;
+        }
+        pagecache_put(page);
+        stats.copies++;
+        return 1;
+    }
+
+    page_t *page = pagecache_get(r->vnode, index);
+    if (!page) return 0;
+    stats.file_faults++;
+
+    /* A page that is part file, part zeros (end of .data) can't be shared */
+    u8 partial = va + FRAME_SIZE > r->file_end;
+    if ((err_code & PF_WRITE) || partial) {
+        phys_t frame = copy_frame(page->frame);
+        pagecache_put(page);
+        if (!frame) return 0;
+        if (partial) {
+            u8 *p = (u8*)kmap(frame);
+            memory_set(p + (r->file_end - va), 0, va + FRAME_SIZE - r->file_end);
+            kunmap(p);
+        }
+        if (!map_page(space->dir, va, frame, flags)) {
+            free_frame(frame);
+            return 0;
+        }
+        stats.copies++;
+        return 1;
+    }
+    /* Reads share the cached frame; a private mapping copies on first write */
+    if (!map_page(space->dir, va, page->frame, flags & ~PAGE_WRITABLE)) {
+        pagecache_put(page);
+        return 0;
+    }
+    return 1;
+}
+
+s32 vm_populate(address_space_t *space, u32 start, u32 end) {
+    for (u32 va = start & PAGE_FRAME_MASK; va < end; va += FRAME_SIZE) {
+        if (get_page_entry(space->dir, va) & PAGE_PRESENT) continue;
+        vm_region_t *r = find_region(space, va);
+        if (!r || !resolve(space, r, va, (r->prot & VM_WRITE) ? PF_WRITE : 0)) return -1;
+    }
+    return 0;
+}
+
+/* Physical address of program address 'va' of 'space', faulting the page
+ * in (and making it private for writes). 0 if the program couldn't make
+ * that access itself */
+static phys_t user_page(address_space_t *space, u32 va, u8 write) {
+    if (va < VM_USER_START || va >= VM_USER_END) return 0;
+    u32 page = va & PAGE_FRAME_MASK;
+    page_entry_t pte = get_page_entry(space->dir, page);
+    if (!(pte & PAGE_PRESENT) || (write && !(pte & PAGE_WRITABLE))) {
+        vm_region_t *r = find_region(space, page);
+        if (!r || !(r->prot & VM_USER) || (write && !(r->prot & VM_WRITE))) return 0;
+        u32 err_code = ((pte & PAGE_PRESENT) ? PF_PRESENT : 0) | (write ? PF_WRITE : 0);
+        if (!resolve(space, r, page, err_code)) return 0;
+        pte = get_page_entry(space->dir, page);
+    }
+    return (pte & PAGE_ADDR_MASK) + (va & ~PAGE_FRAME_MASK);
+}
+
+s32 vm_copy(address_space_t *dst_space, u32 dst, address_space_t *src_space, u32 src, u32 len) {
+    while (len) {
+        u32 n = len;
+        if (dst_space) n = MIN(n, FRAME_SIZE - dst % FRAME_SIZE);
+        if (src_space) n = MIN(n, FRAME_SIZE - src % FRAME_SIZE);
+        phys_t to = dst_space ? user_page(dst_space, dst, 1) : dst;
+        phys_t from = src_space ? user_page(src_space, src, 0) : src;
+        if (!to || !from) return -1;
+        /* Program pages may be outside the direct map */
+        u8 *from_ptr = src_space ? (u8*)kmap(from) : (u8*)src;
+        u8 *to_ptr = dst_space ? (u8*)kmap(to) : (u8*)dst;
+        memory_copy(from_ptr, to_ptr, n);
+        if (dst_space) kunmap(to_ptr);
+        if (src_space) kunmap(from_ptr);
+        dst += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+s32 vm_move_pages(address_space_t *dst_space, u32 dst, address_space_t *src_space, u32 src, u32 count) {
+    for (u32 i = 0; i < count; i++, dst += FRAME_SIZE, src += FRAME_SIZE) {
+        vm_region_t *to = find_region(dst_space, dst);
+        vm_region_t *from = find_region(src_space, src);
+        if (!to || !from || dst < VM_USER_START || dst >= VM_USER_END) return -1;
+        if ((to->prot & (VM_USER | VM_WRITE)) != (VM_USER | VM_WRITE) || !(from->prot & VM_USER)) return -1;
+        if (!user_page(src_space, src, 0)) return -1;
+
+        /* Take the frame out of the sender; a shared page cache frame
+         * stays where it is and a copy travels instead */
+        phys_t frame = get_page_entry(src_space->dir, src) & PAGE_ADDR_MASK;
+        page_t *page = shared_page(from, src, frame);
+        if (page) {
+            frame = copy_frame(frame);
+            if (!frame) return -1;
+            pagecache_put(page);
+        }
+        unmap_page(src_space->dir, src);
+
+        release_page(dst_space, to, dst);
+        if (!map_page(dst_space->dir, dst, frame, region_flags(to))) {
+            free_frame(frame);
+            return -1;
+        }
+        stats.moves++;
+    }
+    return 0;
+}
+
+void* kmmap(vnode_t *vn, u32 offset, u32 len, u8 prot) {
+    if (len == 0 || offset % FRAME_SIZE) return NULL;
+    if (vn && (vn->type != VFS_FILE || ((prot & VM_WRITE) && !(prot & VM_PRIVATE)))) return NULL;
+    u32 size = (len + FRAME_SIZE - 1) & PAGE_FRAME_MASK;
+
+    /* First fit in the address-sorted region list */
+    u32 addr = VM_MMAP_START;
+    vm_region_t **link = &kernel_space.regions;
+    while (*link && addr + size > (*link)->start) {
+        addr = (*link)->end;
+        link = &(*link)->next;
+    }
+    if (addr + size > VM_MMAP_END || addr + size < addr) return NULL;
+
+    if (!insert_region(link, addr, size, prot & ~VM_USER, vn, offset, size)) return NULL;
+    return (void*)addr;
+}
+
+s32 kmunmap(void *addr) {
+    vm_region_t **link = &kernel_space.regions;
+    while (*link && (*link)->start != (u32)addr) link = &(*link)->next;
+    vm_region_t *r = *link;
+    if (!r) return -1;
+    *link = r->next;
+    unmap_region(&kernel_space, r);
+    return 0;
+}
+
+u8 vm_handle_fault(u32 addr, u32 err_code) {
+    u8 kernel_range = addr >= VM_MMAP_START && addr < VM_MMAP_END;
+    address_space_t *current = vm_current_space();
+    address_space_t *space = kernel_range ? &kernel_space : current;
+
+    /* Other directories pick up the kernel's kmmap() page tables on first touch */
+    if (kernel_range && current != &kernel_space && !(err_code & PF_PRESENT)) {
+        sync_kernel_mapping(current->dir, addr);
+        if (get_page_entry(kernel_directory, addr) & PAGE_PRESENT) return 1;
+    }
+
+    vm_region_t *r = find_region(space, addr);
+    if (!r) return 0;
+    if ((err_code & PF_WRITE) && !(r->prot & VM_WRITE)) return 0;
+    if ((err_code & PF_USER) && !(r->prot & VM_USER)) return 0;
+    if ((err_code & PF_FETCH) && !(r->prot & VM_EXEC)) return 0;
+
+    if (!resolve(space, r, addr & PAGE_FRAME_MASK, err_code)) return 0;
+    if (kernel_range && current != &kernel_space) sync_kernel_mapping(current->dir, addr);
+    return 1;
+}
+
+void get_vm_stats(vm_stats_t *out) {
+    memory_copy((u8*)&stats, (u8*)out, sizeof(vm_stats_t));
+}
@@ -0,0 +1,93 @@
+#ifndef VM_H
+#define VM_H
+
+#include "../cpu/types.h"
+#include "../cpu/paging.h"
+#include "../cpu/timepage.h"
+#include "../fs/vfs.h"
+
+/* Program images live between the identity mapped RAM and the time page,
+ * which sits just below the kernel's kmmap() range. Both are shared by
+ * every address space */
+#define VM_USER_START    MEMORY_END
+#define VM_USER_END      VM_TIME_PAGE
+#define VM_TIME_PAGE     TIME_PAGE_ADDR
+#define VM_MMAP_START    0x40000000
+#define VM_MMAP_END      0x80000000
+/* Device registers (the APICs) are mapped uncached at their physical
+ * address up here, in page tables every space shares too */
+#define VM_MMIO_START    0xF0000000
+/* kmap() windows, KMAP_SLOTS per CPU, in the last page table */
+#define VM_KMAP_START    0xFFC00000
+
+/* Region protection and sharing */
+#define VM_READ          0x1
+#define VM_WRITE         0x2
+#define VM_PRIVATE       0x4     /* Writes go to a private copy of the page */
+#define VM_USER          0x8     /* Accessible from ring 3 */
+#define VM_EXEC          0x10    /* Instructions may run from it (NX otherwise) */
+
+/* A lazily populated range: pages appear on first touch */
+typedef struct vm_region {
+    u32 start;
+    u32 end;
+    u8 prot;
+    vnode_t *vnode;              /* Referenced. NULL: anonymous, zero filled */
+    u32 offset;                  /* File offset of 'start' */
+    u32 file_end;                /* File data stops here, zeros up to 'end' */
+    struct vm_region *next;      /* Sorted by address */
+} vm_region_t;
+
+typedef struct address_space {
+    page_directory_t *dir;
+    vm_region_t *regions;
+} address_space_t;
+
+typedef struct {
+    u32 regions;
+    u32 faults;
+    u32 file_faults;             /* Satisfied from the page cache */
+    u32 zero_faults;             /* Anonymous pages and .bss */
+    u32 copies;                  /* Private copies made on write */
+    u32 moves;                   /* Pages moved between address spaces */
+} vm_stats_t;
+
+extern address_space_t kernel_space;
+
+void init_vm();
+
+/* A fresh address space sharing the kernel's mappings */
+address_space_t* vm_create_space();
+void vm_destroy_space(address_space_t *space);
+void vm_switch_space(address_space_t *space);
+address_space_t* vm_current_space();
+
+/* Region at a fixed address. 'file_len' bytes come from 'vn' at 'offset',
+ * the rest of 'len' reads as zeros. Returns 0 or -1 (overlap, bad range) */
+s32 vm_map_region(address_space_t *space, u32 start, u32 len, u8 prot,
+                  vnode_t *vn, u32 offset, u32 file_len);
+/* Fault in [start, end) now instead of on first touch */
+s32 vm_populate(address_space_t *space, u32 start, u32 end);
+
+/* Copy 'len' bytes between program memory of two spaces, faulting pages in
+ * as the program would. A NULL space means a kernel address. Returns 0, or
+ * -1 if either range isn't accessible to the program */
+s32 vm_copy(address_space_t *dst_space, u32 dst, address_space_t *src_space, u32 src, u32 len);
+/* Move 'count' pages from 'src' to 'dst' (both page aligned, 'dst' in a
+ * writable region) by remapping their frames. The source pages read as
+ * fresh ones afterwards. Returns 0 or -1 */
+s32 vm_move_pages(address_space_t *dst_space, u32 dst, address_space_t *src_space, u32 src, u32 count);
+
+/* Map 'len' bytes of 'vn' from 'offset' (page aligned) into the kernel
+ * range. Pages of the file are shared with every other mapper through the
+ * page cache. Shared writable mappings are not supported: use VM_PRIVATE.
+ * Returns NULL on failure */
+void* kmmap(vnode_t *vn, u32 offset, u32 len, u8 prot);
+/* Remove the mapping that starts at 'addr' */
+s32 kmunmap(void *addr);
+
+/* Called from the page fault handler. Returns 1 if the fault was resolved */
+u8 vm_handle_fault(u32 addr, u32 err_code);
+void get_vm_stats(vm_stats_t *stats);
+
+#endif
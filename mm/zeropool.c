@@ -0,0 +1,164 @@
+#include "zeropool.h"
+#include "vm.h"
+#include "../cpu/cpu.h"
+#include "../cpu/isr.h"
+#include "../kernel/bench.h"
+#include "../kernel/command.h"
+#include "../kernel/smp.h"
+#include "../kernel/spinlock.h"
+#include "../kernel/stream.h"
+#include "../kernel/task.h"
+#include "../libc/function.h"
+
+static spinlock_t pool_lock = SPINLOCK_INIT("zeropool");
+static u32 pool[ZEROPOOL_HIGH];
+static u32 pool_count = 0;
+/* Off while bench "zero fault sync" runs */
+static u8 pool_enabled = 1;
+/* On while either zero fault bench runs */
+static u8 preferred = 0;
+static task_t *worker = NULL;
+static zeropool_stats_t stats;
+
+/* Cached stores: the frame is about to be used */
+static void zero_frame(u32 frame) {
+    u32 count = FRAME_SIZE / 4;
+    __asm__ __volatile__("rep stosl" : "+D"(frame), "+c"(count) : "a"(0) : "memory");
+}
+
+/* Straight to memory, leaving the cache to whoever runs next. MOVNTI
+ * comes with SSE2 but stores a general register, so needs no FPU state */
+static void zero_frame_nontemporal(u32 frame) {
+    for (u32 *p = (u32*)frame; p < (u32*)(frame + FRAME_SIZE); p += 4) {
+        __asm__ __volatile__("movnti %1, (%0)\n\t"
+                             "movnti %1, 4(%0)\n\t"
+                             "movnti %1, 8(%0)\n\t"
+                             "movnti %1, 12(%0)" :: "r"(p), "r"(0) : "memory");
+    }
+    __asm__ __volatile__("sfence" ::: "memory");
+}
+
+/* Zero up to 'n' frames into the pool, without the kernel lock for the
+ * background task. Returns how many, 0 once it is full or memory is short */
+static u32 refill(u32 n, u8 background) {
+    u32 frames[ZEROPOOL_BATCH];
+    u32 got = 0;
+    n = MIN(n, ZEROPOOL_BATCH);
+    n = MIN(n, ZEROPOOL_HIGH - pool_count);
+    while (got < n && get_free_frame_count() > ZEROPOOL_HIGH) {
+        frames[got] = alloc_frame();
+        if (!frames[got]) break;
+        got++;
+    }
+    if (!got) return 0;
+
+    u32 depth = background ? kernel_lock_drop() : 0;
+    for (u32 i = 0; i < got; i++) {
+        if (stats.nontemporal) zero_frame_nontemporal(frames[i]);
+        else zero_frame(frames[i]);
+    }
+    kernel_lock_restore(depth);
+
+    u32 flags = spin_lock_irqsave(&pool_lock);
+    for (u32 i = 0; i < got; i++) {
+        if (pool_count < ZEROPOOL_HIGH) pool[pool_count++] = frames[i];
+        else free_frame(frames[i]);
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+    stats.zeroed += got;
+    return got;
+}
+
+/* Low priority: a batch at a time, and only while nothing else on this
+ * CPU is ready to run */
+static void zero_worker(void *arg) {
+    UNUSED(arg);
+    while (1) {
+        if (pool_count >= ZEROPOOL_HIGH || !refill(ZEROPOOL_BATCH, 1)) task_block(WAIT_WORK);
+        else if (this_cpu()->run_head) task_yield();
+    }
+}
+
+u32 zeropool_take() {
+    u32 frame = 0;
+    u8 wake = 0;
+    if (pool_enabled) {
+        u32 flags = spin_lock_irqsave(&pool_lock);
+        if (pool_count) frame = pool[--pool_count];
+        wake = pool_count < ZEROPOOL_LOW;
+        spin_unlock_irqrestore(&pool_lock, flags);
+    }
+    if (wake && worker && worker->wait == WAIT_WORK) task_wake(worker, 0);
+    if (frame) stats.hits++;
+    else stats.misses++;
+    return frame;
+}
+
+u8 zeropool_preferred() {
+    return preferred;
+}
+
+u32 alloc_frame_zeroed() {
+    u32 frame = zeropool_take();
+    if (frame) return frame;
+    frame = alloc_frame();
+    if (frame) zero_frame(frame);
+    return frame;
+}
+
+void get_zeropool_stats(zeropool_stats_t *out) {
+    *out = stats;
+    out->pooled = pool_count;
+}
+
+/* bench "zero fault pool" / "zero fault sync": first writes to fresh
+ * anonymous kernel pages, fault to resume, with the pool full or off */
+static u8 *bench_area = NULL;
+static u32 bench_next = 0;
+
+static void bench_zero_setup(u32 use_pool) {
+    pool_enabled = use_pool;
+    preferred = 1;
+    while (use_pool && refill(ZEROPOOL_HIGH, 0));
+    bench_area = (u8*)kmmap(NULL, 0, (BENCH_WARMUP + BENCH_SAMPLES) * ZEROPOOL_BENCH_FAULTS * FRAME_SIZE,
+                            VM_READ | VM_WRITE);
+    bench_next = 0;
+}
+
+static void bench_zero_fault(u32 use_pool, u32 iterations) {
+    UNUSED(use_pool);
+    if (!bench_area) return;
+    for (u32 i = 0; i < iterations; i++) {
+        ((volatile u8*)bench_area)[bench_next++ * FRAME_SIZE] = 1;
+    }
+}
+
+static void bench_zero_teardown(u32 use_pool) {
+    UNUSED(use_pool);
+    if (bench_area) kmunmap(bench_area);
+    bench_area = NULL;
+    pool_enabled = 1;
+    preferred = 0;
+}
+
+static bench_t zeropool_benches[] = {
+    {"zero fault pool", bench_zero_setup, bench_zero_fault, bench_zero_teardown, 1, ZEROPOOL_BENCH_FAULTS},
+    {"zero fault sync", bench_zero_setup, bench_zero_fault, bench_zero_teardown, 0, ZEROPOOL_BENCH_FAULTS},
+};
+
+static void zeropool_command(char *args) {
+    UNUSED(args);
+    zeropool_stats_t st;
+    get_zeropool_stats(&st);
+    stream_printf(stream_out(), "Zeroed frames: %d pooled (refilled below %d up to %d), %d taken, %d zeroed on the spot\n",
+                  st.pooled, ZEROPOOL_LOW, ZEROPOOL_HIGH, st.hits, st.misses);
+    stream_printf(stream_out(), "Background task: %d frames zeroed with %s stores\n", st.zeroed,
+                  st.nontemporal ? "non-temporal" : "cached");
+}
+
+void init_zeropool() {
+    stats.nontemporal = (cpu_features() & CPUID_EDX_SSE2) != 0;
+    worker = task_create_kernel(zero_worker, NULL);
+    register_command("zeropool", zeropool_command, "Pre-zeroed frame pool counters");
+    for (u32 i = 0; i < sizeof(zeropool_benches) / sizeof(zeropool_benches[0]); i++) register_bench(&zeropool_benches[i]);
+}
@@ -0,0 +1,40 @@
+#ifndef ZEROPOOL_H
+#define ZEROPOOL_H
+
+#include "../cpu/types.h"
+
+/* Frames zeroed ahead of time by a background task, for page tables,
+ * directories, and anonymous pages once high memory runs out. The task
+ * refills the pool up to ZEROPOOL_HIGH once it falls below ZEROPOOL_LOW,
+ * and leaves ZEROPOOL_HIGH frames to the rest of the system */
+#define ZEROPOOL_HIGH          128
+#define ZEROPOOL_LOW           32
+/* Frames zeroed between looks at the run queue */
+#define ZEROPOOL_BATCH         8
+
+/* bench "zero fault": faults timed per sample, the pool must hold all of
+ * them (see kernel/bench.h for the sample count) */
+#define ZEROPOOL_BENCH_FAULTS  4
+
+typedef struct {
+    u32 pooled;
+    u32 hits;                    /* Frames taken from the pool */
+    u32 misses;                  /* Found it empty: zeroed on the spot */
+    u32 zeroed;                  /* By the background task */
+    u8 nontemporal;              /* The task zeroes with MOVNTI */
+} zeropool_stats_t;
+
+/* Start the background task and register the zeropool command and the
+ * zero fault benchmarks. Needs tasks */
+void init_zeropool();
+/* A zeroed frame, from the pool if it has one. 0 if memory ran out */
+u32 alloc_frame_zeroed();
+/* A frame from the pool, 0 if it is empty: the caller zeroes one itself */
+u32 zeropool_take();
+/* Set while the zero fault benches run: anonymous pages then come from
+ * alloc_frame_zeroed() rather than high memory, so the two benches time
+ * the pool against zeroing on the spot */
+u8 zeropool_preferred();
+void get_zeropool_stats(zeropool_stats_t *stats);
+
+#endif
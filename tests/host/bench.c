@@ -0,0 +1,123 @@
+#include "hosttest.h"
+#include "../../libc/mem.h"
+#include "../../libc/string.h"
+#include "../../cpu/paging.h"
+
+static void bench_report(char *name, u64 ops, u64 ns, u32 bytes, char *extra) {
+    printf("%-26s %12.0f ops/s %9.1f ns/op", name, ops * 1e9 / ns, (double)ns / ops);
+    if (bytes) printf("  %.0f MB/s", (double)ops * bytes * 1e3 / ns);
+    printf("  %s\n", extra ? extra : "");
+}
+
+/* Calls 'op' in batches of 'batch' until BENCH_NS have passed. 'bytes' per
+ * op, if any, gives a throughput too */
+#define BENCH_LOOP(name, batch, bytes, extra, op) do {                 \
+        u64 ops_ = 0, start_ = now_ns(), ns_;                          \
+        do {                                                           \
+            for (u32 i_ = 0; i_ < (batch); i_++) { op; }               \
+            ops_ += (batch);                                           \
+        } while ((ns_ = now_ns() - start_) < BENCH_NS);                \
+        bench_report(name, ops_, ns_, bytes, extra);                   \
+    } while (0)
+
+static void bench_kmalloc_pair() {
+    BENCH_LOOP("kmalloc+kfree 64B", 1000, 0, NULL, kfree((void*)(size_t)kmalloc(64, 0, NULL)));
+}
+
+/* Steady state: free a random live block and allocate one of a random
+ * size, 'n' blocks live. The fragmentation ratio is the heap the blocks
+ * took up over the bytes still live */
+static void kmalloc_mix(u32 n, u32 max_size) {
+    static u32 addr[4096], size[4096];
+    u32 live = 0;
+    for (u32 i = 0; i < n; i++) {
+        size[i] = rng_range(16, max_size);
+        addr[i] = kmalloc(size[i], 0, NULL);
+        live += size[i];
+    }
+
+    u32 failed = 0;
+    u64 ops = 0, start = now_ns(), ns;
+    do {
+        for (u32 k = 0; k < 100; k++) {
+            u32 i = rng() % n;
+            if (addr[i]) {
+                kfree((void*)(size_t)addr[i]);
+                live -= size[i];
+            }
+            size[i] = rng_range(16, max_size);
+            addr[i] = kmalloc(size[i], 0, NULL);
+            if (addr[i]) live += size[i];
+            else failed++;
+        }
+        ops += 100;
+    } while ((ns = now_ns() - start) < BENCH_NS);
+
+    u32 total, used, free_mem;
+    get_heap_stats(&total, &used, &free_mem);
+    char name[64], extra[96];
+    snprintf(name, sizeof(name), "kmalloc mix %u live", n);
+    snprintf(extra, sizeof(extra), "fragmentation %.2f (%uKB heap, %uKB live)%s", live ? (double)total / live : 0.0,
+             total / 1024, live / 1024, failed ? ", out of heap" : "");
+    bench_report(name, ops, ns, 0, extra);
+}
+
+static void bench_kmalloc_mix_small() {
+    kmalloc_mix(256, 256);
+}
+
+static void bench_kmalloc_mix_large() {
+    kmalloc_mix(1024, 2048);
+}
+
+/* alloc_frame+free_frame with the bitmap filled to 'percent' first */
+static void frame_pair(u32 percent) {
+    init_frame_allocator();
+    u32 fill = get_free_frame_count() * percent / 100;
+    for (u32 i = 0; i < fill; i++) alloc_frame();
+    char name[64];
+    snprintf(name, sizeof(name), "alloc_frame+free %u%% full", percent);
+    BENCH_LOOP(name, 1000, 0, NULL, free_frame(alloc_frame()));
+}
+
+static void bench_frame_0() {
+    frame_pair(0);
+}
+
+static void bench_frame_50() {
+    frame_pair(50);
+}
+
+static void bench_frame_90() {
+    frame_pair(90);
+}
+
+static void bench_memory() {
+    static u8 src[4096], dst[4096];
+    BENCH_LOOP("memory_copy 4KB", 100, sizeof(dst), NULL, memory_copy(src, dst, sizeof(dst)));
+    BENCH_LOOP("memory_set 4KB", 100, sizeof(dst), NULL, memory_set(dst, 0, sizeof(dst)));
+}
+
+static void bench_string() {
+    char s[80], num[16];
+    for (u32 i = 0; i < 64; i++) s[i] = 'a' + i % 26;
+    s[64] = '\0';
+    volatile s32 sink;
+    BENCH_LOOP("strlen 64B", 1000, 0, NULL, sink = strlen(s));
+    BENCH_LOOP("strcmp 64B equal", 1000, 0, NULL, sink = strcmp(s, s));
+    BENCH_LOOP("int_to_ascii", 1000, 0, NULL, int_to_ascii((s32)i_ * 7919, num));
+    BENCH_LOOP("hex_to_ascii", 1000, 0, NULL, (num[0] = '\0', hex_to_ascii((s32)i_ * 7919, num)));
+    (void)sink;
+}
+
+host_test_t benchmarks[] = {
+    {"kmalloc_pair", bench_kmalloc_pair},
+    {"kmalloc_mix_small", bench_kmalloc_mix_small},
+    {"kmalloc_mix_large", bench_kmalloc_mix_large},
+    {"frame_0", bench_frame_0},
+    {"frame_50", bench_frame_50},
+    {"frame_90", bench_frame_90},
+    {"memory", bench_memory},
+    {"string", bench_string},
+    {NULL, NULL}
+};
@@ -0,0 +1,60 @@
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+/* Host build of libc/mem.c, libc/string.c, mm/frame.c and the locks in
+ * kernel/spinlock.c (make hosttest).
+ * Kernel headers come in with HOST_BUILD, which lets cpu/types.h defer
+ * size_t and NULL to the host */
+
+#include <stdio.h>
+#include "../../cpu/types.h"
+
+/* shim.c: the kernel heap lives at fixed addresses that kmalloc() hands
+ * out as u32, so the same range is mapped in the test process */
+void shim_map_heap();
+/* Calls to kprintf_color()/kprintf(), which the shim swallows */
+extern u32 shim_prints;
+/* kprint_color() and the cursor work on a screen of characters, MAX_ROWS
+ * by MAX_COLS. Characters written to it so far */
+extern char shim_screen[];
+extern u32 shim_chars_written;
+
+/* xorshift64*, seeded from the command line so failures reproduce */
+void rng_seed(u64 seed);
+u32 rng();
+/* Uniform in [lo, hi] */
+u32 rng_range(u32 lo, u32 hi);
+
+/* Monotonic clock in nanoseconds */
+u64 now_ns();
+
+/* A failed check prints where and why and fails the current test, which
+ * runs in its own process (main.c) */
+extern u32 check_failures;
+#define CHECK(cond, ...) do {                                          \
+        if (!(cond)) {                                                 \
+            check_failures++;                                          \
+            printf("  %s:%d: ", __FILE__, __LINE__);                   \
+            printf(__VA_ARGS__);                                       \
+            printf("\n");                                              \
+            if (check_failures > 10) return;                           \
+        }                                                              \
+    } while (0)
+
+typedef struct {
+    char *name;
+    void (*run)();
+} host_test_t;
+
+/* Each module's tests and benchmarks, NULL terminated */
+extern host_test_t mem_tests[];
+extern host_test_t frame_tests[];
+extern host_test_t string_tests[];
+extern host_test_t lineedit_tests[];
+extern host_test_t spinlock_tests[];
+extern host_test_t benchmarks[];
+
+/* bench.c: every benchmark runs for about BENCH_NS */
+#define BENCH_NS 200000000ull
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hosttest.h"
+#include "../../libc/string.h"
+
+/* hosttest [tests|bench|all] [seed]
+ *
+ * Every test and benchmark runs in a child process of its own: the heap,
+ * the frame bitmap and the heap window start out fresh, and a crash fails
+ * one test instead of the run */
+
+u32 check_failures = 0;
+
+static host_test_t *suites[] = {mem_tests, frame_tests, string_tests, lineedit_tests, spinlock_tests, NULL};
+
+/* Returns 1 if it passed */
+static int run(host_test_t *t, u64 seed, int quiet) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("hosttest: fork");
+        exit(2);
+    }
+    if (pid == 0) {
+        shim_map_heap();
+        rng_seed(seed);
+        t->run();
+        fflush(stdout);
+        _exit(check_failures ? 1 : 0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    int passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!passed) {
+        if (WIFSIGNALED(status)) printf("FAIL %s (signal %d)\n", t->name, WTERMSIG(status));
+        else printf("FAIL %s\n", t->name);
+    } else if (!quiet) {
+        printf("PASS %s\n", t->name);
+    }
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    char *mode = argc > 1 ? argv[1] : "all";
+    u64 seed = argc > 2 ? strtoull(argv[2], NULL, 0) : (u64)now_ns();
+    int tests = !strcmp(mode, "tests") || !strcmp(mode, "all");
+    int bench = !strcmp(mode, "bench") || !strcmp(mode, "all");
+    if (!tests && !bench) {
+        fprintf(stderr, "usage: %s [tests|bench|all] [seed]\n", argv[0]);
+        return 2;
+    }
+
+    u32 failed = 0;
+    if (tests) {
+        u32 total = 0;
+        printf("seed %llu\n", (unsigned long long)seed);
+        for (host_test_t **s = suites; *s; s++) {
+            for (host_test_t *t = *s; t->name; t++, total++) {
+                if (!run(t, seed, 0)) failed++;
+            }
+        }
+        printf("%u/%u tests passed\n", total - failed, total);
+    }
+    if (bench) {
+        for (host_test_t *t = benchmarks; t->name; t++) run(t, seed, 1);
+    }
+    return failed ? 1 : 0;
+}
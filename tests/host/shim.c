@@ -0,0 +1,103 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "hosttest.h"
+#include "../../libc/mem.h"
+#include "../../drivers/screen.h"
+
+/* The hardware hooks the modules under test reach for: the screen, which
+ * kprintf_color() reports frame allocator events on, and what the locks
+ * use */
+
+u32 shim_prints = 0;
+
+void kprintf_color(char attr, char *fmt, ...) {
+    (void)attr;
+    (void)fmt;
+    shim_prints++;
+}
+
+void kprintf(char *fmt, ...) {
+    (void)fmt;
+    shim_prints++;
+}
+
+/* A text screen for the line editor: characters only, scrolled like the
+ * VGA driver does */
+char shim_screen[MAX_ROWS * MAX_COLS];
+u32 shim_chars_written = 0;
+static s32 cursor = 0;
+
+s32 get_cursor_offset() {
+    return cursor;
+}
+
+void set_cursor_offset(s32 offset) {
+    cursor = offset;
+}
+
+void kprint_color(char *message, char attr) {
+    (void)attr;
+    for (; *message; message++) {
+        if (*message == '\n') {
+            cursor = (cursor / BYTES_PER_CHAR / MAX_COLS + 1) * MAX_COLS * BYTES_PER_CHAR;
+        } else {
+            shim_screen[cursor / BYTES_PER_CHAR] = *message;
+            cursor += BYTES_PER_CHAR;
+            shim_chars_written++;
+        }
+        if (cursor >= MAX_ROWS * MAX_COLS * BYTES_PER_CHAR) {
+            for (u32 i = 0; i < (MAX_ROWS - 1) * MAX_COLS; i++) shim_screen[i] = shim_screen[i + MAX_COLS];
+            for (u32 i = 0; i < MAX_COLS; i++) shim_screen[(MAX_ROWS - 1) * MAX_COLS + i] = ' ';
+            cursor -= MAX_COLS * BYTES_PER_CHAR;
+        }
+    }
+}
+
+/* No interrupts in the test process to keep out */
+u32 irq_save() {
+    return 0;
+}
+
+void irq_restore(u32 flags) {
+    (void)flags;
+}
+
+u64 read_tsc() {
+    u32 low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((u64)high << 32) | low;
+}
+
+void shim_map_heap() {
+    void *heap = mmap((void*)KMALLOC_START, KMALLOC_END - KMALLOC_START, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (heap != (void*)KMALLOC_START) {
+        perror("hosttest: mapping the kernel heap range");
+        exit(2);
+    }
+}
+
+static u64 rng_state = 1;
+
+void rng_seed(u64 seed) {
+    rng_state = seed ? seed : 1;
+}
+
+u32 rng() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (u32)((rng_state * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+u32 rng_range(u32 lo, u32 hi) {
+    return lo + rng() % (hi - lo + 1);
+}
+
+u64 now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,182 @@
+#include "hosttest.h"
+#include "../../cpu/paging.h"
+#include "../../libc/mem.h"
+
+/* Reference model of the frame bitmap: one byte per frame */
+
+#define RESERVED_FRAMES (KMALLOC_END / FRAME_SIZE)
+
+static u8 used[TOTAL_FRAMES];
+static u32 used_count;
+static u32 held[TOTAL_FRAMES];
+static u32 held_count;
+
+static void model_reset() {
+    for (u32 i = 0; i < TOTAL_FRAMES; i++) used[i] = i < RESERVED_FRAMES;
+    used_count = RESERVED_FRAMES;
+    held_count = 0;
+}
+
+static void check_counts() {
+    CHECK(get_used_frame_count() == used_count, "%u frames used, model says %u", get_used_frame_count(), used_count);
+    CHECK(get_free_frame_count() == TOTAL_FRAMES - used_count, "%u frames free, model says %u",
+          get_free_frame_count(), TOTAL_FRAMES - used_count);
+}
+
+static void alloc_one() {
+    u32 prints = shim_prints;
+    u32 addr = alloc_frame();
+    if (used_count == TOTAL_FRAMES) {
+        CHECK(addr == 0, "alloc_frame returned %#x with every frame used", addr);
+        CHECK(shim_prints == prints + 1, "out of memory not reported");
+        return;
+    }
+    CHECK(addr && !(addr & (FRAME_SIZE - 1)), "alloc_frame returned %#x", addr);
+    CHECK(addr >= KMALLOC_END && addr < MEMORY_END, "frame %#x outside the frame range", addr);
+    CHECK(!used[addr / FRAME_SIZE], "frame %#x handed out twice", addr);
+    used[addr / FRAME_SIZE] = 1;
+    used_count++;
+    held[held_count++] = addr;
+}
+
+static void free_one(u32 i) {
+    u32 addr = held[i];
+    free_frame(addr);
+    used[addr / FRAME_SIZE] = 0;
+    used_count--;
+    held[i] = held[--held_count];
+}
+
+static void test_frame_stress() {
+    init_frame_allocator();
+    model_reset();
+    check_counts();
+
+    for (u32 op = 0; op < 200000 && !check_failures; op++) {
+        /* Drift between nearly empty and completely full */
+        u32 phase = (op / 20000) % 2;
+        if (rng() % 100 < (phase ? 30u : 70u)) alloc_one();
+        else if (held_count) free_one(rng() % held_count);
+        if (op % 500 == 0) check_counts();
+    }
+    check_counts();
+}
+
+static void test_frame_exhaustion() {
+    init_frame_allocator();
+    model_reset();
+    while (used_count < TOTAL_FRAMES && !check_failures) alloc_one();
+    alloc_one();
+    check_counts();
+
+    /* A freed frame is the next one handed out */
+    u32 victim = held[rng() % held_count];
+    free_frame(victim);
+    CHECK(alloc_frame() == victim, "frame %#x not reused", victim);
+}
+
+static void test_frame_free_edge_cases() {
+    init_frame_allocator();
+    model_reset();
+    alloc_one();
+    u32 addr = held[0];
+
+    /* Double frees and addresses past the end change nothing */
+    free_one(0);
+    free_frame(addr);
+    free_frame(MEMORY_END);
+    free_frame(0xFFFFF000);
+    check_counts();
+
+    /* Any address inside the frame frees it */
+    alloc_one();
+    addr = held[0];
+    free_frame(addr + 0x123);
+    used[addr / FRAME_SIZE] = 0;
+    used_count--;
+    check_counts();
+}
+
+/* Initialising again forgets every allocation */
+static void test_frame_reinit() {
+    init_frame_allocator();
+    model_reset();
+    while (used_count < TOTAL_FRAMES) alloc_one();
+    init_frame_allocator();
+    model_reset();
+    check_counts();
+    u32 addr = alloc_frame();
+    CHECK(addr == KMALLOC_END, "first frame after init is %#x", addr);
+}
+
+/* High memory: 64MB past the direct map, a hole, 64MB above 4GB */
+#define HIGH_LOW_END    (MEMORY_END + 0x4000000ULL)
+#define HIGH_END        (FOUR_GB + 0x4000000ULL)
+#define HIGH_FRAMES     (u32)((HIGH_LOW_END - MEMORY_END + HIGH_END - FOUR_GB) / FRAME_SIZE)
+
+static u8 high_used[(HIGH_END - MEMORY_END) / FRAME_SIZE];
+
+static void check_high_frame(phys_t addr, phys_t below) {
+    CHECK(addr && !(addr & (FRAME_SIZE - 1)), "alloc_frame_high returned %#llx", addr);
+    CHECK((addr >= MEMORY_END && addr < HIGH_LOW_END) || (addr >= FOUR_GB && addr < HIGH_END),
+          "high frame %#llx outside the RAM given", addr);
+    /* Top down, so each one is below the last */
+    CHECK(addr < below, "high frame %#llx after %#llx", addr, below);
+    CHECK(!high_used[(addr - MEMORY_END) / FRAME_SIZE], "high frame %#llx handed out twice", addr);
+    high_used[(addr - MEMORY_END) / FRAME_SIZE] = 1;
+}
+
+static void test_frame_high() {
+    init_frame_allocator();
+    CHECK(alloc_frame_high() == 0, "high frame before there is high memory");
+    CHECK(init_high_frames(HIGH_END), "no room for the high memory bitmap");
+    add_high_frames(MEMORY_END, HIGH_LOW_END);
+    add_high_frames(FOUR_GB, HIGH_END);
+    CHECK(get_high_frame_count() == HIGH_FRAMES && get_high_free_frame_count() == HIGH_FRAMES,
+          "%u high frames, %u free, expected %u", get_high_frame_count(), get_high_free_frame_count(), HIGH_FRAMES);
+
+    phys_t below = HIGH_END;
+    for (u32 i = 0; i < HIGH_FRAMES && !check_failures; i++) {
+        phys_t addr = alloc_frame_high();
+        check_high_frame(addr, below);
+        below = addr;
+        /* Everything above 4GB goes first */
+        if (i < (HIGH_END - FOUR_GB) / FRAME_SIZE) CHECK(addr >= FOUR_GB, "frame %u at %#llx, below 4GB", i, addr);
+    }
+    CHECK(alloc_frame_high() == 0, "high frame with all of them used");
+    CHECK(get_high_free_frame_count() == 0, "%u high frames free", get_high_free_frame_count());
+    CHECK(get_free_frame_count() == TOTAL_FRAMES - RESERVED_FRAMES, "high allocations changed the low counts");
+
+    /* Frees anywhere come back highest first */
+    u32 freed = 0;
+    for (u32 i = 0; i < 2000; i++) {
+        phys_t addr = rng() % 2 ? MEMORY_END + (phys_t)rng_range(0, 0x3FFF) * FRAME_SIZE
+                                : FOUR_GB + (phys_t)rng_range(0, 0x3FFF) * FRAME_SIZE;
+        if (!high_used[(addr - MEMORY_END) / FRAME_SIZE]) continue;
+        high_used[(addr - MEMORY_END) / FRAME_SIZE] = 0;
+        free_frame(addr + rng() % FRAME_SIZE);
+        freed++;
+    }
+    CHECK(get_high_free_frame_count() == freed, "%u high frames free, %u freed", get_high_free_frame_count(), freed);
+    below = HIGH_END;
+    for (u32 i = 0; i < freed && !check_failures; i++) {
+        phys_t addr = alloc_frame_high();
+        check_high_frame(addr, below);
+        below = addr;
+    }
+    CHECK(alloc_frame_high() == 0, "more high frames than were freed");
+
+    /* Addresses past the end change nothing */
+    free_frame(HIGH_END);
+    free_frame(0xFFFFFFFFF000ULL);
+    CHECK(get_high_free_frame_count() == 0, "a frame past the end was freed");
+}
+
+host_test_t frame_tests[] = {
+    {"frame_stress", test_frame_stress},
+    {"frame_exhaustion", test_frame_exhaustion},
+    {"frame_free_edge_cases", test_frame_free_edge_cases},
+    {"frame_reinit", test_frame_reinit},
+    {"frame_high", test_frame_high},
+    {NULL, NULL}
+};
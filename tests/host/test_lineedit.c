@@ -0,0 +1,133 @@
+#include "hosttest.h"
+#include "../../kernel/lineedit.h"
+#include "../../libc/string.h"
+#include "../../drivers/screen.h"
+
+/* The gap buffer against a plain array and a cursor, and the screen
+ * against the line after every redraw */
+
+static line_editor_t ed;
+static char model[LINE_MAX];
+static u32 model_len, model_cursor;
+
+static void model_insert(char c) {
+    for (u32 i = model_len; i > model_cursor; i--) model[i] = model[i - 1];
+    model[model_cursor++] = c;
+    model_len++;
+}
+
+static void model_delete(u32 at) {
+    for (u32 i = at; i + 1 < model_len; i++) model[i] = model[i + 1];
+    model_len--;
+}
+
+static void check_line() {
+    char text[LINE_MAX];
+    line_text(&ed, text);
+    model[model_len] = '\0';
+    CHECK(line_length(&ed) == model_len && strcmp(text, model) == 0, "\"%s\" != \"%s\"", text, model);
+    CHECK(line_cursor(&ed) == model_cursor, "cursor %u, expected %u", line_cursor(&ed), model_cursor);
+
+    u32 first = ed.origin / BYTES_PER_CHAR;
+    for (u32 i = 0; i < model_len; i++) {
+        CHECK(shim_screen[first + i] == model[i], "screen shows '%c' at %u of \"%s\"", shim_screen[first + i], i, model);
+        if (shim_screen[first + i] != model[i]) break;
+    }
+    CHECK(get_cursor_offset() == (s32)((first + model_cursor) * BYTES_PER_CHAR), "screen cursor %d, line cursor %u",
+          get_cursor_offset() / BYTES_PER_CHAR - first, model_cursor);
+}
+
+static void start(u32 row, u32 col) {
+    for (u32 i = 0; i < MAX_ROWS * MAX_COLS; i++) shim_screen[i] = ' ';
+    set_cursor_offset((row * MAX_COLS + col) * BYTES_PER_CHAR);
+    line_begin(&ed, 0);
+    model_len = model_cursor = 0;
+}
+
+static void test_lineedit_random() {
+    /* Near the bottom, so long lines scroll the screen */
+    start(MAX_ROWS - 2, 6);
+    for (u32 op = 0; op < 200000 && !check_failures; op++) {
+        u32 r = rng() % 100;
+        if (r < 50) {
+            char c = rng() % 5 ? (char)rng_range('a', 'z') : ' ';
+            s32 ok = line_insert(&ed, c);
+            CHECK((ok == 0) == (model_len < LINE_MAX - 1), "insert at length %u returned %d", model_len, ok);
+            if (ok == 0) model_insert(c);
+        } else if (r < 60) {
+            if (line_delete_back(&ed) == 0) model_delete(--model_cursor);
+        } else if (r < 65) {
+            if (line_delete_forward(&ed) == 0) model_delete(model_cursor);
+        } else if (r < 75) {
+            line_left(&ed);
+            if (model_cursor) model_cursor--;
+        } else if (r < 85) {
+            line_right(&ed);
+            if (model_cursor < model_len) model_cursor++;
+        } else if (r < 88) {
+            line_home(&ed);
+            model_cursor = 0;
+        } else if (r < 91) {
+            line_end(&ed);
+            model_cursor = model_len;
+        } else if (r < 94) {
+            line_word_left(&ed);
+            while (model_cursor && model[model_cursor - 1] == ' ') model_cursor--;
+            while (model_cursor && model[model_cursor - 1] != ' ') model_cursor--;
+        } else if (r < 97) {
+            line_word_right(&ed);
+            while (model_cursor < model_len && model[model_cursor] == ' ') model_cursor++;
+            while (model_cursor < model_len && model[model_cursor] != ' ') model_cursor++;
+        } else {
+            char text[LINE_MAX];
+            u32 len = rng_range(0, 300);
+            for (u32 i = 0; i < len && i < LINE_MAX - 1; i++) text[i] = (char)rng_range('a', 'c');
+            text[MIN(len, LINE_MAX - 1)] = '\0';
+            line_set(&ed, text);
+            model_len = model_cursor = MIN(len, LINE_MAX - 1);
+            for (u32 i = 0; i < model_len; i++) model[i] = text[i];
+        }
+        line_redraw(&ed);
+        check_line();
+    }
+}
+
+/* Only what changed reaches the screen */
+static void test_lineedit_minimal_redraw() {
+    start(3, 6);
+    for (char *p = "exec /bin/hello"; *p; p++) {
+        u32 before = shim_chars_written;
+        line_insert(&ed, *p);
+        line_redraw(&ed);
+        CHECK(shim_chars_written - before == 1, "typing '%c' wrote %u characters", *p, shim_chars_written - before);
+    }
+
+    /* In the middle: the rest of the line moves over by one */
+    line_home(&ed);
+    u32 before = shim_chars_written;
+    line_redraw(&ed);
+    CHECK(shim_chars_written == before, "moving the cursor wrote %u characters", shim_chars_written - before);
+    for (u32 i = 0; i < 5; i++) line_right(&ed);
+    line_insert(&ed, 'X');
+    line_redraw(&ed);
+    CHECK(shim_chars_written - before == 11, "inserting in the middle wrote %u characters", shim_chars_written - before);
+
+    /* A history recall sharing a prefix and the length of the old line */
+    before = shim_chars_written;
+    line_set(&ed, "exec X/bin/world");
+    line_redraw(&ed);
+    CHECK(shim_chars_written - before == 5, "recall wrote %u characters", shim_chars_written - before);
+
+    /* A shorter line blanks the rest */
+    before = shim_chars_written;
+    line_set(&ed, "exec");
+    line_redraw(&ed);
+    CHECK(shim_chars_written - before == 12, "shortening wrote %u characters", shim_chars_written - before);
+    CHECK(shim_screen[3 * MAX_COLS + 6 + 4] == ' ', "old text left on screen");
+}
+
+host_test_t lineedit_tests[] = {
+    {"lineedit_random", test_lineedit_random},
+    {"lineedit_minimal_redraw", test_lineedit_minimal_redraw},
+    {NULL, NULL}
+};
@@ -0,0 +1,222 @@
+#include "hosttest.h"
+#include "../../libc/mem.h"
+
+/* Reference model of the heap: every live allocation with the pattern it
+ * was filled with. kmalloc() must never hand out memory that overlaps a
+ * live block or lies outside the heap, and nothing may touch a live
+ * block's bytes until it is freed */
+
+#define MODEL_MAX 1024
+
+typedef struct {
+    u32 addr;
+    u32 size;
+    u8 seed;
+} live_t;
+
+static live_t live[MODEL_MAX];
+static u32 live_count;
+static u32 live_bytes;
+
+static void fill(live_t *l) {
+    u8 *p = (u8*)(size_t)l->addr;
+    for (u32 i = 0; i < l->size; i++) p[i] = (u8)(l->seed + i * 7);
+}
+
+/* Offset of the first byte that differs from the pattern, or size */
+static u32 verify(live_t *l) {
+    u8 *p = (u8*)(size_t)l->addr;
+    for (u32 i = 0; i < l->size; i++) {
+        if (p[i] != (u8)(l->seed + i * 7)) return i;
+    }
+    return l->size;
+}
+
+static live_t* overlapping(u32 addr, u32 size) {
+    for (u32 i = 0; i < live_count; i++) {
+        if (addr < live[i].addr + live[i].size && live[i].addr < addr + size) return &live[i];
+    }
+    return NULL;
+}
+
+/* Mostly small blocks with the odd large one, like the kernel's own mix of
+ * nodes, buffers and 16KB task stacks */
+static u32 random_size() {
+    u32 r = rng() % 100;
+    if (r < 70) return rng_range(1, 256);
+    if (r < 95) return rng_range(257, 4096);
+    return rng_range(4097, 0x4000);
+}
+
+static void check_stats(u32 aligned_bytes) {
+    u32 total, used, free_mem;
+    get_heap_stats(&total, &used, &free_mem);
+    CHECK(total <= KMALLOC_END - KMALLOC_START, "heap total %u beyond the heap", total);
+    CHECK(used <= total, "used %u > total %u", used, total);
+    CHECK(used >= live_bytes + aligned_bytes, "used %u < %u bytes live", used, live_bytes + aligned_bytes);
+    CHECK(free_mem == total - used, "free %u != total %u - used %u", free_mem, total, used);
+}
+
+static void test_kmalloc_stress() {
+    u32 aligned_bytes = 0;
+    u32 failed = 0;
+    live_count = 0;
+    live_bytes = 0;
+
+    for (u32 op = 0; op < 100000 && !check_failures; op++) {
+        u32 r = rng() % 100;
+        if (r < 2) {
+            /* Page aligned blocks carry no header and are never freed */
+            u32 size = rng_range(1, 2 * PAGE_SIZE);
+            u32 phys = 0;
+            u32 addr = kmalloc(size, 1, &phys);
+            if (!addr) continue;
+            CHECK(!(addr & PAGE_OFFSET_MASK), "aligned kmalloc returned %#x", addr);
+            CHECK(phys == addr, "phys %#x for %#x", phys, addr);
+            CHECK(addr >= KMALLOC_START && addr + size <= KMALLOC_END, "aligned block %#x+%u outside the heap", addr, size);
+            live_t *o = overlapping(addr, size);
+            CHECK(!o, "aligned block %#x+%u overlaps %#x+%u", addr, size, o ? o->addr : 0, o ? o->size : 0);
+            aligned_bytes += size;
+        } else if (r < 55 && live_count < MODEL_MAX) {
+            u32 size = random_size();
+            u32 addr = kmalloc(size, 0, NULL);
+            if (!addr) {
+                failed++;
+                continue;
+            }
+            CHECK(addr >= KMALLOC_START && addr + size <= KMALLOC_END, "block %#x+%u outside the heap", addr, size);
+            live_t *o = overlapping(addr, size);
+            CHECK(!o, "block %#x+%u overlaps %#x+%u", addr, size, o ? o->addr : 0, o ? o->size : 0);
+            live_t *l = &live[live_count++];
+            l->addr = addr;
+            l->size = size;
+            l->seed = (u8)rng();
+            fill(l);
+            live_bytes += size;
+        } else if (live_count) {
+            u32 i = rng() % live_count;
+            u32 bad = verify(&live[i]);
+            CHECK(bad == live[i].size, "block %#x+%u corrupted at offset %u", live[i].addr, live[i].size, bad);
+            kfree((void*)(size_t)live[i].addr);
+            live_bytes -= live[i].size;
+            live[i] = live[--live_count];
+        }
+        if (op % 1000 == 0) check_stats(aligned_bytes);
+    }
+
+    for (u32 i = 0; i < live_count; i++) {
+        u32 bad = verify(&live[i]);
+        CHECK(bad == live[i].size, "block %#x+%u corrupted at offset %u", live[i].addr, live[i].size, bad);
+        kfree((void*)(size_t)live[i].addr);
+    }
+    live_count = 0;
+    live_bytes = 0;
+    check_stats(aligned_bytes);
+
+    /* With everything freed only the aligned blocks count as used */
+    u32 total, used, free_mem;
+    get_heap_stats(&total, &used, &free_mem);
+    CHECK(used == aligned_bytes, "used %u after freeing everything, %u aligned", used, aligned_bytes);
+    if (failed) printf("  (%u allocations ran out of heap)\n", failed);
+}
+
+/* A freed block comes back for a request it fits */
+static void test_kmalloc_reuse() {
+    u32 a = kmalloc(100, 0, NULL);
+    u32 b = kmalloc(100, 0, NULL);
+    CHECK(a && b && a != b, "kmalloc %#x %#x", a, b);
+    kfree((void*)(size_t)a);
+    u32 c = kmalloc(64, 0, NULL);
+    CHECK(c == a, "freed block %#x not reused, got %#x", a, c);
+    kfree(NULL);
+    /* Freeing twice counts once */
+    kfree((void*)(size_t)b);
+    kfree((void*)(size_t)b);
+    u32 total, used, free_mem;
+    get_heap_stats(&total, &used, &free_mem);
+    CHECK(used == 100, "used %u, expected 100", used);
+}
+
+/* Running out of heap fails cleanly and leaves the heap usable */
+static void test_kmalloc_exhaustion() {
+    u32 n = 0;
+    while (kmalloc(0x10000, 0, NULL)) n++;
+    CHECK(n > 0 && n < (KMALLOC_END - KMALLOC_START) / 0x10000, "%u 64KB blocks", n);
+    CHECK(!kmalloc(KMALLOC_END - KMALLOC_START, 1, NULL), "aligned allocation past the end");
+    u32 small = kmalloc(16, 0, NULL);
+    CHECK(small && small + 16 <= KMALLOC_END, "no room left for 16 bytes: %#x", small);
+}
+
+/* Freed blocks and the tail as get_heap_fragmentation() sees them, and
+ * with HEAP_TRACK the site each block is charged to */
+static u32 alloc_here(u32 size) {
+    return kmalloc(size, 0, NULL);
+}
+
+static void test_heap_fragmentation() {
+    u32 a[8];
+    for (u32 i = 0; i < 8; i++) a[i] = alloc_here(100 << i);
+    for (u32 i = 0; i < 8; i += 2) kfree((void*)(size_t)a[i]);
+
+    heap_frag_t f;
+    get_heap_fragmentation(&f);
+    u32 total, used, free_mem;
+    get_heap_stats(&total, &used, &free_mem);
+    CHECK(f.used_blocks == 4 && f.free_blocks == 4, "%u used, %u free blocks", f.used_blocks, f.free_blocks);
+    CHECK(f.free_bytes == 100 + 400 + 1600 + 6400, "%u bytes free", f.free_bytes);
+    CHECK(f.largest_free == 6400, "largest free %u", f.largest_free);
+    CHECK(f.tail == KMALLOC_END - KMALLOC_START - total, "tail %u, heap grown %u", f.tail, total);
+    u32 buckets = 0;
+    for (u32 b = 0; b < HEAP_FREE_BUCKETS; b++) buckets += f.histogram[b];
+    CHECK(buckets == 4 && f.histogram[6] == 1 && f.histogram[12] == 1, "free block histogram");
+
+    heap_site_t sites[HEAP_SITES];
+    u32 n = get_heap_sites(sites, HEAP_SITES);
+#ifdef HEAP_TRACK
+    CHECK(n == 1, "%u allocation sites", n);
+    CHECK(sites[0].allocs == 8 && sites[0].live_blocks == 4, "%u allocations, %u live", sites[0].allocs, sites[0].live_blocks);
+    CHECK(sites[0].live_bytes == 200 + 800 + 3200 + 12800, "%u bytes live", sites[0].live_bytes);
+#else
+    CHECK(n == 0, "%u allocation sites without HEAP_TRACK", n);
+#endif
+}
+
+/* Both against a byte loop, with guard bytes around the range */
+static void test_memory_copy_set() {
+    static u8 src[512], dst[512 + 64];
+    for (u32 round = 0; round < 2000 && !check_failures; round++) {
+        u32 len = rng_range(0, 512);
+        u32 off = rng_range(0, 32);
+        u8 guard = (u8)rng();
+        u8 val = (u8)rng();
+        for (u32 i = 0; i < sizeof(src); i++) src[i] = (u8)rng();
+        for (u32 i = 0; i < sizeof(dst); i++) dst[i] = guard;
+
+        memory_copy(src, dst + off, len);
+        for (u32 i = 0; i < sizeof(dst); i++) {
+            u8 want = (i >= off && i < off + len) ? src[i - off] : guard;
+            if (dst[i] != want) {
+                CHECK(0, "memory_copy len %u off %u: byte %u is %#x, not %#x", len, off, i, dst[i], want);
+                break;
+            }
+        }
+
+        memory_set(dst + off, val, len);
+        for (u32 i = 0; i < sizeof(dst); i++) {
+            u8 want = (i >= off && i < off + len) ? val : guard;
+            if (dst[i] != want) {
+                CHECK(0, "memory_set len %u off %u: byte %u is %#x, not %#x", len, off, i, dst[i], want);
+                break;
+            }
+        }
+    }
+}
+
+host_test_t mem_tests[] = {
+    {"kmalloc_stress", test_kmalloc_stress},
+    {"kmalloc_reuse", test_kmalloc_reuse},
+    {"kmalloc_exhaustion", test_kmalloc_exhaustion},
+    {"heap_fragmentation", test_heap_fragmentation},
+    {"memory_copy_set", test_memory_copy_set},
+    {NULL, NULL}
+};
@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include "hosttest.h"
+#include "../../kernel/spinlock.h"
+
+/* Host threads stand in for CPUs: each test has THREADS of them hammer one
+ * lock and checks nothing got in under it */
+
+#define THREADS 4
+#define ROUNDS  20000
+
+static void run_threads(void *(*body)(void*)) {
+    pthread_t threads[THREADS];
+    for (u32 i = 0; i < THREADS; i++) pthread_create(&threads[i], NULL, body, (void*)(size_t)i);
+    for (u32 i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+}
+
+static spinlock_t counter_lock = SPINLOCK_INIT("counter");
+static u32 counter;
+
+static void *count_body(void *arg) {
+    (void)arg;
+    for (u32 i = 0; i < ROUNDS; i++) {
+        u32 flags = spin_lock_irqsave(&counter_lock);
+        /* Read and write apart, so a second holder would lose updates */
+        u32 seen = counter;
+        __asm__ __volatile__("" ::: "memory");
+        counter = seen + 1;
+        spin_unlock_irqrestore(&counter_lock, flags);
+    }
+    return NULL;
+}
+
+static void test_spin_counter() {
+    run_threads(count_body);
+    CHECK(counter == THREADS * ROUNDS, "counter %u, expected %u", counter, THREADS * ROUNDS);
+    CHECK(counter_lock.owner == counter_lock.next, "tickets %u served of %u drawn", counter_lock.owner,
+          counter_lock.next);
+#ifdef LOCK_STATS
+    CHECK(lock_stats_list() == &counter_lock.stats, "lock not listed after use");
+    CHECK(counter_lock.stats.acquisitions == THREADS * ROUNDS, "%u acquisitions counted",
+          counter_lock.stats.acquisitions);
+#else
+    CHECK(lock_stats_list() == NULL, "locks listed without LOCK_STATS");
+#endif
+}
+
+/* Writers keep a == b, readers must never see them differ */
+static rwlock_t pair_lock = RWLOCK_INIT("pair");
+static volatile u32 pair_a, pair_b;
+static u32 torn_reads;
+static u32 readers_inside, max_readers_inside;
+
+static void *rw_body(void *arg) {
+    u32 id = (u32)(size_t)arg;
+    for (u32 i = 0; i < ROUNDS; i++) {
+        if (id == 0 && i % 8 == 0) {
+            write_lock(&pair_lock);
+            pair_a++;
+            __asm__ __volatile__("" ::: "memory");
+            pair_b++;
+            write_unlock(&pair_lock);
+        } else {
+            read_lock(&pair_lock);
+            u32 inside = __sync_add_and_fetch(&readers_inside, 1);
+            if (inside > max_readers_inside) max_readers_inside = inside;
+            if (pair_a != pair_b) __sync_fetch_and_add(&torn_reads, 1);
+            __sync_fetch_and_sub(&readers_inside, 1);
+            read_unlock(&pair_lock);
+        }
+    }
+    return NULL;
+}
+
+static void test_rwlock() {
+    run_threads(rw_body);
+    CHECK(torn_reads == 0, "%u reads saw a writer half done", torn_reads);
+    CHECK(pair_a == ROUNDS / 8, "%u writes, expected %u", pair_a, ROUNDS / 8);
+    CHECK(pair_lock.value == 0, "lock word %#x after everyone left", pair_lock.value);
+    printf("  at most %u readers inside at once\n", max_readers_inside);
+}
+
+/* One writer, the others read a pair that must always match */
+static seqlock_t seq_lock = SEQLOCK_INIT("seq");
+static volatile u64 seq_a, seq_b;
+static u32 seq_torn, seq_retries;
+
+static void *seq_body(void *arg) {
+    u32 id = (u32)(size_t)arg;
+    for (u32 i = 0; i < ROUNDS; i++) {
+        if (id == 0) {
+            write_seqlock(&seq_lock);
+            seq_a = i;
+            seq_b = (u64)i << 32;
+            write_sequnlock(&seq_lock);
+            continue;
+        }
+        u64 a, b;
+        u32 seq, tries = 0;
+        do {
+            seq = read_seqbegin(&seq_lock);
+            a = seq_a;
+            b = seq_b;
+            tries++;
+        } while (read_seqretry(&seq_lock, seq));
+        if (b != a << 32) __sync_fetch_and_add(&seq_torn, 1);
+        __sync_fetch_and_add(&seq_retries, tries - 1);
+    }
+    return NULL;
+}
+
+static void test_seqlock() {
+    run_threads(seq_body);
+    CHECK(seq_torn == 0, "%u reads returned a torn pair", seq_torn);
+    CHECK(seq_lock.seq == 2 * ROUNDS, "sequence %u after %u writes", seq_lock.seq, ROUNDS);
+#ifdef LOCK_STATS
+    CHECK(seq_lock.lock.stats.retries == seq_retries, "%u retries counted, readers saw %u",
+          seq_lock.lock.stats.retries, seq_retries);
+#endif
+    printf("  %u read retries\n", seq_retries);
+}
+
+host_test_t spinlock_tests[] = {
+    {"spin_counter", test_spin_counter},
+    {"rwlock", test_rwlock},
+    {"seqlock", test_seqlock},
+    {NULL, NULL}
+};
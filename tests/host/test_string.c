@@ -0,0 +1,161 @@
+#include "hosttest.h"
+#include "../../libc/string.h"
+
+static s32 sign(s32 v) {
+    return (v > 0) - (v < 0);
+}
+
+/* Same characters as the host's printf, for anything but INT_MIN, which
+ * int_to_ascii cannot negate */
+static void test_int_to_ascii() {
+    s32 fixed[] = {0, 1, -1, 9, 10, -10, 2147483647, -2147483647};
+    char want[32], got[32];
+    for (u32 i = 0; i < 100000 && !check_failures; i++) {
+        s32 n = i < sizeof(fixed) / sizeof(fixed[0]) ? fixed[i] : (s32)(rng() >> rng_range(0, 31));
+        if (n == (s32)0x80000000) continue;
+        if (i >= sizeof(fixed) / sizeof(fixed[0]) && (rng() & 1)) n = -n;
+        snprintf(want, sizeof(want), "%d", n);
+        int_to_ascii(n, got);
+        CHECK(strcmp(got, want) == 0, "int_to_ascii(%d) = \"%s\"", n, got);
+    }
+}
+
+static void test_hex_to_ascii() {
+    u32 fixed[] = {0, 0xA, 0xF, 0x10, 0xA0, 0xAA, 0xABCDEF, 0xDEADBEEF, 0x80000000, 0xFFFFFFFF};
+    char want[32], got[32];
+    for (u32 i = 0; i < 100000 && !check_failures; i++) {
+        u32 n = i < sizeof(fixed) / sizeof(fixed[0]) ? fixed[i] : rng() >> rng_range(0, 31);
+        snprintf(want, sizeof(want), "0x%x", n);
+        got[0] = '\0';             /* It appends */
+        hex_to_ascii((s32)n, got);
+        CHECK(strcmp(got, want) == 0, "hex_to_ascii(%#x) = \"%s\"", n, got);
+    }
+}
+
+/* Short strings over a tiny alphabet share long prefixes */
+static void random_string(char *s, u32 max) {
+    u32 len = rng_range(0, max);
+    for (u32 i = 0; i < len; i++) s[i] = "ab\x80"[rng() % 3];
+    s[len] = '\0';
+}
+
+static void test_compare() {
+    char a[24], b[24];
+    for (u32 i = 0; i < 100000 && !check_failures; i++) {
+        random_string(a, 20);
+        if (rng() & 1) strcpy(b, a);
+        else random_string(b, 20);
+        if (b[0] && (rng() & 1)) b[rng() % strlen(b)] = 'a';
+
+        s32 want = 0, n = rng_range(0, 24), want_n = 0;
+        for (s32 j = 0; ; j++) {
+            if (a[j] != b[j]) {
+                want = a[j] - b[j];
+                if (j < n) want_n = want;
+                break;
+            }
+            if (!a[j]) break;
+        }
+        CHECK(sign(strcmp(a, b)) == sign(want), "strcmp(\"%s\", \"%s\") = %d", a, b, strcmp(a, b));
+        CHECK(sign(strncmp(a, b, n)) == sign(want_n), "strncmp(\"%s\", \"%s\", %d) = %d", a, b, n, strncmp(a, b, n));
+    }
+}
+
+static void test_edit() {
+    char s[80], model[80];
+    s[0] = model[0] = '\0';
+    u32 len = 0;
+    for (u32 i = 0; i < 100000 && !check_failures; i++) {
+        if (len < sizeof(s) - 1 && (len == 0 || rng() % 3)) {
+            char c = (char)rng_range('a', 'z');
+            append(s, c);
+            model[len++] = c;
+        } else {
+            backspace(s);
+            len--;
+        }
+        model[len] = '\0';
+        CHECK((u32)strlen(s) == len, "strlen %d, expected %u", strlen(s), len);
+        CHECK(strcmp(s, model) == 0, "\"%s\" != \"%s\"", s, model);
+    }
+
+    char r[80];
+    strcpy(r, model);
+    reverse(r);
+    for (u32 i = 0; i < len; i++) CHECK(r[i] == model[len - 1 - i], "reverse(\"%s\") = \"%s\"", model, r);
+}
+
+/* The word-at-a-time paths: every alignment of source and destination,
+ * NULs at every position within a word, nothing written past the NUL */
+static void test_alignment() {
+    static char a[96] __attribute__((aligned(4))), b[96] __attribute__((aligned(4)));
+    for (u32 round = 0; round < 20000 && !check_failures; round++) {
+        u32 oa = rng() % 4, ob = rng() % 4, len = rng_range(0, 60);
+        char *s = a + oa, *d = b + ob;
+        for (u32 i = 0; i < sizeof(a); i++) a[i] = (char)rng_range(1, 255);
+        for (u32 i = 0; i < sizeof(b); i++) b[i] = '#';
+        s[len] = '\0';
+
+        CHECK((u32)strlen(s) == len, "strlen at +%u: %d, not %u", oa, strlen(s), len);
+        strcpy(d, s);
+        u32 i = 0;
+        for (; i <= len && d[i] == s[i]; i++);
+        CHECK(i == len + 1, "strcpy +%u to +%u, length %u: byte %u differs", oa, ob, len, i);
+        CHECK(d[len + 1] == '#', "strcpy +%u to +%u, length %u wrote past the NUL", oa, ob, len);
+        CHECK(strcmp(d, s) == 0 && strncmp(d, s, len + 1) == 0, "copy not equal, +%u to +%u", oa, ob);
+
+        if (len == 0) continue;
+        u32 at = rng() % len;
+        char was = d[at];
+        d[at] = (char)(was + 1 ? was + 1 : 1);
+        s32 want = d[at] - was;
+        CHECK(sign(strcmp(d, s)) == sign(want), "strcmp differing at %u of %u, +%u/+%u", at, len, ob, oa);
+        CHECK(sign(strncmp(d, s, at + 1)) == sign(want), "strncmp differing at %u, n %u", at, at + 1);
+        CHECK(strncmp(d, s, at) == 0, "strncmp equal prefix of %u", at);
+    }
+}
+
+/* kstrbuf against a plain array and a length, filled past capacity */
+static void test_kstrbuf() {
+    char buf[17], model[17];
+    kstrbuf_t sb;
+    kstrbuf_init(&sb, buf, sizeof(buf));
+    u32 len = 0;
+    for (u32 i = 0; i < 100000 && !check_failures; i++) {
+        u32 op = rng() % 10;
+        if (op < 5) {
+            char c = (char)rng_range('a', 'z');
+            s32 r = kstrbuf_append(&sb, c);
+            CHECK(r == (len < sizeof(buf) - 1 ? 0 : -1), "append at length %u returned %d", len, r);
+            if (len < sizeof(buf) - 1) model[len++] = c;
+        } else if (op < 8) {
+            s32 r = kstrbuf_backspace(&sb);
+            CHECK(r == (len ? 0 : -1), "backspace at length %u returned %d", len, r);
+            if (len) len--;
+        } else if (op < 9) {
+            char s[8] = "abcdefg";
+            u32 n = kstrbuf_append_str(&sb, s);
+            u32 fits = MIN(7, sizeof(buf) - 1 - len);
+            CHECK(n == fits, "append_str took %u, %u fit", n, fits);
+            for (u32 j = 0; j < fits; j++) model[len++] = s[j];
+        } else {
+            u32 to = rng_range(0, 20);
+            kstrbuf_truncate(&sb, to);
+            if (to < len) len = to;
+        }
+        model[len] = '\0';
+        CHECK(sb.len == len && strcmp(buf, model) == 0, "\"%s\" (%u) != \"%s\" (%u)", buf, sb.len, model, len);
+    }
+    kstrbuf_set(&sb, "0123456789abcdefghij");
+    CHECK(sb.len == 16 && strcmp(buf, "0123456789abcdef") == 0, "set truncated to \"%s\"", buf);
+}
+
+host_test_t string_tests[] = {
+    {"int_to_ascii", test_int_to_ascii},
+    {"hex_to_ascii", test_hex_to_ascii},
+    {"strcmp_strncmp", test_compare},
+    {"append_backspace_reverse", test_edit},
+    {"word_at_a_time", test_alignment},
+    {"kstrbuf", test_kstrbuf},
+    {NULL, NULL}
+};
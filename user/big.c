@@ -0,0 +1,15 @@
+/* Large program image: 64KB of initialized data and 1MB of .bss, global so
+ * the compiler keeps them. Only the pages it touches should ever be read
+ * in or zeroed */
+#include "user.h"
+
+#define TABLE_WORDS  (0x10000 / sizeof(unsigned int))
+#define SCRATCH_SIZE 0x100000
+
+unsigned int table[TABLE_WORDS] = { [0 ... TABLE_WORDS - 1] = 1 };
+unsigned char scratch[SCRATCH_SIZE];
+
+void _start(void) {
+    scratch[SCRATCH_SIZE / 2] = 2;
+    exit(table[0] + table[TABLE_WORDS - 1] + scratch[SCRATCH_SIZE / 2]);
+}
@@ -0,0 +1,11 @@
+/* Smallest program image: one text page and a little rodata */
+#include "user.h"
+
+static const char message[] = "Hello from ring 3\n";
+
+void _start(void) {
+    int sum = 0;
+    for (const char *p = message; *p; p++) sum += *p;
+    print(message);
+    exit(sum);
+}
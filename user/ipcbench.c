@@ -0,0 +1,78 @@
+/* IPC round trips: call() to a server that replies with the same message.
+ * Started without an argument it creates the port and spawns itself as
+ * the server, passing the port number */
+#include "user.h"
+
+#define ROUNDS  200         /* Round trips timed together */
+#define BATCHES 10          /* After one warm-up batch */
+#define LARGE   0x10000
+
+static unsigned char buffer[LARGE + 0x1000] __attribute__((aligned(0x1000)));
+
+static void serve(int port) {
+    ipc_msg_t msg;
+    for (;;) {
+        msg.data = (unsigned int)buffer;
+        msg.size = LARGE;
+        int handle = ipc_receive(port, &msg);
+        if (handle < 0) exit(0);    /* The client went away with its port */
+        if (handle) ipc_reply(handle, &msg);
+    }
+}
+
+/* 'offset' 0 keeps large messages page aligned (remapped), anything else
+ * forces the copy */
+static void bench(int port, const char *label, unsigned int len, unsigned int offset) {
+    unsigned int best = ~0u, total = 0;
+    ipc_msg_t msg;
+    for (int b = 0; b <= BATCHES; b++) {
+        unsigned long long start = rdtsc();
+        for (int i = 0; i < ROUNDS; i++) {
+            msg.label = i;
+            msg.len = len;
+            msg.size = len;
+            msg.data = (unsigned int)buffer + offset;
+            if (ipc_call(port, &msg) != IPC_OK) {
+                print(label);
+                print(": call failed\n");
+                return;
+            }
+        }
+        unsigned int cycles = (unsigned int)(rdtsc() - start) / ROUNDS;
+        if (b == 0) continue;
+        if (cycles < best) best = cycles;
+        total += cycles;
+    }
+    print(label);
+    print(": ");
+    print_num(best);
+    print(" cycles min, ");
+    print_num(total / BATCHES);
+    print(" avg per round trip");
+    /* Both directions carry the message */
+    unsigned int mhz = TIME_PAGE->tsc_mhz;
+    if (mhz && len >= 0x1000) {
+        print(", ");
+        print_num(2 * len * mhz / best);
+        print(" MB/s");
+    }
+    print("\n");
+}
+
+void _start(int port) {
+    if (port) serve(port);
+
+    port = port_create();
+    if (port < 0) {
+        print("ipcbench: no port\n");
+        exit(1);
+    }
+    if (spawn("/bin/ipcbench", port) < 0) {
+        print("ipcbench: spawn failed\n");
+        exit(1);
+    }
+    bench(port, "64B", 64, 0);
+    bench(port, "64KB copied", LARGE, 4);
+    bench(port, "64KB remapped", LARGE, 0);
+    exit(0);
+}
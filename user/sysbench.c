@@ -0,0 +1,33 @@
+/* Null system call round trip through int 0x80 and SYSENTER/SYSEXIT */
+#include "user.h"
+
+#define BATCH   1000        /* Calls timed together */
+#define BATCHES 20          /* After one warm-up batch */
+
+static void bench(const char *label, int fast) {
+    unsigned int best = ~0u, total = 0;
+    for (int b = 0; b <= BATCHES; b++) {
+        unsigned long long start = rdtsc();
+        for (int i = 0; i < BATCH; i++) {
+            if (fast) syscall_fast(SYS_NULL, 0, 0, 0);
+            else syscall(SYS_NULL, 0, 0, 0);
+        }
+        unsigned int cycles = (unsigned int)(rdtsc() - start) / BATCH;
+        if (b == 0) continue;
+        if (cycles < best) best = cycles;
+        total += cycles;
+    }
+    print(label);
+    print(": ");
+    print_num(best);
+    print(" cycles min, ");
+    print_num(total / BATCHES);
+    print(" avg per call\n");
+}
+
+void _start(void) {
+    bench("int 0x80", 0);
+    if (has_sysenter()) bench("sysenter", 1);
+    else print("sysenter: not supported by this CPU\n");
+    exit(0);
+}
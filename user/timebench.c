@@ -0,0 +1,50 @@
+/* Reading the clock from the time page against asking the kernel */
+#include "user.h"
+
+#define BATCH   1000
+#define BATCHES 20
+
+static unsigned int sink;
+
+static unsigned int read_clock(int how) {
+    switch (how) {
+        case 0: return uptime_us();
+        case 1: return syscall(SYS_UPTIME, 0, 0, 0);
+        default: return syscall_fast(SYS_UPTIME, 0, 0, 0);
+    }
+}
+
+static void bench(const char *label, int how) {
+    unsigned int best = ~0u, total = 0;
+    for (int b = 0; b <= BATCHES; b++) {
+        unsigned long long start = rdtsc();
+        for (int i = 0; i < BATCH; i++) sink += read_clock(how);
+        unsigned int cycles = (unsigned int)(rdtsc() - start) / BATCH;
+        if (b == 0) continue;
+        if (cycles < best) best = cycles;
+        total += cycles;
+    }
+    print(label);
+    print(": ");
+    print_num(best);
+    print(" cycles min, ");
+    print_num(total / BATCHES);
+    print(" avg per read\n");
+}
+
+void _start(void) {
+    print("boot time ");
+    print_num(TIME_PAGE->boot_time);
+    print(", TSC ");
+    print_num(TIME_PAGE->tsc_mhz);
+    print(" MHz, uptime ");
+    print_num(uptime_us());
+    print(" us (kernel says ");
+    print_num(syscall(SYS_UPTIME, 0, 0, 0));
+    print(")\n");
+
+    bench("time page", 0);
+    bench("int 0x80", 1);
+    if (has_sysenter()) bench("sysenter", 2);
+    exit(0);
+}
@@ -0,0 +1,103 @@
+#ifndef USER_H
+#define USER_H
+
+/* What programs in user/ get instead of a libc. Everything is inline so
+ * each program links on its own */
+#include "../cpu/syscall.h"
+#include "../cpu/timepage.h"
+
+#define TIME_PAGE ((const volatile time_page_t*)TIME_PAGE_ADDR)
+
+static inline int syscall(int num, int a, int b, int c) {
+    int ret;
+    __asm__ __volatile__("int %1" : "=a"(ret) : "i"(SYSCALL_VECTOR), "a"(num), "b"(a), "S"(b), "D"(c) : "memory");
+    return ret;
+}
+
+/* The same call through SYSENTER: the kernel comes back to the label
+ * below with SYSEXIT, on the stack passed in ecx */
+static inline int syscall_fast(int num, int a, int b, int c) {
+    int ret;
+    __asm__ __volatile__(
+        "mov %%esp, %%ecx\n"
+        "mov $1f, %%edx\n"
+        "sysenter\n"
+        "1:\n"
+        : "=a"(ret) : "a"(num), "b"(a), "S"(b), "D"(c) : "ecx", "edx", "memory");
+    return ret;
+}
+
+/* The kernel enables SYSENTER whenever the CPU has it */
+static inline int has_sysenter(void) {
+    unsigned int eax, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    return (edx >> 11) & 1;
+}
+
+/* SYSENTER when there is one, int 0x80 otherwise */
+static inline int syscall_auto(int num, int a, int b, int c) {
+    static int fast = -1;
+    if (fast < 0) fast = has_sysenter();
+    return fast ? syscall_fast(num, a, b, c) : syscall(num, a, b, c);
+}
+
+static inline void exit(int status) {
+    syscall(SYS_EXIT, status, 0, 0);
+    for (;;);
+}
+
+static inline void print(const char *s) {
+    int len = 0;
+    while (s[len]) len++;
+    syscall(SYS_WRITE, (int)s, len, 0);
+}
+
+static inline void print_num(unsigned int n) {
+    char buf[11];
+    int i = sizeof(buf) - 1;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    print(buf + i);
+}
+
+/* Start the program at 'path' alongside this one, 'arg' becomes the
+ * argument of its _start. Returns its task id or a negative error */
+static inline int spawn(const char *path, int arg) {
+    return syscall(SYS_SPAWN, (int)path, arg, 0);
+}
+
+static inline int port_create(void) {
+    return syscall(SYS_PORT_CREATE, 0, 0, 0);
+}
+
+static inline int ipc_send(int port, ipc_msg_t *msg) {
+    return syscall_auto(SYS_SEND, port, (int)msg, 0);
+}
+
+static inline int ipc_receive(int port, ipc_msg_t *msg) {
+    return syscall_auto(SYS_RECEIVE, port, (int)msg, 0);
+}
+
+static inline int ipc_call(int port, ipc_msg_t *msg) {
+    return syscall_auto(SYS_CALL, port, (int)msg, 0);
+}
+
+static inline int ipc_reply(int handle, ipc_msg_t *msg) {
+    return syscall_auto(SYS_REPLY, handle, (int)msg, 0);
+}
+
+static inline unsigned long long rdtsc(void) {
+    unsigned int low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((unsigned long long)high << 32) | low;
+}
+
+/* Microseconds since boot without entering the kernel */
+static inline unsigned int uptime_us(void) {
+    return time_page_uptime_us(TIME_PAGE);
+}
+
+#endif